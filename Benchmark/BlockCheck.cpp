@@ -0,0 +1,356 @@
+#include "BlockCheck.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+using AxImageLoader::BlockFormat;
+
+// Channels first to first + count - 1 of every pixel i take palette[indices[i]]. A BC3 block
+// has one group for color and one for alpha, a BC5 block one per channel.
+struct IndexedChannels {
+	int first = 0;
+	int count = 0;
+	int entries = 0;
+	std::array<std::array<int, 4>, 16> palette = {};
+	std::array<int, 16> indices = {};
+};
+
+struct DecodedBlock {
+	std::array<IndexedChannels, 2> groups;
+	int groupCount = 0;
+
+	IndexedChannels& add(int first, int count) {
+		IndexedChannels& group = groups[groupCount++];
+		group.first = first;
+		group.count = count;
+		return group;
+	}
+};
+
+#pragma region Decoders
+// written from the format descriptions rather than shared with the encoder, so a mistake on
+// one side does not cancel out on the other
+static int expand5(int v) {
+	return (v << 3) | (v >> 2);
+}
+
+static int expand6(int v) {
+	return (v << 2) | (v >> 4);
+}
+
+// The color half of a BC3 block always has four colors, whatever the endpoint order, and
+// leaves alpha to the other half.
+static void decodeBc1(const uint8_t* block, bool threeColorMode, DecodedBlock& out) {
+	const uint16_t c0 = static_cast<uint16_t>(block[0] | block[1] << 8);
+	const uint16_t c1 = static_cast<uint16_t>(block[2] | block[3] << 8);
+	IndexedChannels& color = out.add(0, threeColorMode ? 4 : 3);
+	color.entries = 4;
+	auto& palette = color.palette;
+	palette[0] = { expand5(c0 >> 11), expand6((c0 >> 5) & 63), expand5(c0 & 31), 255 };
+	palette[1] = { expand5(c1 >> 11), expand6((c1 >> 5) & 63), expand5(c1 & 31), 255 };
+	if (c0 > c1 || !threeColorMode) {
+		for (int c = 0; c < 3; c++) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		palette[2][3] = 255;
+		palette[3][3] = 255;
+	}
+	else {
+		for (int c = 0; c < 3; c++) {
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+		}
+		palette[2][3] = 255;
+		palette[3] = { 0, 0, 0, 0 };
+	}
+	const uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 | static_cast<uint32_t>(block[7]) << 24;
+	for (int i = 0; i < 16; i++) {
+		color.indices[i] = (indices >> (2 * i)) & 3;
+	}
+}
+
+static void decodeBc4(const uint8_t* block, int channel, DecodedBlock& out) {
+	IndexedChannels& values = out.add(channel, 1);
+	values.entries = 8;
+	const int e0 = block[0];
+	const int e1 = block[1];
+	values.palette[0][channel] = e0;
+	values.palette[1][channel] = e1;
+	if (e0 > e1) {
+		for (int k = 1; k < 7; k++) {
+			values.palette[1 + k][channel] = ((7 - k) * e0 + k * e1 + 3) / 7;
+		}
+	}
+	else {
+		for (int k = 1; k < 5; k++) {
+			values.palette[1 + k][channel] = ((5 - k) * e0 + k * e1 + 2) / 5;
+		}
+		values.palette[6][channel] = 0;
+		values.palette[7][channel] = 255;
+	}
+	uint64_t indices = 0;
+	for (int i = 0; i < 6; i++) {
+		indices |= static_cast<uint64_t>(block[2 + i]) << (8 * i);
+	}
+	for (int i = 0; i < 16; i++) {
+		values.indices[i] = static_cast<int>((indices >> (3 * i)) & 7);
+	}
+}
+
+// Reads fields from the least significant bit of the first byte up, the order BC7 is laid out in.
+class BlockBitReader {
+public:
+	explicit BlockBitReader(const uint8_t* block) : block(block) {}
+
+	int read(uint32_t bits) {
+		int value = 0;
+		for (uint32_t i = 0; i < bits; i++, position++) {
+			value |= ((block[position >> 3] >> (position & 7)) & 1) << i;
+		}
+		return value;
+	}
+
+private:
+	const uint8_t* block;
+	uint32_t position = 0;
+};
+
+static constexpr std::array<int, 16> bc7Weights4 = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+static constexpr std::array<int, 4> bc7Weights2 = { 0, 21, 43, 64 };
+
+static int bc7Interpolate(int e0, int e1, int weight) {
+	return ((64 - weight) * e0 + weight * e1 + 32) >> 6;
+}
+
+template<size_t Entries>
+static void interpolateBc7(IndexedChannels& group, const std::array<std::array<int, 4>, 2>& endpoints, const std::array<int, Entries>& weights) {
+	group.entries = static_cast<int>(Entries);
+	for (size_t p = 0; p < Entries; p++) {
+		for (int c = group.first; c < group.first + group.count; c++) {
+			group.palette[p][c] = bc7Interpolate(endpoints[0][c], endpoints[1][c], weights[p]);
+		}
+	}
+}
+
+// Only modes 5 and 6 without channel rotation, which is all the encoder writes; returns what
+// else the block uses.
+static std::optional<std::string> decodeBc7(const uint8_t* block, DecodedBlock& out) {
+	BlockBitReader bits(block);
+	int mode = 0;
+	while (mode < 8 && bits.read(1) == 0) {
+		mode++;
+	}
+	std::array<std::array<int, 4>, 2> endpoints;
+	if (mode == 6) {
+		for (int c = 0; c < 4; c++) {
+			endpoints[0][c] = bits.read(7);
+			endpoints[1][c] = bits.read(7);
+		}
+		for (auto& endpoint : endpoints) {
+			int p = bits.read(1);
+			for (int& value : endpoint) {
+				value = value << 1 | p;
+			}
+		}
+		IndexedChannels& rgba = out.add(0, 4);
+		interpolateBc7(rgba, endpoints, bc7Weights4);
+		for (int i = 0; i < 16; i++) {
+			rgba.indices[i] = bits.read(i == 0 ? 3 : 4);
+		}
+		return std::nullopt;
+	}
+	if (mode == 5) {
+		if (bits.read(2) != 0) {
+			return "a channel rotation";
+		}
+		for (int c = 0; c < 3; c++) {
+			for (auto& endpoint : endpoints) {
+				int q = bits.read(7);
+				endpoint[c] = q << 1 | q >> 6;
+			}
+		}
+		endpoints[0][3] = bits.read(8);
+		endpoints[1][3] = bits.read(8);
+		IndexedChannels& color = out.add(0, 3);
+		IndexedChannels& alpha = out.add(3, 1);
+		interpolateBc7(color, endpoints, bc7Weights2);
+		interpolateBc7(alpha, endpoints, bc7Weights2);
+		for (int i = 0; i < 16; i++) {
+			color.indices[i] = bits.read(i == 0 ? 1 : 2);
+		}
+		for (int i = 0; i < 16; i++) {
+			alpha.indices[i] = bits.read(i == 0 ? 1 : 2);
+		}
+		return std::nullopt;
+	}
+	return "mode " + std::to_string(mode);
+}
+#pragma endregion
+
+// Squared distance per sample between neighbouring endpoint values: 5 and 6 bits for BC1
+// colors, 7 bits and a low one for BC7, all 8 for BC4. Even a best fit may round the mean
+// color that far.
+static std::array<int, 4> endpointRounding(BlockFormat format) {
+	switch (format) {
+	case BlockFormat::BC1:
+		return { 68, 17, 68, 0 };
+	case BlockFormat::BC3:
+		return { 68, 17, 68, 1 };
+	case BlockFormat::BC4:
+		return { 1, 0, 0, 0 };
+	case BlockFormat::BC5:
+		return { 1, 1, 0, 0 };
+	default:
+		return { 4, 4, 4, 4 };
+	}
+}
+
+// squared distance over the group's channels
+static int distance(const IndexedChannels& group, const std::array<int, 4>& a, const std::array<int, 4>& b) {
+	int sum = 0;
+	for (int c = group.first; c < group.first + group.count; c++) {
+		sum += (a[c] - b[c]) * (a[c] - b[c]);
+	}
+	return sum;
+}
+
+// What is wrong with one block, or nothing. source holds the pixels inside the image, at
+// positions inside in the block; the encoder repeats the edge to fill the rest.
+static std::optional<std::string> checkBlock(const DecodedBlock& block, std::span<const std::array<int, 4>> source, std::span<const int> inside, int channels, bool storesAlpha, const std::array<int, 4>& rounding, double nearestMargin) {
+	std::vector<std::array<int, 4>> decoded(source.size(), { 0, 0, 0, 255 });
+	for (size_t k = 0; k < source.size(); k++) {
+		for (int g = 0; g < block.groupCount; g++) {
+			const IndexedChannels& group = block.groups[g];
+			const std::array<int, 4>& chosen = group.palette[group.indices[inside[k]]];
+			for (int c = group.first; c < group.first + group.count; c++) {
+				decoded[k][c] = chosen[c];
+			}
+			const double chosenDistance = std::sqrt(distance(group, chosen, source[k]));
+			for (int p = 0; p < group.entries; p++) {
+				if (std::sqrt(distance(group, group.palette[p], source[k])) + nearestMargin < chosenDistance) {
+					return "pixel " + std::to_string(inside[k]) + " does not take its nearest palette entry";
+				}
+			}
+		}
+	}
+
+	const bool opaque = storesAlpha && std::all_of(source.begin(), source.end(), [](const auto& pixel) { return pixel[3] == 255; });
+	if (opaque && std::any_of(decoded.begin(), decoded.end(), [](const auto& pixel) { return pixel[3] != 255; })) {
+		return std::string("opaque pixels decode with alpha below 255");
+	}
+
+	int64_t error = 0;
+	double allowed = 0;
+	for (int c = 0; c < channels; c++) {
+		double mean = 0;
+		for (const auto& pixel : source) {
+			mean += pixel[c];
+		}
+		mean /= static_cast<double>(source.size());
+		for (size_t k = 0; k < source.size(); k++) {
+			int d = source[k][c] - decoded[k][c];
+			error += d * d;
+			allowed += (source[k][c] - mean) * (source[k][c] - mean) + rounding[c];
+		}
+	}
+	if (static_cast<double>(error) > allowed) {
+		return "squared error " + std::to_string(error) + " is above the " + std::to_string(static_cast<int64_t>(allowed)) + " of the mean color";
+	}
+	return std::nullopt;
+}
+
+std::optional<std::string> checkBlocks(const AxImageLoader::Image& blocks, const AxImageLoader::Image& pixels) {
+	using AxImageLoader::MipLevel;
+	const BlockFormat format = blocks.blockFormat;
+	if (format == BlockFormat::None || pixels.blockFormat != BlockFormat::None) {
+		return "expected a block-compressed image and a pixel one";
+	}
+	const std::vector<MipLevel> blockLevels = blocks.mipLevels.empty() ? std::vector<MipLevel>{ { blocks.width, blocks.height, 0 } } : blocks.mipLevels;
+	const std::vector<MipLevel> pixelLevels = pixels.mipLevels.empty() ? std::vector<MipLevel>{ { pixels.width, pixels.height, 0 } } : pixels.mipLevels;
+	if (blockLevels.size() != pixelLevels.size()) {
+		return "the block and pixel images have different mip chains";
+	}
+
+	const uint16_t channels = pixels.channels;
+	// BC1, BC3 and BC7 decode to RGBA, so an image without alpha has to come back opaque
+	const bool storesAlpha = format == BlockFormat::BC1 || format == BlockFormat::BC3 || format == BlockFormat::BC7;
+	const size_t blockBytes = format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+	const std::array<int, 4> rounding = endpointRounding(format);
+	// BC1 and BC4 try every entry. BC7 takes the nearest point on the line between the endpoints
+	// and only tries the entries beside it, which are that point rounded by up to half a unit per
+	// channel, so the entry it picks may be up to twice that further away than the nearest one.
+	const double nearestMargin = format == BlockFormat::BC7 ? 2.0 : 0.0;
+
+	size_t blockCount = 0;
+	size_t failedCount = 0;
+	std::string firstFailure;
+	for (size_t level = 0; level < blockLevels.size(); level++) {
+		const uint32_t width = pixelLevels[level].width;
+		const uint32_t height = pixelLevels[level].height;
+		const uint32_t blocksWide = (width + 3) / 4;
+		const uint32_t blocksHigh = (height + 3) / 4;
+		if (blockLevels[level].offset + static_cast<size_t>(blocksWide) * blocksHigh * blockBytes > blocks.data.size()) {
+			return "block data ends inside level " + std::to_string(level);
+		}
+		for (uint32_t blockY = 0; blockY < blocksHigh; blockY++) {
+			for (uint32_t blockX = 0; blockX < blocksWide; blockX++) {
+				const uint8_t* data = blocks.data.data() + blockLevels[level].offset + (static_cast<size_t>(blockY) * blocksWide + blockX) * blockBytes;
+				DecodedBlock block;
+				std::optional<std::string> failure;
+				switch (format) {
+				case BlockFormat::BC1:
+					decodeBc1(data, true, block);
+					break;
+				case BlockFormat::BC3:
+					decodeBc4(data, 3, block);
+					decodeBc1(data + 8, false, block);
+					break;
+				case BlockFormat::BC4:
+					decodeBc4(data, 0, block);
+					break;
+				case BlockFormat::BC5:
+					decodeBc4(data, 0, block);
+					decodeBc4(data + 8, 1, block);
+					break;
+				default:
+					if (std::optional<std::string> unsupported = decodeBc7(data, block)) {
+						failure = "it uses BC7 " + *unsupported;
+					}
+					break;
+				}
+
+				std::array<std::array<int, 4>, 16> source;
+				std::array<int, 16> inside;
+				size_t count = 0;
+				for (int i = 0; i < 16; i++) {
+					uint32_t x = blockX * 4 + i % 4;
+					uint32_t y = blockY * 4 + i / 4;
+					if (x >= width || y >= height) {
+						continue;
+					}
+					const uint8_t* pixel = pixels.data.data() + pixelLevels[level].offset + (static_cast<size_t>(y) * width + x) * channels;
+					source[count] = { 0, 0, 0, 255 };
+					for (uint16_t c = 0; c < channels; c++) {
+						source[count][c] = pixel[c];
+					}
+					inside[count++] = i;
+				}
+				if (!failure) {
+					failure = checkBlock(block, std::span(source).first(count), std::span(inside).first(count), storesAlpha ? 4 : channels, storesAlpha, rounding, nearestMargin);
+				}
+
+				blockCount++;
+				if (failure && failedCount++ == 0) {
+					firstFailure = "block " + std::to_string(blockX) + "," + std::to_string(blockY) + " of level " + std::to_string(level) + ": " + *failure;
+				}
+			}
+		}
+	}
+	if (failedCount > 0) {
+		return std::to_string(failedCount) + " of " + std::to_string(blockCount) + " blocks failed, the first " + firstFailure;
+	}
+	return std::nullopt;
+}
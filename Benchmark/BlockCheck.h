@@ -0,0 +1,11 @@
+#pragma once
+#include "AxImageLoader.h"
+#include <optional>
+#include <string>
+
+// Decodes the BCn blocks of every level of blocks and compares them with pixels, the same image
+// loaded without block compression. Every pixel has to take the palette entry nearest to it, a
+// block may not come out further from its pixels than their mean color would, give or take the
+// rounding of the format's endpoints, and opaque pixels have to decode to alpha 255. Returns
+// what failed, or nothing.
+std::optional<std::string> checkBlocks(const AxImageLoader::Image& blocks, const AxImageLoader::Image& pixels);
@@ -0,0 +1,213 @@
+#include "Corpus.h"
+#include "Checksum.h"
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+
+static constexpr std::array<uint8_t, 8> pngSignature = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+static constexpr size_t idatChunkSize = 1 << 16;
+
+static uint32_t samplesPerPixel(uint8_t colorType) {
+	switch (colorType) {
+	case 2: return 3;
+	case 4: return 2;
+	case 6: return 4;
+	default: return 1;
+	}
+}
+
+static size_t rowBytes(const CorpusImage& image) {
+	return (static_cast<size_t>(image.width) * samplesPerPixel(image.colorType) * image.bitDepth + 7) / 8;
+}
+
+size_t filteredSize(const CorpusImage& image) {
+	return (rowBytes(image) + 1) * image.height;
+}
+
+std::vector<CorpusImage> benchmarkCorpus() {
+	std::vector<CorpusImage> corpus;
+	struct Format {
+		uint8_t colorType;
+		uint8_t bitDepth;
+		const char* name;
+	};
+	static constexpr std::array<Format, 15> formats = { {
+		{ 0, 1, "gray1" }, { 0, 2, "gray2" }, { 0, 4, "gray4" }, { 0, 8, "gray8" }, { 0, 16, "gray16" },
+		{ 2, 8, "rgb8" }, { 2, 16, "rgb16" },
+		{ 3, 1, "palette1" }, { 3, 2, "palette2" }, { 3, 4, "palette4" }, { 3, 8, "palette8" },
+		{ 4, 8, "grayalpha8" }, { 4, 16, "grayalpha16" },
+		{ 6, 8, "rgba8" }, { 6, 16, "rgba16" },
+	} };
+	for (const Format& format : formats) {
+		corpus.push_back({ std::string("format_") + format.name, 512, 512, format.colorType, format.bitDepth, FilterMode::Adaptive, DeflateMode::Dynamic });
+	}
+
+	static constexpr std::array<std::pair<FilterMode, const char*>, 5> filters = { {
+		{ FilterMode::None, "none" }, { FilterMode::Sub, "sub" }, { FilterMode::Up, "up" }, { FilterMode::Average, "average" }, { FilterMode::Paeth, "paeth" },
+	} };
+	for (const auto& [filter, name] : filters) {
+		corpus.push_back({ std::string("filter_") + name, 1024, 1024, 6, 8, filter, DeflateMode::Dynamic });
+	}
+
+	corpus.push_back({ "deflate_stored", 1024, 1024, 2, 8, FilterMode::Adaptive, DeflateMode::Stored });
+	corpus.push_back({ "deflate_fixed", 1024, 1024, 2, 8, FilterMode::Adaptive, DeflateMode::Fixed });
+	corpus.push_back({ "deflate_dynamic", 1024, 1024, 2, 8, FilterMode::Adaptive, DeflateMode::Dynamic });
+
+	for (uint32_t size : { 16u, 32u, 64u, 256u, 2048u, 4096u, 8192u }) {
+		corpus.push_back({ "size_" + std::to_string(size), size, size, 6, 8, FilterMode::Adaptive, DeflateMode::Dynamic });
+	}
+	return corpus;
+}
+
+// integer hash of a sample position, so the content never depends on the platform's rand()
+static uint32_t noise(uint32_t x, uint32_t y, uint32_t channel) {
+	uint32_t h = x * 0x9E3779B1u ^ y * 0x85EBCA77u ^ channel * 0xC2B2AE3Du;
+	h ^= h >> 15;
+	h *= 0x2C1B3C6Du;
+	h ^= h >> 12;
+	h *= 0x297A2D39u;
+	h ^= h >> 15;
+	return h;
+}
+
+// Smooth gradients with texture and a little noise, so filters and matches behave roughly like
+// they do on photographs and game textures.
+static uint32_t sampleValue(const CorpusImage& image, uint32_t x, uint32_t y, uint32_t channel) {
+	uint32_t gradient = (x * 255 / std::max(1u, image.width - 1) * (channel + 1) + y * 255 / std::max(1u, image.height - 1) * (4 - channel)) / 5;
+	uint32_t texture = ((x / 7 + y / 5) * (channel + 3)) & 31;
+	uint32_t value8 = (gradient + texture + (noise(x, y, channel) & 7)) & 0xFF;
+	if (image.bitDepth == 16) {
+		return (value8 << 8) | (noise(x, y, channel + 4) & 0xFF);
+	}
+	if (image.colorType == 3) {
+		return value8 % (1u << std::min<uint8_t>(image.bitDepth, 8));
+	}
+	return value8 >> (8 - image.bitDepth);
+}
+
+static std::vector<uint8_t> packRow(const CorpusImage& image, uint32_t y) {
+	std::vector<uint8_t> row(rowBytes(image), 0);
+	uint32_t samples = samplesPerPixel(image.colorType);
+	size_t bit = 0;
+	for (uint32_t x = 0; x < image.width; x++) {
+		for (uint32_t channel = 0; channel < samples; channel++) {
+			uint32_t value = sampleValue(image, x, y, channel);
+			if (image.bitDepth == 16) {
+				row[bit / 8] = static_cast<uint8_t>(value >> 8);
+				row[bit / 8 + 1] = static_cast<uint8_t>(value);
+			}
+			else {
+				row[bit / 8] |= static_cast<uint8_t>(value << (8 - image.bitDepth - bit % 8));
+			}
+			bit += image.bitDepth;
+		}
+	}
+	return row;
+}
+
+static uint8_t paeth(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = std::abs(p - a);
+	int pb = std::abs(p - b);
+	int pc = std::abs(p - c);
+	if (pa <= pb && pa <= pc) {
+		return static_cast<uint8_t>(a);
+	}
+	return static_cast<uint8_t>(pb <= pc ? b : c);
+}
+
+static void filterRow(uint8_t type, const std::vector<uint8_t>& row, const std::vector<uint8_t>& previous, size_t bpp, uint8_t* out) {
+	for (size_t i = 0; i < row.size(); i++) {
+		int a = i >= bpp ? row[i - bpp] : 0;
+		int b = previous[i];
+		int c = i >= bpp ? previous[i - bpp] : 0;
+		int predictor = 0;
+		switch (type) {
+		case 1: predictor = a; break;
+		case 2: predictor = b; break;
+		case 3: predictor = (a + b) / 2; break;
+		case 4: predictor = paeth(a, b, c); break;
+		}
+		out[i] = static_cast<uint8_t>(row[i] - predictor);
+	}
+}
+
+static std::vector<uint8_t> filterImage(const CorpusImage& image) {
+	size_t stride = rowBytes(image);
+	size_t bpp = std::max<size_t>(1, samplesPerPixel(image.colorType) * image.bitDepth / 8);
+	std::vector<uint8_t> filtered(filteredSize(image));
+	std::vector<uint8_t> previous(stride, 0);
+	std::vector<uint8_t> candidate(stride);
+	for (uint32_t y = 0; y < image.height; y++) {
+		std::vector<uint8_t> row = packRow(image, y);
+		uint8_t* out = filtered.data() + y * (stride + 1);
+		uint8_t type = static_cast<uint8_t>(image.filter);
+		if (image.filter == FilterMode::Adaptive) {
+			// smallest sum of absolute differences, the heuristic libpng uses
+			uint64_t bestCost = UINT64_MAX;
+			for (uint8_t t = 0; t < 5; t++) {
+				filterRow(t, row, previous, bpp, candidate.data());
+				uint64_t cost = 0;
+				for (uint8_t value : candidate) {
+					cost += static_cast<uint64_t>(std::abs(static_cast<int8_t>(value)));
+				}
+				if (cost < bestCost) {
+					bestCost = cost;
+					type = t;
+				}
+			}
+		}
+		out[0] = type;
+		filterRow(type, row, previous, bpp, out + 1);
+		previous = std::move(row);
+	}
+	return filtered;
+}
+
+static void appendU32(std::vector<uint8_t>& out, uint32_t value) {
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		out.push_back(static_cast<uint8_t>(value >> shift));
+	}
+}
+
+static void appendChunk(std::vector<uint8_t>& png, const char* type, std::span<const uint8_t> data) {
+	appendU32(png, static_cast<uint32_t>(data.size()));
+	size_t typeStart = png.size();
+	png.insert(png.end(), type, type + 4);
+	png.insert(png.end(), data.begin(), data.end());
+	appendU32(png, crc32(0, std::span(png).subspan(typeStart)));
+}
+
+std::vector<uint8_t> encodePng(const CorpusImage& image) {
+	std::vector<uint8_t> png(pngSignature.begin(), pngSignature.end());
+
+	std::vector<uint8_t> header;
+	appendU32(header, image.width);
+	appendU32(header, image.height);
+	header.insert(header.end(), { image.bitDepth, image.colorType, 0, 0, 0 });
+	appendChunk(png, "IHDR", header);
+
+	if (image.colorType == 3) {
+		uint32_t entries = 1u << image.bitDepth;
+		std::vector<uint8_t> palette;
+		std::vector<uint8_t> transparency;
+		for (uint32_t i = 0; i < entries; i++) {
+			palette.insert(palette.end(), { static_cast<uint8_t>(i * 7), static_cast<uint8_t>(i * 13 + 50), static_cast<uint8_t>(255 - i * 3) });
+			// a partial tRNS, as palettized sprites usually carry
+			if (i < entries / 2) {
+				transparency.push_back(static_cast<uint8_t>(i * 255 / entries));
+			}
+		}
+		appendChunk(png, "PLTE", palette);
+		if (!transparency.empty()) {
+			appendChunk(png, "tRNS", transparency);
+		}
+	}
+
+	std::vector<uint8_t> compressed = zlibCompress(filterImage(image), image.deflate);
+	for (size_t offset = 0; offset < compressed.size(); offset += idatChunkSize) {
+		appendChunk(png, "IDAT", std::span(compressed).subspan(offset, std::min(idatChunkSize, compressed.size() - offset)));
+	}
+	appendChunk(png, "IEND", {});
+	return png;
+}
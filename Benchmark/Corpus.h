@@ -0,0 +1,32 @@
+#pragma once
+#include "Deflate.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// PNG filter applied to every row; Adaptive picks one per row the way common encoders do
+enum class FilterMode : uint8_t {
+	None,
+	Sub,
+	Up,
+	Average,
+	Paeth,
+	Adaptive
+};
+
+struct CorpusImage {
+	std::string name;
+	uint32_t width;
+	uint32_t height;
+	uint8_t colorType;
+	uint8_t bitDepth;
+	FilterMode filter;
+	DeflateMode deflate;
+};
+
+// Every color type and bit depth, every filter, every deflate block type and sizes from icons
+// up to 8k. Encoding is deterministic, so two runs always time the same bytes.
+std::vector<CorpusImage> benchmarkCorpus();
+std::vector<uint8_t> encodePng(const CorpusImage& image);
+// size of the filtered scanlines, i.e. what inflating the image data produces
+size_t filteredSize(const CorpusImage& image);
@@ -0,0 +1,410 @@
+#include "Deflate.h"
+#include "Checksum.h"
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <queue>
+
+static constexpr std::array<uint16_t, 29> lengthBase = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static constexpr std::array<uint8_t, 29> lengthExtra = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static constexpr std::array<uint16_t, 30> distanceBase = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static constexpr std::array<uint8_t, 30> distanceExtra = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static constexpr std::array<uint8_t, 19> codeLengthOrder = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static constexpr size_t windowSize = 32768;
+static constexpr uint32_t minMatch = 3;
+static constexpr uint32_t maxMatch = 258;
+static constexpr uint32_t hashBits = 15;
+static constexpr uint32_t maxChain = 8;
+// input bytes per compressed block
+static constexpr size_t blockInput = 1 << 18;
+static constexpr size_t maxStoredBlock = 65535;
+
+class BitWriter {
+public:
+	explicit BitWriter(std::vector<uint8_t>& out) : out(out) {}
+
+	void write(uint32_t value, uint32_t count) {
+		buffer |= static_cast<uint64_t>(value) << bitCount;
+		bitCount += count;
+		while (bitCount >= 8) {
+			out.push_back(static_cast<uint8_t>(buffer));
+			buffer >>= 8;
+			bitCount -= 8;
+		}
+	}
+
+	void alignToByte() {
+		if (bitCount > 0) {
+			write(0, 8 - bitCount);
+		}
+	}
+
+private:
+	std::vector<uint8_t>& out;
+	uint64_t buffer = 0;
+	uint32_t bitCount = 0;
+};
+
+// literal when distance is 0, otherwise a match of length bytes
+struct Symbol {
+	uint16_t length;
+	uint16_t distance;
+};
+
+struct HuffmanCode {
+	std::vector<uint8_t> lengths;
+	// bit-reversed, ready to be written least significant bit first
+	std::vector<uint16_t> codes;
+
+	void write(BitWriter& writer, uint32_t symbol) const {
+		writer.write(codes[symbol], lengths[symbol]);
+	}
+};
+
+static uint32_t lengthCode(uint32_t length) {
+	return static_cast<uint32_t>(std::upper_bound(lengthBase.begin(), lengthBase.end(), length) - lengthBase.begin()) - 1;
+}
+
+static uint32_t distanceCode(uint32_t distance) {
+	return static_cast<uint32_t>(std::upper_bound(distanceBase.begin(), distanceBase.end(), distance) - distanceBase.begin()) - 1;
+}
+
+// Huffman code lengths no longer than maxBits. Frequencies are flattened until the tree fits,
+// which costs a little ratio but keeps the code short.
+static std::vector<uint8_t> buildLengths(std::span<const uint32_t> frequencies, uint32_t maxBits) {
+	size_t n = frequencies.size();
+	std::vector<uint64_t> weights(frequencies.begin(), frequencies.end());
+	std::vector<uint8_t> lengths(n, 0);
+	while (true) {
+		using Node = std::pair<uint64_t, size_t>;
+		std::priority_queue<Node, std::vector<Node>, std::greater<>> queue;
+		for (size_t i = 0; i < n; i++) {
+			if (weights[i] > 0) {
+				queue.push({ weights[i], i });
+			}
+		}
+		if (queue.size() == 1) {
+			lengths[queue.top().second] = 1;
+			return lengths;
+		}
+
+		// internal nodes get indices above every leaf, and parents always above their children
+		std::vector<size_t> parent(2 * n, 0);
+		size_t next = n;
+		while (queue.size() > 1) {
+			Node a = queue.top();
+			queue.pop();
+			Node b = queue.top();
+			queue.pop();
+			parent[a.second] = next;
+			parent[b.second] = next;
+			queue.push({ a.first + b.first, next++ });
+		}
+		std::vector<uint32_t> depth(next, 0);
+		uint32_t maxDepth = 0;
+		for (size_t node = next - 1; node-- > 0;) {
+			if (node >= n || weights[node] > 0) {
+				depth[node] = depth[parent[node]] + 1;
+			}
+			if (node < n) {
+				maxDepth = std::max(maxDepth, depth[node]);
+			}
+		}
+		if (maxDepth <= maxBits) {
+			for (size_t i = 0; i < n; i++) {
+				lengths[i] = static_cast<uint8_t>(depth[i]);
+			}
+			return lengths;
+		}
+		for (uint64_t& weight : weights) {
+			if (weight > 0) {
+				weight = std::max<uint64_t>(1, weight >> 1);
+			}
+		}
+	}
+}
+
+static HuffmanCode makeCode(std::vector<uint8_t> lengths) {
+	std::array<uint16_t, 16> counts = {};
+	for (uint8_t length : lengths) {
+		counts[length]++;
+	}
+	counts[0] = 0;
+	std::array<uint16_t, 16> nextCode = {};
+	uint16_t code = 0;
+	for (size_t bits = 1; bits < 16; bits++) {
+		code = static_cast<uint16_t>((code + counts[bits - 1]) << 1);
+		nextCode[bits] = code;
+	}
+
+	HuffmanCode huffman;
+	huffman.codes.assign(lengths.size(), 0);
+	for (size_t symbol = 0; symbol < lengths.size(); symbol++) {
+		uint32_t length = lengths[symbol];
+		if (length == 0) {
+			continue;
+		}
+		uint32_t value = nextCode[length]++;
+		uint32_t reversed = 0;
+		for (uint32_t bit = 0; bit < length; bit++) {
+			reversed |= ((value >> bit) & 1) << (length - 1 - bit);
+		}
+		huffman.codes[symbol] = static_cast<uint16_t>(reversed);
+	}
+	huffman.lengths = std::move(lengths);
+	return huffman;
+}
+
+static HuffmanCode fixedLiteralCode() {
+	std::vector<uint8_t> lengths(288);
+	std::fill(lengths.begin(), lengths.begin() + 144, 8);
+	std::fill(lengths.begin() + 144, lengths.begin() + 256, 9);
+	std::fill(lengths.begin() + 256, lengths.begin() + 280, 7);
+	std::fill(lengths.begin() + 280, lengths.end(), 8);
+	return makeCode(std::move(lengths));
+}
+
+static HuffmanCode fixedDistanceCode() {
+	return makeCode(std::vector<uint8_t>(30, 5));
+}
+
+// Greedy LZ77 with hash chains. The chains persist across calls, so matches reach back into
+// earlier blocks.
+class MatchFinder {
+public:
+	explicit MatchFinder(std::span<const uint8_t> data) : data(data), head(size_t(1) << hashBits, -1), previous(windowSize, -1) {}
+
+	void findSymbols(size_t start, size_t end, std::vector<Symbol>& symbols) {
+		size_t position = start;
+		while (position < end) {
+			uint32_t bestLength = 0;
+			uint32_t bestDistance = 0;
+			if (position + minMatch <= data.size()) {
+				uint32_t limit = static_cast<uint32_t>(std::min<size_t>(maxMatch, end - position));
+				int64_t candidate = head[hash(position)];
+				for (uint32_t chain = 0; chain < maxChain && candidate >= 0 && position - candidate <= windowSize; chain++) {
+					uint32_t length = 0;
+					while (length < limit && data[candidate + length] == data[position + length]) {
+						length++;
+					}
+					if (length > bestLength) {
+						bestLength = length;
+						bestDistance = static_cast<uint32_t>(position - candidate);
+						if (length == limit) {
+							break;
+						}
+					}
+					int64_t older = previous[candidate % windowSize];
+					// the ring slot may already hold a newer position
+					if (older >= candidate) {
+						break;
+					}
+					candidate = older;
+				}
+			}
+
+			if (bestLength >= minMatch) {
+				symbols.push_back({ static_cast<uint16_t>(bestLength), static_cast<uint16_t>(bestDistance) });
+				for (uint32_t i = 0; i < bestLength; i++) {
+					insert(position + i);
+				}
+				position += bestLength;
+			}
+			else {
+				symbols.push_back({ data[position], 0 });
+				insert(position);
+				position++;
+			}
+		}
+	}
+
+private:
+	uint32_t hash(size_t position) const {
+		uint32_t value = data[position] | (data[position + 1] << 8) | (data[position + 2] << 16);
+		return (value * 2654435761u) >> (32 - hashBits);
+	}
+
+	void insert(size_t position) {
+		if (position + minMatch > data.size()) {
+			return;
+		}
+		uint32_t h = hash(position);
+		previous[position % windowSize] = head[h];
+		head[h] = static_cast<int64_t>(position);
+	}
+
+	std::span<const uint8_t> data;
+	std::vector<int64_t> head;
+	std::vector<int64_t> previous;
+};
+
+static void writeSymbols(BitWriter& writer, std::span<const Symbol> symbols, const HuffmanCode& literals, const HuffmanCode& distances) {
+	for (const Symbol& symbol : symbols) {
+		if (symbol.distance == 0) {
+			literals.write(writer, symbol.length);
+			continue;
+		}
+		uint32_t length = lengthCode(symbol.length);
+		literals.write(writer, 257 + length);
+		writer.write(symbol.length - lengthBase[length], lengthExtra[length]);
+		uint32_t distance = distanceCode(symbol.distance);
+		distances.write(writer, distance);
+		writer.write(symbol.distance - distanceBase[distance], distanceExtra[distance]);
+	}
+	literals.write(writer, 256);
+}
+
+static void writeDynamicBlock(BitWriter& writer, std::span<const Symbol> symbols, bool final) {
+	std::vector<uint32_t> literalFrequencies(286, 0);
+	std::vector<uint32_t> distanceFrequencies(30, 0);
+	for (const Symbol& symbol : symbols) {
+		if (symbol.distance == 0) {
+			literalFrequencies[symbol.length]++;
+		}
+		else {
+			literalFrequencies[257 + lengthCode(symbol.length)]++;
+			distanceFrequencies[distanceCode(symbol.distance)]++;
+		}
+	}
+	literalFrequencies[256] = 1;
+	// keep both trees complete so any conforming decoder accepts them
+	if (std::count_if(literalFrequencies.begin(), literalFrequencies.end(), [](uint32_t f) { return f > 0; }) < 2) {
+		literalFrequencies[0]++;
+	}
+	for (uint32_t i = 0; std::count_if(distanceFrequencies.begin(), distanceFrequencies.end(), [](uint32_t f) { return f > 0; }) < 2; i++) {
+		distanceFrequencies[i] = std::max<uint32_t>(distanceFrequencies[i], 1);
+	}
+
+	HuffmanCode literals = makeCode(buildLengths(literalFrequencies, 15));
+	HuffmanCode distances = makeCode(buildLengths(distanceFrequencies, 15));
+	size_t literalCount = 286;
+	while (literalCount > 257 && literals.lengths[literalCount - 1] == 0) {
+		literalCount--;
+	}
+	size_t distanceCount = 30;
+	while (distanceCount > 1 && distances.lengths[distanceCount - 1] == 0) {
+		distanceCount--;
+	}
+
+	// run-length encode both length tables as one sequence
+	std::vector<uint8_t> allLengths(literals.lengths.begin(), literals.lengths.begin() + literalCount);
+	allLengths.insert(allLengths.end(), distances.lengths.begin(), distances.lengths.begin() + distanceCount);
+	struct LengthSymbol {
+		uint8_t symbol;
+		uint8_t extra;
+	};
+	std::vector<LengthSymbol> lengthSymbols;
+	for (size_t i = 0; i < allLengths.size();) {
+		uint8_t value = allLengths[i];
+		size_t run = 1;
+		while (i + run < allLengths.size() && allLengths[i + run] == value) {
+			run++;
+		}
+		i += run;
+		if (value == 0) {
+			while (run >= 11) {
+				size_t take = std::min<size_t>(run, 138);
+				lengthSymbols.push_back({ 18, static_cast<uint8_t>(take - 11) });
+				run -= take;
+			}
+			if (run >= 3) {
+				lengthSymbols.push_back({ 17, static_cast<uint8_t>(run - 3) });
+				run = 0;
+			}
+		}
+		else {
+			lengthSymbols.push_back({ value, 0 });
+			run--;
+			while (run >= 3) {
+				size_t take = std::min<size_t>(run, 6);
+				lengthSymbols.push_back({ 16, static_cast<uint8_t>(take - 3) });
+				run -= take;
+			}
+		}
+		for (; run > 0; run--) {
+			lengthSymbols.push_back({ value, 0 });
+		}
+	}
+
+	std::vector<uint32_t> lengthFrequencies(19, 0);
+	for (const LengthSymbol& symbol : lengthSymbols) {
+		lengthFrequencies[symbol.symbol]++;
+	}
+	HuffmanCode lengthCodes = makeCode(buildLengths(lengthFrequencies, 7));
+	size_t lengthCodeCount = 19;
+	while (lengthCodeCount > 4 && lengthCodes.lengths[codeLengthOrder[lengthCodeCount - 1]] == 0) {
+		lengthCodeCount--;
+	}
+
+	writer.write(final ? 1 : 0, 1);
+	writer.write(2, 2);
+	writer.write(static_cast<uint32_t>(literalCount - 257), 5);
+	writer.write(static_cast<uint32_t>(distanceCount - 1), 5);
+	writer.write(static_cast<uint32_t>(lengthCodeCount - 4), 4);
+	for (size_t i = 0; i < lengthCodeCount; i++) {
+		writer.write(lengthCodes.lengths[codeLengthOrder[i]], 3);
+	}
+	for (const LengthSymbol& symbol : lengthSymbols) {
+		lengthCodes.write(writer, symbol.symbol);
+		if (symbol.symbol == 16) {
+			writer.write(symbol.extra, 2);
+		}
+		else if (symbol.symbol == 17) {
+			writer.write(symbol.extra, 3);
+		}
+		else if (symbol.symbol == 18) {
+			writer.write(symbol.extra, 7);
+		}
+	}
+	writeSymbols(writer, symbols, literals, distances);
+}
+
+std::vector<uint8_t> zlibCompress(std::span<const uint8_t> data, DeflateMode mode) {
+	std::vector<uint8_t> out = { 0x78, 0x01 };
+	BitWriter writer(out);
+
+	if (mode == DeflateMode::Stored) {
+		size_t position = 0;
+		do {
+			size_t length = std::min(maxStoredBlock, data.size() - position);
+			bool final = position + length == data.size();
+			writer.write(final ? 1 : 0, 1);
+			writer.write(0, 2);
+			writer.alignToByte();
+			writer.write(static_cast<uint32_t>(length), 16);
+			writer.write(static_cast<uint32_t>(~length & 0xFFFF), 16);
+			out.insert(out.end(), data.begin() + position, data.begin() + position + length);
+			position += length;
+		} while (position < data.size());
+	}
+	else {
+		MatchFinder matchFinder(data);
+		HuffmanCode fixedLiterals = fixedLiteralCode();
+		HuffmanCode fixedDistances = fixedDistanceCode();
+		std::vector<Symbol> symbols;
+		size_t position = 0;
+		do {
+			size_t end = std::min(data.size(), position + blockInput);
+			bool final = end == data.size();
+			symbols.clear();
+			matchFinder.findSymbols(position, end, symbols);
+			if (mode == DeflateMode::Fixed) {
+				writer.write(final ? 1 : 0, 1);
+				writer.write(1, 2);
+				writeSymbols(writer, symbols, fixedLiterals, fixedDistances);
+			}
+			else {
+				writeDynamicBlock(writer, symbols, final);
+			}
+			position = end;
+		} while (position < data.size());
+	}
+	writer.alignToByte();
+
+	uint32_t adler = adler32(1, data);
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		out.push_back(static_cast<uint8_t>(adler >> shift));
+	}
+	return out;
+}
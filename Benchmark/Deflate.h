@@ -0,0 +1,14 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+enum class DeflateMode {
+	Stored,
+	Fixed,
+	Dynamic
+};
+
+// zlib stream built entirely from blocks of the given type. Only meant for generating the
+// benchmark corpus, so it favours simple code over compression ratio.
+std::vector<uint8_t> zlibCompress(std::span<const uint8_t> data, DeflateMode mode);
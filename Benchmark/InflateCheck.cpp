@@ -0,0 +1,155 @@
+#include "InflateCheck.h"
+
+#ifdef AX_BENCHMARK_ZLIB
+#include "Inflater.h"
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <memory_resource>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <zlib.h>
+
+// fixed rather than the core count, so every machine searches the same block starts
+static constexpr uint32_t threadCount = 4;
+static constexpr size_t inputBytes = 6 << 20;
+
+enum class InputKind {
+	// smooth rows with noise, like filtered scanlines
+	Image,
+	// words from a small vocabulary, so matches are short and frequent
+	Text,
+	// random runs repeated at distances up to the full window, so pieces reach far behind them
+	Repeats
+};
+
+static uint32_t nextRandom(uint32_t& state) {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+static std::vector<uint8_t> makeInput(InputKind kind) {
+	std::vector<uint8_t> data;
+	data.reserve(inputBytes);
+	uint32_t state = 0x9E3779B9u;
+	switch (kind) {
+	case InputKind::Image:
+		for (size_t i = 0; i < inputBytes; i++) {
+			uint32_t x = static_cast<uint32_t>(i % 4096);
+			uint32_t y = static_cast<uint32_t>(i / 4096);
+			data.push_back(static_cast<uint8_t>((x / 3 + y / 2 + (nextRandom(state) & 7)) & 0xFF));
+		}
+		break;
+	case InputKind::Text: {
+		static constexpr const char* words[] = { "inflate ", "block ", "window ", "symbol ", "huffman ", "distance ", "length ", "stream ", "the ", "a ", "of ", "\n" };
+		while (data.size() < inputBytes) {
+			std::string_view word = words[nextRandom(state) % std::size(words)];
+			data.insert(data.end(), word.begin(), word.end());
+		}
+		data.resize(inputBytes);
+		break;
+	}
+	case InputKind::Repeats:
+		while (data.size() < inputBytes) {
+			size_t length = 16 + nextRandom(state) % 512;
+			size_t distance = 1 + nextRandom(state) % 32768;
+			if (data.size() < distance || nextRandom(state) % 3 == 0) {
+				for (size_t i = 0; i < length; i++) {
+					data.push_back(static_cast<uint8_t>(nextRandom(state)));
+				}
+			}
+			else {
+				for (size_t i = 0; i < length; i++) {
+					data.push_back(data[data.size() - distance]);
+				}
+			}
+		}
+		data.resize(inputBytes);
+		break;
+	}
+	return data;
+}
+
+// raw DEFLATE, as inflateParallel takes it
+static std::vector<uint8_t> rawDeflate(const std::vector<uint8_t>& data, int level, int strategy) {
+	z_stream stream = {};
+	deflateInit2(&stream, level, Z_DEFLATED, -15, 8, strategy);
+	std::vector<uint8_t> compressed(deflateBound(&stream, static_cast<uLong>(data.size())));
+	stream.next_in = const_cast<Bytef*>(data.data());
+	stream.avail_in = static_cast<uInt>(data.size());
+	stream.next_out = compressed.data();
+	stream.avail_out = static_cast<uInt>(compressed.size());
+	deflate(&stream, Z_FINISH);
+	compressed.resize(stream.total_out);
+	deflateEnd(&stream);
+	return compressed;
+}
+
+bool checkParallelInflate() {
+	uint32_t passed = 0;
+	uint32_t total = 0;
+	auto check = [&](bool ok, const std::string& name) {
+		total++;
+		passed += ok;
+		if (!ok) {
+			std::printf("parallel inflate: %s failed\n", name.c_str());
+		}
+	};
+
+	struct Case {
+		InputKind kind;
+		int level;
+		int strategy;
+		const char* name;
+	};
+	static constexpr Case cases[] = {
+		{ InputKind::Image, 1, Z_DEFAULT_STRATEGY, "image level 1" },
+		{ InputKind::Image, 6, Z_DEFAULT_STRATEGY, "image level 6" },
+		{ InputKind::Image, 9, Z_DEFAULT_STRATEGY, "image level 9" },
+		{ InputKind::Image, 6, Z_FILTERED, "image filtered" },
+		{ InputKind::Image, 6, Z_RLE, "image rle" },
+		{ InputKind::Image, 6, Z_HUFFMAN_ONLY, "image huffman only" },
+		{ InputKind::Text, 1, Z_DEFAULT_STRATEGY, "text level 1" },
+		{ InputKind::Text, 9, Z_DEFAULT_STRATEGY, "text level 9" },
+		{ InputKind::Repeats, 6, Z_DEFAULT_STRATEGY, "repeats level 6" },
+		{ InputKind::Repeats, 9, Z_DEFAULT_STRATEGY, "repeats level 9" },
+	};
+	std::pmr::memory_resource* resource = std::pmr::get_default_resource();
+	std::optional<InputKind> inputKind;
+	std::vector<uint8_t> input;
+	for (const Case& c : cases) {
+		if (inputKind != c.kind) {
+			input = makeInput(c.kind);
+			inputKind = c.kind;
+		}
+		std::vector<uint8_t> compressed = rawDeflate(input, c.level, c.strategy);
+
+		// a valid stream big enough for every thread has to come back whole, not fall back
+		std::pmr::vector<uint8_t> output(resource);
+		std::optional<size_t> used = inflateParallel(compressed, output, threadCount, {});
+		check(used == compressed.size() && std::equal(output.begin(), output.end(), input.begin(), input.end()), c.name);
+
+		std::vector<uint8_t> truncated(compressed.begin(), compressed.begin() + compressed.size() * 3 / 4);
+		std::pmr::vector<uint8_t> truncatedOutput(resource);
+		check(!inflateParallel(truncated, truncatedOutput, threadCount, {}), std::string(c.name) + " truncated");
+	}
+
+	input = makeInput(InputKind::Image);
+	std::stop_source stopped;
+	stopped.request_stop();
+	std::pmr::vector<uint8_t> output(resource);
+	check(!inflateParallel(rawDeflate(input, 6, Z_DEFAULT_STRATEGY), output, threadCount, stopped.get_token()), "stop requested");
+
+	// too small to split, so it is left to the serial inflater however valid it is
+	input.resize(256 * 1024);
+	check(!inflateParallel(rawDeflate(input, 6, Z_DEFAULT_STRATEGY), output, threadCount, {}), "small stream");
+
+	std::printf("parallel inflate: %u of %u checks passed\n", passed, total);
+	return passed == total;
+}
+#endif
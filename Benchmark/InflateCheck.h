@@ -0,0 +1,6 @@
+#pragma once
+
+// Round trips inflateParallel against streams zlib compressed, since the corpus images are too
+// small to ever take the speculative path, and checks that a truncated stream, a stop and a
+// stream below the size limit fall back. Prints what failed; true when everything passed.
+bool checkParallelInflate();
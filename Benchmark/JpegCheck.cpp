@@ -0,0 +1,306 @@
+#include "JpegCheck.h"
+#include "AxImageLoader.h"
+#include "JpegKernels.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <numbers>
+#include <span>
+#include <string>
+#include <vector>
+
+#ifdef AX_BENCHMARK_LIBJPEG
+#include <jpeglib.h>
+#endif
+
+static uint32_t nextRandom(uint32_t& state) {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+// widths around the 8 and 16 samples the SIMD kernels take at a time, so every tail is covered
+static constexpr uint32_t maxKernelWidth = 67;
+
+static bool checkKernels() {
+	uint32_t state = 0x2545F491u;
+	bool ok = true;
+
+	// The coefficients are what an encoder writes: the forward DCT of an 8x8 block of samples,
+	// quantized and dequantized. Random ones would take the SIMD kernel's 16-bit intermediates
+	// past what they hold.
+	std::array<std::array<double, 8>, 8> basis;
+	for (int x = 0; x < 8; x++) {
+		for (int u = 0; u < 8; u++) {
+			basis[x][u] = std::cos((2 * x + 1) * u * std::numbers::pi / 16) * (u == 0 ? std::numbers::sqrt2 / 4 : 0.5);
+		}
+	}
+	IdctKernel idct = selectIdctKernel();
+	for (uint32_t block = 0; block < 20000 && ok; block++) {
+		// noise, a checkerboard (the most high frequency energy a block can hold), a gradient and
+		// random black and white
+		std::array<int, 64> samples;
+		for (int i = 0; i < 64; i++) {
+			int x = i % 8;
+			int y = i / 8;
+			switch (block % 4) {
+			case 0: samples[i] = nextRandom(state) % 256; break;
+			case 1: samples[i] = (x + y) % 2 == 0 ? 255 : 0; break;
+			case 2: samples[i] = (x * 32 + y * 4 + nextRandom(state) % 16) % 256; break;
+			default: samples[i] = nextRandom(state) % 2 == 0 ? 255 : 0; break;
+			}
+		}
+		// a quantizer of 1 keeps every coefficient exact; the largest tables go up to 255
+		int quantizer = block % 5 == 0 ? 1 : 1 + nextRandom(state) % 255;
+		std::array<int16_t, 64> coefficients;
+		for (int v = 0; v < 8; v++) {
+			for (int u = 0; u < 8; u++) {
+				double sum = 0;
+				for (int i = 0; i < 64; i++) {
+					sum += (samples[i] - 128) * basis[i % 8][u] * basis[i / 8][v];
+				}
+				coefficients[v * 8 + u] = static_cast<int16_t>(std::lround(sum / quantizer) * quantizer);
+			}
+		}
+		std::array<uint8_t, 64> expected;
+		std::array<uint8_t, 64> actual;
+		idctScalar(coefficients.data(), expected.data(), 8);
+		idct(coefficients.data(), actual.data(), 8);
+		if (expected != actual) {
+			std::printf("jpeg: idct kernel differs from the scalar one on block %u\n", block);
+			ok = false;
+		}
+	}
+
+	struct Upsampler {
+		UpsampleKernel kernel;
+		UpsampleKernel reference;
+		const char* name;
+	};
+	const Upsampler upsamplers[] = {
+		{ selectUpsampleH2V1(), upsampleH2V1Scalar, "h2v1" },
+		{ selectUpsampleH2V2(), upsampleH2V2Scalar, "h2v2" },
+	};
+	std::vector<uint8_t> near(maxKernelWidth);
+	std::vector<uint8_t> far(maxKernelWidth);
+	std::vector<uint8_t> expected(maxKernelWidth * 4);
+	std::vector<uint8_t> actual(maxKernelWidth * 4);
+	for (const Upsampler& upsampler : upsamplers) {
+		for (uint32_t width = 1; width <= maxKernelWidth; width++) {
+			for (uint32_t i = 0; i < width; i++) {
+				near[i] = static_cast<uint8_t>(nextRandom(state));
+				far[i] = static_cast<uint8_t>(nextRandom(state));
+			}
+			upsampler.reference(near.data(), far.data(), expected.data(), width);
+			upsampler.kernel(near.data(), far.data(), actual.data(), width);
+			if (!std::equal(expected.begin(), expected.begin() + 2 * width, actual.begin())) {
+				std::printf("jpeg: %s upsampling kernel differs from the scalar one at width %u\n", upsampler.name, width);
+				ok = false;
+				break;
+			}
+		}
+	}
+
+	std::vector<uint8_t> luma(maxKernelWidth);
+	std::vector<uint8_t> blue(maxKernelWidth);
+	std::vector<uint8_t> red(maxKernelWidth);
+	for (uint16_t channels : { 3, 4 }) {
+		YCbCrKernel kernel = selectYCbCrKernel(channels);
+		YCbCrKernel reference = selectYCbCrScalar(channels);
+		for (uint32_t count = 1; count <= maxKernelWidth; count++) {
+			for (uint32_t i = 0; i < count; i++) {
+				luma[i] = static_cast<uint8_t>(nextRandom(state));
+				blue[i] = static_cast<uint8_t>(nextRandom(state));
+				red[i] = static_cast<uint8_t>(nextRandom(state));
+			}
+			reference(luma.data(), blue.data(), red.data(), expected.data(), count);
+			kernel(luma.data(), blue.data(), red.data(), actual.data(), count);
+			if (!std::equal(expected.begin(), expected.begin() + count * channels, actual.begin())) {
+				std::printf("jpeg: %u-channel color conversion kernel differs from the scalar one at %u pixels\n", channels, count);
+				ok = false;
+				break;
+			}
+		}
+	}
+	if (ok) {
+		std::printf("jpeg: idct, upsampling and color conversion kernels match the scalar ones\n");
+	}
+	return ok;
+}
+
+#ifdef AX_BENCHMARK_LIBJPEG
+struct JpegCase {
+	uint32_t width;
+	uint32_t height;
+	// 1 for grayscale, 3 for color
+	int components;
+	// sampling factors of the first component; the others are 1x1
+	int horizontalSampling;
+	int verticalSampling;
+	bool progressive;
+	// in MCUs, 0 for none
+	uint32_t restartInterval;
+	// color stored as RGB rather than YCbCr, which libjpeg marks with an Adobe segment
+	bool rgb;
+	int quality;
+};
+
+// gradients, noise and a checkerboard, so blocks carry both smooth and sharp content
+static std::vector<uint8_t> makePixels(const JpegCase& c) {
+	std::vector<uint8_t> pixels(static_cast<size_t>(c.width) * c.height * c.components);
+	uint32_t state = c.width * 31 + c.height;
+	for (uint32_t y = 0; y < c.height; y++) {
+		for (uint32_t x = 0; x < c.width; x++) {
+			for (int k = 0; k < c.components; k++) {
+				uint32_t value = (x * (k + 1) * 3 + y * (2 - k % 2) * 5) / 4 + nextRandom(state) % 24 + (((x / 16 + y / 16) & 1) ? 60 : 0);
+				pixels[(static_cast<size_t>(y) * c.width + x) * c.components + k] = static_cast<uint8_t>(value);
+			}
+		}
+	}
+	return pixels;
+}
+
+static std::vector<uint8_t> encodeWithLibjpeg(const JpegCase& c) {
+	std::vector<uint8_t> pixels = makePixels(c);
+	jpeg_compress_struct info;
+	jpeg_error_mgr error;
+	info.err = jpeg_std_error(&error);
+	jpeg_create_compress(&info);
+	unsigned char* buffer = nullptr;
+	unsigned long size = 0;
+	jpeg_mem_dest(&info, &buffer, &size);
+	info.image_width = c.width;
+	info.image_height = c.height;
+	info.input_components = c.components;
+	info.in_color_space = c.components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+	jpeg_set_defaults(&info);
+	if (c.rgb) {
+		jpeg_set_colorspace(&info, JCS_RGB);
+	}
+	jpeg_set_quality(&info, c.quality, TRUE);
+	info.comp_info[0].h_samp_factor = c.horizontalSampling;
+	info.comp_info[0].v_samp_factor = c.verticalSampling;
+	if (c.progressive) {
+		jpeg_simple_progression(&info);
+	}
+	info.restart_interval = c.restartInterval;
+	jpeg_start_compress(&info, TRUE);
+	while (info.next_scanline < info.image_height) {
+		JSAMPROW row = pixels.data() + static_cast<size_t>(info.next_scanline) * c.width * c.components;
+		jpeg_write_scanlines(&info, &row, 1);
+	}
+	jpeg_finish_compress(&info);
+	jpeg_destroy_compress(&info);
+	std::vector<uint8_t> jpeg(buffer, buffer + size);
+	std::free(buffer);
+	return jpeg;
+}
+
+// the islow IDCT and fancy upsampling, which the loader reproduces
+static std::vector<uint8_t> decodeWithLibjpeg(std::span<const uint8_t> jpeg) {
+	jpeg_decompress_struct info;
+	jpeg_error_mgr error;
+	info.err = jpeg_std_error(&error);
+	jpeg_create_decompress(&info);
+	jpeg_mem_src(&info, jpeg.data(), static_cast<unsigned long>(jpeg.size()));
+	jpeg_read_header(&info, TRUE);
+	info.dct_method = JDCT_ISLOW;
+	info.do_fancy_upsampling = TRUE;
+	jpeg_start_decompress(&info);
+	size_t rowBytes = static_cast<size_t>(info.output_width) * info.output_components;
+	std::vector<uint8_t> pixels(rowBytes * info.output_height);
+	while (info.output_scanline < info.output_height) {
+		JSAMPROW row = pixels.data() + info.output_scanline * rowBytes;
+		jpeg_read_scanlines(&info, &row, 1);
+	}
+	jpeg_finish_decompress(&info);
+	jpeg_destroy_decompress(&info);
+	return pixels;
+}
+
+// largest difference between the image and the rows and columns of reference it covers
+static int maxDifference(const AxImageLoader::Image& image, const std::vector<uint8_t>& reference, uint32_t referenceWidth, uint32_t x, uint32_t y) {
+	int difference = 0;
+	size_t rowBytes = static_cast<size_t>(image.width) * image.channels;
+	for (uint32_t row = 0; row < image.height; row++) {
+		const uint8_t* expected = reference.data() + ((static_cast<size_t>(y) + row) * referenceWidth + x) * image.channels;
+		const uint8_t* actual = image.data.data() + row * rowBytes;
+		for (size_t i = 0; i < rowBytes; i++) {
+			difference = std::max(difference, std::abs(expected[i] - actual[i]));
+		}
+	}
+	return difference;
+}
+
+static bool checkAgainstLibjpeg() {
+	std::vector<JpegCase> cases;
+	static constexpr std::array<std::array<uint32_t, 2>, 6> sizes = { { { 1, 1 }, { 7, 5 }, { 17, 33 }, { 64, 48 }, { 301, 203 }, { 640, 480 } } };
+	// 4:4:4, 4:2:2, 4:2:0 and 4:4:0
+	static constexpr std::array<std::array<int, 2>, 4> samplings = { { { 1, 1 }, { 2, 1 }, { 2, 2 }, { 1, 2 } } };
+	for (const auto& [width, height] : sizes) {
+		for (bool progressive : { false, true }) {
+			for (const auto& [horizontal, vertical] : samplings) {
+				for (uint32_t restartInterval : { 0u, 3u }) {
+					cases.push_back({ width, height, 3, horizontal, vertical, progressive, restartInterval, false, 90 });
+				}
+			}
+			cases.push_back({ width, height, 1, 1, 1, progressive, 0, false, 85 });
+			cases.push_back({ width, height, 1, 1, 1, progressive, 2, false, 85 });
+			cases.push_back({ width, height, 3, 1, 1, progressive, 0, true, 95 });
+			cases.push_back({ width, height, 3, 2, 2, progressive, 1, false, 100 });
+			cases.push_back({ width, height, 3, 2, 2, progressive, 0, false, 10 });
+		}
+	}
+
+	uint32_t failures = 0;
+	uint32_t decodes = 0;
+	for (const JpegCase& c : cases) {
+		std::vector<uint8_t> jpeg = encodeWithLibjpeg(c);
+		std::vector<uint8_t> reference = decodeWithLibjpeg(jpeg);
+		// the middle of the image, so region decodes start and end inside MCUs
+		AxImageLoader::ImageRegion region;
+		region.x = c.width / 4;
+		region.y = c.height / 3;
+		region.width = c.width - region.x - c.width / 5;
+		region.height = c.height - region.y - c.height / 5;
+
+		for (bool pipelined : { false, true }) {
+			AxImageLoader::LoadOptions options;
+			options.pipelined = pipelined;
+			options.pipelineThreads = 4;
+			auto full = AxImageLoader::loadImageFromMemory(jpeg, 0, options);
+			auto part = AxImageLoader::loadImageRegion(jpeg, region, 0, options);
+			decodes += 2;
+			std::string error;
+			if (!full || !part) {
+				error = full ? part.error() : full.error();
+			}
+			else if (full->width != c.width || full->height != c.height || full->channels != c.components) {
+				error = "decoded as " + std::to_string(full->width) + "x" + std::to_string(full->height) + "x" + std::to_string(full->channels);
+			}
+			else if (int difference = std::max(maxDifference(*full, reference, c.width, 0, 0), maxDifference(*part, reference, c.width, region.x, region.y)); difference > 1) {
+				error = "differs from libjpeg by " + std::to_string(difference);
+			}
+			if (!error.empty()) {
+				std::printf("jpeg: %ux%u, %d components, %dx%d sampling, %s, restart interval %u%s%s: %s\n", c.width, c.height, c.components,
+					c.horizontalSampling, c.verticalSampling, c.progressive ? "progressive" : "baseline", c.restartInterval, c.rgb ? ", rgb" : "",
+					pipelined ? ", pipelined" : "", error.c_str());
+				failures++;
+			}
+		}
+	}
+	std::printf("jpeg: %u of %u decodes within 1 of libjpeg\n", decodes - failures, decodes);
+	return failures == 0;
+}
+#endif
+
+bool checkJpegDecoder() {
+	bool ok = checkKernels();
+#ifdef AX_BENCHMARK_LIBJPEG
+	ok = checkAgainstLibjpeg() && ok;
+#endif
+	return ok;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// Checks the JPEG kernels the CPU selects against their scalar versions and, when libjpeg is
+// found, decodes of baseline and progressive images it encoded against its own islow decode.
+// Prints what failed; true when everything passed.
+bool checkJpegDecoder();
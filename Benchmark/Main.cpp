@@ -0,0 +1,411 @@
+#include "AxImageLoader.h"
+#include "BlockCheck.h"
+#include "Corpus.h"
+#include "InflateCheck.h"
+#include "JpegCheck.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <string>
+
+#ifdef AX_BENCHMARK_ZLIB
+#include <zlib.h>
+#endif
+#ifdef AX_BENCHMARK_LIBPNG
+#include <png.h>
+#endif
+
+// bump when the generator changes, so corpora written by older builds are not reused
+static constexpr const char* corpusVersion = "v1";
+
+struct BenchmarkOptions {
+	std::filesystem::path corpusDirectory;
+	uint32_t iterations = 10;
+	std::string filter;
+	uint16_t requiredChannels = 0;
+	AxImageLoader::LoadOptions loadOptions;
+	bool compare = true;
+	bool stats = false;
+};
+
+struct Timing {
+	double p50 = 0;
+	double p90 = 0;
+	double p99 = 0;
+};
+
+static void printUsage() {
+	std::printf(
+		"usage: AxImageLoaderBenchmark [options]\n"
+		"  --corpus DIR        where the generated corpus is cached (default: temp directory)\n"
+		"  --iterations N      timed decodes per image (default: 10)\n"
+		"  --filter TEXT       only images whose name contains TEXT\n"
+		"  --channels N        requiredChannels passed to loadImage (default: 0)\n"
+		"  --integrity LEVEL   none, adler or full (default: none)\n"
+		"  --pipelined         decode with LoadOptions::pipelined\n"
+		"  --speculative       decode with LoadOptions::speculativeInflate\n"
+		"  --blocks QUALITY    also encode BCn blocks: fast or high (default: off)\n"
+		"  --no-compare        skip the zlib and libpng runs and the correctness checks\n"
+		"  --stats             print where the decode time goes; needs a library built with imageLoaderStats=1\n");
+}
+
+static std::optional<BenchmarkOptions> parseArguments(int argc, char** argv) {
+	BenchmarkOptions options;
+	options.corpusDirectory = std::filesystem::temp_directory_path() / (std::string("AxImageLoaderBenchmark-") + corpusVersion);
+	for (int i = 1; i < argc; i++) {
+		std::string_view argument = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (argument == "--corpus" && hasValue) {
+			options.corpusDirectory = argv[++i];
+		}
+		else if (argument == "--iterations" && hasValue) {
+			options.iterations = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (argument == "--filter" && hasValue) {
+			options.filter = argv[++i];
+		}
+		else if (argument == "--channels" && hasValue) {
+			options.requiredChannels = static_cast<uint16_t>(std::atoi(argv[++i]));
+		}
+		else if (argument == "--integrity" && hasValue) {
+			std::string_view level = argv[++i];
+			if (level == "none") {
+				options.loadOptions.integrityCheck = AxImageLoader::IntegrityCheck::None;
+			}
+			else if (level == "adler") {
+				options.loadOptions.integrityCheck = AxImageLoader::IntegrityCheck::Adler;
+			}
+			else if (level == "full") {
+				options.loadOptions.integrityCheck = AxImageLoader::IntegrityCheck::Full;
+			}
+			else {
+				return std::nullopt;
+			}
+		}
+		else if (argument == "--pipelined") {
+			options.loadOptions.pipelined = true;
+		}
+		else if (argument == "--speculative") {
+			options.loadOptions.speculativeInflate = true;
+		}
+		else if (argument == "--blocks" && hasValue) {
+			std::string_view quality = argv[++i];
+			if (quality == "fast") {
+				options.loadOptions.blockCompression = AxImageLoader::BlockCompression::Fast;
+			}
+			else if (quality == "high") {
+				options.loadOptions.blockCompression = AxImageLoader::BlockCompression::HighQuality;
+			}
+			else {
+				return std::nullopt;
+			}
+		}
+		else if (argument == "--no-compare") {
+			options.compare = false;
+		}
+		else if (argument == "--stats") {
+			options.stats = true;
+		}
+		else {
+			return std::nullopt;
+		}
+	}
+	return options;
+}
+
+// nearest-rank percentiles over the timed iterations, in milliseconds
+static Timing measure(uint32_t iterations, const std::function<bool()>& run) {
+	std::vector<double> samples;
+	samples.reserve(iterations);
+	for (uint32_t i = 0; i < iterations; i++) {
+		auto start = std::chrono::steady_clock::now();
+		if (!run()) {
+			return {};
+		}
+		samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	}
+	std::sort(samples.begin(), samples.end());
+	auto percentile = [&](double p) {
+		size_t rank = static_cast<size_t>(std::ceil(p * samples.size()));
+		return samples[std::clamp<size_t>(rank, 1, samples.size()) - 1];
+	};
+	return { percentile(0.5), percentile(0.9), percentile(0.99) };
+}
+
+static double megabytesPerSecond(size_t bytes, double milliseconds) {
+	return milliseconds > 0 ? bytes / 1e6 / (milliseconds / 1e3) : 0;
+}
+
+static std::vector<uint8_t> readFile(const std::filesystem::path& path) {
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	std::vector<uint8_t> data(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+	return data;
+}
+
+static bool writeFile(const std::filesystem::path& path, std::span<const uint8_t> data) {
+	// renamed into place, so an interrupted run never leaves a truncated image behind
+	std::filesystem::path tempPath = path;
+	tempPath += ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+		if (!file) {
+			return false;
+		}
+	}
+	std::error_code error;
+	std::filesystem::rename(tempPath, path, error);
+	return !error;
+}
+
+#ifdef AX_BENCHMARK_ZLIB
+// the concatenated IDAT payload, i.e. the zlib stream
+static std::vector<uint8_t> imageData(std::span<const uint8_t> png) {
+	std::vector<uint8_t> data;
+	size_t offset = 8;
+	while (offset + 12 <= png.size()) {
+		uint32_t length = (png[offset] << 24) | (png[offset + 1] << 16) | (png[offset + 2] << 8) | png[offset + 3];
+		if (std::memcmp(png.data() + offset + 4, "IDAT", 4) == 0) {
+			data.insert(data.end(), png.begin() + offset + 8, png.begin() + offset + 8 + length);
+		}
+		offset += 12 + static_cast<size_t>(length);
+	}
+	return data;
+}
+#endif
+
+#ifdef AX_BENCHMARK_LIBPNG
+// Decodes with the transforms loadImage applies: 16-bit samples keep their high byte, low bit
+// depths and palettes expand to 8 bits, and alpha is dropped rather than composited.
+static bool decodeWithLibpng(const std::filesystem::path& path, uint16_t channels, std::vector<uint8_t>& pixels) {
+	FILE* file = std::fopen(path.string().c_str(), "rb");
+	if (!file) {
+		return false;
+	}
+	png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+	png_infop info = png ? png_create_info_struct(png) : nullptr;
+	if (!info || setjmp(png_jmpbuf(png))) {
+		png_destroy_read_struct(&png, &info, nullptr);
+		std::fclose(file);
+		return false;
+	}
+	png_init_io(png, file);
+	png_read_info(png, info);
+	uint8_t colorType = png_get_color_type(png, info);
+	bool color = (colorType & PNG_COLOR_MASK_COLOR) != 0;
+	bool alpha = (colorType & PNG_COLOR_MASK_ALPHA) != 0 || png_get_valid(png, info, PNG_INFO_tRNS) != 0;
+	png_set_expand(png);
+	png_set_strip_16(png);
+	if (channels >= 3 && !color) {
+		png_set_gray_to_rgb(png);
+	}
+	if (channels <= 2 && color) {
+		png_set_rgb_to_gray_fixed(png, 1, 29900, 58700);
+	}
+	if ((channels == 2 || channels == 4) && !alpha) {
+		png_set_add_alpha(png, 0xFF, PNG_FILLER_AFTER);
+	}
+	if ((channels == 1 || channels == 3) && alpha) {
+		png_set_strip_alpha(png);
+	}
+	png_set_interlace_handling(png);
+	png_read_update_info(png, info);
+
+	size_t rowBytes = png_get_rowbytes(png, info);
+	uint32_t height = png_get_image_height(png, info);
+	pixels.resize(rowBytes * height);
+	std::vector<png_bytep> rows(height);
+	for (uint32_t y = 0; y < height; y++) {
+		rows[y] = pixels.data() + y * rowBytes;
+	}
+	png_read_image(png, rows.data());
+	png_read_end(png, nullptr);
+	png_destroy_read_struct(&png, &info, nullptr);
+	std::fclose(file);
+	return true;
+}
+
+// index of the first sample further than tolerance from the reference
+static std::optional<size_t> firstMismatch(std::span<const uint8_t> output, std::span<const uint8_t> reference, int tolerance) {
+	if (output.size() != reference.size()) {
+		return std::min(output.size(), reference.size());
+	}
+	for (size_t i = 0; i < output.size(); i++) {
+		if (std::abs(output[i] - reference[i]) > tolerance) {
+			return i;
+		}
+	}
+	return std::nullopt;
+}
+#endif
+
+// per-decode averages of what the timed iterations recorded
+static void printStats(const AxImageLoader::DecodeStats& stats, uint32_t iterations) {
+	auto ms = [&](uint64_t nanoseconds) { return nanoseconds / 1e6 / iterations; };
+	std::printf("  stages ms: read %.3f, chunks %.3f, inflate %.3f, unfilter %.3f, entropy %.3f, idct %.3f, convert %.3f, mips %.3f, bcn %.3f\n",
+		ms(stats.readNanoseconds), ms(stats.chunkNanoseconds), ms(stats.inflateNanoseconds), ms(stats.unfilterNanoseconds), ms(stats.entropyNanoseconds), ms(stats.idctNanoseconds), ms(stats.convertNanoseconds), ms(stats.mipNanoseconds), ms(stats.blockCompressionNanoseconds));
+	std::printf("  blocks: %llu stored, %llu fixed, %llu dynamic (%llu tables); filters: %llu none, %llu sub, %llu up, %llu average, %llu paeth\n",
+		static_cast<unsigned long long>(stats.blockTypes[0] / iterations), static_cast<unsigned long long>(stats.blockTypes[1] / iterations),
+		static_cast<unsigned long long>(stats.blockTypes[2] / iterations), static_cast<unsigned long long>(stats.huffmanTableBuilds / iterations),
+		static_cast<unsigned long long>(stats.filterTypes[0] / iterations), static_cast<unsigned long long>(stats.filterTypes[1] / iterations),
+		static_cast<unsigned long long>(stats.filterTypes[2] / iterations), static_cast<unsigned long long>(stats.filterTypes[3] / iterations),
+		static_cast<unsigned long long>(stats.filterTypes[4] / iterations));
+}
+
+int main(int argc, char** argv) {
+	std::optional<BenchmarkOptions> options = parseArguments(argc, argv);
+	if (!options) {
+		printUsage();
+		return 1;
+	}
+
+	std::vector<CorpusImage> corpus = benchmarkCorpus();
+	std::erase_if(corpus, [&](const CorpusImage& image) { return image.name.find(options->filter) == std::string::npos; });
+	std::error_code error;
+	std::filesystem::create_directories(options->corpusDirectory, error);
+	if (error) {
+		std::fprintf(stderr, "Failed to create corpus directory %s\n", options->corpusDirectory.string().c_str());
+		return 1;
+	}
+	for (const CorpusImage& image : corpus) {
+		std::filesystem::path path = options->corpusDirectory / (image.name + ".png");
+		if (!std::filesystem::exists(path)) {
+			std::printf("generating %s\n", path.string().c_str());
+			std::fflush(stdout);
+			if (!writeFile(path, encodePng(image))) {
+				std::fprintf(stderr, "Failed to write %s\n", path.string().c_str());
+				return 1;
+			}
+		}
+	}
+
+	bool compare = options->compare;
+#if !defined(AX_BENCHMARK_ZLIB) && !defined(AX_BENCHMARK_LIBPNG)
+	compare = false;
+#endif
+	bool failed = false;
+#ifdef AX_BENCHMARK_ZLIB
+	if (compare && !checkParallelInflate()) {
+		failed = true;
+	}
+#endif
+	// the kernel half of the check needs no library, so it only follows --no-compare
+	if (options->compare && !checkJpegDecoder()) {
+		failed = true;
+	}
+	std::printf("%-20s %10s %10s %9s %9s %9s %9s", "image", "file KB", "output MB", "p50 ms", "p90 ms", "p99 ms", "MB/s");
+	if (compare) {
+		std::printf(" %11s %11s", "libpng MB/s", "zlib ms");
+	}
+	std::printf("\n");
+
+	size_t totalBytes = 0;
+	double totalMilliseconds = 0;
+	size_t libpngBytes = 0;
+	double libpngMilliseconds = 0;
+	for (const CorpusImage& corpusImage : corpus) {
+		std::filesystem::path path = options->corpusDirectory / (corpusImage.name + ".png");
+		std::vector<uint8_t> fileData = readFile(path);
+
+		// one untimed decode warms the caches and yields the output size
+		auto warmup = AxImageLoader::loadImage(path, options->requiredChannels, options->loadOptions);
+		if (!warmup) {
+			std::printf("%-20s failed: %s\n", corpusImage.name.c_str(), warmup.error().c_str());
+			failed = true;
+			continue;
+		}
+		size_t outputBytes = warmup->data.size();
+		[[maybe_unused]] uint16_t outputChannels = warmup->channels;
+		// kept for the check against libpng; BCn blocks are checked against the pixels they were
+		// made from, which then go to libpng instead
+		[[maybe_unused]] std::vector<uint8_t> output;
+		std::optional<std::string> blockFailure;
+		if (options->loadOptions.blockCompression == AxImageLoader::BlockCompression::None) {
+			if (compare) {
+				output = std::move(warmup->data);
+			}
+		}
+		else if (options->compare) {
+			AxImageLoader::LoadOptions pixelOptions = options->loadOptions;
+			pixelOptions.blockCompression = AxImageLoader::BlockCompression::None;
+			auto pixels = AxImageLoader::loadImage(path, options->requiredChannels, pixelOptions);
+			if (!pixels) {
+				blockFailure = pixels.error();
+			}
+			else {
+				blockFailure = checkBlocks(*warmup, *pixels);
+				if (compare) {
+					output = std::move(pixels->data);
+				}
+			}
+		}
+		warmup = {};
+
+		AxImageLoader::DecodeStats stats;
+		AxImageLoader::LoadOptions loadOptions = options->loadOptions;
+		if (options->stats) {
+			loadOptions.stats = &stats;
+		}
+		Timing timing = measure(options->iterations, [&] {
+			return AxImageLoader::loadImage(path, options->requiredChannels, loadOptions).has_value();
+		});
+		totalBytes += outputBytes;
+		totalMilliseconds += timing.p50;
+		std::printf("%-20s %10.1f %10.2f %9.3f %9.3f %9.3f %9.1f", corpusImage.name.c_str(), fileData.size() / 1024.0, outputBytes / 1e6,
+			timing.p50, timing.p90, timing.p99, megabytesPerSecond(outputBytes, timing.p50));
+
+		std::optional<size_t> mismatch;
+		if (compare) {
+			double libpngRate = 0;
+#ifdef AX_BENCHMARK_LIBPNG
+			std::vector<uint8_t> pixels;
+			Timing libpng = measure(options->iterations, [&] { return decodeWithLibpng(path, outputChannels, pixels); });
+			libpngRate = megabytesPerSecond(pixels.size(), libpng.p50);
+			libpngBytes += pixels.size();
+			libpngMilliseconds += libpng.p50;
+			if (!output.empty()) {
+				// libpng's fixed-point luma weights round where ours truncate
+				bool colorToGray = (corpusImage.colorType & 2) != 0 && outputChannels <= 2;
+				mismatch = firstMismatch(output, pixels, colorToGray ? 1 : 0);
+			}
+#endif
+			double zlibMilliseconds = 0;
+#ifdef AX_BENCHMARK_ZLIB
+			// inflating the image data alone, the floor for any zlib-based PNG decoder
+			std::vector<uint8_t> compressed = imageData(fileData);
+			std::vector<uint8_t> inflated(filteredSize(corpusImage));
+			zlibMilliseconds = measure(options->iterations, [&] {
+				uLongf size = static_cast<uLongf>(inflated.size());
+				return uncompress(inflated.data(), &size, compressed.data(), static_cast<uLong>(compressed.size())) == Z_OK;
+			}).p50;
+#endif
+			std::printf(" %11.1f %11.3f", libpngRate, zlibMilliseconds);
+		}
+		std::printf("\n");
+		if (mismatch) {
+			std::printf("  output differs from libpng at byte %zu\n", *mismatch);
+			failed = true;
+		}
+		if (blockFailure) {
+			std::printf("  blocks: %s\n", blockFailure->c_str());
+			failed = true;
+		}
+		if (options->stats) {
+			printStats(stats, options->iterations);
+		}
+	}
+
+	std::printf("\ntotal %.2f MB in %.3f ms (sum of medians), %.1f MB/s\n", totalBytes / 1e6, totalMilliseconds, megabytesPerSecond(totalBytes, totalMilliseconds));
+	if (compare && libpngMilliseconds > 0) {
+		std::printf("libpng %.2f MB in %.3f ms, %.1f MB/s\n", libpngBytes / 1e6, libpngMilliseconds, megabytesPerSecond(libpngBytes, libpngMilliseconds));
+	}
+	return failed ? 1 : 0;
+}
@@ -1,14 +1,408 @@
 #pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
 #include <expected>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <stop_token>
+#include <string_view>
 #include <vector>
 
+class MappedFile;
+
 namespace AxImageLoader {
+	class PngRowStream;
+	class AsyncLoadState;
+	struct ImageCacheState;
+	struct DecoderState;
+
+	// error of a load stopped through LoadOptions::stopToken or LoadHandle::cancel()
+	inline constexpr std::string_view cancelledError = "Image load was cancelled";
+
+	// one level of a mip chain, stored at data.data() + offset with width * channels bytes per row
+	struct MipLevel {
+		uint32_t width;
+		uint32_t height;
+		size_t offset;
+	};
+
+	// GPU block-compressed formats, in 4x4 pixel blocks stored row by row, (width + 3) / 4 per row
+	enum class BlockFormat {
+		// plain pixels, channels bytes each
+		None,
+		// RGB, 8 bytes per block
+		BC1,
+		// RGBA, 16 bytes per block
+		BC3,
+		// one channel, 8 bytes per block
+		BC4,
+		// two channels, gray and alpha of a gray-alpha image, 16 bytes per block
+		BC5,
+		// RGB or RGBA, 16 bytes per block
+		BC7
+	};
+
 	struct Image {
 		std::vector<uint8_t> data;
 		uint32_t width;
 		uint32_t height;
 		uint16_t channels;
+		// Set when LoadOptions::mipChain asks for a chain: every level down to 1x1, level 0
+		// being the image itself, packed one after another in data. Empty otherwise.
+		std::vector<MipLevel> mipLevels;
+		// what data holds; with blocks the mip level offsets are into the block data
+		BlockFormat blockFormat;
+	};
+
+	struct ImageInfo {
+		uint32_t width;
+		uint32_t height;
+		// channels of the decoded output, the file's own unless requiredChannels overrides them
+		uint16_t channels;
+		// bits per sample as stored in the file
+		uint8_t bitDepth;
+		bool hasAlpha;
+		// Adam7 interlaced PNG or progressive JPEG
+		bool interlaced;
+		// width * height * channels of the decoded output
+		size_t byteSize;
+	};
+
+	enum class IntegrityCheck {
+		None,
+		// Adler-32 of the decompressed image data
+		Adler,
+		// Adler-32 plus the CRC-32 of every chunk the decoder reads
+		Full
+	};
+
+	// Where the time of a decode goes, for finding slow assets and checking optimizations.
+	// Filled in only when the library is built with AX_IMAGE_LOADER_STATS (scons
+	// imageLoaderStats=1); otherwise the recording code is compiled out and the struct is
+	// left untouched. Loads add to the values, so one struct can total a whole batch, and
+	// loads running in parallel may share it. The stages of a pipelined decode overlap, so
+	// their times add up to more than the wall time.
+	struct DecodeStats {
+		// reading or mapping the file; zero for loads from memory
+		uint64_t readNanoseconds = 0;
+		// walking the chunks, including their CRCs under IntegrityCheck::Full
+		uint64_t chunkNanoseconds = 0;
+		uint64_t inflateNanoseconds = 0;
+		uint64_t unfilterNanoseconds = 0;
+		// JPEG's counterparts of inflate and unfilter: Huffman decoding and the inverse DCT
+		uint64_t entropyNanoseconds = 0;
+		uint64_t idctNanoseconds = 0;
+		uint64_t convertNanoseconds = 0;
+		uint64_t mipNanoseconds = 0;
+		uint64_t blockCompressionNanoseconds = 0;
+		// encoded file bytes, IDAT payload or JPEG entropy-coded data, decompressed scanlines and decoded pixels
+		uint64_t inputBytes = 0;
+		uint64_t compressedBytes = 0;
+		uint64_t inflatedBytes = 0;
+		uint64_t outputBytes = 0;
+		// DEFLATE blocks by type: stored, fixed Huffman, dynamic Huffman
+		std::array<uint64_t, 3> blockTypes = {};
+		// scanlines by PNG filter type: None, Sub, Up, Average, Paeth
+		std::array<uint64_t, 5> filterTypes = {};
+		// Huffman decode tables built for dynamic blocks, three per block
+		uint64_t huffmanTableBuilds = 0;
+	};
+
+	// Reported after each of the seven Adam7 passes of an interlaced PNG. The decoder fills
+	// every output pixel with the nearest one decoded so far, so pixels is always a complete,
+	// progressively sharper preview: after pass 1 each 8x8 block shows one pixel, after pass 7
+	// the image is final. previewBlockWidth and previewBlockHeight are the block size at this
+	// pass. Only valid during the call; after the last pass the load returns as usual.
+	struct InterlacePass {
+		// 1 to 7
+		uint32_t pass;
+		uint32_t previewBlockWidth;
+		uint32_t previewBlockHeight;
+		uint32_t width;
+		uint32_t height;
+		uint16_t channels;
+		// the whole output image, row y at y * rowPitch
+		std::span<const uint8_t> pixels;
+		size_t rowPitch;
+	};
+	using InterlaceCallback = std::function<void(const InterlacePass&)>;
+
+	enum class MipChain {
+		None,
+		// 2x2 box filter on the stored values
+		Linear,
+		// 2x2 box filter in linear light for the color channels, for sRGB-encoded images;
+		// alpha is averaged as stored
+		Srgb
+	};
+
+	enum class BlockCompression {
+		None,
+		// BC1, BC3, BC4 or BC5 with a quick endpoint fit, for encoding while loading
+		Fast,
+		// BC7 for color images and a thorough endpoint search, for baking assets
+		HighQuality
+	};
+
+	struct LoadOptions {
+		// checksums to verify; a mismatch fails the load with an "Adler-32 mismatch" or "CRC
+		// mismatch" error
+		IntegrityCheck integrityCheck = IntegrityCheck::None;
+		// Decodes a large PNG on several threads: one inflates, one unfilters and the rest
+		// convert rows. JPEGs split their restart intervals, the IDCT of progressive images and
+		// the color conversion between the threads instead. Meant for single huge images;
+		// batches already decode one image per thread.
+		bool pipelined = false;
+		// threads of a pipelined decode, 0 for one per hardware thread
+		uint32_t pipelineThreads = 0;
+		// Experimental: inflates very large non-interlaced images on pipelineThreads threads by
+		// guessing where DEFLATE blocks start. The result is the same as a serial inflate, which
+		// is also what runs when a guess fails. Ignored when pipelined is set. Data split over
+		// several IDAT chunks is copied into one buffer first, a few milliseconds for the 9 MB
+		// of the 2048x2048 benchmark image, which with the block search made that image slower
+		// than a serial inflate (128 ms against 121 ms); measure before turning it on.
+		bool speculativeInflate = false;
+		// Backs the temporary buffers of a decode (decompressed data, scanlines, chunk lists,
+		// Huffman tables), e.g. a frame allocator. Null uses std::pmr::get_default_resource().
+		// The returned Image::data is not scratch memory and always comes from std::allocator.
+		std::pmr::memory_resource* scratchMemory = nullptr;
+		// checked between inflate steps and scanline blocks; a stop fails the load with cancelledError
+		std::stop_token stopToken;
+		// receives per-stage timings and counts, see DecodeStats
+		DecodeStats* stats = nullptr;
+		// Called on the decoding thread as each pass of an interlaced PNG completes; never called
+		// for other images. Each pass is inflated only once the previous one is reported, so
+		// the first preview arrives after about 1/64 of the image data.
+		InterlaceCallback onInterlacePass;
+		// Builds the mip chain while decoding; each level is made from rows of the one above
+		// as soon as they are written, while they are still in cache. Odd sizes round down, as
+		// GPUs do. Applies to the functions returning an Image; loadImageInto ignores it.
+		MipChain mipChain = MipChain::None;
+		// Encodes the decoded image, and its mip chain if there is one, into GPU blocks instead of
+		// returning pixels. The format follows the output channels: BC4 for gray, BC5 for
+		// gray-alpha, BC1 for RGB and for RGBA whose alpha is all opaque, BC3 for other RGBA.
+		// HighQuality uses BC7 for the last three. Applies to the functions returning an Image.
+		BlockCompression blockCompression = BlockCompression::None;
+		// threads encoding blocks, 0 for one per hardware thread
+		uint32_t blockCompressionThreads = 0;
+	};
+
+	enum class PngCompression {
+		// no compression at all, for when only the write speed matters
+		Store,
+		// filtered rows Huffman coded without matching; close to Balanced on photos, far larger
+		// on flat UI content
+		Fast,
+		// greedy matching over short chains, which is what flat content and text need
+		Balanced
+	};
+
+	struct SaveOptions {
+		PngCompression compression = PngCompression::Balanced;
+		// Threads compressing bands of rows, 0 for one per hardware thread. Each band is its own
+		// DEFLATE stream, so more bands cost a little ratio and the output differs with the
+		// band size but never with the thread count.
+		uint32_t threads = 0;
+	};
+
+	std::expected<Image, std::string> loadImage(const std::filesystem::path& imagePath, uint16_t requiredChannels = 0, const LoadOptions& options = {});
+	// decodes an image that is already in memory, e.g. inside a mapped asset archive
+	std::expected<Image, std::string> loadImageFromMemory(std::span<const uint8_t> data, uint16_t requiredChannels = 0, const LoadOptions& options = {});
+	// maps the file instead of reading it, so decoding runs directly on page-cache memory
+	std::expected<Image, std::string> loadImageMapped(const std::filesystem::path& imagePath, uint16_t requiredChannels = 0, const LoadOptions& options = {});
+	// Reads only the header chunks (JPEG: the segments up to the frame header), never the
+	// pixel data; from a path that is the first few kilobytes of the file. The result describes
+	// what loadImage would return with the same requiredChannels.
+	std::expected<ImageInfo, std::string> probeImage(std::span<const uint8_t> data, uint16_t requiredChannels = 0);
+	std::expected<ImageInfo, std::string> probeImage(const std::filesystem::path& imagePath, uint16_t requiredChannels = 0);
+	// Rectangle of an image in pixels. The default width takes every column from x to the right edge.
+	struct ImageRegion {
+		uint32_t y = 0;
+		uint32_t height = 0;
+		uint32_t x = 0;
+		uint32_t width = UINT32_MAX;
+	};
+
+	// Decodes only region of the image; the result is region.width x region.height. Inflating
+	// stops at the region's last row and columns outside it are not converted, so a band near the
+	// top of a large file costs a fraction of a full load. Interlaced images spread every row
+	// over the whole file and are decoded whole. Sequential JPEG scans stop after the region's
+	// last block row; progressive ones run to the end but transform only the region's rows.
+	// The Adler-32 of IntegrityCheck is checked only for interlaced images, since it trails data
+	// the decode of any other never reaches; chunk CRCs are.
+	std::expected<Image, std::string> loadImageRegion(std::span<const uint8_t> data, const ImageRegion& region, uint16_t requiredChannels = 0, const LoadOptions& options = {});
+	std::expected<Image, std::string> loadImageRegion(const std::filesystem::path& imagePath, const ImageRegion& region, uint16_t requiredChannels = 0, const LoadOptions& options = {});
+	// Decodes straight into caller memory such as a mapped staging buffer, row y at
+	// dst + y * rowPitch. channels selects the output format like requiredChannels does.
+	// The contents of dst are unspecified if decoding fails.
+	std::expected<ImageInfo, std::string> loadImageInto(std::span<const uint8_t> data, std::span<uint8_t> dst, size_t rowPitch, uint16_t channels, const LoadOptions& options = {});
+	std::expected<ImageInfo, std::string> loadImageInto(const std::filesystem::path& imagePath, std::span<uint8_t> dst, size_t rowPitch, uint16_t channels, const LoadOptions& options = {});
+	// Writes image as an 8-bit PNG: gray, gray-alpha, RGB or RGBA after its channels. Only
+	// pixel images are saved; of a mip chain only level 0 is. Each row gets the filter with the
+	// smallest sum of absolute differences, and bands of rows are compressed on
+	// SaveOptions::threads threads into one IDAT sequence.
+	std::expected<void, std::string> saveImage(const std::filesystem::path& imagePath, const Image& image, const SaveOptions& options = {});
+	std::expected<std::vector<uint8_t>, std::string> saveImageToMemory(const Image& image, const SaveOptions& options = {});
+	// Decodes a batch of files in parallel on workerCount threads (0 uses one per hardware thread).
+	// Results are in the order of imagePaths; a failed image does not affect the others.
+	std::vector<std::expected<Image, std::string>> loadImages(std::span<const std::filesystem::path> imagePaths, uint16_t requiredChannels = 0, uint32_t workerCount = 0, const LoadOptions& options = {});
+
+	// Loads images one after another with the same scratch memory, for worker threads that
+	// decode thousands of images. load maps the file, and every temporary buffer of a decode
+	// comes from an arena owned by the decoder, which is reset after each load instead of freed;
+	// once it has grown to the largest load seen, a load allocates nothing but the returned Image.
+	// The threads of pipelined and speculative decodes are still started per load. A decoder
+	// must not be used by two threads at once, and it replaces LoadOptions::scratchMemory.
+	class Decoder {
+	public:
+		// Between loads the arena keeps at most maxRetainedBytes. A load that needs more takes
+		// the rest from the heap and gives it back when it ends.
+		explicit Decoder(size_t maxRetainedBytes = SIZE_MAX);
+		Decoder(Decoder&& other) noexcept;
+		Decoder& operator=(Decoder&& other) noexcept;
+		~Decoder();
+
+		std::expected<Image, std::string> load(const std::filesystem::path& imagePath, uint16_t requiredChannels = 0, const LoadOptions& options = {});
+		std::expected<Image, std::string> loadFromMemory(std::span<const uint8_t> data, uint16_t requiredChannels = 0, const LoadOptions& options = {});
+		// like loadImageInto
+		std::expected<ImageInfo, std::string> loadInto(std::span<const uint8_t> data, std::span<uint8_t> dst, size_t rowPitch, uint16_t channels, const LoadOptions& options = {});
+
+		// bytes the arena holds between loads
+		size_t arenaBytes() const;
+		// frees the arena down to at most bytes; the next loads grow it again as they need
+		void shrink(size_t bytes = 0);
+		// lowers or raises the cap given to the constructor, shrinking the arena if it is above it
+		void setMaxRetainedBytes(size_t bytes);
+
+	private:
+		std::unique_ptr<DecoderState> state;
+	};
+
+	// Decodes a PNG one row at a time, so only the DEFLATE window and two scanlines are held
+	// in memory instead of the whole decompressed image. data must outlive the decoder.
+	class RowDecoder {
+	public:
+		RowDecoder(RowDecoder&& other) noexcept;
+		RowDecoder& operator=(RowDecoder&& other) noexcept;
+		~RowDecoder();
+
+		static std::expected<RowDecoder, std::string> open(std::span<const uint8_t> data, uint16_t requiredChannels = 0);
+
+		uint32_t width() const;
+		uint32_t height() const;
+		uint16_t channels() const;
+		// Writes the next row, width() * channels() bytes, into row.
+		// Returns false once every row has been read.
+		std::expected<bool, std::string> readRow(std::span<uint8_t> row);
+
+	private:
+		explicit RowDecoder(std::unique_ptr<PngRowStream> stream);
+
+		std::unique_ptr<PngRowStream> stream;
+	};
+
+	// Runs the work of asynchronous loads, e.g. on an engine's job system. Tasks must each run
+	// exactly once; they do not have to run in submission order.
+	class Executor {
+	public:
+		virtual ~Executor() = default;
+		virtual void execute(std::move_only_function<void()> task) = 0;
+	};
+
+	struct AsyncOptions {
+		// among loads waiting for the same executor, higher priorities start first
+		int priority = 0;
+		// null runs the load on a pool owned by the library
+		Executor* executor = nullptr;
+	};
+
+	// Refers to one asynchronous load; copies refer to the same load.
+	class LoadHandle {
+	public:
+		LoadHandle() = default;
+		explicit LoadHandle(std::shared_ptr<AsyncLoadState> state);
+
+		bool valid() const { return state != nullptr; }
+		bool done() const;
+		void wait() const;
+		// returns true if the load finished within timeout
+		bool waitFor(std::chrono::milliseconds timeout) const;
+		// A load that has not started finishes right away with cancelledError; a running one
+		// stops at its next inflate step or scanline block.
+		void cancel();
+		// only affects a load that has not started yet
+		void setPriority(int priority);
+
+	protected:
+		std::shared_ptr<AsyncLoadState> state;
+	};
+
+	class ImageFuture : public LoadHandle {
+	public:
+		using LoadHandle::LoadHandle;
+
+		// waits for the load and hands over its result; call at most once
+		std::expected<Image, std::string> get();
+	};
+
+	using LoadCallback = std::move_only_function<void(std::expected<Image, std::string>)>;
+
+	ImageFuture loadImageAsync(const std::filesystem::path& imagePath, uint16_t requiredChannels = 0, const LoadOptions& options = {}, const AsyncOptions& asyncOptions = {});
+	// callback receives the result on an executor thread, or on the thread calling cancel()
+	// if the load had not started
+	LoadHandle loadImageAsync(const std::filesystem::path& imagePath, LoadCallback callback, uint16_t requiredChannels = 0, const LoadOptions& options = {}, const AsyncOptions& asyncOptions = {});
+
+	// Decoded pixels from an ImageCache, read straight from a mapping of the cache entry. If the
+	// entry could not be written they are held in memory instead.
+	class CachedImage {
+	public:
+		CachedImage(CachedImage&& other) noexcept;
+		CachedImage& operator=(CachedImage&& other) noexcept;
+		~CachedImage();
+
+		uint32_t width() const { return imageWidth; }
+		uint32_t height() const { return imageHeight; }
+		uint16_t channels() const { return imageChannels; }
+		std::span<const uint8_t> data() const { return pixels; }
+
+	private:
+		friend struct ImageCacheState;
+		CachedImage();
+
+		std::unique_ptr<MappedFile> mapping;
+		std::vector<uint8_t> ownedPixels;
+		std::span<const uint8_t> pixels;
+		uint32_t imageWidth = 0;
+		uint32_t imageHeight = 0;
+		uint16_t imageChannels = 0;
+	};
+
+	// On-disk cache of decoded images, keyed by a hash of the source file's bytes and
+	// requiredChannels, so an edited file misses and a moved one still hits. Entries are written
+	// to a temporary file and renamed into place, so other processes sharing the directory never
+	// see a partial entry. Once the directory grows past maxBytes the least recently used entries
+	// are deleted. Safe to use from several threads.
+	class ImageCache {
+	public:
+		ImageCache(ImageCache&& other) noexcept;
+		ImageCache& operator=(ImageCache&& other) noexcept;
+		~ImageCache();
+
+		// creates directory if it does not exist
+		static std::expected<ImageCache, std::string> open(const std::filesystem::path& directory, uint64_t maxBytes);
+
+		// returns the cached pixels, or decodes the file and stores them
+		std::expected<CachedImage, std::string> load(const std::filesystem::path& imagePath, uint16_t requiredChannels = 0, const LoadOptions& options = {});
+		// deletes least recently used entries until the cache fits in maxBytes
+		void trim();
+
+	private:
+		explicit ImageCache(std::unique_ptr<ImageCacheState> state);
+
+		std::unique_ptr<ImageCacheState> state;
 	};
-	std::expected<Image, std::string> loadImage(const std::filesystem::path& imagePath, uint16_t requiredChannels = 0);
 }
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include "AxImageLoader.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <optional>
+
+namespace AxImageLoader {
+	// passes a stop requested on the caller's token on to the load's own stop source
+	struct StopForwarder {
+		std::stop_source source;
+		void operator()() const { source.request_stop(); }
+	};
+
+	class AsyncLoadState {
+	public:
+		std::filesystem::path imagePath;
+		uint16_t requiredChannels = 0;
+		LoadOptions options;
+		Executor* executor = nullptr;
+		std::atomic<int> priority = 0;
+		uint64_t sequence = 0;
+		std::stop_source stopSource;
+		std::optional<std::stop_callback<StopForwarder>> callerStop;
+		LoadCallback callback;
+
+		std::mutex mutex;
+		std::condition_variable finished;
+		bool done = false;
+		std::optional<std::expected<Image, std::string>> result;
+
+		void complete(std::expected<Image, std::string> loaded) {
+			if (callback) {
+				callback(std::move(loaded));
+			}
+			{
+				std::lock_guard lock(mutex);
+				if (!callback) {
+					result = std::move(loaded);
+				}
+				done = true;
+			}
+			finished.notify_all();
+		}
+	};
+
+	// Loads wait here, per executor, until a task on that executor picks the most urgent one.
+	// Every submitted load hands its executor one task, so no load is left behind; picking at
+	// run time is what lets priority changes reorder loads that are already queued.
+	class AsyncScheduler {
+	public:
+		void submit(std::shared_ptr<AsyncLoadState> load) {
+			Executor* executor = load->executor ? load->executor : &defaultExecutor;
+			{
+				std::lock_guard lock(mutex);
+				load->sequence = nextSequence++;
+				pending[executor].push_back(std::move(load));
+			}
+			executor->execute([this, executor] { runNext(executor); });
+		}
+
+		// returns false if the load already started
+		bool remove(const std::shared_ptr<AsyncLoadState>& load) {
+			Executor* executor = load->executor ? load->executor : &defaultExecutor;
+			std::lock_guard lock(mutex);
+			auto& loads = pending[executor];
+			auto it = std::find(loads.begin(), loads.end(), load);
+			if (it == loads.end()) {
+				return false;
+			}
+			loads.erase(it);
+			return true;
+		}
+
+	private:
+		class PoolExecutor : public Executor {
+		public:
+			void execute(std::move_only_function<void()> task) override { pool.submit(std::move(task)); }
+
+		private:
+			ThreadPool pool;
+		};
+
+		void runNext(Executor* executor) {
+			std::shared_ptr<AsyncLoadState> load;
+			{
+				std::lock_guard lock(mutex);
+				auto& loads = pending[executor];
+				if (loads.empty()) {
+					// this task's load was cancelled before it started
+					return;
+				}
+				auto next = std::max_element(loads.begin(), loads.end(), [](const auto& a, const auto& b) {
+					int priorityA = a->priority.load(std::memory_order_relaxed);
+					int priorityB = b->priority.load(std::memory_order_relaxed);
+					return priorityA < priorityB || (priorityA == priorityB && a->sequence > b->sequence);
+				});
+				load = std::move(*next);
+				loads.erase(next);
+			}
+
+			load->complete(loadImageMapped(load->imagePath, load->requiredChannels, load->options));
+		}
+
+		std::mutex mutex;
+		std::map<Executor*, std::vector<std::shared_ptr<AsyncLoadState>>> pending;
+		uint64_t nextSequence = 0;
+		// declared last so its workers finish before the queues above are destroyed
+		PoolExecutor defaultExecutor;
+	};
+
+	static AsyncScheduler& scheduler() {
+		static AsyncScheduler instance;
+		return instance;
+	}
+
+	static std::shared_ptr<AsyncLoadState> startLoad(const std::filesystem::path& imagePath, LoadCallback callback, uint16_t requiredChannels, const LoadOptions& options, const AsyncOptions& asyncOptions) {
+		auto load = std::make_shared<AsyncLoadState>();
+		load->imagePath = imagePath;
+		load->requiredChannels = requiredChannels;
+		load->options = options;
+		load->options.stopToken = load->stopSource.get_token();
+		if (options.stopToken.stop_possible()) {
+			load->callerStop.emplace(options.stopToken, StopForwarder{ load->stopSource });
+		}
+		load->executor = asyncOptions.executor;
+		load->priority = asyncOptions.priority;
+		load->callback = std::move(callback);
+		scheduler().submit(load);
+		return load;
+	}
+
+	LoadHandle::LoadHandle(std::shared_ptr<AsyncLoadState> state) : state(std::move(state)) {}
+
+	bool LoadHandle::done() const {
+		std::lock_guard lock(state->mutex);
+		return state->done;
+	}
+
+	void LoadHandle::wait() const {
+		std::unique_lock lock(state->mutex);
+		state->finished.wait(lock, [this] { return state->done; });
+	}
+
+	bool LoadHandle::waitFor(std::chrono::milliseconds timeout) const {
+		std::unique_lock lock(state->mutex);
+		return state->finished.wait_for(lock, timeout, [this] { return state->done; });
+	}
+
+	void LoadHandle::cancel() {
+		state->stopSource.request_stop();
+		if (scheduler().remove(state)) {
+			state->complete(std::unexpected(std::string(cancelledError)));
+		}
+	}
+
+	void LoadHandle::setPriority(int priority) {
+		state->priority.store(priority, std::memory_order_relaxed);
+	}
+
+	std::expected<Image, std::string> ImageFuture::get() {
+		wait();
+		std::lock_guard lock(state->mutex);
+		return std::move(*state->result);
+	}
+
+	ImageFuture loadImageAsync(const std::filesystem::path& imagePath, uint16_t requiredChannels, const LoadOptions& options, const AsyncOptions& asyncOptions) {
+		return ImageFuture(startLoad(imagePath, nullptr, requiredChannels, options, asyncOptions));
+	}
+
+	LoadHandle loadImageAsync(const std::filesystem::path& imagePath, LoadCallback callback, uint16_t requiredChannels, const LoadOptions& options, const AsyncOptions& asyncOptions) {
+		return LoadHandle(startLoad(imagePath, std::move(callback), requiredChannels, options, asyncOptions));
+	}
+}
@@ -1,39 +1,40 @@
 #include "AxImageLoader.h"
 #include "BitReader.h"
-#include "HuffmanTree.h"
+#include "BlockCompress.h"
+#include "Checksum.h"
+#include "Inflater.h"
+#include "JpegDecoder.h"
+#include "MappedFile.h"
+#include "MipChain.h"
+#include "PixelConvert.h"
+#include "PngEncoder.h"
+#include "ScratchArena.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+#include "Unfilter.h"
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
 #include <fstream>
 #include <iostream>
-#include <numeric>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <semaphore>
+#include <span>
+#include <string_view>
 
 namespace AxImageLoader {
-	// these are deflate spec constants
-	const std::array<int, 29> lengthExtraBits = {
-	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3,
-	3, 4, 4, 4, 4, 5, 5, 5, 5, 0
-	};
-	const std::array<int, 29> lengthBase = {
-		3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43,
-		51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
-	};
-	const std::array<int, 30> distanceExtraBits = {
-		0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
-		8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
-	};
-	const std::array<int, 30> distanceBase = {
-		1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257,
-		385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385,
-		24577
-	};
-	const std::array<int, 19> codeLengthOrder = {
-		16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
-	};
-
 	// PNG related structures and functions
+	// name and data point into the file buffer, which must outlive the chunk
 	struct PngChunk {
 		uint32_t lenght;
-		std::string name;
-		std::vector<uint8_t> data;
+		std::string_view name;
+		std::span<const uint8_t> data;
 		uint32_t crc;
 
 		friend std::ostream& operator<<(std::ostream& os, const PngChunk& chunk) {
@@ -42,8 +43,8 @@ namespace AxImageLoader {
 		}
 	};
 	struct PngPalette {
-		std::vector<uint8_t> rgb;
-		std::vector<uint8_t> a;
+		std::span<const uint8_t> rgb;
+		std::span<const uint8_t> a;
 	};
 
 	enum class ImageFormat {
@@ -53,159 +54,20 @@ namespace AxImageLoader {
 	};
 
 #pragma region PngFunctions
-	static bool isPng(const std::vector<uint8_t>& data) {
+	static bool isPng(std::span<const uint8_t> data) {
 		static const std::array<uint8_t, 8> pngSignature = { 137, 80, 78, 71, 13, 10, 26, 10 };
 		return data.size() >= pngSignature.size() && std::equal(pngSignature.begin(), pngSignature.end(), data.begin());
 	}
 
-	static ImageFormat detectFormat(const std::vector<uint8_t>& fileData) {
+	static ImageFormat detectFormat(std::span<const uint8_t> fileData) {
 		if (isPng(fileData)) {
 			return ImageFormat::PNG;
 		}
-
-		return ImageFormat::UNKNOWN;
-	}
-
-	static void inflateBlockData(BitReader& bitReader, const HuffmanTree& litLengthTree, const HuffmanTree& distTree, std::vector<uint8_t>& output) {
-		while (true) {
-			int symbol = litLengthTree.decode(bitReader);
-			if (symbol <= 255) {
-				output.push_back(static_cast<uint8_t>(symbol));
-			}
-			else if (symbol == 256) {
-				break;
-			}
-			else {
-				symbol -= 257;
-				int length = bitReader.readBits(lengthExtraBits[symbol]) + lengthBase[symbol];
-				int distSymbol = distTree.decode(bitReader);
-				int distance = bitReader.readBits(distanceExtraBits[distSymbol]) + distanceBase[distSymbol];
-
-				if (distance > output.size()) {
-					throw std::runtime_error("Invalid distance in DEFLATE data");
-				}
-
-				for (int i = 0; i < length; i++) {
-					uint8_t byte = output[output.size() - distance];
-					output.push_back(byte);
-				}
-			}
-		}
-	}
-
-	static void inflateBlockNoCompression(BitReader& bitReader, std::vector<uint8_t>& output) {
-		uint16_t len = bitReader.readBytes(2);
-		uint16_t nlne = bitReader.readBytes(2);
-		for (int i = 0; i < len; i++) {
-			uint8_t byte = bitReader.readByte();
-			output.push_back(byte);
-		}
-	}
-
-	static HuffmanTree blListToHuffmanTree(const std::vector<int>& bitLength, const std::vector<int>& alphabet) {
-		int maxBits = *std::max_element(bitLength.begin(), bitLength.end());
-
-		std::vector<int> blCount(maxBits + 1, 0);
-		for (int bits : bitLength) {
-			if (bits != 0) {
-				blCount[bits]++;
-			}
-		}
-
-		std::vector<int> nextCode(maxBits + 1, 0);
-		for (int bits = 2; bits <= maxBits; bits++) {
-			nextCode[bits] = (nextCode[bits - 1] + blCount[bits - 1]) << 1;
-		}
-
-		HuffmanTree tree;
-		size_t iterationSize = std::min(bitLength.size(), alphabet.size());
-		for (size_t n = 0; n < iterationSize; n++) {
-			int bits = bitLength[n];
-			if (bits != 0) {
-				int codeword = nextCode[bits];
-				tree.insert(codeword, bits, alphabet[n]);
-				nextCode[bits]++;
-			}
-		}
-		return tree;
-	}
-
-	static void inflateBlockFixed(BitReader& bitReader, std::vector<uint8_t>& output) {
-		std::vector<int> literalLengthBl(288);
-		std::fill(literalLengthBl.begin(), literalLengthBl.begin() + 144, 8);
-		std::fill(literalLengthBl.begin() + 144, literalLengthBl.begin() + 256, 9);
-		std::fill(literalLengthBl.begin() + 256, literalLengthBl.begin() + 280, 7);
-		std::fill(literalLengthBl.begin() + 280, literalLengthBl.end(), 8);
-
-		std::vector<int> literalLengthAlphabet(286);
-		std::iota(literalLengthAlphabet.begin(), literalLengthAlphabet.end(), 0);
-		HuffmanTree literalLengthTree = blListToHuffmanTree(literalLengthBl, literalLengthAlphabet);
-		std::vector<int> distanceBl(30, 5);
-		std::vector<int> distanceAlphabet(30);
-		std::iota(distanceAlphabet.begin(), distanceAlphabet.end(), 0);
-		HuffmanTree distanceTree = blListToHuffmanTree(distanceBl, distanceAlphabet);
-		inflateBlockData(bitReader, literalLengthTree, distanceTree, output);
-	}
-
-	static std::pair<HuffmanTree, HuffmanTree> decodeTrees(BitReader& bitReader) {
-		int hlit = bitReader.readBits(5) + 257;
-		int hdist = bitReader.readBits(5) + 1;
-		int hclen = bitReader.readBits(4) + 4;
-
-		std::vector<int> codeLengthTreeBl(19, 0);
-		for (int i = 0; i < hclen; i++) {
-			codeLengthTreeBl[codeLengthOrder[i]] = bitReader.readBits(3);
-		}
-
-		std::vector<int> codeLengthTreeAlphabet(19);
-		std::iota(codeLengthTreeAlphabet.begin(), codeLengthTreeAlphabet.end(), 0);
-		HuffmanTree codeLengthTree = blListToHuffmanTree(codeLengthTreeBl, codeLengthTreeAlphabet);
-
-		std::vector<int> bl;
-		bl.reserve(hlit + hdist);
-		while (bl.size() < hlit + hdist) {
-			int symbol = codeLengthTree.decode(bitReader);
-			if (0 <= symbol && symbol <= 15) {
-				bl.push_back(symbol);
-			}
-			else if (symbol == 16) {
-				if (bl.empty()) {
-					throw std::runtime_error("Invalid repeat code in code length alphabet");
-				}
-				int prevCodeLength = bl.back();
-				int repeatCount = bitReader.readBits(2) + 3;
-				bl.insert(bl.end(), repeatCount, prevCodeLength);
-			}
-			else if (symbol == 17) {
-				int repeatCount = bitReader.readBits(3) + 3;
-				bl.insert(bl.end(), repeatCount, 0);
-			}
-			else if (symbol == 18) {
-				int repeatCount = bitReader.readBits(7) + 11;
-				bl.insert(bl.end(), repeatCount, 0);
-			}
-			else {
-				throw std::runtime_error("Invalid symbol in code length alphabet");
-			}
+		if (isJpeg(fileData)) {
+			return ImageFormat::JPEG;
 		}
 
-		std::vector<int> literalLengthBl(bl.begin(), bl.begin() + hlit);
-		std::vector<int> distanceBl(bl.begin() + hlit, bl.end());
-
-		std::vector<int> literalLengthAlphabet(286);
-		std::iota(literalLengthAlphabet.begin(), literalLengthAlphabet.end(), 0);
-		HuffmanTree literalLengthTree = blListToHuffmanTree(literalLengthBl, literalLengthAlphabet);
-
-		std::vector<int> distanceAlphabet(30);
-		std::iota(distanceAlphabet.begin(), distanceAlphabet.end(), 0);
-		HuffmanTree distanceTree = blListToHuffmanTree(distanceBl, distanceAlphabet);
-
-		return { std::move(literalLengthTree), std::move(distanceTree) };
-	}
-
-	static void inflateBlockDynamic(BitReader& bitReader, std::vector<uint8_t>& output) {
-		auto trees = decodeTrees(bitReader);
-		inflateBlockData(bitReader, trees.first, trees.second, output);
+		return ImageFormat::UNKNOWN;
 	}
 
 	static uint8_t getSamplesPerPixel(uint8_t colorType) {
@@ -238,117 +100,7 @@ namespace AxImageLoader {
 		}
 	}
 
-	static uint8_t paethFilter(uint8_t a, uint8_t b, uint8_t c) {
-		int p = static_cast<int>(a) + static_cast<int>(b) - static_cast<int>(c);
-		int pa = std::abs(p - static_cast<int>(a));
-		int pb = std::abs(p - static_cast<int>(b));
-		int pc = std::abs(p - static_cast<int>(c));
-		if (pa <= pb && pa <= pc) return a;
-		else if (pb <= pc) return b;
-		else return c;
-	}
-
-	static void unfilterScanline(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes, uint32_t bpp, uint8_t filter) {
-		switch (filter) {
-		case 0: // None
-			break;
-		case 1: // Sub
-			for (uint32_t i = bpp; i < rowBytes; i++) {
-				scanline[i] = static_cast<uint8_t>(scanline[i] + scanline[i - bpp]);
-			}
-			break;
-		case 2: // Up
-			for (uint32_t i = 0; i < rowBytes; i++) {
-				scanline[i] = static_cast<uint8_t>(scanline[i] + prev[i]);
-			}
-			break;
-		case 3: // Average
-			if (prev) {
-				for (uint32_t i = 0; i < bpp; i++) {
-					scanline[i] = static_cast<uint8_t>(scanline[i] + (prev[i] >> 1));
-				}
-				for (uint32_t i = bpp; i < rowBytes; i++) {
-					scanline[i] = static_cast<uint8_t>(scanline[i] + ((scanline[i - bpp] + prev[i]) >> 1));
-				}
-			}
-			else {
-				for (uint32_t i = bpp; i < rowBytes; i++) {
-					scanline[i] = static_cast<uint8_t>(scanline[i] + (scanline[i - bpp] >> 1));
-				}
-			}
-			break;
-		case 4: // Paeth
-			if (prev) {
-				for (uint32_t i = 0; i < bpp; i++) {
-					scanline[i] = static_cast<uint8_t>(scanline[i] + paethFilter(0, prev[i], 0));
-				}
-				for (uint32_t i = bpp; i < rowBytes; i++) {
-					scanline[i] = static_cast<uint8_t>(scanline[i] + paethFilter(scanline[i - bpp], prev[i], prev[i - bpp]));
-				}
-			}
-			else {
-				for (uint32_t i = bpp; i < rowBytes; i++) {
-					scanline[i] = static_cast<uint8_t>(scanline[i] + paethFilter(scanline[i - bpp], 0, 0));
-				}
-			}
-			break;
-		default:
-			throw std::runtime_error("Invalid PNG filter type: " + std::to_string(filter));
-			break;
-		}
-	}
-
-	static std::vector<uint32_t> unpackSamples(const std::vector<uint8_t>& imageData, uint32_t width, uint8_t samplesPerPixel, uint8_t bitsPerSample) {
-		std::vector<uint32_t> samples(width * samplesPerPixel);
-		BitReader bitReader(imageData, true);
-		uint16_t bytesPerSample = std::max(1, (bitsPerSample + 7) / 8);
-		for (uint32_t i = 0; i < width; i++) {
-			for (uint8_t s = 0; s < samplesPerPixel; s++) {
-				uint32_t index = i * samplesPerPixel + s;
-				for (uint16_t b = 0; b < bytesPerSample; b++) {
-					samples[index] = bitReader.readBits(bitsPerSample);
-				}
-			}
-		}
-		return samples;
-	}
-
-	static uint8_t sampleToRGBA8(uint32_t sample, uint8_t bitDepth) {
-		if (bitDepth == 8) {
-			return static_cast<uint8_t>(sample);
-		}
-		if (bitDepth == 16) {
-			return static_cast<uint8_t>(sample >> 8);
-		}
-		const uint32_t maxSample = (1 << bitDepth) - 1;
-		return static_cast<uint8_t>((sample * 255 + maxSample / 2) / maxSample);
-	}
-
-	static std::vector<uint8_t> inflate(BitReader& bitReader) {
-		int bfinal = 0;
-		std::vector<uint8_t> output;
-		while (!bfinal) {
-			bfinal = bitReader.readBit();
-			int btype = bitReader.readBits(2);
-			if (btype == 0) {
-				inflateBlockNoCompression(bitReader, output);
-			}
-			else if (btype == 1) {
-				inflateBlockFixed(bitReader, output);
-			}
-			else if (btype == 2) {
-				inflateBlockDynamic(bitReader, output);
-			}
-			else {
-				std::cout << "BTYPE: " << btype << std::endl;
-				throw std::runtime_error("Invalid BTYPE in DEFLATE data");
-			}
-		}
-		return output;
-	}
-
-	static std::vector<uint8_t> decompress(const std::vector<uint8_t>& compressedData) {
-		BitReader r(compressedData);
+	static void readZlibHeader(BitReader& r) {
 		uint8_t CMF = r.readByte();
 		int CM = CMF & 15;
 		if (CM != 8) {
@@ -367,219 +119,1559 @@ namespace AxImageLoader {
 		if (FDICT) {
 			throw std::runtime_error("Preset dictionary not supported");
 		}
+	}
+
+	// the Adler-32 of the uncompressed data, stored big-endian after the last block
+	static uint32_t readZlibTrailer(BitReader& r) {
+		r.alignToByte();
+		return std::byteswap(r.readBytes(4));
+	}
+
+	static std::pmr::memory_resource* scratchResource(const LoadOptions& options) {
+		return options.scratchMemory ? options.scratchMemory : std::pmr::get_default_resource();
+	}
+
+	static void throwIfCancelled(const LoadOptions& options) {
+		if (options.stopToken.stop_requested()) {
+			throw std::runtime_error(std::string(cancelledError));
+		}
+	}
+
+	// output inflated between two cancellation checks
+	static constexpr size_t inflateStepBytes = 1 << 20;
+
+	// Tries inflateParallel on the whole zlib stream, which needs it in one piece, so a stream
+	// spread over several IDAT chunks is copied first. Returns false, leaving out and storedAdler
+	// untouched, whenever the serial inflate has to do the work.
+	static bool decompressSpeculative(std::span<const std::span<const uint8_t>> compressedData, std::pmr::vector<uint8_t>& out, uint32_t& storedAdler, const LoadOptions& options) {
+		uint32_t threadCount = options.pipelineThreads;
+		if (threadCount == 0) {
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+		// one thread never splits the stream, so the copy would be wasted
+		if (threadCount < 2) {
+			return false;
+		}
+		std::pmr::vector<uint8_t> joined(scratchResource(options));
+		std::span<const uint8_t> data;
+		if (compressedData.size() == 1) {
+			data = compressedData.front();
+		}
+		else {
+			size_t totalBytes = 0;
+			for (std::span<const uint8_t> segment : compressedData) {
+				totalBytes += segment.size();
+			}
+			joined.reserve(totalBytes);
+			for (std::span<const uint8_t> segment : compressedData) {
+				joined.insert(joined.end(), segment.begin(), segment.end());
+			}
+			data = joined;
+		}
+		if (data.size() < 2) {
+			return false;
+		}
+
+		std::pmr::vector<uint8_t> speculative(scratchResource(options));
+		std::optional<size_t> used = inflateParallel(data.subspan(2), speculative, threadCount, options.stopToken);
+		if (!used || 2 + *used + 4 > data.size()) {
+			return false;
+		}
+		storedAdler = BitReader::combineBytes(data[2 + *used], data[3 + *used], data[4 + *used], data[5 + *used]);
+		out = std::move(speculative);
+		return true;
+	}
+
+	static std::pmr::vector<uint8_t> decompress(std::span<const std::span<const uint8_t>> compressedData, size_t expectedSize, uint32_t& storedAdler, const LoadOptions& options) {
+		DecodeStats* stats = decodeStats(options);
+		StageTimer timer(stats, &DecodeStats::inflateNanoseconds);
+		BitReader r(compressedData);
+		readZlibHeader(r);
 
-		std::vector<uint8_t> out = inflate(r);
+		std::pmr::vector<uint8_t> out(scratchResource(options));
+		if (options.speculativeInflate && decompressSpeculative(compressedData, out, storedAdler, options)) {
+			if (stats) {
+				stats->inflatedBytes += out.size();
+			}
+			return out;
+		}
+		throwIfCancelled(options);
 
-		// Adler-32 checksum (ignored)
-		uint32_t ADLER32 = r.readBytes(4);
+		out.resize(expectedSize);
+		Inflater inflater(r, out);
+		inflater.setStats(stats);
+		while (!inflater.finished()) {
+			throwIfCancelled(options);
+			inflater.inflateTo(inflater.outputSize() + inflateStepBytes);
+		}
+		out.resize(inflater.outputSize());
+		if (stats) {
+			stats->inflatedBytes += out.size();
+		}
 
+		storedAdler = readZlibTrailer(r);
 		return out;
 	}
 
-	static std::vector<PngChunk> readChunks(const std::vector<uint8_t>& pngData) {
-		std::vector<PngChunk> chunks;
+	static void checkAdler(uint32_t computed, uint32_t stored) {
+		if (computed != stored) {
+			throw std::runtime_error("Adler-32 mismatch in PNG image data");
+		}
+	}
+
+	// ancillary chunks have bit 5 of the first name byte set (a lowercase letter)
+	static bool isUsedChunk(std::string_view name) {
+		bool isCritical = (name[0] & 0x20) == 0;
+		return isCritical || name == "tRNS";
+	}
+
+	// with verifyCrc, checks the CRC of every chunk that is kept
+	static std::pmr::vector<PngChunk> readChunks(std::span<const uint8_t> pngData, bool verifyCrc, std::pmr::memory_resource* scratch) {
+		std::pmr::vector<PngChunk> chunks(scratch);
 		size_t offset = 8; // skip PNG signature
 
 		while (offset + 8 <= pngData.size()) {
 			PngChunk chunk;
 			chunk.lenght = BitReader::combineBytes(pngData[offset], pngData[offset + 1], pngData[offset + 2], pngData[offset + 3]);
-			chunk.name = std::string(reinterpret_cast<const char*>(&pngData[offset + 4]), 4);
+			chunk.name = std::string_view(reinterpret_cast<const char*>(&pngData[offset + 4]), 4);
 
 			offset += 8;
 			if (offset + chunk.lenght + 4 > pngData.size()) {
 				throw std::runtime_error("Invalid PNG chunk length");
 			}
 
-			chunk.data = std::vector<uint8_t>(pngData.begin() + offset, pngData.begin() + offset + chunk.lenght);
+			chunk.data = std::span<const uint8_t>(pngData.data() + offset, chunk.lenght);
 			offset += chunk.lenght;
 			chunk.crc = BitReader::combineBytes(pngData[offset], pngData[offset + 1], pngData[offset + 2], pngData[offset + 3]);
 			offset += 4;
+			if (!isUsedChunk(chunk.name)) {
+				continue;
+			}
+			// the CRC covers the name and the data
+			if (verifyCrc && crc32(0, std::span<const uint8_t>(chunk.data.data() - 4, chunk.lenght + 4)) != chunk.crc) {
+				throw std::runtime_error("CRC mismatch in PNG chunk " + std::string(chunk.name));
+			}
 			chunks.push_back(chunk);
+			if (chunk.name == "IEND") {
+				break;
+			}
 		}
 		return chunks;
 	}
 
-	static std::vector<uint8_t> loadPNG(std::vector<uint8_t>& fileData, uint32_t& outWidth, uint32_t& outHeight, uint16_t& outChannels, uint16_t requiredChannels) {
-		auto pngChunks = readChunks(fileData);
+	struct PngHeader {
 		uint32_t width = 0;
 		uint32_t height = 0;
 		uint8_t bitDepth = 0;
 		uint8_t colorType = 0;
-		std::vector<uint8_t> compressedImageData;
-		std::vector<uint8_t> plteData;
-		std::vector<uint8_t> trnsData;
+		uint8_t interlaceMethod = 0;
+	};
+
+	// what decoding needs from the chunk list; the spans point into the file buffer
+	struct PngImage {
+		PngHeader header = {};
+		PngPalette palette = {};
+		PaletteTable paletteTable = {};
+		std::pmr::vector<std::span<const uint8_t>> compressedImageData;
+	};
+
+	// scanline geometry and output format of one decode
+	struct PngLayout {
+		uint8_t samplesPerPixel;
+		uint8_t bitsPerSample;
+		uint32_t bytesPerRow;
+		uint32_t bytesPerPixel;
+		uint16_t outChannels;
+		RowConverter convertRow;
+	};
+
+	static PngHeader parseHeader(std::span<const uint8_t> data) {
+		if (data.size() < 13) {
+			throw std::runtime_error("Invalid PNG IHDR chunk");
+		}
+		PngHeader header;
+		header.width = BitReader::combineBytes(data[0], data[1], data[2], data[3]);
+		header.height = BitReader::combineBytes(data[4], data[5], data[6], data[7]);
+		header.bitDepth = data[8];
+		header.colorType = data[9];
+		header.interlaceMethod = data[12];
+		return header;
+	}
+
+	static PngImage parsePng(std::span<const uint8_t> fileData, IntegrityCheck integrityCheck, std::pmr::memory_resource* scratch, DecodeStats* stats) {
+		StageTimer timer(stats, &DecodeStats::chunkNanoseconds);
+		auto pngChunks = readChunks(fileData, integrityCheck == IntegrityCheck::Full, scratch);
+		PngImage png = { .compressedImageData = std::pmr::vector<std::span<const uint8_t>>(scratch) };
 		for (const auto& chunk : pngChunks) {
 			if (chunk.name == "IHDR") {
-				width = BitReader::combineBytes(chunk.data[0], chunk.data[1], chunk.data[2], chunk.data[3]);
-				height = BitReader::combineBytes(chunk.data[4], chunk.data[5], chunk.data[6], chunk.data[7]);
-				bitDepth = chunk.data[8];
-				colorType = chunk.data[9];
-				uint8_t interlaceMethod = chunk.data[12];
+				png.header = parseHeader(chunk.data);
 			}
 			if (chunk.name == "IDAT") {
-				compressedImageData.insert(compressedImageData.end(), chunk.data.begin(), chunk.data.end());
+				png.compressedImageData.push_back(chunk.data);
 			}
 			if (chunk.name == "PLTE") {
-				plteData = chunk.data;
+				png.palette.rgb = chunk.data;
 			}
 			if (chunk.name == "tRNS") {
-				trnsData = chunk.data;
+				png.palette.a = chunk.data;
 			}
 		}
 
-		if (colorType == 3 && plteData.empty()) {
+		if (png.header.colorType == 3 && png.palette.rgb.empty()) {
 			throw std::runtime_error("PNG image uses indexed color but has no PLTE chunk");
 		}
+		if (png.header.colorType == 3) {
+			png.paletteTable = makePaletteTable(png.palette.rgb, png.palette.a);
+		}
+		return png;
+	}
 
-		PngPalette palette;
-		palette.rgb = plteData;
-		palette.a = trnsData;
-		uint8_t samplesPerPixel = getSamplesPerPixel(colorType);
-		outChannels = requiredChannels ? requiredChannels : inferChannels(colorType, palette.a.size() > 0 || colorType == 4 || colorType == 6);
-		uint8_t bitsPerSample = bitDepth;
-		uint16_t bitsPerPixel = samplesPerPixel * bitsPerSample;
-		uint32_t bytesPerRow = (bitsPerPixel * width + 7) / 8;
-		uint32_t bytesPerPixel = std::max(1, (bitsPerPixel + 7) / 8);
+	static bool hasAlpha(const PngImage& png) {
+		return png.palette.a.size() > 0 || png.header.colorType == 4 || png.header.colorType == 6;
+	}
 
-		std::vector<uint8_t> decompressedImageData = decompress(compressedImageData);
-		std::vector<uint8_t> outPixels(width * height * outChannels);
-		std::vector<uint8_t> prevScanline(bytesPerRow, 0), currScanline(bytesPerRow, 0);
+	static PngLayout getLayout(const PngImage& png, uint16_t requiredChannels) {
+		const PngHeader& header = png.header;
+		PngLayout layout;
+		layout.samplesPerPixel = getSamplesPerPixel(header.colorType);
+		layout.bitsPerSample = header.bitDepth;
+		layout.outChannels = requiredChannels ? requiredChannels : inferChannels(header.colorType, hasAlpha(png));
+		uint16_t bitsPerPixel = layout.samplesPerPixel * layout.bitsPerSample;
+		layout.bytesPerRow = (bitsPerPixel * header.width + 7) / 8;
+		layout.bytesPerPixel = std::max(1, (bitsPerPixel + 7) / 8);
+		layout.convertRow = selectRowConverter(header.colorType, header.bitDepth, layout.outChannels);
+		return layout;
+	}
 
-		size_t offset = 0;
-		for (uint32_t y = 0; y < height; y++) {
-			if (offset + bytesPerRow + 1 > decompressedImageData.size()) {
-				throw std::runtime_error("Decompressed image data is smaller than expected");
+	static ImageInfo getImageInfo(const PngImage& png, const PngLayout& layout) {
+		ImageInfo info;
+		info.width = png.header.width;
+		info.height = png.header.height;
+		info.channels = layout.outChannels;
+		info.bitDepth = png.header.bitDepth;
+		info.hasAlpha = hasAlpha(png);
+		info.interlaced = png.header.interlaceMethod == 1;
+		info.byteSize = static_cast<size_t>(info.width) * info.height * info.channels;
+		return info;
+	}
+
+	// Parses the chunks in front of the first IDAT, where PNG requires IHDR, PLTE and tRNS
+	// to be, and never looks at the image data.
+	static ImageInfo probePng(std::span<const uint8_t> fileData, uint16_t requiredChannels) {
+		PngImage png;
+		bool hasHeader = false;
+		size_t offset = 8; // skip PNG signature
+		while (offset + 8 <= fileData.size()) {
+			uint32_t length = BitReader::combineBytes(fileData[offset], fileData[offset + 1], fileData[offset + 2], fileData[offset + 3]);
+			std::string_view name(reinterpret_cast<const char*>(&fileData[offset + 4]), 4);
+			if (name == "IDAT" || name == "IEND") {
+				break;
 			}
-			uint8_t filterType = decompressedImageData[offset++];
-			std::memcpy(currScanline.data(), &decompressedImageData[offset], bytesPerRow);
-			offset += bytesPerRow;
-			unfilterScanline(currScanline.data(), prevScanline.data(), bytesPerRow, bytesPerPixel, filterType);
-			auto samples = unpackSamples(currScanline, width, samplesPerPixel, bitsPerSample);
-
-			for (uint32_t x = 0; x < width; x++) {
-				uint8_t r = 0, g = 0, b = 0, a = 255;
-				switch (colorType) {
-				case 0: {
-					uint8_t v = sampleToRGBA8(samples[x * samplesPerPixel + 0], bitDepth);
-					r = g = b = v;
-					break;
+			offset += 8;
+			if (offset + length > fileData.size()) {
+				throw std::runtime_error("Invalid PNG chunk length");
+			}
+			std::span<const uint8_t> data = fileData.subspan(offset, length);
+			if (name == "IHDR") {
+				png.header = parseHeader(data);
+				hasHeader = true;
+			}
+			if (name == "PLTE") {
+				png.palette.rgb = data;
+			}
+			if (name == "tRNS") {
+				png.palette.a = data;
+			}
+			offset += static_cast<size_t>(length) + 4;
+		}
+
+		if (!hasHeader) {
+			throw std::runtime_error("PNG image has no IHDR chunk");
+		}
+		return getImageInfo(png, getLayout(png, requiredChannels));
+	}
+
+	// Copies the signature and the IHDR, PLTE and tRNS chunks in front of the first IDAT and
+	// seeks over everything else, so probing a file reads a few kilobytes at most.
+	static std::vector<uint8_t> readPngHeaderChunks(std::ifstream& file) {
+		std::vector<uint8_t> data(8);
+		file.read(reinterpret_cast<char*>(data.data()), 8);
+		data.resize(static_cast<size_t>(file.gcount()));
+		if (!isPng(data)) {
+			return data;
+		}
+
+		std::array<uint8_t, 8> chunkHeader;
+		while (file.read(reinterpret_cast<char*>(chunkHeader.data()), chunkHeader.size())) {
+			uint32_t length = BitReader::combineBytes(chunkHeader[0], chunkHeader[1], chunkHeader[2], chunkHeader[3]);
+			std::string_view name(reinterpret_cast<const char*>(&chunkHeader[4]), 4);
+			if (name == "IDAT" || name == "IEND") {
+				break;
+			}
+			if (name != "IHDR" && name != "PLTE" && name != "tRNS") {
+				file.seekg(static_cast<std::streamoff>(length) + 4, std::ios::cur);
+				continue;
+			}
+			// a 256-entry PLTE is the largest of the three
+			if (length > 768) {
+				throw std::runtime_error("Invalid PNG chunk length");
+			}
+			size_t offset = data.size();
+			data.resize(offset + chunkHeader.size() + length + 4);
+			std::memcpy(&data[offset], chunkHeader.data(), chunkHeader.size());
+			file.read(reinterpret_cast<char*>(&data[offset + chunkHeader.size()]), length + 4);
+			data.resize(offset + chunkHeader.size() + static_cast<size_t>(file.gcount()));
+		}
+		return data;
+	}
+
+	// converts one unfiltered scanline into width * outChannels bytes of 8-bit output
+	static void convertRow(const PngImage& png, const PngLayout& layout, std::span<const uint8_t> scanline, uint8_t* outRow) {
+		layout.convertRow(scanline.data(), outRow, png.header.width, png.paletteTable);
+	}
+
+	// Scanline blocks of about this many filtered bytes are handed between pipeline stages,
+	// with at most pipelineRingSlots blocks in flight.
+	static constexpr size_t pipelineBlockBytes = 64 * 1024;
+	static constexpr size_t pipelineRingSlots = 8;
+
+	// Splits one decode over several threads. The calling thread inflates scanline blocks into
+	// a ring, one worker unfilters them in order, since every row depends on the one above, and
+	// the remaining workers convert unfiltered blocks into dst.
+	static void decodePngPipelined(const PngImage& png, const PngLayout& layout, const LoadOptions& options, uint8_t* dst, size_t rowPitch) {
+		const uint32_t height = png.header.height;
+		const size_t stride = static_cast<size_t>(layout.bytesPerRow) + 1;
+		std::pmr::memory_resource* scratch = scratchResource(options);
+		const uint32_t blockRows = static_cast<uint32_t>(std::clamp<size_t>(pipelineBlockBytes / stride, 1, height));
+		const uint32_t blockCount = (height + blockRows - 1) / blockRows;
+		auto rowsInBlock = [&](uint32_t block) { return std::min(blockRows, height - block * blockRows); };
+
+		uint32_t threadCount = options.pipelineThreads;
+		if (threadCount == 0) {
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+		ThreadPool pool(std::max(2u, threadCount) - 1);
+		// with a single worker there is nobody left to convert, so the unfilter stage does it
+		const bool convertInline = pool.workerCount() == 1;
+
+		enum class SlotState {
+			Free,
+			Filled,
+			Converting
+		};
+		struct Slot {
+			std::pmr::vector<uint8_t> rows;
+			SlotState state = SlotState::Free;
+		};
+		std::pmr::vector<Slot> ring(scratch);
+		ring.reserve(pipelineRingSlots);
+		for (size_t i = 0; i < pipelineRingSlots; i++) {
+			ring.push_back({ std::pmr::vector<uint8_t>(blockRows * stride, scratch) });
+		}
+
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::exception_ptr failure;
+		auto fail = [&](std::exception_ptr error) {
+			{
+				std::lock_guard lock(mutex);
+				if (!failure) {
+					failure = error;
 				}
-				case 2: {
-					r = sampleToRGBA8(samples[x * samplesPerPixel + 0], bitDepth);
-					g = sampleToRGBA8(samples[x * samplesPerPixel + 1], bitDepth);
-					b = sampleToRGBA8(samples[x * samplesPerPixel + 2], bitDepth);
-					break;
+			}
+			changed.notify_all();
+		};
+		auto setState = [&](Slot& slot, SlotState state) {
+			{
+				std::lock_guard lock(mutex);
+				slot.state = state;
+			}
+			changed.notify_all();
+		};
+		// returns false if another stage failed while waiting
+		auto waitForState = [&](const Slot& slot, SlotState state) {
+			std::unique_lock lock(mutex);
+			changed.wait(lock, [&] { return failure || slot.state == state; });
+			return !failure;
+		};
+
+		DecodeStats* stats = decodeStats(options);
+		// converters run in parallel, so each times itself privately and adds the result here
+		std::atomic<uint64_t> convertNanoseconds = 0;
+
+		auto convertBlock = [&](uint32_t block) {
+			Slot& slot = ring[block % ring.size()];
+			try {
+				DecodeStats blockStats;
+				{
+					StageTimer timer(stats ? &blockStats : nullptr, &DecodeStats::convertNanoseconds);
+					for (uint32_t i = 0; i < rowsInBlock(block); i++) {
+						std::span<const uint8_t> scanline(slot.rows.data() + i * stride + 1, layout.bytesPerRow);
+						convertRow(png, layout, scanline, dst + (static_cast<size_t>(block) * blockRows + i) * rowPitch);
+					}
 				}
-				case 3: {
-					uint32_t index = samples[x * samplesPerPixel + 0];
-					if (index * 3 + 2 >= palette.rgb.size()) {
-						throw std::runtime_error("Palette index out of bounds in PNG image");
+				convertNanoseconds += blockStats.convertNanoseconds;
+			}
+			catch (...) {
+				fail(std::current_exception());
+			}
+			setState(slot, SlotState::Free);
+		};
+
+		pool.submit([&] {
+			try {
+				std::pmr::vector<uint8_t> prevRow(layout.bytesPerRow, 0, scratch);
+				for (uint32_t block = 0; block < blockCount; block++) {
+					Slot& slot = ring[block % ring.size()];
+					if (!waitForState(slot, SlotState::Filled)) {
+						return;
 					}
-					r = palette.rgb[index * 3 + 0];
-					g = palette.rgb[index * 3 + 1];
-					b = palette.rgb[index * 3 + 2];
-					if (index < palette.a.size()) {
-						a = palette.a[index];
+					const uint8_t* prev = prevRow.data();
+					{
+						StageTimer timer(stats, &DecodeStats::unfilterNanoseconds);
+						for (uint32_t i = 0; i < rowsInBlock(block); i++) {
+							uint8_t* row = slot.rows.data() + i * stride;
+							unfilterScanline(row + 1, prev, layout.bytesPerRow, layout.bytesPerPixel, row[0]);
+							if (stats && row[0] < stats->filterTypes.size()) {
+								stats->filterTypes[row[0]]++;
+							}
+							prev = row + 1;
+						}
+						// the slot may be refilled before the next block needs its last row
+						std::memcpy(prevRow.data(), prev, layout.bytesPerRow);
+					}
+					setState(slot, SlotState::Converting);
+					if (convertInline) {
+						convertBlock(block);
+					}
+					else {
+						pool.submit([&convertBlock, block] { convertBlock(block); });
 					}
-					break;
-				}
-				case 4: {
-					uint8_t v = sampleToRGBA8(samples[x * samplesPerPixel + 0], bitDepth);
-					r = g = b = v;
-					a = sampleToRGBA8(samples[x * samplesPerPixel + 1], bitDepth);
-					break;
-				}
-				case 6: {
-					r = sampleToRGBA8(samples[x * samplesPerPixel + 0], bitDepth);
-					g = sampleToRGBA8(samples[x * samplesPerPixel + 1], bitDepth);
-					b = sampleToRGBA8(samples[x * samplesPerPixel + 2], bitDepth);
-					a = sampleToRGBA8(samples[x * samplesPerPixel + 3], bitDepth);
-					break;
-				}
-				default:
-					throw std::runtime_error("Unsupported PNG color type: " + std::to_string(colorType));
 				}
+			}
+			catch (...) {
+				fail(std::current_exception());
+			}
+		});
 
-				size_t pixelIndex = (static_cast<size_t>(y) * width + x) * outChannels;
-				switch (outChannels) {
-				case 1: {
-					uint8_t gray = static_cast<uint8_t>(0.299f * r + 0.587f * g + 0.114f * b);
-					outPixels[pixelIndex + 0] = gray;
-					break;
-				}
-				case 2: {
-					uint8_t gray = static_cast<uint8_t>(
-						0.299f * r + 0.587f * g + 0.114f * b
-						);
-					outPixels[pixelIndex + 0] = gray;
-					outPixels[pixelIndex + 1] = a;
-					break;
+		// same sliding window as PngRowStream, refilled a block at a time
+		try {
+			BitReader bitReader(png.compressedImageData);
+			readZlibHeader(bitReader);
+			std::pmr::vector<uint8_t> window(2 * Inflater::windowSize + blockRows * stride + Inflater::maxMatchLength + Inflater::copySlack, scratch);
+			Inflater inflater(bitReader, window);
+			inflater.setStats(stats);
+			size_t readPos = 0;
+			const bool verifyAdler = options.integrityCheck != IntegrityCheck::None;
+			uint32_t adler = 1;
+			bool aborted = false;
+			for (uint32_t block = 0; block < blockCount; block++) {
+				throwIfCancelled(options);
+				size_t blockBytes = rowsInBlock(block) * stride;
+				if (inflater.outputSize() - readPos < blockBytes) {
+					StageTimer timer(stats, &DecodeStats::inflateNanoseconds);
+					if (readPos + blockBytes > window.size()) {
+						size_t produced = inflater.outputSize();
+						size_t drop = std::min(readPos, produced > Inflater::windowSize ? produced - Inflater::windowSize : 0);
+						inflater.discardOutput(drop);
+						readPos -= drop;
+					}
+					inflater.inflateTo(window.size());
+					if (inflater.outputSize() - readPos < blockBytes) {
+						throw std::runtime_error("Decompressed image data is smaller than expected");
+					}
 				}
-				case 3: {
-					outPixels[pixelIndex + 0] = r;
-					outPixels[pixelIndex + 1] = g;
-					outPixels[pixelIndex + 2] = b;
+
+				Slot& slot = ring[block % ring.size()];
+				if (!waitForState(slot, SlotState::Free)) {
+					aborted = true;
 					break;
 				}
-				case 4: {
-					outPixels[pixelIndex + 0] = r;
-					outPixels[pixelIndex + 1] = g;
-					outPixels[pixelIndex + 2] = b;
-					outPixels[pixelIndex + 3] = a;
-					break;
+				if (verifyAdler) {
+					adler = adler32(adler, std::span<const uint8_t>(window.data() + readPos, blockBytes));
 				}
-				default:
-					throw std::runtime_error("Unsupported output channel count: " + std::to_string(outChannels));
+				std::memcpy(slot.rows.data(), window.data() + readPos, blockBytes);
+				readPos += blockBytes;
+				setState(slot, SlotState::Filled);
+			}
+
+			if (verifyAdler && !aborted) {
+				// the checksum covers anything the stream holds past the last row as well
+				{
+					StageTimer timer(stats, &DecodeStats::inflateNanoseconds);
+					inflater.inflateTo(SIZE_MAX);
 				}
+				adler = adler32(adler, std::span<const uint8_t>(window.data() + readPos, inflater.outputSize() - readPos));
+				checkAdler(adler, readZlibTrailer(bitReader));
+			}
+			if (stats && !aborted) {
+				stats->inflatedBytes += static_cast<uint64_t>(height) * stride + (inflater.outputSize() - readPos);
 			}
-			std::swap(prevScanline, currScanline);
 		}
-		outWidth = width;
-		outHeight = height;
-		return outPixels;
+		catch (...) {
+			fail(std::current_exception());
+		}
+
+		pool.wait();
+		if (stats) {
+			stats->convertNanoseconds += convertNanoseconds;
+		}
+		if (failure) {
+			std::rethrow_exception(failure);
+		}
 	}
-#pragma endregion
 
-	std::expected<Image, std::string> loadImage(const std::filesystem::path& imagePath, uint16_t requiredChannels) {
-		if (!std::filesystem::exists(imagePath)) {
-			return std::unexpected("Image file does not exist: " + imagePath.string());
+	struct Adam7Pass {
+		uint32_t x0;
+		uint32_t y0;
+		uint32_t dx;
+		uint32_t dy;
+		// block each decoded pixel fills in the preview once this pass is done
+		uint32_t blockWidth;
+		uint32_t blockHeight;
+	};
+	static constexpr std::array<Adam7Pass, 7> adam7Passes = { {
+		{ 0, 0, 8, 8, 8, 8 },
+		{ 4, 0, 8, 8, 4, 8 },
+		{ 0, 4, 4, 8, 4, 4 },
+		{ 2, 0, 4, 4, 2, 4 },
+		{ 0, 2, 2, 4, 2, 2 },
+		{ 1, 0, 2, 2, 1, 2 },
+		{ 0, 1, 1, 2, 1, 1 },
+	} };
+
+	// places count converted pixels at every step-th pixel of an output row
+	template<uint16_t Channels>
+	static void scatterPixels(const uint8_t* src, uint8_t* dst, uint32_t count, uint32_t step) {
+		const size_t dstStep = static_cast<size_t>(step) * Channels;
+		for (uint32_t i = 0; i < count; i++) {
+			std::memcpy(dst + i * dstStep, src + i * Channels, Channels);
 		}
+	}
 
-		std::ifstream file(imagePath, std::ios::binary);
-		if (!file) {
-			return std::unexpected("Failed to open image file: " + imagePath.string());
+	static void scatterPixels(const uint8_t* src, uint8_t* dst, uint32_t count, uint32_t step, uint16_t channels) {
+		switch (channels) {
+		case 1: scatterPixels<1>(src, dst, count, step); break;
+		case 2: scatterPixels<2>(src, dst, count, step); break;
+		case 3: scatterPixels<3>(src, dst, count, step); break;
+		case 4: scatterPixels<4>(src, dst, count, step); break;
 		}
+	}
 
-		file.seekg(0, std::ios::end);
-		std::streamoff size = file.tellg();
-		file.seekg(0, std::ios::beg);
-		if (size <= 0) {
-			return std::unexpected("Image file is empty: " + imagePath.string());
+	// copies each pixel of a pass row over the preview block it stands for
+	static void fillPreviewBlocks(uint8_t* dst, size_t rowPitch, uint32_t width, uint32_t height, uint16_t channels, uint32_t y, const Adam7Pass& pass) {
+		uint8_t* row = dst + y * rowPitch;
+		for (uint32_t x = pass.x0; x < width; x += pass.dx) {
+			uint32_t span = std::min(pass.blockWidth, width - x);
+			uint8_t* pixel = row + static_cast<size_t>(x) * channels;
+			for (uint32_t i = 1; i < span; i++) {
+				std::memcpy(pixel + i * channels, pixel, channels);
+			}
+			for (uint32_t i = 1; i < pass.blockHeight && y + i < height; i++) {
+				std::memcpy(dst + (y + i) * rowPitch + static_cast<size_t>(x) * channels, pixel, static_cast<size_t>(span) * channels);
+			}
 		}
-		std::vector<uint8_t> fileData(static_cast<size_t>(size));
-		file.read(reinterpret_cast<char*>(fileData.data()), size);
-		if (!file) {
-			return std::unexpected("Failed to read image file: " + imagePath.string());
+	}
+
+	// Decodes an Adam7 interlaced image one pass at a time. Each pass is a small image of its
+	// own with its own scanlines, so it goes through the same unfilter and row converters as a
+	// plain image and only the placement of the converted pixels differs. The stream is
+	// inflated just far enough for the current pass, so onInterlacePass sees the first
+	// preview after a sixty-fourth of the data.
+	static void decodePngInterlaced(const PngImage& png, const PngLayout& layout, const LoadOptions& options, uint8_t* dst, size_t rowPitch) {
+		const uint32_t width = png.header.width;
+		const uint32_t height = png.header.height;
+		const uint16_t channels = layout.outChannels;
+		const size_t bitsPerPixel = static_cast<size_t>(layout.samplesPerPixel) * layout.bitsPerSample;
+		std::pmr::memory_resource* scratch = scratchResource(options);
+		DecodeStats* stats = decodeStats(options);
+
+		size_t totalBytes = 0;
+		for (const Adam7Pass& pass : adam7Passes) {
+			uint32_t passWidth = (width - std::min(width, pass.x0) + pass.dx - 1) / pass.dx;
+			uint32_t passHeight = (height - std::min(height, pass.y0) + pass.dy - 1) / pass.dy;
+			if (passWidth > 0 && passHeight > 0) {
+				totalBytes += ((bitsPerPixel * passWidth + 7) / 8 + 1) * passHeight;
+			}
 		}
 
-		AxImageLoader::ImageFormat format = detectFormat(fileData);
-		Image image = {};
-		switch (format) {
-		case AxImageLoader::ImageFormat::PNG:
-			image.data = loadPNG(fileData, image.width, image.height, image.channels, requiredChannels);
-			break;
-		case AxImageLoader::ImageFormat::JPEG:
-			// TODO: implement JPEG loading
-			return std::unexpected("JPEG loading not implemented yet");
-			break;
-		case AxImageLoader::ImageFormat::UNKNOWN:
-			return std::unexpected("Unsupported image format: " + imagePath.string());
-			break;
-		default:
-			return std::unexpected("Unsupported image format: " + imagePath.string());
-			break;
+		BitReader bitReader(png.compressedImageData);
+		readZlibHeader(bitReader);
+		std::pmr::vector<uint8_t> data(totalBytes, scratch);
+		Inflater inflater(bitReader, data);
+		inflater.setStats(stats);
+
+		const size_t maxRowBytes = (bitsPerPixel * width + 7) / 8;
+		std::pmr::vector<uint8_t> prevScanline(maxRowBytes, scratch), currScanline(maxRowBytes, scratch);
+		std::pmr::vector<uint8_t> passRow(static_cast<size_t>(width) * channels, scratch);
+		const bool verifyAdler = options.integrityCheck != IntegrityCheck::None;
+		uint32_t adler = 1;
+		size_t offset = 0;
+
+		for (size_t passIndex = 0; passIndex < adam7Passes.size(); passIndex++) {
+			const Adam7Pass& pass = adam7Passes[passIndex];
+			uint32_t passWidth = (width - std::min(width, pass.x0) + pass.dx - 1) / pass.dx;
+			uint32_t passHeight = (height - std::min(height, pass.y0) + pass.dy - 1) / pass.dy;
+			// an empty pass has no scanlines at all, not even filter bytes
+			if (passWidth > 0 && passHeight > 0) {
+				const uint32_t bytesPerRow = static_cast<uint32_t>((bitsPerPixel * passWidth + 7) / 8);
+				const size_t passEnd = offset + (static_cast<size_t>(bytesPerRow) + 1) * passHeight;
+				{
+					StageTimer timer(stats, &DecodeStats::inflateNanoseconds);
+					while (inflater.outputSize() < passEnd && !inflater.finished()) {
+						throwIfCancelled(options);
+						inflater.inflateTo(std::min(passEnd, inflater.outputSize() + inflateStepBytes));
+					}
+				}
+				if (inflater.outputSize() < passEnd) {
+					throw std::runtime_error("Decompressed image data is smaller than expected");
+				}
+
+				std::fill(prevScanline.begin(), prevScanline.begin() + bytesPerRow, 0);
+				for (uint32_t passY = 0; passY < passHeight; passY++) {
+					throwIfCancelled(options);
+					if (verifyAdler) {
+						adler = adler32(adler, std::span<const uint8_t>(&data[offset], static_cast<size_t>(bytesPerRow) + 1));
+					}
+					uint8_t filterType = data[offset++];
+					{
+						StageTimer timer(stats, &DecodeStats::unfilterNanoseconds);
+						std::memcpy(currScanline.data(), &data[offset], bytesPerRow);
+						unfilterScanline(currScanline.data(), prevScanline.data(), bytesPerRow, layout.bytesPerPixel, filterType);
+					}
+					if (stats && filterType < stats->filterTypes.size()) {
+						stats->filterTypes[filterType]++;
+					}
+					offset += bytesPerRow;
+
+					StageTimer timer(stats, &DecodeStats::convertNanoseconds);
+					uint32_t y = pass.y0 + passY * pass.dy;
+					layout.convertRow(currScanline.data(), passRow.data(), passWidth, png.paletteTable);
+					scatterPixels(passRow.data(), dst + y * rowPitch + static_cast<size_t>(pass.x0) * channels, passWidth, pass.dx, channels);
+					if (options.onInterlacePass && passIndex + 1 < adam7Passes.size()) {
+						fillPreviewBlocks(dst, rowPitch, width, height, channels, y, pass);
+					}
+					std::swap(prevScanline, currScanline);
+				}
+			}
+
+			if (options.onInterlacePass) {
+				InterlacePass progress;
+				progress.pass = static_cast<uint32_t>(passIndex) + 1;
+				progress.previewBlockWidth = pass.blockWidth;
+				progress.previewBlockHeight = pass.blockHeight;
+				progress.width = width;
+				progress.height = height;
+				progress.channels = channels;
+				progress.pixels = std::span<const uint8_t>(dst, height > 0 ? rowPitch * (height - 1) + static_cast<size_t>(width) * channels : 0);
+				progress.rowPitch = rowPitch;
+				options.onInterlacePass(progress);
+			}
 		}
 
-		return image;
+		if (verifyAdler) {
+			{
+				StageTimer timer(stats, &DecodeStats::inflateNanoseconds);
+				inflater.inflateTo(SIZE_MAX);
+			}
+			adler = adler32(adler, std::span<const uint8_t>(data.data() + offset, inflater.outputSize() - offset));
+			checkAdler(adler, readZlibTrailer(bitReader));
+		}
+		if (stats) {
+			stats->inflatedBytes += inflater.outputSize();
+		}
+	}
+
+	static void buildMipChain(MipChainBuilder& mips, DecodeStats* stats) {
+		StageTimer timer(stats, &DecodeStats::mipNanoseconds);
+		mips.buildAll();
+	}
+
+	// Writes the decoded image to dst, row y at dst + y * rowPitch, and fills the rest of the
+	// mip chain when mips is set. Only the serial path produces rows in order and feeds the
+	// chain as it goes; the interlaced and pipelined paths build it once they are done.
+	static void decodePng(const PngImage& png, const PngLayout& layout, const LoadOptions& options, uint8_t* dst, size_t rowPitch, MipChainBuilder* mips = nullptr) {
+		const uint32_t height = png.header.height;
+		const uint32_t bytesPerRow = layout.bytesPerRow;
+		std::pmr::memory_resource* scratch = scratchResource(options);
+		DecodeStats* stats = decodeStats(options);
+		if (stats) {
+			for (std::span<const uint8_t> data : png.compressedImageData) {
+				stats->compressedBytes += data.size();
+			}
+		}
+
+		if (png.header.interlaceMethod > 1) {
+			throw std::runtime_error("Unsupported PNG interlace method: " + std::to_string(png.header.interlaceMethod));
+		}
+		// interlaced images always take the serial path, which inflates pass by pass
+		if (png.header.interlaceMethod == 1) {
+			decodePngInterlaced(png, layout, options, dst, rowPitch);
+			if (mips) {
+				buildMipChain(*mips, stats);
+			}
+			return;
+		}
+		if (options.pipelined && (static_cast<size_t>(bytesPerRow) + 1) * height > pipelineBlockBytes) {
+			decodePngPipelined(png, layout, options, dst, rowPitch);
+			if (mips) {
+				buildMipChain(*mips, stats);
+			}
+			return;
+		}
+
+		uint32_t storedAdler = 0;
+		std::pmr::vector<uint8_t> decompressedImageData = decompress(png.compressedImageData, (static_cast<size_t>(bytesPerRow) + 1) * height, storedAdler, options);
+		const bool verifyAdler = options.integrityCheck != IntegrityCheck::None;
+		uint32_t adler = 1;
+		std::pmr::vector<uint8_t> prevScanline(bytesPerRow, 0, scratch), currScanline(bytesPerRow, 0, scratch);
+
+		size_t offset = 0;
+		for (uint32_t y = 0; y < height; y++) {
+			throwIfCancelled(options);
+			if (offset + bytesPerRow + 1 > decompressedImageData.size()) {
+				throw std::runtime_error("Decompressed image data is smaller than expected");
+			}
+			// summed here while the row is in cache rather than in a separate pass
+			if (verifyAdler) {
+				adler = adler32(adler, std::span<const uint8_t>(&decompressedImageData[offset], static_cast<size_t>(bytesPerRow) + 1));
+			}
+			uint8_t filterType = decompressedImageData[offset++];
+			{
+				StageTimer timer(stats, &DecodeStats::unfilterNanoseconds);
+				std::memcpy(currScanline.data(), &decompressedImageData[offset], bytesPerRow);
+				unfilterScanline(currScanline.data(), prevScanline.data(), bytesPerRow, layout.bytesPerPixel, filterType);
+			}
+			if (stats && filterType < stats->filterTypes.size()) {
+				stats->filterTypes[filterType]++;
+			}
+			offset += bytesPerRow;
+			{
+				StageTimer timer(stats, &DecodeStats::convertNanoseconds);
+				convertRow(png, layout, currScanline, dst + static_cast<size_t>(y) * rowPitch);
+			}
+			if (mips) {
+				StageTimer timer(stats, &DecodeStats::mipNanoseconds);
+				mips->rowWritten(y);
+			}
+			std::swap(prevScanline, currScanline);
+		}
+		if (verifyAdler) {
+			adler = adler32(adler, std::span<const uint8_t>(decompressedImageData).subspan(offset));
+			checkAdler(adler, storedAdler);
+		}
+	}
+
+	static std::vector<uint8_t> loadPNG(std::span<const uint8_t> fileData, uint32_t& outWidth, uint32_t& outHeight, uint16_t& outChannels, std::vector<MipLevel>& outMipLevels, uint16_t requiredChannels, const LoadOptions& options) {
+		PngImage png = parsePng(fileData, options.integrityCheck, scratchResource(options), decodeStats(options));
+		PngLayout layout = getLayout(png, requiredChannels);
+		outWidth = png.header.width;
+		outHeight = png.header.height;
+		outChannels = layout.outChannels;
+
+		size_t rowPitch = static_cast<size_t>(outWidth) * outChannels;
+		std::vector<uint8_t> outPixels;
+		if (options.mipChain != MipChain::None) {
+			// the whole chain in one allocation, level 0 first
+			outMipLevels = mipLevels(outWidth, outHeight, outChannels);
+			const MipLevel& smallest = outMipLevels.back();
+			outPixels.resize(smallest.offset + static_cast<size_t>(smallest.width) * smallest.height * outChannels);
+			MipChainBuilder mips(outPixels.data(), outMipLevels, outChannels, options.mipChain);
+			decodePng(png, layout, options, outPixels.data(), rowPitch, &mips);
+		}
+		else {
+			outPixels.resize(rowPitch * outHeight);
+			decodePng(png, layout, options, outPixels.data(), rowPitch);
+		}
+		if (DecodeStats* stats = decodeStats(options)) {
+			stats->outputBytes += outPixels.size();
+		}
+		return outPixels;
+	}
+
+	static ImageInfo loadPNGInto(std::span<const uint8_t> fileData, std::span<uint8_t> dst, size_t rowPitch, uint16_t channels, const LoadOptions& options) {
+		PngImage png = parsePng(fileData, options.integrityCheck, scratchResource(options), decodeStats(options));
+		PngLayout layout = getLayout(png, channels);
+		ImageInfo info = getImageInfo(png, layout);
+
+		size_t rowBytes = static_cast<size_t>(info.width) * info.channels;
+		if (rowPitch < rowBytes) {
+			throw std::runtime_error("Row pitch is smaller than one output row");
+		}
+		if (info.height > 0 && dst.size() < rowPitch * (info.height - 1) + rowBytes) {
+			throw std::runtime_error("Destination buffer is too small for the image");
+		}
+		decodePng(png, layout, options, dst.data(), rowPitch);
+		if (DecodeStats* stats = decodeStats(options)) {
+			stats->outputBytes += info.byteSize;
+		}
+		return info;
+	}
+
+	// Inflates only as much of the IDAT stream as the next scanline needs. The working set
+	// is the DEFLATE window plus the undecoded rest of the current fill and two scanlines.
+	// Rows of an interlaced image are spread over all seven passes, so those are decoded
+	// whole up front and handed out row by row.
+	class PngRowStream {
+	public:
+		// only chunk CRCs of options.integrityCheck apply; the Adler-32 trails data a stream that
+		// stops early never reaches, so it is checked only for interlaced images, decoded whole
+		PngRowStream(std::span<const uint8_t> fileData, uint16_t requiredChannels, const LoadOptions& options = {})
+			: png(parsePng(fileData, options.integrityCheck, scratchResource(options), decodeStats(options))), layout(getLayout(png, requiredChannels)), bitReader(png.compressedImageData), window(scratchResource(options)), inflater(bitReader, window) {
+			stride = static_cast<size_t>(layout.bytesPerRow) + 1;
+			window.resize(2 * Inflater::windowSize + stride + Inflater::maxMatchLength + Inflater::copySlack);
+			prevScanline.assign(layout.bytesPerRow, 0);
+			currScanline.assign(layout.bytesPerRow, 0);
+			if (png.header.interlaceMethod != 0) {
+				size_t rowBytes = static_cast<size_t>(png.header.width) * layout.outChannels;
+				interlacedPixels.resize(rowBytes * png.header.height);
+				decodePng(png, layout, options, interlacedPixels.data(), rowBytes);
+				return;
+			}
+			readZlibHeader(bitReader);
+		}
+
+		const PngImage& image() const { return png; }
+
+		uint32_t width() const { return png.header.width; }
+		uint32_t height() const { return png.header.height; }
+		uint16_t channels() const { return layout.outChannels; }
+
+		// writes the next row into outRow; returns false once every row has been produced
+		bool nextRow(uint8_t* outRow) {
+			return nextRow(outRow, 0, png.header.width);
+		}
+
+		// writes only columnCount pixels from firstColumn on, converting no others
+		bool nextRow(uint8_t* outRow, uint32_t firstColumn, uint32_t columnCount) {
+			if (y == png.header.height) {
+				return false;
+			}
+			if (png.header.interlaceMethod != 0) {
+				size_t rowBytes = static_cast<size_t>(png.header.width) * layout.outChannels;
+				std::memcpy(outRow, interlacedPixels.data() + y * rowBytes + static_cast<size_t>(firstColumn) * layout.outChannels, static_cast<size_t>(columnCount) * layout.outChannels);
+				y++;
+				return true;
+			}
+			unfilterNextRow();
+			convertColumns(outRow, firstColumn, columnCount);
+			std::swap(prevScanline, currScanline);
+			y++;
+			return true;
+		}
+
+		// Unfilters the next row without converting it; later rows still depend on it.
+		// Returns false once every row has been produced.
+		bool skipRow() {
+			if (y == png.header.height) {
+				return false;
+			}
+			if (png.header.interlaceMethod == 0) {
+				unfilterNextRow();
+				std::swap(prevScanline, currScanline);
+			}
+			y++;
+			return true;
+		}
+
+	private:
+		// leaves row y unfiltered in currScanline
+		void unfilterNextRow() {
+
+			if (inflater.outputSize() - readPos < stride) {
+				// slide the buffer, keeping the unread rest and the window matches may reach into
+				if (readPos + stride > window.size()) {
+					size_t produced = inflater.outputSize();
+					size_t drop = std::min(readPos, produced > Inflater::windowSize ? produced - Inflater::windowSize : 0);
+					inflater.discardOutput(drop);
+					readPos -= drop;
+				}
+				inflater.inflateTo(window.size());
+				if (inflater.outputSize() - readPos < stride) {
+					throw std::runtime_error("Decompressed image data is smaller than expected");
+				}
+			}
+
+			uint8_t filterType = window[readPos];
+			std::memcpy(currScanline.data(), window.data() + readPos + 1, layout.bytesPerRow);
+			readPos += stride;
+			unfilterScanline(currScanline.data(), prevScanline.data(), layout.bytesPerRow, layout.bytesPerPixel, filterType);
+		}
+
+		void convertColumns(uint8_t* outRow, uint32_t firstColumn, uint32_t columnCount) {
+			const uint32_t bitsPerPixel = static_cast<uint32_t>(layout.samplesPerPixel) * layout.bitsPerSample;
+			if (bitsPerPixel % 8 == 0) {
+				layout.convertRow(currScanline.data() + static_cast<size_t>(firstColumn) * layout.bytesPerPixel, outRow, columnCount, png.paletteTable);
+				return;
+			}
+			// below 8 bits a pixel, conversion starts at the byte holding firstColumn and the
+			// pixels in front of it are dropped
+			const uint32_t pixelsPerByte = 8 / bitsPerPixel;
+			const uint32_t lead = firstColumn % pixelsPerByte;
+			columnScratch.resize((static_cast<size_t>(columnCount) + lead) * layout.outChannels);
+			layout.convertRow(currScanline.data() + firstColumn / pixelsPerByte, columnScratch.data(), columnCount + lead, png.paletteTable);
+			std::memcpy(outRow, columnScratch.data() + static_cast<size_t>(lead) * layout.outChannels, static_cast<size_t>(columnCount) * layout.outChannels);
+		}
+
+		PngImage png;
+		PngLayout layout;
+		BitReader bitReader;
+		std::pmr::vector<uint8_t> window;
+		Inflater inflater;
+		size_t stride = 0;
+		size_t readPos = 0;
+		uint32_t y = 0;
+		std::vector<uint8_t> prevScanline;
+		std::vector<uint8_t> currScanline;
+		std::vector<uint8_t> interlacedPixels;
+		std::vector<uint8_t> columnScratch;
+	};
+#pragma endregion
+
+#pragma region JpegFunctions
+	static ImageInfo getJpegInfo(const JpegHeader& header, uint16_t requiredChannels) {
+		ImageInfo info = {};
+		info.width = header.width;
+		info.height = header.height;
+		info.channels = jpegOutputChannels(header, requiredChannels);
+		info.bitDepth = 8;
+		info.hasAlpha = false;
+		info.interlaced = header.progressive;
+		info.byteSize = static_cast<size_t>(info.width) * info.height * info.channels;
+		return info;
+	}
+
+	// Decodes region of a JPEG whose header the caller has read, with its mip chain when options
+	// ask for one. Blocks are coded in order, so scans stop after the region's last block row but
+	// decode everything above it.
+	static Image loadJPEG(std::span<const uint8_t> fileData, const JpegHeader& header, ImageRegion region, uint16_t requiredChannels, const LoadOptions& options) {
+		if (region.width == UINT32_MAX) {
+			region.width = header.width - std::min(region.x, header.width);
+		}
+		if (region.x > header.width || region.width > header.width - region.x || region.y > header.height || region.height > header.height - region.y) {
+			throw std::runtime_error("Region lies outside the " + std::to_string(header.width) + "x" + std::to_string(header.height) + " image");
+		}
+
+		Image image = {};
+		image.width = region.width;
+		image.height = region.height;
+		image.channels = jpegOutputChannels(header, requiredChannels);
+		const size_t rowPitch = static_cast<size_t>(image.width) * image.channels;
+		if (options.mipChain != MipChain::None) {
+			image.mipLevels = mipLevels(image.width, image.height, image.channels);
+			const MipLevel& smallest = image.mipLevels.back();
+			image.data.resize(smallest.offset + static_cast<size_t>(smallest.width) * smallest.height * image.channels);
+		}
+		else {
+			image.data.resize(rowPitch * image.height);
+		}
+		if (image.width > 0 && image.height > 0) {
+			decodeJpeg(fileData, image.channels, region, image.data.data(), rowPitch, options);
+			if (!image.mipLevels.empty()) {
+				MipChainBuilder mips(image.data.data(), image.mipLevels, image.channels, options.mipChain);
+				buildMipChain(mips, decodeStats(options));
+			}
+		}
+		if (DecodeStats* stats = decodeStats(options)) {
+			stats->outputBytes += image.data.size();
+		}
+		return image;
+	}
+
+	static ImageInfo loadJPEGInto(std::span<const uint8_t> fileData, std::span<uint8_t> dst, size_t rowPitch, uint16_t channels, const LoadOptions& options) {
+		const JpegHeader header = readJpegHeader(fileData, scratchResource(options));
+		ImageInfo info = getJpegInfo(header, channels);
+
+		size_t rowBytes = static_cast<size_t>(info.width) * info.channels;
+		if (rowPitch < rowBytes) {
+			throw std::runtime_error("Row pitch is smaller than one output row");
+		}
+		if (dst.size() < rowPitch * (info.height - 1) + rowBytes) {
+			throw std::runtime_error("Destination buffer is too small for the image");
+		}
+		decodeJpeg(fileData, info.channels, ImageRegion{ 0, info.height, 0, info.width }, dst.data(), rowPitch, options);
+		if (DecodeStats* stats = decodeStats(options)) {
+			stats->outputBytes += info.byteSize;
+		}
+		return info;
+	}
+
+	// Copies SOI and every segment up to the frame header, which is all probing reads; the
+	// entropy-coded data after it is never touched.
+	static std::vector<uint8_t> readJpegHeaderSegments(std::ifstream& file) {
+		std::vector<uint8_t> data(2);
+		file.read(reinterpret_cast<char*>(data.data()), 2);
+		data.resize(static_cast<size_t>(file.gcount()));
+
+		std::array<uint8_t, 4> segmentHeader;
+		while (file.read(reinterpret_cast<char*>(segmentHeader.data()), segmentHeader.size())) {
+			data.insert(data.end(), segmentHeader.begin(), segmentHeader.end());
+			if (segmentHeader[0] != 0xFF) {
+				break;
+			}
+			const uint8_t marker = segmentHeader[1];
+			size_t length = (static_cast<size_t>(segmentHeader[2]) << 8) | segmentHeader[3];
+			if (length < 2) {
+				break;
+			}
+			size_t offset = data.size();
+			data.resize(offset + length - 2);
+			file.read(reinterpret_cast<char*>(&data[offset]), static_cast<std::streamsize>(length - 2));
+			data.resize(offset + static_cast<size_t>(file.gcount()));
+			// SOF0-SOF15, leaving out DHT, JPG and DAC which share the range
+			if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+				break;
+			}
+		}
+		return data;
+	}
+#pragma endregion
+
+	static constexpr uint32_t blockRowsPerTask = 8;
+
+	// Replaces the pixels of image, every mip level included, with BCn blocks. The levels are
+	// cut into tasks of a few block rows each, spread over blockCompressionThreads threads.
+	static void compressBlocks(Image& image, const LoadOptions& options) {
+		StageTimer timer(decodeStats(options), &DecodeStats::blockCompressionNanoseconds);
+		const uint16_t channels = image.channels;
+		const size_t levelBytes = static_cast<size_t>(image.width) * image.height * channels;
+		const BlockFormat format = selectBlockFormat(std::span<const uint8_t>(image.data).first(levelBytes), channels, options.blockCompression);
+		const std::vector<MipLevel> pixelLevels = image.mipLevels.empty() ? std::vector<MipLevel>{ { image.width, image.height, 0 } } : image.mipLevels;
+
+		std::vector<MipLevel> blockLevels;
+		size_t blockDataSize = 0;
+		for (const MipLevel& level : pixelLevels) {
+			blockLevels.push_back({ level.width, level.height, blockDataSize });
+			blockDataSize += blockLevelBytes(level.width, level.height, format);
+		}
+		std::vector<uint8_t> blocks(blockDataSize);
+
+		struct Task {
+			size_t level;
+			uint32_t firstBlockRow;
+			uint32_t blockRowCount;
+		};
+		std::vector<Task> tasks;
+		for (size_t level = 0; level < pixelLevels.size(); level++) {
+			if (pixelLevels[level].width == 0) {
+				continue;
+			}
+			uint32_t blockRows = (pixelLevels[level].height + 3) / 4;
+			for (uint32_t row = 0; row < blockRows; row += blockRowsPerTask) {
+				tasks.push_back({ level, row, std::min(blockRowsPerTask, blockRows - row) });
+			}
+		}
+		auto encode = [&](const Task& task) {
+			if (options.stopToken.stop_requested()) {
+				return;
+			}
+			const MipLevel& level = pixelLevels[task.level];
+			encodeBlockRows(image.data.data() + level.offset, level.width, level.height, channels, format, options.blockCompression, task.firstBlockRow, task.blockRowCount, blocks.data() + blockLevels[task.level].offset);
+		};
+
+		uint32_t threadCount = options.blockCompressionThreads;
+		if (threadCount == 0) {
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+		threadCount = static_cast<uint32_t>(std::min<size_t>(threadCount, tasks.size()));
+		if (threadCount > 1) {
+			// the calling thread encodes too while it waits
+			ThreadPool pool(threadCount - 1);
+			for (const Task& task : tasks) {
+				pool.submit([&encode, &task] { encode(task); });
+			}
+			pool.wait();
+		}
+		else {
+			for (const Task& task : tasks) {
+				encode(task);
+			}
+		}
+		throwIfCancelled(options);
+
+		image.data = std::move(blocks);
+		if (!image.mipLevels.empty()) {
+			image.mipLevels = std::move(blockLevels);
+		}
+		image.blockFormat = format;
+	}
+
+	// sourceName only labels error messages
+	static std::expected<Image, std::string> decodeImage(std::span<const uint8_t> fileData, uint16_t requiredChannels, const LoadOptions& options, std::string_view sourceName) {
+		if (DecodeStats* stats = decodeStats(options)) {
+			stats->inputBytes += fileData.size();
+		}
+		try {
+			Image image = {};
+			switch (detectFormat(fileData)) {
+			case ImageFormat::PNG:
+				image.data = loadPNG(fileData, image.width, image.height, image.channels, image.mipLevels, requiredChannels, options);
+				break;
+			case ImageFormat::JPEG: {
+				const JpegHeader header = readJpegHeader(fileData, scratchResource(options));
+				image = loadJPEG(fileData, header, ImageRegion{ 0, header.height }, requiredChannels, options);
+				break;
+			}
+			default:
+				return std::unexpected("Unsupported image format: " + std::string(sourceName));
+			}
+			if (options.blockCompression != BlockCompression::None) {
+				compressBlocks(image, options);
+			}
+			return image;
+		}
+		catch (const std::exception& e) {
+			return std::unexpected(std::string(e.what()));
+		}
+	}
+
+	// Produces rows only up to the region's last one, so the rest of the IDAT stream is never
+	// inflated. Rows above the region are still unfiltered, since every row depends on the one
+	// before it, but only the region's columns are converted.
+	static Image loadPNGRegion(std::span<const uint8_t> fileData, const ImageRegion& region, uint16_t requiredChannels, const LoadOptions& options) {
+		PngRowStream stream(fileData, requiredChannels, options);
+		const uint32_t width = stream.width();
+		const uint32_t height = stream.height();
+		const uint32_t columnCount = region.width == UINT32_MAX ? width - std::min(region.x, width) : region.width;
+		if (region.x > width || columnCount > width - region.x || region.y > height || region.height > height - region.y) {
+			throw std::runtime_error("Region lies outside the " + std::to_string(width) + "x" + std::to_string(height) + " image");
+		}
+		if (stream.image().header.interlaceMethod > 1) {
+			throw std::runtime_error("Unsupported PNG interlace method: " + std::to_string(stream.image().header.interlaceMethod));
+		}
+		DecodeStats* stats = decodeStats(options);
+
+		Image image = {};
+		image.width = columnCount;
+		image.height = region.height;
+		image.channels = stream.channels();
+		const size_t rowBytes = static_cast<size_t>(columnCount) * image.channels;
+		std::optional<MipChainBuilder> mips;
+		if (options.mipChain != MipChain::None) {
+			image.mipLevels = mipLevels(image.width, image.height, image.channels);
+			const MipLevel& smallest = image.mipLevels.back();
+			image.data.resize(smallest.offset + static_cast<size_t>(smallest.width) * smallest.height * image.channels);
+			mips.emplace(image.data.data(), image.mipLevels, image.channels, options.mipChain);
+		}
+		else {
+			image.data.resize(rowBytes * image.height);
+		}
+
+		for (uint32_t y = 0; y < region.y; y++) {
+			throwIfCancelled(options);
+			stream.skipRow();
+		}
+		for (uint32_t y = 0; y < region.height; y++) {
+			throwIfCancelled(options);
+			stream.nextRow(image.data.data() + y * rowBytes, region.x, columnCount);
+			if (mips) {
+				StageTimer timer(stats, &DecodeStats::mipNanoseconds);
+				mips->rowWritten(y);
+			}
+		}
+		if (stats) {
+			stats->outputBytes += image.data.size();
+		}
+		return image;
+	}
+
+	static std::expected<Image, std::string> decodeImageRegion(std::span<const uint8_t> fileData, const ImageRegion& region, uint16_t requiredChannels, const LoadOptions& options, std::string_view sourceName) {
+		if (DecodeStats* stats = decodeStats(options)) {
+			stats->inputBytes += fileData.size();
+		}
+		try {
+			switch (detectFormat(fileData)) {
+			case ImageFormat::PNG: {
+				Image image = loadPNGRegion(fileData, region, requiredChannels, options);
+				if (options.blockCompression != BlockCompression::None) {
+					compressBlocks(image, options);
+				}
+				return image;
+			}
+			case ImageFormat::JPEG: {
+				Image image = loadJPEG(fileData, readJpegHeader(fileData, scratchResource(options)), region, requiredChannels, options);
+				if (options.blockCompression != BlockCompression::None) {
+					compressBlocks(image, options);
+				}
+				return image;
+			}
+			default:
+				return std::unexpected("Unsupported image format: " + std::string(sourceName));
+			}
+		}
+		catch (const std::exception& e) {
+			return std::unexpected(std::string(e.what()));
+		}
+	}
+
+	static std::expected<ImageInfo, std::string> decodeImageInto(std::span<const uint8_t> fileData, std::span<uint8_t> dst, size_t rowPitch, uint16_t channels, const LoadOptions& options, std::string_view sourceName) {
+		if (DecodeStats* stats = decodeStats(options)) {
+			stats->inputBytes += fileData.size();
+		}
+		try {
+			switch (detectFormat(fileData)) {
+			case ImageFormat::PNG:
+				return loadPNGInto(fileData, dst, rowPitch, channels, options);
+			case ImageFormat::JPEG:
+				return loadJPEGInto(fileData, dst, rowPitch, channels, options);
+			default:
+				return std::unexpected("Unsupported image format: " + std::string(sourceName));
+			}
+		}
+		catch (const std::exception& e) {
+			return std::unexpected(std::string(e.what()));
+		}
+	}
+
+	std::expected<Image, std::string> loadImage(const std::filesystem::path& imagePath, uint16_t requiredChannels, const LoadOptions& options) {
+		StatsScope statsScope(options);
+		std::vector<uint8_t> fileData;
+		{
+			StageTimer timer(decodeStats(statsScope.options()), &DecodeStats::readNanoseconds);
+			if (!std::filesystem::exists(imagePath)) {
+				return std::unexpected("Image file does not exist: " + imagePath.string());
+			}
+
+			std::ifstream file(imagePath, std::ios::binary);
+			if (!file) {
+				return std::unexpected("Failed to open image file: " + imagePath.string());
+			}
+
+			file.seekg(0, std::ios::end);
+			std::streamoff size = file.tellg();
+			file.seekg(0, std::ios::beg);
+			if (size <= 0) {
+				return std::unexpected("Image file is empty: " + imagePath.string());
+			}
+			fileData.resize(static_cast<size_t>(size));
+			file.read(reinterpret_cast<char*>(fileData.data()), size);
+			if (!file) {
+				return std::unexpected("Failed to read image file: " + imagePath.string());
+			}
+		}
+
+		return decodeImage(fileData, requiredChannels, statsScope.options(), imagePath.string());
+	}
+
+	std::expected<Image, std::string> loadImageFromMemory(std::span<const uint8_t> data, uint16_t requiredChannels, const LoadOptions& options) {
+		if (data.empty()) {
+			return std::unexpected("Image data is empty");
+		}
+		StatsScope statsScope(options);
+		return decodeImage(data, requiredChannels, statsScope.options(), "<memory>");
+	}
+
+	std::expected<Image, std::string> loadImageMapped(const std::filesystem::path& imagePath, uint16_t requiredChannels, const LoadOptions& options) {
+		StatsScope statsScope(options);
+		MappedFile file;
+		{
+			StageTimer timer(decodeStats(statsScope.options()), &DecodeStats::readNanoseconds);
+			if (!file.open(imagePath)) {
+				return std::unexpected("Failed to map image file: " + imagePath.string());
+			}
+		}
+		if (file.data().empty()) {
+			return std::unexpected("Image file is empty: " + imagePath.string());
+		}
+		return decodeImage(file.data(), requiredChannels, statsScope.options(), imagePath.string());
+	}
+
+	std::expected<Image, std::string> loadImageRegion(std::span<const uint8_t> data, const ImageRegion& region, uint16_t requiredChannels, const LoadOptions& options) {
+		if (data.empty()) {
+			return std::unexpected("Image data is empty");
+		}
+		StatsScope statsScope(options);
+		return decodeImageRegion(data, region, requiredChannels, statsScope.options(), "<memory>");
+	}
+
+	std::expected<Image, std::string> loadImageRegion(const std::filesystem::path& imagePath, const ImageRegion& region, uint16_t requiredChannels, const LoadOptions& options) {
+		StatsScope statsScope(options);
+		// mapped, so pages of the file past the region are never read
+		MappedFile file;
+		{
+			StageTimer timer(decodeStats(statsScope.options()), &DecodeStats::readNanoseconds);
+			if (!file.open(imagePath)) {
+				return std::unexpected("Failed to map image file: " + imagePath.string());
+			}
+		}
+		if (file.data().empty()) {
+			return std::unexpected("Image file is empty: " + imagePath.string());
+		}
+		return decodeImageRegion(file.data(), region, requiredChannels, statsScope.options(), imagePath.string());
+	}
+
+	std::expected<ImageInfo, std::string> loadImageInto(std::span<const uint8_t> data, std::span<uint8_t> dst, size_t rowPitch, uint16_t channels, const LoadOptions& options) {
+		if (data.empty()) {
+			return std::unexpected("Image data is empty");
+		}
+		StatsScope statsScope(options);
+		return decodeImageInto(data, dst, rowPitch, channels, statsScope.options(), "<memory>");
+	}
+
+	std::expected<ImageInfo, std::string> loadImageInto(const std::filesystem::path& imagePath, std::span<uint8_t> dst, size_t rowPitch, uint16_t channels, const LoadOptions& options) {
+		StatsScope statsScope(options);
+		MappedFile file;
+		{
+			StageTimer timer(decodeStats(statsScope.options()), &DecodeStats::readNanoseconds);
+			if (!file.open(imagePath)) {
+				return std::unexpected("Failed to map image file: " + imagePath.string());
+			}
+		}
+		if (file.data().empty()) {
+			return std::unexpected("Image file is empty: " + imagePath.string());
+		}
+		return decodeImageInto(file.data(), dst, rowPitch, channels, statsScope.options(), imagePath.string());
+	}
+
+	static std::expected<ImageInfo, std::string> probeImageData(std::span<const uint8_t> fileData, uint16_t requiredChannels, std::string_view sourceName) {
+		try {
+			switch (detectFormat(fileData)) {
+			case ImageFormat::PNG:
+				return probePng(fileData, requiredChannels);
+			case ImageFormat::JPEG:
+				return getJpegInfo(readJpegHeader(fileData), requiredChannels);
+			default:
+				return std::unexpected("Unsupported image format: " + std::string(sourceName));
+			}
+		}
+		catch (const std::exception& e) {
+			return std::unexpected(std::string(e.what()));
+		}
+	}
+
+	std::expected<ImageInfo, std::string> probeImage(std::span<const uint8_t> data, uint16_t requiredChannels) {
+		if (data.empty()) {
+			return std::unexpected("Image data is empty");
+		}
+		return probeImageData(data, requiredChannels, "<memory>");
+	}
+
+	std::expected<ImageInfo, std::string> probeImage(const std::filesystem::path& imagePath, uint16_t requiredChannels) {
+		std::ifstream file(imagePath, std::ios::binary);
+		if (!file) {
+			return std::unexpected("Failed to open image file: " + imagePath.string());
+		}
+		std::vector<uint8_t> headerData;
+		try {
+			headerData = readPngHeaderChunks(file);
+			if (isJpeg(headerData)) {
+				file.clear();
+				file.seekg(0);
+				headerData = readJpegHeaderSegments(file);
+			}
+		}
+		catch (const std::exception& e) {
+			return std::unexpected(std::string(e.what()));
+		}
+		if (headerData.empty()) {
+			return std::unexpected("Image file is empty: " + imagePath.string());
+		}
+		return probeImageData(headerData, requiredChannels, imagePath.string());
+	}
+
+	std::expected<std::vector<uint8_t>, std::string> saveImageToMemory(const Image& image, const SaveOptions& options) {
+		try {
+			return encodePng(image, options);
+		}
+		catch (const std::exception& e) {
+			return std::unexpected(std::string(e.what()));
+		}
+	}
+
+	std::expected<void, std::string> saveImage(const std::filesystem::path& imagePath, const Image& image, const SaveOptions& options) {
+		std::expected<std::vector<uint8_t>, std::string> png = saveImageToMemory(image, options);
+		if (!png) {
+			return std::unexpected(png.error());
+		}
+		std::ofstream file(imagePath, std::ios::binary | std::ios::trunc);
+		if (!file) {
+			return std::unexpected("Failed to open image file for writing: " + imagePath.string());
+		}
+		file.write(reinterpret_cast<const char*>(png->data()), static_cast<std::streamsize>(png->size()));
+		if (!file) {
+			return std::unexpected("Failed to write image file: " + imagePath.string());
+		}
+		return {};
+	}
+
+	std::vector<std::expected<Image, std::string>> loadImages(std::span<const std::filesystem::path> imagePaths, uint16_t requiredChannels, uint32_t workerCount, const LoadOptions& options) {
+		std::vector<std::expected<Image, std::string>> results(imagePaths.size());
+
+		// largest files first, so no long decode is left running alone at the end of the batch
+		std::vector<std::pair<uintmax_t, size_t>> order;
+		order.reserve(imagePaths.size());
+		for (size_t i = 0; i < imagePaths.size(); i++) {
+			std::error_code error;
+			uintmax_t size = std::filesystem::file_size(imagePaths[i], error);
+			order.emplace_back(error ? 0 : size, i);
+		}
+		std::stable_sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+		ThreadPool pool(workerCount);
+		// the calling thread maps files and starts their reads ahead of the workers; the slots
+		// bound how many files are mapped at once
+		std::counting_semaphore<> mappingSlots(2 * pool.workerCount());
+		for (const auto& [size, index] : order) {
+			const std::filesystem::path& imagePath = imagePaths[index];
+			mappingSlots.acquire();
+			MappedFile file;
+			// timed here on the calling thread and handed to the worker's stats with the file
+			DecodeStats readStats;
+			bool mapped;
+			{
+				StageTimer timer(decodeStats(options) ? &readStats : nullptr, &DecodeStats::readNanoseconds);
+				mapped = file.open(imagePath);
+				if (mapped) {
+					file.prefetch();
+				}
+			}
+			if (!mapped) {
+				results[index] = std::unexpected("Failed to map image file: " + imagePath.string());
+				mappingSlots.release();
+				continue;
+			}
+			if (file.data().empty()) {
+				results[index] = std::unexpected("Image file is empty: " + imagePath.string());
+				mappingSlots.release();
+				continue;
+			}
+
+			pool.submit([&, index, readStats, file = std::move(file)]() mutable {
+				const std::filesystem::path& imagePath = imagePaths[index];
+				try {
+					StatsScope statsScope(options);
+					if (DecodeStats* stats = decodeStats(statsScope.options())) {
+						stats->readNanoseconds += readStats.readNanoseconds;
+					}
+					results[index] = decodeImage(file.data(), requiredChannels, statsScope.options(), imagePath.string());
+				}
+				catch (const std::exception& e) {
+					results[index] = std::unexpected(std::string(e.what()));
+				}
+				file.close();
+				mappingSlots.release();
+			});
+		}
+		pool.wait();
+		return results;
+	}
+
+	RowDecoder::RowDecoder(std::unique_ptr<PngRowStream> stream) : stream(std::move(stream)) {}
+	RowDecoder::RowDecoder(RowDecoder&& other) noexcept = default;
+	RowDecoder& RowDecoder::operator=(RowDecoder&& other) noexcept = default;
+	RowDecoder::~RowDecoder() = default;
+
+	std::expected<RowDecoder, std::string> RowDecoder::open(std::span<const uint8_t> data, uint16_t requiredChannels) {
+		if (detectFormat(data) != ImageFormat::PNG) {
+			return std::unexpected("Row decoding is only supported for PNG images");
+		}
+		try {
+			return RowDecoder(std::make_unique<PngRowStream>(data, requiredChannels));
+		}
+		catch (const std::exception& e) {
+			return std::unexpected(std::string(e.what()));
+		}
+	}
+
+	uint32_t RowDecoder::width() const {
+		return stream->width();
+	}
+
+	uint32_t RowDecoder::height() const {
+		return stream->height();
+	}
+
+	uint16_t RowDecoder::channels() const {
+		return stream->channels();
+	}
+
+	std::expected<bool, std::string> RowDecoder::readRow(std::span<uint8_t> row) {
+		if (row.size() < static_cast<size_t>(width()) * channels()) {
+			return std::unexpected("Row buffer is smaller than one output row");
+		}
+		try {
+			return stream->nextRow(row.data());
+		}
+		catch (const std::exception& e) {
+			return std::unexpected(std::string(e.what()));
+		}
+	}
+
+	struct DecoderState {
+		explicit DecoderState(size_t maxRetainedBytes) : arena(maxRetainedBytes) {}
+
+		ScratchArena arena;
+	};
+
+	// Points a load's options at the decoder's arena and resets the arena once the load is done,
+	// however it ends
+	class ArenaLoad {
+	public:
+		ArenaLoad(DecoderState& state, const LoadOptions& options) : arena(state.arena), arenaOptions(options) {
+			arenaOptions.scratchMemory = &arena;
+		}
+		~ArenaLoad() { arena.reset(); }
+		ArenaLoad(const ArenaLoad&) = delete;
+		ArenaLoad& operator=(const ArenaLoad&) = delete;
+
+		const LoadOptions& options() const { return arenaOptions; }
+
+	private:
+		ScratchArena& arena;
+		LoadOptions arenaOptions;
+	};
+
+	Decoder::Decoder(size_t maxRetainedBytes) : state(std::make_unique<DecoderState>(maxRetainedBytes)) {}
+	Decoder::Decoder(Decoder&& other) noexcept = default;
+	Decoder& Decoder::operator=(Decoder&& other) noexcept = default;
+	Decoder::~Decoder() = default;
+
+	std::expected<Image, std::string> Decoder::load(const std::filesystem::path& imagePath, uint16_t requiredChannels, const LoadOptions& options) {
+		ArenaLoad load(*state, options);
+		StatsScope statsScope(load.options());
+		std::pmr::polymorphic_allocator<char> allocator(&state->arena);
+		const std::pmr::string sourceName = imagePath.string<char, std::char_traits<char>>(allocator);
+		// mapped rather than read, since a stream allocates its buffer and locale state per open
+		MappedFile file;
+		{
+			StageTimer timer(decodeStats(statsScope.options()), &DecodeStats::readNanoseconds);
+			if (!file.open(imagePath)) {
+				return std::unexpected("Failed to map image file: " + imagePath.string());
+			}
+		}
+		if (file.data().empty()) {
+			return std::unexpected("Image file is empty: " + imagePath.string());
+		}
+		return decodeImage(file.data(), requiredChannels, statsScope.options(), sourceName);
+	}
+
+	std::expected<Image, std::string> Decoder::loadFromMemory(std::span<const uint8_t> data, uint16_t requiredChannels, const LoadOptions& options) {
+		if (data.empty()) {
+			return std::unexpected("Image data is empty");
+		}
+		ArenaLoad load(*state, options);
+		StatsScope statsScope(load.options());
+		return decodeImage(data, requiredChannels, statsScope.options(), "<memory>");
+	}
+
+	std::expected<ImageInfo, std::string> Decoder::loadInto(std::span<const uint8_t> data, std::span<uint8_t> dst, size_t rowPitch, uint16_t channels, const LoadOptions& options) {
+		if (data.empty()) {
+			return std::unexpected("Image data is empty");
+		}
+		ArenaLoad load(*state, options);
+		StatsScope statsScope(load.options());
+		return decodeImageInto(data, dst, rowPitch, channels, statsScope.options(), "<memory>");
+	}
+
+	size_t Decoder::arenaBytes() const {
+		return state->arena.retainedBytes();
+	}
+
+	void Decoder::shrink(size_t bytes) {
+		state->arena.shrink(bytes);
+	}
+
+	void Decoder::setMaxRetainedBytes(size_t bytes) {
+		state->arena.setMaxRetainedBytes(bytes);
 	}
-}
\ No newline at end of file
+}
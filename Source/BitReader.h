@@ -1,23 +1,216 @@
 #pragma once
-#include <vector>
-#include <stdexcept>
+#include <algorithm>
+#include <bit>
 #include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <vector>
 
-class BitReader {
+enum class BitOrder {
+	LsbFirst, // DEFLATE streams
+	MsbFirst // packed PNG samples
+};
+
+// Reads bits through a 64-bit buffer that is refilled a whole word at a time.
+// Bits above bitCount are either zero or the next unread bits of the input,
+// which is what lets refill() OR a full unaligned word into the buffer.
+// Whole-word loads only happen inside one segment; crossing into the next
+// segment goes through the byte-wise path.
+template<BitOrder Order>
+class BasicBitReader {
 public:
-	BitReader(const std::vector<uint8_t>& data, bool isReversed = false) : mem(data), pos(0), b(0), numBits(0), reversed(isReversed) {}
-	~BitReader() = default;
+	BasicBitReader(std::span<const uint8_t> data) : mem(data) {}
+	// reads the segments back to back as one stream, e.g. the payloads of consecutive IDAT chunks
+	BasicBitReader(std::span<const std::span<const uint8_t>> segments) : segments(segments) { nextSegment(); }
+	~BasicBitReader() = default;
 
-	uint8_t readByte();
-	int readBit();
+	void refill();
+	// bits past the end of data read as zero
+	uint32_t peekBits(int n);
+	void consume(int n);
 	uint32_t readBits(int n);
+	int readBit() { return static_cast<int>(readBits(1)); }
+
+	// unchecked variants for loops that have already verified enough input remains
+	bool canRefillFast() const { return pos + sizeof(uint64_t) <= mem.size(); }
+	// bits in the buffer, which the unchecked variants may read without a refill
+	int bufferedBits() const { return bitCount; }
+	void refillFast();
+	uint32_t peekBitsFast(int n) const;
+	void consumeFast(int n);
+	uint32_t readBitsFast(int n);
+
+	void alignToByte() { consume(bitCount & 7); }
+	// bits read so far; only meaningful for a reader over a single span
+	size_t bitPosition() const { return pos * 8 - bitCount; }
+	uint8_t readByte();
 	uint32_t readBytes(int n);
+	void readAlignedBytes(uint8_t* dst, size_t n);
 	static uint32_t combineBytes(uint8_t byte1, uint8_t byte2, uint8_t byte3, uint8_t byte4);
 
 private:
-	const std::vector<uint8_t>& mem;
-	size_t pos;
-	uint8_t b;
-	int numBits;
-	bool reversed; // If set to true, bits are read MSB first
-};
\ No newline at end of file
+	bool nextSegment();
+
+	std::span<const uint8_t> mem;
+	std::span<const std::span<const uint8_t>> segments; // the ones after mem
+	size_t pos = 0;
+	uint64_t bitBuffer = 0;
+	int bitCount = 0;
+};
+
+using BitReader = BasicBitReader<BitOrder::LsbFirst>;
+using ReversedBitReader = BasicBitReader<BitOrder::MsbFirst>;
+
+template<BitOrder Order>
+inline bool BasicBitReader<Order>::nextSegment() {
+	while (!segments.empty()) {
+		mem = segments.front();
+		segments = segments.subspan(1);
+		pos = 0;
+		if (!mem.empty()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+template<BitOrder Order>
+inline void BasicBitReader<Order>::refillFast() {
+	uint64_t word;
+	std::memcpy(&word, mem.data() + pos, sizeof(word));
+	if constexpr (Order == BitOrder::LsbFirst) {
+		if constexpr (std::endian::native == std::endian::big) {
+			word = std::byteswap(word);
+		}
+		bitBuffer |= word << bitCount;
+	}
+	else {
+		if constexpr (std::endian::native == std::endian::little) {
+			word = std::byteswap(word);
+		}
+		bitBuffer |= word >> bitCount;
+	}
+	pos += (63 - bitCount) >> 3;
+	bitCount |= 56;
+}
+
+template<BitOrder Order>
+inline void BasicBitReader<Order>::refill() {
+	if (canRefillFast()) {
+		refillFast();
+		return;
+	}
+
+	while (bitCount <= 56) {
+		if (pos == mem.size() && !nextSegment()) {
+			break;
+		}
+		uint64_t byte = mem[pos++];
+		if constexpr (Order == BitOrder::LsbFirst) {
+			bitBuffer |= byte << bitCount;
+		}
+		else {
+			bitBuffer |= byte << (56 - bitCount);
+		}
+		bitCount += 8;
+	}
+}
+
+template<BitOrder Order>
+inline uint32_t BasicBitReader<Order>::peekBitsFast(int n) const {
+	if constexpr (Order == BitOrder::LsbFirst) {
+		return static_cast<uint32_t>(bitBuffer & ((uint64_t(1) << n) - 1));
+	}
+	else {
+		return n ? static_cast<uint32_t>(bitBuffer >> (64 - n)) : 0;
+	}
+}
+
+template<BitOrder Order>
+inline void BasicBitReader<Order>::consumeFast(int n) {
+	if constexpr (Order == BitOrder::LsbFirst) {
+		bitBuffer >>= n;
+	}
+	else {
+		bitBuffer <<= n;
+	}
+	bitCount -= n;
+}
+
+template<BitOrder Order>
+inline uint32_t BasicBitReader<Order>::readBitsFast(int n) {
+	uint32_t out = peekBitsFast(n);
+	consumeFast(n);
+	return out;
+}
+
+template<BitOrder Order>
+inline uint32_t BasicBitReader<Order>::peekBits(int n) {
+	if (bitCount < n) {
+		refill();
+	}
+	return peekBitsFast(n);
+}
+
+template<BitOrder Order>
+inline void BasicBitReader<Order>::consume(int n) {
+	if (n > bitCount) {
+		throw std::out_of_range("BitReader: read out of bounds");
+	}
+	consumeFast(n);
+}
+
+template<BitOrder Order>
+inline uint32_t BasicBitReader<Order>::readBits(int n) {
+	uint32_t out = peekBits(n);
+	consume(n);
+	return out;
+}
+
+template<BitOrder Order>
+inline uint8_t BasicBitReader<Order>::readByte() {
+	alignToByte();
+	return static_cast<uint8_t>(readBits(8));
+}
+
+template<BitOrder Order>
+inline uint32_t BasicBitReader<Order>::readBytes(int n) {
+	uint32_t out = 0;
+	for (int i = 0; i < n; i++) {
+		out |= (static_cast<uint32_t>(readByte()) << (i * 8));
+	}
+	return out;
+}
+
+template<BitOrder Order>
+inline void BasicBitReader<Order>::readAlignedBytes(uint8_t* dst, size_t n) {
+	alignToByte();
+	while (n > 0 && bitCount > 0) {
+		*dst++ = static_cast<uint8_t>(readBits(8));
+		n--;
+	}
+	if (n == 0) {
+		return;
+	}
+	while (n > 0) {
+		if (pos == mem.size() && !nextSegment()) {
+			throw std::out_of_range("BitReader: readAlignedBytes out of bounds");
+		}
+		size_t count = std::min(n, mem.size() - pos);
+		std::memcpy(dst, mem.data() + pos, count);
+		dst += count;
+		pos += count;
+		n -= count;
+	}
+	// the buffer may hold lookahead bits of the bytes that were just copied
+	bitBuffer = 0;
+}
+
+template<BitOrder Order>
+inline uint32_t BasicBitReader<Order>::combineBytes(uint8_t byte1, uint8_t byte2, uint8_t byte3, uint8_t byte4) {
+	return (static_cast<uint32_t>(byte1) << 24) |
+		   (static_cast<uint32_t>(byte2) << 16) |
+		   (static_cast<uint32_t>(byte3) << 8) |
+		   (static_cast<uint32_t>(byte4));
+}
@@ -0,0 +1,748 @@
+#include "BlockCompress.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+using AxImageLoader::BlockCompression;
+using AxImageLoader::BlockFormat;
+
+#pragma region Blocks
+// the 16 pixels of a 4x4 block row by row, as RGBA with missing channels 0 and alpha 255
+using PixelBlock = std::array<std::array<uint8_t, 4>, 16>;
+
+static PixelBlock loadBlock(const uint8_t* pixels, uint32_t width, uint32_t height, uint16_t channels, uint32_t blockX, uint32_t blockY) {
+	PixelBlock block;
+	for (uint32_t i = 0; i < 16; i++) {
+		uint32_t x = std::min(blockX * 4 + i % 4, width - 1);
+		uint32_t y = std::min(blockY * 4 + i / 4, height - 1);
+		const uint8_t* pixel = pixels + (static_cast<size_t>(y) * width + x) * channels;
+		block[i] = { 0, 0, 0, 255 };
+		for (uint16_t c = 0; c < channels; c++) {
+			block[i][c] = pixel[c];
+		}
+	}
+	return block;
+}
+
+// Writes fields from the least significant bit of the first byte up, the order BC7 is laid out in.
+class BlockBitWriter {
+public:
+	BlockBitWriter(uint8_t* out, uint32_t bytes) : out(out) {
+		std::memset(out, 0, bytes);
+	}
+
+	void write(uint32_t value, uint32_t bits) {
+		for (uint32_t i = 0; i < bits; i++, position++) {
+			out[position >> 3] |= static_cast<uint8_t>(((value >> i) & 1) << (position & 7));
+		}
+	}
+
+private:
+	uint8_t* out;
+	uint32_t position = 0;
+};
+#pragma endregion
+
+#pragma region Endpoints
+template<int First, int Count>
+static std::array<float, Count> blockMean(const PixelBlock& block) {
+	std::array<float, Count> mean = {};
+	for (const auto& pixel : block) {
+		for (int c = 0; c < Count; c++) {
+			mean[c] += pixel[First + c];
+		}
+	}
+	for (float& m : mean) {
+		m /= 16.0f;
+	}
+	return mean;
+}
+
+// Unit direction of greatest variance, by power iteration on the covariance; zero for a block
+// of one color.
+template<int First, int Count>
+static std::array<float, Count> principalAxis(const PixelBlock& block, const std::array<float, Count>& mean) {
+	std::array<std::array<float, Count>, Count> covariance = {};
+	for (const auto& pixel : block) {
+		std::array<float, Count> d;
+		for (int c = 0; c < Count; c++) {
+			d[c] = pixel[First + c] - mean[c];
+		}
+		for (int a = 0; a < Count; a++) {
+			for (int b = 0; b < Count; b++) {
+				covariance[a][b] += d[a] * d[b];
+			}
+		}
+	}
+
+	// start from the covariance row of the channel that varies most
+	int largest = 0;
+	for (int c = 1; c < Count; c++) {
+		if (covariance[c][c] > covariance[largest][largest]) {
+			largest = c;
+		}
+	}
+	std::array<float, Count> axis = covariance[largest];
+	for (int iteration = 0; iteration < 8; iteration++) {
+		std::array<float, Count> next = {};
+		float length = 0.0f;
+		for (int a = 0; a < Count; a++) {
+			for (int b = 0; b < Count; b++) {
+				next[a] += covariance[a][b] * axis[b];
+			}
+			length = std::max(length, std::abs(next[a]));
+		}
+		if (length == 0.0f) {
+			return {};
+		}
+		for (int a = 0; a < Count; a++) {
+			axis[a] = next[a] / length;
+		}
+	}
+
+	float length = 0.0f;
+	for (float a : axis) {
+		length += a * a;
+	}
+	length = std::sqrt(length);
+	for (float& a : axis) {
+		a /= length;
+	}
+	return axis;
+}
+
+// the ends of the stretch of the principal axis the pixels project onto
+template<int First, int Count>
+static void fitLine(const PixelBlock& block, std::array<float, Count>& low, std::array<float, Count>& high) {
+	std::array<float, Count> mean = blockMean<First, Count>(block);
+	std::array<float, Count> axis = principalAxis<First, Count>(block, mean);
+	float minT = 0.0f, maxT = 0.0f;
+	for (const auto& pixel : block) {
+		float t = 0.0f;
+		for (int c = 0; c < Count; c++) {
+			t += (pixel[First + c] - mean[c]) * axis[c];
+		}
+		minT = std::min(minT, t);
+		maxT = std::max(maxT, t);
+	}
+	for (int c = 0; c < Count; c++) {
+		low[c] = std::clamp(mean[c] + minT * axis[c], 0.0f, 255.0f);
+		high[c] = std::clamp(mean[c] + maxT * axis[c], 0.0f, 255.0f);
+	}
+}
+
+// Least-squares endpoints for pixels decoded as (1 - t) * e0 + t * e1, t being where on the
+// palette each one was put. False if every pixel has the same t.
+template<int First, int Count>
+static bool solveEndpoints(const PixelBlock& block, const std::array<float, 16>& t, std::array<float, Count>& e0, std::array<float, Count>& e1) {
+	float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+	std::array<float, Count> ax = {}, bx = {};
+	for (int i = 0; i < 16; i++) {
+		float a = 1.0f - t[i];
+		float b = t[i];
+		aa += a * a;
+		bb += b * b;
+		ab += a * b;
+		for (int c = 0; c < Count; c++) {
+			ax[c] += a * block[i][First + c];
+			bx[c] += b * block[i][First + c];
+		}
+	}
+	float determinant = aa * bb - ab * ab;
+	if (determinant < 1e-4f) {
+		return false;
+	}
+	for (int c = 0; c < Count; c++) {
+		e0[c] = std::clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.0f, 255.0f);
+		e1[c] = std::clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.0f, 255.0f);
+	}
+	return true;
+}
+#pragma endregion
+
+#pragma region BC1
+static int expand5(int v) {
+	return (v << 3) | (v >> 2);
+}
+
+static int expand6(int v) {
+	return (v << 2) | (v >> 4);
+}
+
+static uint16_t packRgb565(const std::array<float, 3>& color) {
+	int r = std::clamp(static_cast<int>(std::lround(color[0] * 31.0f / 255.0f)), 0, 31);
+	int g = std::clamp(static_cast<int>(std::lround(color[1] * 63.0f / 255.0f)), 0, 63);
+	int b = std::clamp(static_cast<int>(std::lround(color[2] * 31.0f / 255.0f)), 0, 31);
+	return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+static std::array<int, 3> unpackRgb565(uint16_t color) {
+	return { expand5(color >> 11), expand6((color >> 5) & 63), expand5(color & 31) };
+}
+
+// where each index sits between the endpoints in the four-color mode
+static constexpr std::array<float, 4> bc1Positions = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+// Gives every pixel its nearest color of the four-color palette; returns the squared error.
+static uint32_t fitBc1Indices(const PixelBlock& block, uint16_t c0, uint16_t c1, uint32_t& indices) {
+	std::array<std::array<int, 3>, 4> palette;
+	palette[0] = unpackRgb565(c0);
+	palette[1] = unpackRgb565(c1);
+	for (int c = 0; c < 3; c++) {
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+
+	uint32_t error = 0;
+	indices = 0;
+	for (uint32_t i = 0; i < 16; i++) {
+		uint32_t bestError = UINT32_MAX;
+		uint32_t best = 0;
+		for (uint32_t p = 0; p < 4; p++) {
+			uint32_t e = 0;
+			for (int c = 0; c < 3; c++) {
+				int d = block[i][c] - palette[p][c];
+				e += d * d;
+			}
+			if (e < bestError) {
+				bestError = e;
+				best = p;
+			}
+		}
+		indices |= best << (2 * i);
+		error += bestError;
+	}
+	return error;
+}
+
+// For each 8-bit value, the 5- and 6-bit endpoint pairs whose 1/3 point decodes closest to it.
+// One-color blocks use them with every index at 2, which gets much closer than rounding to 565.
+// Among equally close pairs the nearest ones win, so decoders that round the interpolation
+// differently still agree.
+struct SingleColorTables {
+	std::array<std::array<uint8_t, 2>, 256> match5;
+	std::array<std::array<uint8_t, 2>, 256> match6;
+};
+
+static const SingleColorTables& singleColorTables() {
+	static const SingleColorTables tables = [] {
+		SingleColorTables t;
+		auto build = [](std::array<std::array<uint8_t, 2>, 256>& match, int levels, int (*expand)(int)) {
+			for (int v = 0; v < 256; v++) {
+				int bestError = INT32_MAX;
+				for (int high = 0; high < levels; high++) {
+					for (int low = 0; low < levels; low++) {
+						int a = expand(high);
+						int b = expand(low);
+						int error = std::abs((2 * a + b) / 3 - v) * 256 + std::abs(a - b);
+						if (error < bestError) {
+							bestError = error;
+							match[v] = { static_cast<uint8_t>(high), static_cast<uint8_t>(low) };
+						}
+					}
+				}
+			}
+		};
+		build(t.match5, 32, expand5);
+		build(t.match6, 64, expand6);
+		return t;
+	}();
+	return tables;
+}
+
+static void writeBc1Block(uint16_t c0, uint16_t c1, uint32_t indices, uint8_t* out) {
+	// a first endpoint that is not the larger one would switch the block to three colors and
+	// transparent black
+	if (c0 < c1) {
+		std::swap(c0, c1);
+		indices ^= 0x55555555;
+	}
+	else if (c0 == c1) {
+		indices = 0;
+	}
+	out[0] = static_cast<uint8_t>(c0);
+	out[1] = static_cast<uint8_t>(c0 >> 8);
+	out[2] = static_cast<uint8_t>(c1);
+	out[3] = static_cast<uint8_t>(c1 >> 8);
+	for (int i = 0; i < 4; i++) {
+		out[4 + i] = static_cast<uint8_t>(indices >> (8 * i));
+	}
+}
+
+static void encodeBc1(const PixelBlock& block, BlockCompression compression, uint8_t* out) {
+	bool singleColor = std::all_of(block.begin(), block.end(), [&](const auto& pixel) {
+		return pixel[0] == block[0][0] && pixel[1] == block[0][1] && pixel[2] == block[0][2];
+	});
+	if (singleColor) {
+		const SingleColorTables& tables = singleColorTables();
+		const auto& r = tables.match5[block[0][0]];
+		const auto& g = tables.match6[block[0][1]];
+		const auto& b = tables.match5[block[0][2]];
+		writeBc1Block(static_cast<uint16_t>((r[0] << 11) | (g[0] << 5) | b[0]), static_cast<uint16_t>((r[1] << 11) | (g[1] << 5) | b[1]), 0xAAAAAAAA, out);
+		return;
+	}
+
+	std::array<float, 3> low, high;
+	fitLine<0, 3>(block, low, high);
+	uint16_t c0 = packRgb565(high);
+	uint16_t c1 = packRgb565(low);
+	uint32_t indices;
+	uint32_t error = fitBc1Indices(block, c0, c1, indices);
+
+	// refit the endpoints to the chosen indices for as long as that keeps helping
+	int refinements = compression == BlockCompression::HighQuality ? 8 : 1;
+	for (int refinement = 0; refinement < refinements && error > 0; refinement++) {
+		std::array<float, 16> t;
+		for (int i = 0; i < 16; i++) {
+			t[i] = bc1Positions[(indices >> (2 * i)) & 3];
+		}
+		std::array<float, 3> e0, e1;
+		if (!solveEndpoints<0, 3>(block, t, e0, e1)) {
+			break;
+		}
+		uint16_t n0 = packRgb565(e0);
+		uint16_t n1 = packRgb565(e1);
+		uint32_t newIndices;
+		uint32_t newError = fitBc1Indices(block, n0, n1, newIndices);
+		if (newError >= error) {
+			break;
+		}
+		c0 = n0;
+		c1 = n1;
+		indices = newIndices;
+		error = newError;
+	}
+	writeBc1Block(c0, c1, indices, out);
+}
+#pragma endregion
+
+#pragma region BC4
+// e0 > e1 interpolates eight values; otherwise six, plus 0 and 255
+static std::array<int, 8> bc4Palette(int e0, int e1) {
+	if (e0 > e1) {
+		return { e0, e1, (6 * e0 + e1 + 3) / 7, (5 * e0 + 2 * e1 + 3) / 7, (4 * e0 + 3 * e1 + 3) / 7, (3 * e0 + 4 * e1 + 3) / 7, (2 * e0 + 5 * e1 + 3) / 7, (e0 + 6 * e1 + 3) / 7 };
+	}
+	return { e0, e1, (4 * e0 + e1 + 2) / 5, (3 * e0 + 2 * e1 + 2) / 5, (2 * e0 + 3 * e1 + 2) / 5, (e0 + 4 * e1 + 2) / 5, 0, 255 };
+}
+
+static uint32_t fitBc4Indices(const std::array<uint8_t, 16>& values, int e0, int e1, uint64_t& indices) {
+	std::array<int, 8> palette = bc4Palette(e0, e1);
+	uint32_t error = 0;
+	indices = 0;
+	for (uint32_t i = 0; i < 16; i++) {
+		uint32_t bestError = UINT32_MAX;
+		uint64_t best = 0;
+		for (uint64_t p = 0; p < 8; p++) {
+			uint32_t e = static_cast<uint32_t>(std::abs(values[i] - palette[p]));
+			if (e < bestError) {
+				bestError = e;
+				best = p;
+			}
+		}
+		indices |= best << (3 * i);
+		error += bestError * bestError;
+	}
+	return error;
+}
+
+// one channel of the block; BC3 alpha and both halves of BC5 are BC4 blocks too
+static void encodeBc4(const PixelBlock& block, uint32_t channel, BlockCompression compression, uint8_t* out) {
+	std::array<uint8_t, 16> values;
+	for (int i = 0; i < 16; i++) {
+		values[i] = block[i][channel];
+	}
+	auto [minValue, maxValue] = std::minmax_element(values.begin(), values.end());
+	int low = *minValue, high = *maxValue;
+
+	int e0 = high, e1 = low;
+	uint64_t indices;
+	uint32_t error = fitBc4Indices(values, e0, e1, indices);
+	auto tryEndpoints = [&](int a, int b) {
+		uint64_t newIndices;
+		uint32_t newError = fitBc4Indices(values, a, b, newIndices);
+		if (newError < error) {
+			e0 = a;
+			e1 = b;
+			indices = newIndices;
+			error = newError;
+		}
+	};
+	if (compression == BlockCompression::HighQuality && error > 0) {
+		// endpoints pulled in a little often land the inner values on palette entries
+		for (int a = high; a >= std::max(low + 1, high - 4); a--) {
+			for (int b = low; b <= std::min(a - 1, low + 4); b++) {
+				tryEndpoints(a, b);
+			}
+		}
+		// the six-value palette has exact 0 and 255, which suits blocks that touch either
+		int innerLow = 255, innerHigh = 0;
+		for (uint8_t v : values) {
+			if (v != 0 && v != 255) {
+				innerLow = std::min<int>(innerLow, v);
+				innerHigh = std::max<int>(innerHigh, v);
+			}
+		}
+		if (innerLow <= innerHigh) {
+			tryEndpoints(innerLow, innerHigh);
+		}
+	}
+
+	out[0] = static_cast<uint8_t>(e0);
+	out[1] = static_cast<uint8_t>(e1);
+	for (int i = 0; i < 6; i++) {
+		out[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+	}
+}
+#pragma endregion
+
+#pragma region BC7
+// Only modes 6 and 5 are used: one subset with RGBA endpoints and 4-bit indices, and one
+// subset with separate 2-bit color and alpha indices for blocks whose alpha does not follow
+// the color. Both are single-subset, so no partition search is needed.
+static constexpr std::array<int, 16> bc7Weights4 = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+static constexpr std::array<int, 4> bc7Weights2 = { 0, 21, 43, 64 };
+
+static int bc7Interpolate(int e0, int e1, int weight) {
+	return ((64 - weight) * e0 + weight * e1 + 32) >> 6;
+}
+
+// Gives every pixel the weight nearest its projection onto the endpoint segment, checking the
+// neighbouring weights too since they are not evenly spaced; returns the squared error.
+template<int First, int Count, size_t Entries>
+static uint32_t fitBc7Indices(const PixelBlock& block, const std::array<int, Count>& e0, const std::array<int, Count>& e1, const std::array<int, Entries>& weights, std::array<uint8_t, 16>& indices) {
+	std::array<std::array<int, Count>, Entries> palette;
+	int lengthSquared = 0;
+	for (int c = 0; c < Count; c++) {
+		for (size_t p = 0; p < Entries; p++) {
+			palette[p][c] = bc7Interpolate(e0[c], e1[c], weights[p]);
+		}
+		lengthSquared += (e1[c] - e0[c]) * (e1[c] - e0[c]);
+	}
+
+	uint32_t error = 0;
+	for (int i = 0; i < 16; i++) {
+		int guess = 0;
+		if (lengthSquared > 0) {
+			int dot = 0;
+			for (int c = 0; c < Count; c++) {
+				dot += (block[i][First + c] - e0[c]) * (e1[c] - e0[c]);
+			}
+			guess = std::clamp(static_cast<int>(std::lround(static_cast<float>(dot) / lengthSquared * (Entries - 1))), 0, static_cast<int>(Entries) - 1);
+		}
+		uint32_t bestError = UINT32_MAX;
+		for (int p = std::max(0, guess - 1); p <= std::min(static_cast<int>(Entries) - 1, guess + 1); p++) {
+			uint32_t e = 0;
+			for (int c = 0; c < Count; c++) {
+				int d = block[i][First + c] - palette[p][c];
+				e += d * d;
+			}
+			if (e < bestError) {
+				bestError = e;
+				indices[i] = static_cast<uint8_t>(p);
+			}
+		}
+		error += bestError;
+	}
+	return error;
+}
+
+template<size_t Entries>
+static std::array<float, 16> bc7Positions(const std::array<uint8_t, 16>& indices, const std::array<int, Entries>& weights) {
+	std::array<float, 16> t;
+	for (int i = 0; i < 16; i++) {
+		t[i] = weights[indices[i]] / 64.0f;
+	}
+	return t;
+}
+
+// mode 6 endpoint: 7 bits per channel plus one low bit shared by the four channels
+struct Mode6Endpoint {
+	std::array<int, 4> q;
+	int p;
+
+	std::array<int, 4> value() const {
+		return { q[0] << 1 | p, q[1] << 1 | p, q[2] << 1 | p, q[3] << 1 | p };
+	}
+};
+
+static Mode6Endpoint quantizeMode6(const std::array<float, 4>& color, int p) {
+	Mode6Endpoint endpoint = { {}, p };
+	for (int c = 0; c < 4; c++) {
+		endpoint.q[c] = std::clamp(static_cast<int>(std::lround((color[c] - p) / 2.0f)), 0, 127);
+	}
+	return endpoint;
+}
+
+// with the shared bit that rounds the four channels best
+static Mode6Endpoint quantizeMode6(const std::array<float, 4>& color) {
+	Mode6Endpoint best = {};
+	float bestError = 0.0f;
+	for (int p = 0; p < 2; p++) {
+		Mode6Endpoint endpoint = quantizeMode6(color, p);
+		std::array<int, 4> v = endpoint.value();
+		float error = 0.0f;
+		for (int c = 0; c < 4; c++) {
+			error += (v[c] - color[c]) * (v[c] - color[c]);
+		}
+		if (p == 0 || error < bestError) {
+			best = endpoint;
+			bestError = error;
+		}
+	}
+	return best;
+}
+
+static uint32_t encodeBc7Mode6(const PixelBlock& block, uint8_t* out) {
+	// alpha 255 takes q = 127 with a shared bit of 1, so an opaque block keeps both endpoints
+	// there; anything else decodes to 254 at best
+	const bool opaque = std::all_of(block.begin(), block.end(), [](const auto& pixel) { return pixel[3] == 255; });
+	auto quantize = [&](const std::array<float, 4>& color) {
+		if (!opaque) {
+			return quantizeMode6(color);
+		}
+		Mode6Endpoint endpoint = quantizeMode6(color, 1);
+		endpoint.q[3] = 127;
+		return endpoint;
+	};
+
+	std::array<float, 4> low, high;
+	fitLine<0, 4>(block, low, high);
+	std::array<Mode6Endpoint, 2> endpoints = { quantize(low), quantize(high) };
+	std::array<uint8_t, 16> indices;
+	uint32_t error = fitBc7Indices<0, 4>(block, endpoints[0].value(), endpoints[1].value(), bc7Weights4, indices);
+
+	auto tryEndpoints = [&](const std::array<Mode6Endpoint, 2>& candidate) {
+		std::array<uint8_t, 16> newIndices;
+		uint32_t newError = fitBc7Indices<0, 4>(block, candidate[0].value(), candidate[1].value(), bc7Weights4, newIndices);
+		if (newError >= error) {
+			return false;
+		}
+		endpoints = candidate;
+		indices = newIndices;
+		error = newError;
+		return true;
+	};
+
+	for (int refinement = 0; refinement < 4 && error > 0; refinement++) {
+		if (!solveEndpoints<0, 4>(block, bc7Positions(indices, bc7Weights4), low, high) || !tryEndpoints({ quantize(low), quantize(high) })) {
+			break;
+		}
+	}
+	// each endpoint picked its shared bit alone; try the other pairings, then nudge every value a
+	// step. Opaque blocks have neither a choice of bit nor an alpha to nudge.
+	for (int p0 = 0; p0 < 2 && error > 0 && !opaque; p0++) {
+		for (int p1 = 0; p1 < 2; p1++) {
+			tryEndpoints({ quantizeMode6(low, p0), quantizeMode6(high, p1) });
+		}
+	}
+	// no line fits pixels that stray from the rest in different directions, and the fitted one
+	// can then do worse than the mean color alone
+	if (error > 0) {
+		const std::array<float, 4> mean = blockMean<0, 4>(block);
+		tryEndpoints({ quantize(mean), quantize(mean) });
+	}
+	for (int e = 0; e < 2 && error > 0; e++) {
+		for (int c = 0; c < (opaque ? 3 : 4); c++) {
+			for (int step : { -1, 1 }) {
+				std::array<Mode6Endpoint, 2> candidate = endpoints;
+				candidate[e].q[c] += step;
+				if (candidate[e].q[c] >= 0 && candidate[e].q[c] <= 127) {
+					tryEndpoints(candidate);
+				}
+			}
+		}
+	}
+
+	// pixel 0 is stored without the top bit of its index, so that bit must be clear
+	if (indices[0] >= 8) {
+		std::swap(endpoints[0], endpoints[1]);
+		for (uint8_t& index : indices) {
+			index = static_cast<uint8_t>(15 - index);
+		}
+	}
+	BlockBitWriter bits(out, 16);
+	bits.write(1 << 6, 7);
+	for (int c = 0; c < 4; c++) {
+		bits.write(endpoints[0].q[c], 7);
+		bits.write(endpoints[1].q[c], 7);
+	}
+	bits.write(endpoints[0].p, 1);
+	bits.write(endpoints[1].p, 1);
+	bits.write(indices[0], 3);
+	for (int i = 1; i < 16; i++) {
+		bits.write(indices[i], 4);
+	}
+	return error;
+}
+
+// mode 5 color endpoint channels have 7 bits, expanded by repeating the top one
+static std::array<int, 3> quantizeMode5(const std::array<float, 3>& color) {
+	std::array<int, 3> q;
+	for (int c = 0; c < 3; c++) {
+		q[c] = std::clamp(static_cast<int>(std::lround(color[c] * 127.0f / 255.0f)), 0, 127);
+	}
+	return q;
+}
+
+static std::array<int, 3> expandMode5(const std::array<int, 3>& q) {
+	return { q[0] << 1 | q[0] >> 6, q[1] << 1 | q[1] >> 6, q[2] << 1 | q[2] >> 6 };
+}
+
+static uint32_t encodeBc7Mode5(const PixelBlock& block, uint8_t* out) {
+	std::array<float, 3> low, high;
+	fitLine<0, 3>(block, low, high);
+	std::array<std::array<int, 3>, 2> color = { quantizeMode5(low), quantizeMode5(high) };
+	std::array<uint8_t, 16> colorIndices;
+	uint32_t colorError = fitBc7Indices<0, 3>(block, expandMode5(color[0]), expandMode5(color[1]), bc7Weights2, colorIndices);
+	for (int refinement = 0; refinement < 4 && colorError > 0; refinement++) {
+		if (!solveEndpoints<0, 3>(block, bc7Positions(colorIndices, bc7Weights2), low, high)) {
+			break;
+		}
+		std::array<std::array<int, 3>, 2> candidate = { quantizeMode5(low), quantizeMode5(high) };
+		std::array<uint8_t, 16> newIndices;
+		uint32_t newError = fitBc7Indices<0, 3>(block, expandMode5(candidate[0]), expandMode5(candidate[1]), bc7Weights2, newIndices);
+		if (newError >= colorError) {
+			break;
+		}
+		color = candidate;
+		colorIndices = newIndices;
+		colorError = newError;
+	}
+
+	// alpha endpoints are stored with all 8 bits
+	std::array<int, 1> alphaLow = { 255 }, alphaHigh = { 0 };
+	for (const auto& pixel : block) {
+		alphaLow[0] = std::min<int>(alphaLow[0], pixel[3]);
+		alphaHigh[0] = std::max<int>(alphaHigh[0], pixel[3]);
+	}
+	std::array<std::array<int, 1>, 2> alpha = { alphaLow, alphaHigh };
+	std::array<uint8_t, 16> alphaIndices;
+	uint32_t alphaError = fitBc7Indices<3, 1>(block, alpha[0], alpha[1], bc7Weights2, alphaIndices);
+	for (int refinement = 0; refinement < 4 && alphaError > 0; refinement++) {
+		std::array<float, 1> a0, a1;
+		if (!solveEndpoints<3, 1>(block, bc7Positions(alphaIndices, bc7Weights2), a0, a1)) {
+			break;
+		}
+		std::array<std::array<int, 1>, 2> candidate = { { { static_cast<int>(std::lround(a0[0])) }, { static_cast<int>(std::lround(a1[0])) } } };
+		std::array<uint8_t, 16> newIndices;
+		uint32_t newError = fitBc7Indices<3, 1>(block, candidate[0], candidate[1], bc7Weights2, newIndices);
+		if (newError >= alphaError) {
+			break;
+		}
+		alpha = candidate;
+		alphaIndices = newIndices;
+		alphaError = newError;
+	}
+
+	if (colorIndices[0] >= 2) {
+		std::swap(color[0], color[1]);
+		for (uint8_t& index : colorIndices) {
+			index = static_cast<uint8_t>(3 - index);
+		}
+	}
+	if (alphaIndices[0] >= 2) {
+		std::swap(alpha[0], alpha[1]);
+		for (uint8_t& index : alphaIndices) {
+			index = static_cast<uint8_t>(3 - index);
+		}
+	}
+	BlockBitWriter bits(out, 16);
+	bits.write(1 << 5, 6);
+	// no channel rotation
+	bits.write(0, 2);
+	for (int c = 0; c < 3; c++) {
+		bits.write(color[0][c], 7);
+		bits.write(color[1][c], 7);
+	}
+	bits.write(alpha[0][0], 8);
+	bits.write(alpha[1][0], 8);
+	bits.write(colorIndices[0], 1);
+	for (int i = 1; i < 16; i++) {
+		bits.write(colorIndices[i], 2);
+	}
+	bits.write(alphaIndices[0], 1);
+	for (int i = 1; i < 16; i++) {
+		bits.write(alphaIndices[i], 2);
+	}
+	return colorError + alphaError;
+}
+
+static void encodeBc7(const PixelBlock& block, uint8_t* out) {
+	uint32_t error = encodeBc7Mode6(block, out);
+	bool varyingAlpha = std::any_of(block.begin(), block.end(), [&](const auto& pixel) { return pixel[3] != block[0][3]; });
+	if (varyingAlpha && error > 0) {
+		std::array<uint8_t, 16> mode5;
+		if (encodeBc7Mode5(block, mode5.data()) < error) {
+			std::memcpy(out, mode5.data(), mode5.size());
+		}
+	}
+}
+#pragma endregion
+
+BlockFormat selectBlockFormat(std::span<const uint8_t> pixels, uint16_t channels, BlockCompression compression) {
+	if (compression == BlockCompression::None) {
+		return BlockFormat::None;
+	}
+	bool highQuality = compression == BlockCompression::HighQuality;
+	switch (channels) {
+	case 1:
+		return BlockFormat::BC4;
+	case 2:
+		return BlockFormat::BC5;
+	case 3:
+		return highQuality ? BlockFormat::BC7 : BlockFormat::BC1;
+	default:
+		if (highQuality) {
+			return BlockFormat::BC7;
+		}
+		// requiredChannels = 4 on an opaque image adds an alpha channel that BC1 stores for free
+		for (size_t i = 3; i < pixels.size(); i += 4) {
+			if (pixels[i] != 255) {
+				return BlockFormat::BC3;
+			}
+		}
+		return BlockFormat::BC1;
+	}
+}
+
+uint32_t blockBytes(BlockFormat format) {
+	return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+}
+
+size_t blockLevelBytes(uint32_t width, uint32_t height, BlockFormat format) {
+	return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+void encodeBlockRows(const uint8_t* pixels, uint32_t width, uint32_t height, uint16_t channels, BlockFormat format, BlockCompression compression, uint32_t firstBlockRow, uint32_t blockRowCount, uint8_t* blocks) {
+	const uint32_t blocksWide = (width + 3) / 4;
+	const uint32_t bytes = blockBytes(format);
+	for (uint32_t blockY = firstBlockRow; blockY < firstBlockRow + blockRowCount; blockY++) {
+		for (uint32_t blockX = 0; blockX < blocksWide; blockX++) {
+			PixelBlock block = loadBlock(pixels, width, height, channels, blockX, blockY);
+			uint8_t* out = blocks + (static_cast<size_t>(blockY) * blocksWide + blockX) * bytes;
+			switch (format) {
+			case BlockFormat::BC1:
+				encodeBc1(block, compression, out);
+				break;
+			case BlockFormat::BC3:
+				encodeBc4(block, 3, compression, out);
+				encodeBc1(block, compression, out + 8);
+				break;
+			case BlockFormat::BC4:
+				encodeBc4(block, 0, compression, out);
+				break;
+			case BlockFormat::BC5:
+				encodeBc4(block, 0, compression, out);
+				encodeBc4(block, 1, compression, out + 8);
+				break;
+			case BlockFormat::BC7:
+				encodeBc7(block, out);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include "AxImageLoader.h"
+#include <cstdint>
+#include <span>
+
+// Encodes 8-bit pixels into BCn blocks. Blocks past the right or bottom edge of a level
+// repeat its last column and row.
+
+// the format LoadOptions::blockCompression picks for pixels with this many channels
+AxImageLoader::BlockFormat selectBlockFormat(std::span<const uint8_t> pixels, uint16_t channels, AxImageLoader::BlockCompression compression);
+
+// 8 for BC1 and BC4, 16 for the rest
+uint32_t blockBytes(AxImageLoader::BlockFormat format);
+size_t blockLevelBytes(uint32_t width, uint32_t height, AxImageLoader::BlockFormat format);
+
+// Encodes block rows firstBlockRow to firstBlockRow + blockRowCount - 1 of a width x height
+// level into blocks, the start of the level's block data. Rows can be encoded on different
+// threads at the same time.
+void encodeBlockRows(const uint8_t* pixels, uint32_t width, uint32_t height, uint16_t channels, AxImageLoader::BlockFormat format, AxImageLoader::BlockCompression compression, uint32_t firstBlockRow, uint32_t blockRowCount, uint8_t* blocks);
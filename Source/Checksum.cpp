@@ -0,0 +1,350 @@
+#include "Checksum.h"
+#include "CpuFeatures.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+
+// largest n such that 255 * n * (n + 1) / 2 + (n + 1) * (adlerBase - 1) fits in 32 bits, i.e.
+// how many bytes can be summed before s2 has to be reduced
+static constexpr uint32_t adlerBase = 65521;
+static constexpr size_t adlerMaxRun = 5552;
+
+using ChecksumFunction = uint32_t (*)(uint32_t, const uint8_t*, size_t);
+
+#pragma region Scalar
+static uint32_t adler32Scalar(uint32_t adler, const uint8_t* data, size_t n) {
+	uint32_t s1 = adler & 0xFFFF;
+	uint32_t s2 = adler >> 16;
+	while (n > 0) {
+		size_t run = std::min(n, adlerMaxRun);
+		n -= run;
+		for (size_t i = 0; i < run; i++) {
+			s1 += data[i];
+			s2 += s1;
+		}
+		data += run;
+		s1 %= adlerBase;
+		s2 %= adlerBase;
+	}
+	return (s2 << 16) | s1;
+}
+
+// table k advances a byte through k further zero bytes, so eight bytes fold in one step
+static constexpr std::array<std::array<uint32_t, 256>, 8> makeCrcTables() {
+	std::array<std::array<uint32_t, 256>, 8> tables = {};
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int bit = 0; bit < 8; bit++) {
+			c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+		}
+		tables[0][i] = c;
+	}
+	for (uint32_t i = 0; i < 256; i++) {
+		for (size_t k = 1; k < 8; k++) {
+			tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xFF];
+		}
+	}
+	return tables;
+}
+
+static constexpr auto crcTables = makeCrcTables();
+
+// slice-by-8; crc is the inverted running value
+static uint32_t crc32Scalar(uint32_t crc, const uint8_t* data, size_t n) {
+	for (; n >= 8; n -= 8, data += 8) {
+		crc ^= static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+			   (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+		crc = crcTables[7][crc & 0xFF] ^ crcTables[6][(crc >> 8) & 0xFF] ^
+			  crcTables[5][(crc >> 16) & 0xFF] ^ crcTables[4][crc >> 24] ^
+			  crcTables[3][data[4]] ^ crcTables[2][data[5]] ^
+			  crcTables[1][data[6]] ^ crcTables[0][data[7]];
+	}
+	for (; n > 0; n--, data++) {
+		crc = crcTables[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+	}
+	return crc;
+}
+#pragma endregion
+
+#if AX_ARCH_X86
+#pragma region X86
+// Per 32-byte block: s1 grows by the byte sum (psadbw) and s2 by the bytes weighted 32..1
+// (pmaddubsw) plus 32 times the s1 of all earlier blocks, which v_ps collects.
+AX_TARGET("ssse3")
+static uint32_t adler32Ssse3(uint32_t adler, const uint8_t* data, size_t n) {
+	uint32_t s1 = adler & 0xFFFF;
+	uint32_t s2 = adler >> 16;
+	size_t blocks = n / 32;
+	n -= blocks * 32;
+
+	const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+	const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi16(1);
+	while (blocks > 0) {
+		size_t run = std::min(blocks, adlerMaxRun / 32);
+		blocks -= run;
+		__m128i v_ps = _mm_cvtsi32_si128(static_cast<int32_t>(s1 * run));
+		__m128i v_s2 = _mm_cvtsi32_si128(static_cast<int32_t>(s2));
+		__m128i v_s1 = _mm_setzero_si128();
+		for (size_t i = 0; i < run; i++, data += 32) {
+			__m128i bytes1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+			__m128i bytes2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+			v_ps = _mm_add_epi32(v_ps, v_s1);
+			v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+			v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+			v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+			v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+		}
+		v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+		// horizontal sums; psadbw leaves v_s1 in lanes 0 and 2
+		v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+		v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+		v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+		s1 = (s1 + static_cast<uint32_t>(_mm_cvtsi128_si32(v_s1))) % adlerBase;
+		s2 = static_cast<uint32_t>(_mm_cvtsi128_si32(v_s2)) % adlerBase;
+	}
+	return adler32Scalar((s2 << 16) | s1, data, n);
+}
+
+// advances x by one 16-byte lane and adds next
+AX_TARGET("pclmul")
+static inline __m128i foldLane(__m128i x, __m128i next, __m128i k) {
+	__m128i low = _mm_clmulepi64_si128(x, k, 0x00);
+	__m128i high = _mm_clmulepi64_si128(x, k, 0x11);
+	return _mm_xor_si128(_mm_xor_si128(high, low), next);
+}
+
+// Carry-less multiply folding from Intel's "Fast CRC Computation for Generic Polynomials
+// Using PCLMULQDQ", with the bit-reflected constants for the zlib polynomial. Folds four
+// 16-byte lanes, then one, then reduces with Barrett; needs at least 64 bytes.
+AX_TARGET("pclmul")
+static uint32_t crc32FoldPclmul(uint32_t crc, const uint8_t* data, size_t n) {
+	const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596, 0x0154442BD4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009E, 0x01751997D0);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163CD6124);
+	const __m128i poly = _mm_set_epi64x(0x01F7011641, 0x01DB710641);
+	const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+
+	__m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0));
+	__m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+	__m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32));
+	__m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int32_t>(crc)));
+	data += 64;
+	n -= 64;
+
+	for (; n >= 64; n -= 64, data += 64) {
+		__m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		__m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		__m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		__m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x11), x5);
+		x2 = _mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x11), x6);
+		x3 = _mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x11), x7);
+		x4 = _mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x11), x8);
+		x1 = _mm_xor_si128(x1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0)));
+		x2 = _mm_xor_si128(x2, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)));
+		x3 = _mm_xor_si128(x3, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32)));
+		x4 = _mm_xor_si128(x4, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48)));
+	}
+
+	x1 = foldLane(x1, x2, k3k4);
+	x1 = foldLane(x1, x3, k3k4);
+	x1 = foldLane(x1, x4, k3k4);
+	for (; n >= 16; n -= 16, data += 16) {
+		x1 = foldLane(x1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), k3k4);
+	}
+
+	// 128 to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5k0, 0x00), x2);
+
+	// Barrett reduction to 32 bits
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(x1, 4)));
+}
+
+static uint32_t crc32Pclmul(uint32_t crc, const uint8_t* data, size_t n) {
+	if (n >= 64) {
+		size_t folded = n & ~size_t(15);
+		crc = crc32FoldPclmul(crc, data, folded);
+		data += folded;
+		n -= folded;
+	}
+	return crc32Scalar(crc, data, n);
+}
+#pragma endregion
+#endif
+
+#if AX_ARCH_ARM64
+#pragma region Neon
+// same block scheme as the SSSE3 version; the weighted sum is built from per-column byte
+// totals, which fit in 16 bits for a whole run
+static uint32_t adler32Neon(uint32_t adler, const uint8_t* data, size_t n) {
+	static const uint16_t weights[32] = {
+		32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+		16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1
+	};
+	uint32_t s1 = adler & 0xFFFF;
+	uint32_t s2 = adler >> 16;
+	size_t blocks = n / 32;
+	n -= blocks * 32;
+
+	while (blocks > 0) {
+		size_t run = std::min(blocks, adlerMaxRun / 32);
+		blocks -= run;
+		uint32x4_t v_s2 = vsetq_lane_u32(static_cast<uint32_t>(s1 * run), vdupq_n_u32(0), 0);
+		uint32x4_t v_s1 = vdupq_n_u32(0);
+		uint16x8_t column1 = vdupq_n_u16(0);
+		uint16x8_t column2 = vdupq_n_u16(0);
+		uint16x8_t column3 = vdupq_n_u16(0);
+		uint16x8_t column4 = vdupq_n_u16(0);
+		for (size_t i = 0; i < run; i++, data += 32) {
+			uint8x16_t bytes1 = vld1q_u8(data);
+			uint8x16_t bytes2 = vld1q_u8(data + 16);
+			v_s2 = vaddq_u32(v_s2, v_s1);
+			v_s1 = vpadalq_u16(v_s1, vpadalq_u8(vpaddlq_u8(bytes1), bytes2));
+			column1 = vaddw_u8(column1, vget_low_u8(bytes1));
+			column2 = vaddw_u8(column2, vget_high_u8(bytes1));
+			column3 = vaddw_u8(column3, vget_low_u8(bytes2));
+			column4 = vaddw_u8(column4, vget_high_u8(bytes2));
+		}
+		v_s2 = vshlq_n_u32(v_s2, 5);
+		v_s2 = vmlal_u16(v_s2, vget_low_u16(column1), vld1_u16(weights + 0));
+		v_s2 = vmlal_u16(v_s2, vget_high_u16(column1), vld1_u16(weights + 4));
+		v_s2 = vmlal_u16(v_s2, vget_low_u16(column2), vld1_u16(weights + 8));
+		v_s2 = vmlal_u16(v_s2, vget_high_u16(column2), vld1_u16(weights + 12));
+		v_s2 = vmlal_u16(v_s2, vget_low_u16(column3), vld1_u16(weights + 16));
+		v_s2 = vmlal_u16(v_s2, vget_high_u16(column3), vld1_u16(weights + 20));
+		v_s2 = vmlal_u16(v_s2, vget_low_u16(column4), vld1_u16(weights + 24));
+		v_s2 = vmlal_u16(v_s2, vget_high_u16(column4), vld1_u16(weights + 28));
+
+		s1 = (s1 + vaddvq_u32(v_s1)) % adlerBase;
+		s2 = (s2 + vaddvq_u32(v_s2)) % adlerBase;
+	}
+	return adler32Scalar((s2 << 16) | s1, data, n);
+}
+#pragma endregion
+#endif
+
+static ChecksumFunction selectAdler32() {
+#if AX_ARCH_X86
+	if (getCpuFeatures().ssse3) {
+		return adler32Ssse3;
+	}
+#elif AX_ARCH_ARM64
+	return adler32Neon;
+#endif
+	return adler32Scalar;
+}
+
+static ChecksumFunction selectCrc32() {
+#if AX_ARCH_X86
+	if (getCpuFeatures().pclmul && getCpuFeatures().sse2) {
+		return crc32Pclmul;
+	}
+#endif
+	return crc32Scalar;
+}
+
+uint32_t adler32(uint32_t adler, std::span<const uint8_t> data) {
+	static const ChecksumFunction function = selectAdler32();
+	return function(adler, data.data(), data.size());
+}
+
+uint32_t crc32(uint32_t crc, std::span<const uint8_t> data) {
+	static const ChecksumFunction function = selectCrc32();
+	return ~function(~crc, data.data(), data.size());
+}
+
+// zlib's adler32_combine: every byte of the second piece adds the first piece's s1 to s2 once more
+uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, size_t length2) {
+	const uint64_t remainder = length2 % adlerBase;
+	uint64_t s1 = (adler1 & 0xFFFF) + (adler2 & 0xFFFF) + adlerBase - 1;
+	uint64_t s2 = remainder * (adler1 & 0xFFFF) % adlerBase + (adler1 >> 16) + (adler2 >> 16) + adlerBase - remainder;
+	return static_cast<uint32_t>(((s2 % adlerBase) << 16) | (s1 % adlerBase));
+}
+
+#pragma region Hash
+static constexpr uint64_t xxPrime1 = 0x9E3779B185EBCA87ull;
+static constexpr uint64_t xxPrime2 = 0xC2B2AE3D27D4EB4Full;
+static constexpr uint64_t xxPrime3 = 0x165667B19E3779F9ull;
+static constexpr uint64_t xxPrime4 = 0x85EBCA77C2B2AE63ull;
+static constexpr uint64_t xxPrime5 = 0x27D4EB2F165667C5ull;
+
+static inline uint64_t xxRound(uint64_t acc, uint64_t input) {
+	return std::rotl(acc + input * xxPrime2, 31) * xxPrime1;
+}
+
+static inline uint64_t xxMerge(uint64_t acc, uint64_t lane) {
+	return (acc ^ xxRound(0, lane)) * xxPrime1 + xxPrime4;
+}
+
+static inline uint64_t read64(const uint8_t* p) {
+	uint64_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t read32(const uint8_t* p) {
+	uint32_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+uint64_t hash64(std::span<const uint8_t> data, uint64_t seed) {
+	const uint8_t* p = data.data();
+	size_t n = data.size();
+	uint64_t h;
+	if (n >= 32) {
+		uint64_t v1 = seed + xxPrime1 + xxPrime2;
+		uint64_t v2 = seed + xxPrime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - xxPrime1;
+		for (; n >= 32; n -= 32, p += 32) {
+			v1 = xxRound(v1, read64(p));
+			v2 = xxRound(v2, read64(p + 8));
+			v3 = xxRound(v3, read64(p + 16));
+			v4 = xxRound(v4, read64(p + 24));
+		}
+		h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+		h = xxMerge(h, v1);
+		h = xxMerge(h, v2);
+		h = xxMerge(h, v3);
+		h = xxMerge(h, v4);
+	}
+	else {
+		h = seed + xxPrime5;
+	}
+	h += data.size();
+
+	for (; n >= 8; n -= 8, p += 8) {
+		h = std::rotl(h ^ xxRound(0, read64(p)), 27) * xxPrime1 + xxPrime4;
+	}
+	if (n >= 4) {
+		h = std::rotl(h ^ (read32(p) * xxPrime1), 23) * xxPrime2 + xxPrime3;
+		n -= 4;
+		p += 4;
+	}
+	for (; n > 0; n--, p++) {
+		h = std::rotl(h ^ (*p * xxPrime5), 11) * xxPrime1;
+	}
+
+	h ^= h >> 33;
+	h *= xxPrime2;
+	h ^= h >> 29;
+	h *= xxPrime3;
+	h ^= h >> 32;
+	return h;
+}
+#pragma endregion
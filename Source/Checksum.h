@@ -0,0 +1,15 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Running checksums with zlib's conventions: start from adler32(1, ...) and crc32(0, ...)
+// and feed the data in any number of pieces. The SIMD variant is chosen once per process.
+uint32_t adler32(uint32_t adler, std::span<const uint8_t> data);
+uint32_t crc32(uint32_t crc, std::span<const uint8_t> data);
+// the Adler-32 of two pieces back to back, from the checksum of each and the second's length
+uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, size_t length2);
+
+// 64-bit XXH64 of data, for content keys. Reads words in host byte order, so values are only
+// comparable between machines of the same endianness.
+uint64_t hash64(std::span<const uint8_t> data, uint64_t seed = 0);
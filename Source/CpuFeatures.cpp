@@ -0,0 +1,68 @@
+#include "CpuFeatures.h"
+
+#if AX_ARCH_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void cpuid(int leaf, int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER) && !defined(__clang__)
+	int out[4];
+	__cpuidex(out, leaf, subleaf);
+	for (int i = 0; i < 4; i++) {
+		regs[i] = static_cast<unsigned int>(out[i]);
+	}
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// AVX registers are only usable if the OS saves them on context switches
+static bool osSavesYmmState() {
+#if defined(_MSC_VER) && !defined(__clang__)
+	return (_xgetbv(0) & 6) == 6;
+#else
+	unsigned int eax, edx;
+	__asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return (eax & 6) == 6;
+#endif
+}
+
+static CpuFeatures detectCpuFeatures() {
+	CpuFeatures features;
+	unsigned int regs[4] = {};
+	cpuid(0, 0, regs);
+	unsigned int maxLeaf = regs[0];
+	if (maxLeaf < 1) {
+		return features;
+	}
+
+	cpuid(1, 0, regs);
+	features.sse2 = (regs[3] >> 26) & 1;
+	features.ssse3 = (regs[2] >> 9) & 1;
+	features.pclmul = (regs[2] >> 1) & 1;
+	bool osxsave = (regs[2] >> 27) & 1;
+	bool avx = (regs[2] >> 28) & 1;
+	if (maxLeaf >= 7 && osxsave && avx && osSavesYmmState()) {
+		cpuid(7, 0, regs);
+		features.avx2 = (regs[1] >> 5) & 1;
+	}
+	return features;
+}
+#else
+static CpuFeatures detectCpuFeatures() {
+	CpuFeatures features;
+#if AX_ARCH_ARM64
+	// NEON is part of the base AArch64 instruction set
+	features.neon = true;
+#endif
+	return features;
+}
+#endif
+
+const CpuFeatures& getCpuFeatures() {
+	static const CpuFeatures features = detectCpuFeatures();
+	return features;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define AX_ARCH_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define AX_ARCH_ARM64 1
+#include <arm_neon.h>
+#endif
+
+// GCC and Clang only allow intrinsics of an instruction set inside functions compiled for it;
+// MSVC allows them anywhere, so the attribute is dropped there.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define AX_TARGET(isa)
+#else
+#define AX_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+struct CpuFeatures {
+	bool sse2 = false;
+	bool ssse3 = false;
+	bool avx2 = false;
+	bool pclmul = false;
+	bool neon = false;
+};
+
+// detected on first use, then cached for the lifetime of the process
+const CpuFeatures& getCpuFeatures();
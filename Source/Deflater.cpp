@@ -0,0 +1,545 @@
+#include "Deflater.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <queue>
+
+static constexpr std::array<uint16_t, 29> lengthBase = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static constexpr std::array<uint8_t, 29> lengthExtra = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static constexpr std::array<uint16_t, 30> distanceBase = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static constexpr std::array<uint8_t, 30> distanceExtra = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static constexpr std::array<uint8_t, 19> codeLengthOrder = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static constexpr size_t windowSize = 32768;
+// DEFLATE allows 3, but on filtered pixels 3-byte matches rarely beat three literals
+static constexpr uint32_t minMatch = 4;
+static constexpr uint32_t maxMatch = 258;
+static constexpr uint32_t hashBits = 15;
+// candidates tried per position; pixel data gains little from longer chains
+static constexpr uint32_t maxChain = 8;
+// a match this long is taken without trying the rest of the chain
+static constexpr uint32_t goodMatch = 32;
+// positions inside longer matches are not hashed, which keeps flat areas cheap
+static constexpr uint32_t maxInsertLength = 32;
+// input bytes per block; each block gets its own Huffman codes
+static constexpr size_t blockInput = 1 << 17;
+static constexpr size_t maxStoredBlock = 65535;
+static constexpr uint32_t literalSymbols = 286;
+static constexpr uint32_t distanceSymbols = 30;
+static constexpr uint32_t endOfBlock = 256;
+
+// length code (0-28) of every match length
+static constexpr std::array<uint8_t, maxMatch + 1> lengthCodes = [] {
+	std::array<uint8_t, maxMatch + 1> codes = {};
+	for (uint32_t code = 0; code < lengthBase.size(); code++) {
+		uint32_t end = code + 1 < lengthBase.size() ? lengthBase[code + 1] : maxMatch + 1;
+		for (uint32_t length = lengthBase[code]; length < end; length++) {
+			codes[length] = static_cast<uint8_t>(code);
+		}
+	}
+	return codes;
+}();
+
+// codes 2n and 2n + 1 split the distances whose distance - 1 has its top bit at n
+static inline uint32_t distanceCode(uint32_t distance) {
+	if (distance <= 4) {
+		return distance - 1;
+	}
+	uint32_t d = distance - 1;
+	uint32_t topBit = static_cast<uint32_t>(std::bit_width(d)) - 1;
+	return 2 * topBit + ((d >> (topBit - 1)) & 1);
+}
+
+// Gathers bits least significant first and appends them to out a 32-bit word at a time
+class DeflateBitWriter {
+public:
+	explicit DeflateBitWriter(std::vector<uint8_t>& out) : out(out) {}
+
+	// value must fit in count bits, count at most 32
+	void write(uint32_t value, uint32_t count) {
+		buffer |= static_cast<uint64_t>(value) << bitCount;
+		bitCount += count;
+		if (bitCount >= 32) {
+			const uint8_t bytes[4] = { static_cast<uint8_t>(buffer), static_cast<uint8_t>(buffer >> 8), static_cast<uint8_t>(buffer >> 16), static_cast<uint8_t>(buffer >> 24) };
+			out.insert(out.end(), bytes, bytes + 4);
+			buffer >>= 32;
+			bitCount -= 32;
+		}
+	}
+
+	// pads to a byte boundary with zeros and moves every pending bit to out
+	void alignToByte() {
+		while (bitCount > 0) {
+			out.push_back(static_cast<uint8_t>(buffer));
+			buffer >>= 8;
+			bitCount = bitCount > 8 ? bitCount - 8 : 0;
+		}
+	}
+
+	// only after alignToByte()
+	void writeBytes(std::span<const uint8_t> bytes) {
+		out.insert(out.end(), bytes.begin(), bytes.end());
+	}
+
+private:
+	std::vector<uint8_t>& out;
+	uint64_t buffer = 0;
+	uint32_t bitCount = 0;
+};
+
+#pragma region Huffman
+struct DeflateCode {
+	std::vector<uint8_t> lengths;
+	// bit-reversed, ready to be written least significant bit first
+	std::vector<uint16_t> codes;
+
+	void write(DeflateBitWriter& writer, uint32_t symbol) const {
+		writer.write(codes[symbol], lengths[symbol]);
+	}
+};
+
+// Huffman code lengths no longer than maxBits. Frequencies are flattened until the tree fits,
+// which costs a little ratio but keeps the code short.
+static std::vector<uint8_t> buildLengths(std::span<const uint32_t> frequencies, uint32_t maxBits) {
+	const size_t n = frequencies.size();
+	std::vector<uint64_t> weights(frequencies.begin(), frequencies.end());
+	std::vector<uint8_t> lengths(n, 0);
+	std::vector<size_t> parent(2 * n, 0);
+	std::vector<uint32_t> depth(2 * n, 0);
+	while (true) {
+		using Node = std::pair<uint64_t, size_t>;
+		std::priority_queue<Node, std::vector<Node>, std::greater<>> queue;
+		for (size_t i = 0; i < n; i++) {
+			if (weights[i] > 0) {
+				queue.push({ weights[i], i });
+			}
+		}
+		if (queue.size() == 1) {
+			lengths[queue.top().second] = 1;
+			return lengths;
+		}
+
+		// internal nodes get indices above every leaf, and parents always above their children
+		size_t next = n;
+		while (queue.size() > 1) {
+			Node a = queue.top();
+			queue.pop();
+			Node b = queue.top();
+			queue.pop();
+			parent[a.second] = next;
+			parent[b.second] = next;
+			queue.push({ a.first + b.first, next++ });
+		}
+		uint32_t maxDepth = 0;
+		depth[next - 1] = 0;
+		for (size_t node = next - 1; node-- > 0;) {
+			if (node >= n || weights[node] > 0) {
+				depth[node] = depth[parent[node]] + 1;
+			}
+			if (node < n) {
+				maxDepth = std::max(maxDepth, weights[node] > 0 ? depth[node] : 0);
+			}
+		}
+		if (maxDepth <= maxBits) {
+			for (size_t i = 0; i < n; i++) {
+				lengths[i] = weights[i] > 0 ? static_cast<uint8_t>(depth[i]) : 0;
+			}
+			return lengths;
+		}
+		for (uint64_t& weight : weights) {
+			if (weight > 0) {
+				weight = std::max<uint64_t>(1, weight >> 1);
+			}
+		}
+	}
+}
+
+// canonical codes for lengths, as RFC 1951 assigns them
+static DeflateCode makeCode(std::vector<uint8_t> lengths) {
+	std::array<uint16_t, 16> counts = {};
+	for (uint8_t length : lengths) {
+		counts[length]++;
+	}
+	counts[0] = 0;
+	std::array<uint16_t, 16> nextCode = {};
+	uint16_t code = 0;
+	for (size_t bits = 1; bits < 16; bits++) {
+		code = static_cast<uint16_t>((code + counts[bits - 1]) << 1);
+		nextCode[bits] = code;
+	}
+
+	DeflateCode huffman;
+	huffman.codes.assign(lengths.size(), 0);
+	for (size_t symbol = 0; symbol < lengths.size(); symbol++) {
+		uint32_t length = lengths[symbol];
+		if (length != 0) {
+			uint32_t value = nextCode[length]++;
+			uint32_t reversed = 0;
+			for (uint32_t bit = 0; bit < length; bit++) {
+				reversed |= ((value >> bit) & 1) << (length - 1 - bit);
+			}
+			huffman.codes[symbol] = static_cast<uint16_t>(reversed);
+		}
+	}
+	huffman.lengths = std::move(lengths);
+	return huffman;
+}
+
+// The codes of one dynamic block and its header, the code lengths run-length coded as
+// RFC 1951 describes.
+struct DynamicBlock {
+	struct LengthSymbol {
+		uint8_t symbol;
+		uint8_t extra;
+	};
+
+	DynamicBlock(std::vector<uint32_t>& literalFrequencies, std::vector<uint32_t>& distanceFrequencies);
+
+	// size of the whole block in bits
+	uint64_t bitCount(std::span<const uint32_t> literalFrequencies, std::span<const uint32_t> distanceFrequencies) const;
+	void writeHeader(DeflateBitWriter& writer, bool final) const;
+
+	DeflateCode literals;
+	DeflateCode distances;
+	DeflateCode lengthCodes;
+	size_t literalCount = literalSymbols;
+	size_t distanceCount = distanceSymbols;
+	size_t lengthCodeCount = 19;
+	std::vector<LengthSymbol> lengthSymbols;
+};
+
+static uint32_t lengthSymbolExtraBits(uint8_t symbol) {
+	return symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0;
+}
+
+DynamicBlock::DynamicBlock(std::vector<uint32_t>& literalFrequencies, std::vector<uint32_t>& distanceFrequencies) {
+	literalFrequencies[endOfBlock] = 1;
+	// keep both trees complete so any conforming decoder accepts them
+	if (std::count_if(literalFrequencies.begin(), literalFrequencies.end(), [](uint32_t f) { return f > 0; }) < 2) {
+		literalFrequencies[literalFrequencies[0] == 0 ? 0 : 1]++;
+	}
+	for (uint32_t i = 0; std::count_if(distanceFrequencies.begin(), distanceFrequencies.end(), [](uint32_t f) { return f > 0; }) < 2; i++) {
+		distanceFrequencies[i] = std::max<uint32_t>(distanceFrequencies[i], 1);
+	}
+
+	literals = makeCode(buildLengths(literalFrequencies, 15));
+	distances = makeCode(buildLengths(distanceFrequencies, 15));
+	while (literalCount > 257 && literals.lengths[literalCount - 1] == 0) {
+		literalCount--;
+	}
+	while (distanceCount > 1 && distances.lengths[distanceCount - 1] == 0) {
+		distanceCount--;
+	}
+
+	// run-length code both length tables as one sequence
+	std::vector<uint8_t> allLengths(literals.lengths.begin(), literals.lengths.begin() + literalCount);
+	allLengths.insert(allLengths.end(), distances.lengths.begin(), distances.lengths.begin() + distanceCount);
+	for (size_t i = 0; i < allLengths.size();) {
+		uint8_t value = allLengths[i];
+		size_t run = 1;
+		while (i + run < allLengths.size() && allLengths[i + run] == value) {
+			run++;
+		}
+		i += run;
+		if (value == 0) {
+			while (run >= 11) {
+				size_t take = std::min<size_t>(run, 138);
+				lengthSymbols.push_back({ 18, static_cast<uint8_t>(take - 11) });
+				run -= take;
+			}
+			if (run >= 3) {
+				lengthSymbols.push_back({ 17, static_cast<uint8_t>(run - 3) });
+				run = 0;
+			}
+		}
+		else {
+			lengthSymbols.push_back({ value, 0 });
+			run--;
+			while (run >= 3) {
+				size_t take = std::min<size_t>(run, 6);
+				lengthSymbols.push_back({ 16, static_cast<uint8_t>(take - 3) });
+				run -= take;
+			}
+		}
+		for (; run > 0; run--) {
+			lengthSymbols.push_back({ value, 0 });
+		}
+	}
+
+	std::vector<uint32_t> lengthFrequencies(19, 0);
+	for (const LengthSymbol& symbol : lengthSymbols) {
+		lengthFrequencies[symbol.symbol]++;
+	}
+	lengthCodes = makeCode(buildLengths(lengthFrequencies, 7));
+	while (lengthCodeCount > 4 && lengthCodes.lengths[codeLengthOrder[lengthCodeCount - 1]] == 0) {
+		lengthCodeCount--;
+	}
+}
+
+uint64_t DynamicBlock::bitCount(std::span<const uint32_t> literalFrequencies, std::span<const uint32_t> distanceFrequencies) const {
+	uint64_t bits = 3 + 5 + 5 + 4 + 3 * lengthCodeCount;
+	for (const LengthSymbol& symbol : lengthSymbols) {
+		bits += lengthCodes.lengths[symbol.symbol] + lengthSymbolExtraBits(symbol.symbol);
+	}
+	for (size_t i = 0; i < literalFrequencies.size(); i++) {
+		uint32_t extra = i > endOfBlock ? lengthExtra[i - 257] : 0;
+		bits += static_cast<uint64_t>(literalFrequencies[i]) * (literals.lengths[i] + extra);
+	}
+	for (size_t i = 0; i < distanceFrequencies.size(); i++) {
+		bits += static_cast<uint64_t>(distanceFrequencies[i]) * (distances.lengths[i] + distanceExtra[i]);
+	}
+	return bits;
+}
+
+void DynamicBlock::writeHeader(DeflateBitWriter& writer, bool final) const {
+	writer.write(final ? 1 : 0, 1);
+	writer.write(2, 2);
+	writer.write(static_cast<uint32_t>(literalCount - 257), 5);
+	writer.write(static_cast<uint32_t>(distanceCount - 1), 5);
+	writer.write(static_cast<uint32_t>(lengthCodeCount - 4), 4);
+	for (size_t i = 0; i < lengthCodeCount; i++) {
+		writer.write(lengthCodes.lengths[codeLengthOrder[i]], 3);
+	}
+	for (const LengthSymbol& symbol : lengthSymbols) {
+		lengthCodes.write(writer, symbol.symbol);
+		writer.write(symbol.extra, lengthSymbolExtraBits(symbol.symbol));
+	}
+}
+#pragma endregion
+
+#pragma region Blocks
+// literal when distance is 0, otherwise a match of length bytes
+struct DeflateSymbol {
+	uint16_t length;
+	uint16_t distance;
+};
+
+// as many stored blocks as data needs, at least one; only the last may be final
+static void writeStoredBlocks(DeflateBitWriter& writer, std::span<const uint8_t> data, bool final) {
+	size_t position = 0;
+	do {
+		size_t length = std::min(maxStoredBlock, data.size() - position);
+		bool lastBlock = position + length == data.size();
+		writer.write(final && lastBlock ? 1 : 0, 1);
+		writer.write(0, 2);
+		writer.alignToByte();
+		writer.write(static_cast<uint32_t>(length), 16);
+		writer.write(static_cast<uint32_t>(~length & 0xFFFF), 16);
+		writer.alignToByte();
+		writer.writeBytes(data.subspan(position, length));
+		position += length;
+	} while (position < data.size());
+}
+
+// bits of storing size bytes, counting the padding in front of the first header at its worst
+static uint64_t storedBitCount(size_t size) {
+	size_t blocks = std::max<size_t>(1, (size + maxStoredBlock - 1) / maxStoredBlock);
+	return (static_cast<uint64_t>(size) + 4 * blocks) * 8 + 3 * blocks + 7;
+}
+
+static void writeSymbols(DeflateBitWriter& writer, const DynamicBlock& block, std::span<const DeflateSymbol> symbols) {
+	for (const DeflateSymbol& symbol : symbols) {
+		if (symbol.distance == 0) {
+			block.literals.write(writer, symbol.length);
+			continue;
+		}
+		uint32_t length = lengthCodes[symbol.length];
+		block.literals.write(writer, 257 + length);
+		writer.write(symbol.length - lengthBase[length], lengthExtra[length]);
+		uint32_t distance = distanceCode(symbol.distance);
+		block.distances.write(writer, distance);
+		writer.write(symbol.distance - distanceBase[distance], distanceExtra[distance]);
+	}
+}
+
+// Codes input as the smallest of: a dynamic block of symbols, which code input, a dynamic block
+// of its bytes as literals, and stored blocks. Without symbols only the last two are tried.
+// On noisy data the literals can win, as matches cost the literal code the short lengths of
+// the bytes they replace.
+static void writeBlock(DeflateBitWriter& writer, std::optional<std::span<const DeflateSymbol>> symbols, std::span<const uint8_t> input, bool final) {
+	std::optional<DynamicBlock> symbolBlock;
+	uint64_t symbolBits = UINT64_MAX;
+	if (symbols) {
+		std::vector<uint32_t> literalFrequencies(literalSymbols, 0);
+		std::vector<uint32_t> distanceFrequencies(distanceSymbols, 0);
+		for (const DeflateSymbol& symbol : *symbols) {
+			if (symbol.distance == 0) {
+				literalFrequencies[symbol.length]++;
+			}
+			else {
+				literalFrequencies[257 + lengthCodes[symbol.length]]++;
+				distanceFrequencies[distanceCode(symbol.distance)]++;
+			}
+		}
+		symbolBlock.emplace(literalFrequencies, distanceFrequencies);
+		symbolBits = symbolBlock->bitCount(literalFrequencies, distanceFrequencies);
+	}
+
+	// literals only pay off on data that barely compresses, so well matched blocks skip counting them
+	std::optional<DynamicBlock> literalBlock;
+	uint64_t literalBits = UINT64_MAX;
+	if (symbolBits > input.size() * 4) {
+		std::vector<uint32_t> literalFrequencies(literalSymbols, 0);
+		std::vector<uint32_t> distanceFrequencies(distanceSymbols, 0);
+		for (uint8_t byte : input) {
+			literalFrequencies[byte]++;
+		}
+		literalBlock.emplace(literalFrequencies, distanceFrequencies);
+		literalBits = literalBlock->bitCount(literalFrequencies, {});
+	}
+
+	if (std::min(literalBits, symbolBits) >= storedBitCount(input.size())) {
+		writeStoredBlocks(writer, input, final);
+	}
+	else if (symbolBits < literalBits) {
+		symbolBlock->writeHeader(writer, final);
+		writeSymbols(writer, *symbolBlock, *symbols);
+		symbolBlock->literals.write(writer, endOfBlock);
+	}
+	else {
+		literalBlock->writeHeader(writer, final);
+		const uint16_t* codes = literalBlock->literals.codes.data();
+		const uint8_t* lengths = literalBlock->literals.lengths.data();
+		for (uint8_t byte : input) {
+			writer.write(codes[byte], lengths[byte]);
+		}
+		literalBlock->literals.write(writer, endOfBlock);
+	}
+}
+#pragma endregion
+
+#pragma region Matching
+// bytes a and b have in common, up to limit, compared a word at a time
+static inline uint32_t matchLength(const uint8_t* a, const uint8_t* b, uint32_t limit) {
+	uint32_t length = 0;
+	while (length + sizeof(uint64_t) <= limit) {
+		uint64_t x;
+		uint64_t y;
+		std::memcpy(&x, a + length, sizeof(x));
+		std::memcpy(&y, b + length, sizeof(y));
+		if (uint64_t difference = x ^ y) {
+			if constexpr (std::endian::native == std::endian::little) {
+				return length + static_cast<uint32_t>(std::countr_zero(difference)) / 8;
+			}
+			else {
+				return length + static_cast<uint32_t>(std::countl_zero(difference)) / 8;
+			}
+		}
+		length += sizeof(uint64_t);
+	}
+	while (length < limit && a[length] == b[length]) {
+		length++;
+	}
+	return length;
+}
+
+// Greedy LZ77 with hash chains over one piece. The chains persist across calls, so matches
+// reach back into earlier blocks of the piece but never outside it.
+class DeflateMatchFinder {
+public:
+	explicit DeflateMatchFinder(std::span<const uint8_t> data) : data(data), head(size_t(1) << hashBits, -1), previous(windowSize, -1) {}
+
+	void findSymbols(size_t start, size_t end, std::vector<DeflateSymbol>& symbols) {
+		size_t position = start;
+		while (position < end) {
+			uint32_t bestLength = 0;
+			uint32_t bestDistance = 0;
+			const uint32_t limit = static_cast<uint32_t>(std::min<size_t>(maxMatch, end - position));
+			if (limit >= minMatch) {
+				int64_t candidate = head[hash(position)];
+				for (uint32_t chain = 0; chain < maxChain && candidate >= 0 && position - candidate <= windowSize; chain++) {
+					// a longer match has to differ from the best so far at its last byte
+					if (data[candidate + bestLength] == data[position + bestLength] || bestLength == 0) {
+						uint32_t length = matchLength(&data[candidate], &data[position], limit);
+						if (length > bestLength) {
+							bestLength = length;
+							bestDistance = static_cast<uint32_t>(position - candidate);
+							if (length >= std::min(limit, goodMatch)) {
+								break;
+							}
+						}
+					}
+					int64_t older = previous[candidate % windowSize];
+					// the ring slot may already hold a newer position
+					if (older >= candidate) {
+						break;
+					}
+					candidate = older;
+				}
+			}
+
+			if (bestLength >= minMatch) {
+				symbols.push_back({ static_cast<uint16_t>(bestLength), static_cast<uint16_t>(bestDistance) });
+				insert(position);
+				if (bestLength <= maxInsertLength) {
+					for (uint32_t i = 1; i < bestLength; i++) {
+						insert(position + i);
+					}
+				}
+				position += bestLength;
+			}
+			else {
+				symbols.push_back({ data[position], 0 });
+				insert(position);
+				position++;
+			}
+		}
+	}
+
+private:
+	uint32_t hash(size_t position) const {
+		uint32_t value;
+		std::memcpy(&value, &data[position], sizeof(value));
+		return (value * 2654435761u) >> (32 - hashBits);
+	}
+
+	void insert(size_t position) {
+		if (position + minMatch > data.size()) {
+			return;
+		}
+		uint32_t h = hash(position);
+		previous[position % windowSize] = head[h];
+		head[h] = static_cast<int64_t>(position);
+	}
+
+	std::span<const uint8_t> data;
+	std::vector<int64_t> head;
+	std::vector<int64_t> previous;
+};
+#pragma endregion
+
+void deflatePiece(std::span<const uint8_t> data, DeflateStrategy strategy, bool last, std::vector<uint8_t>& out) {
+	DeflateBitWriter writer(out);
+	if (strategy == DeflateStrategy::Store) {
+		writeStoredBlocks(writer, data, last);
+	}
+	else {
+		std::optional<DeflateMatchFinder> matchFinder;
+		std::vector<DeflateSymbol> symbols;
+		if (strategy == DeflateStrategy::Greedy) {
+			matchFinder.emplace(data);
+			symbols.reserve(blockInput);
+		}
+		size_t position = 0;
+		do {
+			size_t end = std::min(data.size(), position + blockInput);
+			bool final = last && end == data.size();
+			std::optional<std::span<const DeflateSymbol>> blockSymbols;
+			if (matchFinder) {
+				symbols.clear();
+				matchFinder->findSymbols(position, end, symbols);
+				blockSymbols = symbols;
+			}
+			writeBlock(writer, blockSymbols, data.subspan(position, end - position), final);
+			position = end;
+		} while (position < data.size());
+	}
+	if (!last) {
+		// sync flush
+		writeStoredBlocks(writer, {}, false);
+	}
+	writer.alignToByte();
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+enum class DeflateStrategy {
+	// stored blocks only
+	Store,
+	// literals only, in dynamic Huffman blocks
+	HuffmanOnly,
+	// greedy LZ77 over short hash chains, in dynamic Huffman blocks
+	Greedy
+};
+
+// Appends data to out as raw DEFLATE blocks. Matches never reach outside data, so pieces of
+// one stream can be compressed independently and concatenated: every piece but the last ends
+// with an empty stored block (a sync flush), which leaves it byte aligned, and the last one
+// ends with the final block. A block that would come out larger than its input is stored.
+void deflatePiece(std::span<const uint8_t> data, DeflateStrategy strategy, bool last, std::vector<uint8_t>& out);
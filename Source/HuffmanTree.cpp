@@ -1,33 +1,42 @@
 #include "HuffmanTree.h"
 
-void HuffmanTree::insert(int codeword, int n, int symbol) {
-	Node* node = root.get();
-	for (int i = n - 1; i >= 0; i--) {
-		int b = codeword & (1 << i);
-		if (b) {
-			if (!node->right) {
-				node->right = std::make_unique<Node>();
-			}
-			node = node->right.get();
-		}
-		else {
-			if (!node->left) {
-				node->left = std::make_unique<Node>();
-			}
-			node = node->left.get();
-		}
+// codewords are stored MSB first but DEFLATE packs them starting from the LSB,
+// so the table is indexed by the bit-reversed code
+static uint32_t reverseBits(uint32_t codeword, int n) {
+	uint32_t out = 0;
+	for (int i = 0; i < n; i++) {
+		out = (out << 1) | ((codeword >> i) & 1);
 	}
-	node->symbol = symbol;
+	return out;
 }
 
-int HuffmanTree::decode(BitReader& bitReader) const {
-	Node* node = root.get();
-	while (node->left || node->right) {
-		int b = bitReader.readBit();
-		node = b ? node->right.get() : node->left.get();
-		if (!node) {
-			throw std::runtime_error("Invalid Huffman code");
+void HuffmanTree::clear() {
+	table.assign(1 << primaryBits, HuffmanEntry{});
+}
+
+void HuffmanTree::insert(int codeword, int n, int symbol) {
+	if (n <= 0 || n > maxCodeLength) {
+		throw std::runtime_error("Invalid Huffman code length");
+	}
+
+	uint32_t reversed = reverseBits(codeword, n);
+	HuffmanEntry leaf = { static_cast<uint16_t>(symbol), static_cast<uint8_t>(n), 0 };
+	if (n <= primaryBits) {
+		for (uint32_t i = reversed; i < (1u << primaryBits); i += (1u << n)) {
+			table[i] = leaf;
 		}
+		return;
+	}
+
+	uint32_t prefix = reversed & ((1u << primaryBits) - 1);
+	if (!table[prefix].secondary) {
+		table[prefix] = { static_cast<uint16_t>(table.size()), 0, 1 };
+		table.resize(table.size() + (1u << secondaryBits));
+	}
+
+	uint32_t offset = table[prefix].value;
+	int rest = n - primaryBits;
+	for (uint32_t i = reversed >> primaryBits; i < (1u << secondaryBits); i += (1u << rest)) {
+		table[offset + i] = leaf;
 	}
-	return node->symbol;
 }
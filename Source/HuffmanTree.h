@@ -1,21 +1,50 @@
 #pragma once
 #include "BitReader.h"
-#include <memory>
+#include <memory_resource>
+#include <vector>
 
-struct Node {
-	int symbol = -1;
-	std::unique_ptr<Node> left = nullptr;
-	std::unique_ptr<Node> right = nullptr;
+// One slot of the decode table. A code of length n <= primaryBits owns every primary
+// slot whose low n bits match it, so a single peek resolves it. Longer codes are
+// reached through a secondary table indexed by the bits after the primary prefix.
+struct HuffmanEntry {
+	uint16_t value = 0; // symbol, or offset of the secondary table
+	uint8_t length = 0; // code length in bits, 0 marks a slot no code maps to
+	uint8_t secondary = 0; // set when value points at a secondary table
 };
 
 class HuffmanTree {
 public:
-	HuffmanTree() : root(std::make_unique<Node>()) {}
+	static constexpr int maxCodeLength = 15;
+	static constexpr int primaryBits = 9;
+	static constexpr int secondaryBits = maxCodeLength - primaryBits;
 
+	explicit HuffmanTree(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) : table(1 << primaryBits, resource) {}
+
+	// removes every code but keeps the memory of the table for the next one
+	void clear();
 	void insert(int codeword, int n, int symbol);
 	int decode(BitReader& bitReader) const;
+	// resolves the entry for the next maxCodeLength bits of the stream, LSB first
+	HuffmanEntry lookup(uint32_t bits) const;
 
 private:
-	std::unique_ptr<Node> root;
+	std::pmr::vector<HuffmanEntry> table;
 };
 
+// defined inline so the lookup is folded into the inflate loop
+inline HuffmanEntry HuffmanTree::lookup(uint32_t bits) const {
+	HuffmanEntry entry = table[bits & ((1u << primaryBits) - 1)];
+	if (entry.secondary) {
+		entry = table[entry.value + (bits >> primaryBits)];
+	}
+	return entry;
+}
+
+inline int HuffmanTree::decode(BitReader& bitReader) const {
+	HuffmanEntry entry = lookup(bitReader.peekBits(maxCodeLength));
+	if (entry.length == 0) {
+		throw std::runtime_error("Invalid Huffman code");
+	}
+	bitReader.consume(entry.length);
+	return entry.value;
+}
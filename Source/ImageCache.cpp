@@ -0,0 +1,235 @@
+#include "AxImageLoader.h"
+#include "Checksum.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <random>
+
+namespace AxImageLoader {
+	// A cache entry is this header, zero padding up to entryDataOffset, then the pixels.
+	// Entries are only read on the machine that wrote them, so fields are in host byte order.
+	struct CacheEntryHeader {
+		std::array<char, 4> magic;
+		uint32_t version;
+		uint32_t width;
+		uint32_t height;
+		uint32_t channels;
+		uint32_t reserved;
+		uint64_t dataSize;
+	};
+
+	static constexpr std::array<char, 4> entryMagic = { 'A', 'X', 'I', 'C' };
+	// bump whenever decoded output changes, so entries written by older builds miss
+	static constexpr uint32_t entryVersion = 1;
+	static constexpr size_t entryDataOffset = 64;
+	static constexpr std::string_view entryExtension = ".axi";
+	static constexpr std::string_view tempMarker = ".axi.tmp";
+	// temporary files this old belong to a writer that died before renaming them
+	static constexpr std::chrono::hours staleTempAge{ 1 };
+
+	struct ImageCacheState {
+		std::filesystem::path directory;
+		uint64_t maxBytes = 0;
+		std::mutex mutex;
+		// running estimate; entries written by other processes are only counted by the next trim
+		uint64_t totalBytes = 0;
+
+		std::filesystem::path entryPath(uint64_t contentHash, uint16_t requiredChannels) const {
+			char name[32];
+			std::snprintf(name, sizeof(name), "%016llx-%u", static_cast<unsigned long long>(contentHash), static_cast<unsigned>(requiredChannels));
+			return directory / (std::string(name) + std::string(entryExtension));
+		}
+
+		static std::optional<CachedImage> mapEntry(const std::filesystem::path& path) {
+			auto mapping = std::make_unique<MappedFile>();
+			if (!mapping->open(path) || mapping->data().size() < entryDataOffset) {
+				return std::nullopt;
+			}
+			CacheEntryHeader header;
+			std::memcpy(&header, mapping->data().data(), sizeof(header));
+			uint64_t expectedSize = static_cast<uint64_t>(header.width) * header.height * header.channels;
+			if (header.magic != entryMagic || header.version != entryVersion || header.dataSize != expectedSize ||
+				mapping->data().size() != entryDataOffset + header.dataSize) {
+				return std::nullopt;
+			}
+
+			CachedImage image;
+			image.imageWidth = header.width;
+			image.imageHeight = header.height;
+			image.imageChannels = static_cast<uint16_t>(header.channels);
+			image.pixels = mapping->data().subspan(entryDataOffset);
+			image.mapping = std::move(mapping);
+			return image;
+		}
+
+		// writes to a file only this thread knows about, then renames it over the entry
+		static bool writeEntry(const std::filesystem::path& path, const Image& image) {
+			static thread_local std::mt19937_64 random(std::random_device{}());
+			std::filesystem::path tempPath = path;
+			tempPath += std::string(".tmp") + std::to_string(random());
+
+			bool written;
+			{
+				std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+				if (!file) {
+					return false;
+				}
+				CacheEntryHeader header = { entryMagic, entryVersion, image.width, image.height, image.channels, 0, image.data.size() };
+				std::array<char, entryDataOffset> headerBytes = {};
+				std::memcpy(headerBytes.data(), &header, sizeof(header));
+				file.write(headerBytes.data(), headerBytes.size());
+				file.write(reinterpret_cast<const char*>(image.data.data()), static_cast<std::streamsize>(image.data.size()));
+				file.close();
+				written = !file.fail();
+			}
+
+			std::error_code error;
+			if (written) {
+				std::filesystem::rename(tempPath, path, error);
+			}
+			if (!written || error) {
+				std::filesystem::remove(tempPath, error);
+				return false;
+			}
+			return true;
+		}
+
+		void trim() {
+			struct Entry {
+				std::filesystem::file_time_type lastUse;
+				uint64_t size;
+				std::filesystem::path path;
+			};
+			std::vector<Entry> entries;
+			uint64_t total = 0;
+			auto now = std::filesystem::file_time_type::clock::now();
+
+			std::lock_guard lock(mutex);
+			std::error_code error;
+			for (std::filesystem::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+				std::error_code entryError;
+				const std::filesystem::path& path = it->path();
+				auto lastUse = it->last_write_time(entryError);
+				if (entryError || !it->is_regular_file(entryError)) {
+					continue;
+				}
+				if (path.extension() == entryExtension) {
+					uint64_t size = it->file_size(entryError);
+					if (!entryError) {
+						entries.push_back({ lastUse, size, path });
+						total += size;
+					}
+				}
+				else if (path.filename().string().find(tempMarker) != std::string::npos && now - lastUse > staleTempAge) {
+					std::filesystem::remove(path, entryError);
+				}
+			}
+
+			// evict a tenth below the cap, so the next few stores do not trim again
+			if (total > maxBytes) {
+				std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.lastUse < b.lastUse; });
+				uint64_t target = maxBytes - maxBytes / 10;
+				for (const Entry& entry : entries) {
+					if (total <= target) {
+						break;
+					}
+					// an entry another process still has mapped may refuse to go on Windows
+					if (std::filesystem::remove(entry.path, error)) {
+						total -= entry.size;
+					}
+				}
+			}
+			totalBytes = total;
+		}
+
+		std::expected<CachedImage, std::string> load(const std::filesystem::path& imagePath, uint16_t requiredChannels, const LoadOptions& options) {
+			MappedFile source;
+			if (!source.open(imagePath)) {
+				return std::unexpected("Failed to map image file: " + imagePath.string());
+			}
+			if (source.data().empty()) {
+				return std::unexpected("Image file is empty: " + imagePath.string());
+			}
+
+			std::filesystem::path path = entryPath(hash64(source.data()), requiredChannels);
+			if (auto cached = mapEntry(path)) {
+				// the modification time doubles as the last use for eviction
+				std::error_code error;
+				std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+				return std::move(*cached);
+			}
+
+			// entries hold a single level of pixels, which is all CachedImage can describe
+			LoadOptions decodeOptions = options;
+			decodeOptions.mipChain = MipChain::None;
+			decodeOptions.blockCompression = BlockCompression::None;
+			std::expected<Image, std::string> decoded = loadImageFromMemory(source.data(), requiredChannels, decodeOptions);
+			if (!decoded) {
+				return std::unexpected(decoded.error());
+			}
+			source.close();
+
+			if (writeEntry(path, *decoded)) {
+				std::optional<CachedImage> cached = mapEntry(path);
+				bool overCap;
+				{
+					std::lock_guard lock(mutex);
+					totalBytes += entryDataOffset + decoded->data.size();
+					overCap = totalBytes > maxBytes;
+				}
+				if (overCap) {
+					trim();
+				}
+				if (cached) {
+					return std::move(*cached);
+				}
+			}
+
+			// the cache directory is not writable; hand out the decoded pixels as they are
+			CachedImage image;
+			image.imageWidth = decoded->width;
+			image.imageHeight = decoded->height;
+			image.imageChannels = decoded->channels;
+			image.ownedPixels = std::move(decoded->data);
+			image.pixels = image.ownedPixels;
+			return image;
+		}
+	};
+
+	CachedImage::CachedImage() = default;
+	CachedImage::CachedImage(CachedImage&& other) noexcept = default;
+	CachedImage& CachedImage::operator=(CachedImage&& other) noexcept = default;
+	CachedImage::~CachedImage() = default;
+
+	ImageCache::ImageCache(std::unique_ptr<ImageCacheState> state) : state(std::move(state)) {}
+	ImageCache::ImageCache(ImageCache&& other) noexcept = default;
+	ImageCache& ImageCache::operator=(ImageCache&& other) noexcept = default;
+	ImageCache::~ImageCache() = default;
+
+	std::expected<ImageCache, std::string> ImageCache::open(const std::filesystem::path& directory, uint64_t maxBytes) {
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+		if (error) {
+			return std::unexpected("Failed to create cache directory: " + directory.string());
+		}
+		auto state = std::make_unique<ImageCacheState>();
+		state->directory = directory;
+		state->maxBytes = maxBytes;
+		// counts what earlier runs left behind
+		state->trim();
+		return ImageCache(std::move(state));
+	}
+
+	std::expected<CachedImage, std::string> ImageCache::load(const std::filesystem::path& imagePath, uint16_t requiredChannels, const LoadOptions& options) {
+		return state->load(imagePath, requiredChannels, options);
+	}
+
+	void ImageCache::trim() {
+		state->trim();
+	}
+}
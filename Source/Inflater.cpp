@@ -0,0 +1,629 @@
+#include "Inflater.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+
+// these are deflate spec constants
+static const std::array<int, 29> lengthExtraBits = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3,
+	3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const std::array<int, 29> lengthBase = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43,
+	51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const std::array<int, 30> distanceExtraBits = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+	8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const std::array<int, 30> distanceBase = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257,
+	385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385,
+	24577
+};
+static const std::array<int, 19> codeLengthOrder = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// Replaces the codes in tree with the canonical code of bitLength. Only the first symbolCount
+// symbols get codes, although every length counts towards the code assignment.
+static void buildTree(HuffmanTree& tree, std::span<const int> bitLength, size_t symbolCount) {
+	std::array<int, HuffmanTree::maxCodeLength + 1> blCount = {};
+	for (int bits : bitLength) {
+		if (bits != 0) {
+			blCount[bits]++;
+		}
+	}
+
+	std::array<int, HuffmanTree::maxCodeLength + 1> nextCode = {};
+	for (int bits = 2; bits <= HuffmanTree::maxCodeLength; bits++) {
+		nextCode[bits] = (nextCode[bits - 1] + blCount[bits - 1]) << 1;
+	}
+
+	tree.clear();
+	size_t iterationSize = std::min(bitLength.size(), symbolCount);
+	for (size_t n = 0; n < iterationSize; n++) {
+		int bits = bitLength[n];
+		if (bits != 0) {
+			int codeword = nextCode[bits];
+			tree.insert(codeword, bits, static_cast<int>(n));
+			nextCode[bits]++;
+		}
+	}
+}
+
+// the fixed code is the same for every block, so its tables are built only once
+static const std::pair<HuffmanTree, HuffmanTree>& fixedTrees() {
+	static const std::pair<HuffmanTree, HuffmanTree> trees = [] {
+		std::array<int, 288> literalLengthBl;
+		std::fill(literalLengthBl.begin(), literalLengthBl.begin() + 144, 8);
+		std::fill(literalLengthBl.begin() + 144, literalLengthBl.begin() + 256, 9);
+		std::fill(literalLengthBl.begin() + 256, literalLengthBl.begin() + 280, 7);
+		std::fill(literalLengthBl.begin() + 280, literalLengthBl.end(), 8);
+
+		std::pair<HuffmanTree, HuffmanTree> fixed;
+		buildTree(fixed.first, literalLengthBl, 286);
+		std::array<int, 30> distanceBl;
+		distanceBl.fill(5);
+		buildTree(fixed.second, distanceBl, 30);
+		return fixed;
+	}();
+	return trees;
+}
+
+// Whether code lengths form a code zlib would accept: one that uses every bit pattern, a single
+// one-bit code, or, where allowEmpty says so, no code at all.
+static bool isAcceptedCode(std::span<const int> bitLength, bool allowEmpty) {
+	uint32_t used = 0;
+	int codes = 0;
+	for (int bits : bitLength) {
+		if (bits != 0) {
+			used += 1u << (HuffmanTree::maxCodeLength - bits);
+			codes++;
+		}
+	}
+	return used == (1u << HuffmanTree::maxCodeLength) || (codes == 1 && used == (1u << (HuffmanTree::maxCodeLength - 1))) || (allowEmpty && codes == 0);
+}
+
+// With strict set, headers that only a corrupt stream contains are rejected: out of range
+// counts, lengths that overrun the tables, incomplete codes and a missing end-of-block code.
+// The speculative search depends on it to tell block headers from other bits.
+static void decodeTrees(BitReader& bitReader, DynamicTrees& trees, bool strict = false) {
+	int hlit = bitReader.readBits(5) + 257;
+	int hdist = bitReader.readBits(5) + 1;
+	int hclen = bitReader.readBits(4) + 4;
+	if (strict && (hlit > 286 || hdist > 30)) {
+		throw std::runtime_error("Invalid code counts in DEFLATE block header");
+	}
+
+	std::array<int, 19> codeLengthTreeBl = {};
+	for (int i = 0; i < hclen; i++) {
+		codeLengthTreeBl[codeLengthOrder[i]] = bitReader.readBits(3);
+	}
+	if (strict && !isAcceptedCode(codeLengthTreeBl, false)) {
+		throw std::runtime_error("Invalid code length code in DEFLATE block header");
+	}
+	buildTree(trees.codeLength, codeLengthTreeBl, 19);
+
+	// a repeat may run up to 138 lengths past the counts, which the tables below still see
+	std::array<int, 288 + 32 + 138> bl;
+	size_t blSize = 0;
+	const size_t blTarget = static_cast<size_t>(hlit + hdist);
+	while (blSize < blTarget) {
+		int symbol = trees.codeLength.decode(bitReader);
+		if (0 <= symbol && symbol <= 15) {
+			bl[blSize++] = symbol;
+		}
+		else if (symbol == 16) {
+			if (blSize == 0) {
+				throw std::runtime_error("Invalid repeat code in code length alphabet");
+			}
+			int prevCodeLength = bl[blSize - 1];
+			int repeatCount = bitReader.readBits(2) + 3;
+			std::fill_n(bl.begin() + blSize, repeatCount, prevCodeLength);
+			blSize += repeatCount;
+		}
+		else if (symbol == 17) {
+			int repeatCount = bitReader.readBits(3) + 3;
+			std::fill_n(bl.begin() + blSize, repeatCount, 0);
+			blSize += repeatCount;
+		}
+		else if (symbol == 18) {
+			int repeatCount = bitReader.readBits(7) + 11;
+			std::fill_n(bl.begin() + blSize, repeatCount, 0);
+			blSize += repeatCount;
+		}
+		else {
+			throw std::runtime_error("Invalid symbol in code length alphabet");
+		}
+	}
+
+	std::span<const int> literalLengthBl(bl.data(), hlit);
+	std::span<const int> distanceBl(bl.data() + hlit, blSize - hlit);
+	if (strict && (blSize != blTarget || literalLengthBl[256] == 0 || !isAcceptedCode(literalLengthBl, false) || !isAcceptedCode(distanceBl, true))) {
+		throw std::runtime_error("Invalid code lengths in DEFLATE block header");
+	}
+
+	buildTree(trees.literalLength, literalLengthBl, 286);
+	buildTree(trees.distance, distanceBl, 30);
+}
+
+// Copies an LZ77 match that may overlap its own output. Writes up to copySlack - 1
+// bytes past dst + length, so callers must guarantee that much room.
+static void copyMatch(uint8_t* dst, size_t distance, size_t length) {
+	const uint8_t* src = dst - distance;
+	if (distance == 1) {
+		std::memset(dst, src[0], length);
+		return;
+	}
+	if (distance >= 16) {
+		for (size_t i = 0; i < length; i += 16) {
+			std::memcpy(dst + i, src + i, 16);
+		}
+		return;
+	}
+	if (distance >= 8) {
+		for (size_t i = 0; i < length; i += 8) {
+			std::memcpy(dst + i, src + i, 8);
+		}
+		return;
+	}
+
+	// a short distance repeats a pattern of that period, so any multiple of it is an
+	// equally valid distance; lay down one period of at least 8 bytes and copy from that
+	size_t period = distance * ((8 + distance - 1) / distance);
+	size_t head = std::min(period, length);
+	for (size_t i = 0; i < head; i++) {
+		dst[i] = src[i];
+	}
+	for (size_t i = head; i < length; i += 8) {
+		std::memcpy(dst + i, dst + i - period, 8);
+	}
+}
+
+void Inflater::reserveOutput(size_t n) {
+	if (outPos + n > output.size()) {
+		output.resize(std::max(output.size() * 2, outPos + n + maxMatchLength + copySlack));
+	}
+}
+
+void Inflater::inflateBlockNoCompression(size_t target) {
+	size_t n = std::min(storedRemaining, target - outPos);
+	reserveOutput(n);
+	bitReader.readAlignedBytes(output.data() + outPos, n);
+	outPos += n;
+	storedRemaining -= n;
+	if (storedRemaining == 0) {
+		endBlock();
+	}
+}
+
+// Runs while at least one full refill of input and a worst-case match of output remain.
+// One refill yields 56 bits, enough for a literal/length code, its extra bits, a distance
+// code and its extra bits (15 + 5 + 15 + 13), so nothing inside needs a bounds check.
+// May run past target by less than one match. Returns true when the end-of-block symbol
+// was decoded.
+bool Inflater::inflateBlockDataFast(size_t target) {
+	uint8_t* out = output.data();
+	size_t fastEnd = output.size() >= maxMatchLength + copySlack ? output.size() - maxMatchLength - copySlack : 0;
+	fastEnd = std::min(fastEnd, target);
+	while (outPos < fastEnd && bitReader.canRefillFast()) {
+		bitReader.refillFast();
+		HuffmanEntry entry = litLengthTree->lookup(bitReader.peekBitsFast(HuffmanTree::maxCodeLength));
+		if (entry.length == 0) {
+			throw std::runtime_error("Invalid Huffman code");
+		}
+		bitReader.consumeFast(entry.length);
+
+		int symbol = entry.value;
+		if (symbol <= 255) {
+			out[outPos++] = static_cast<uint8_t>(symbol);
+			continue;
+		}
+		if (symbol == 256) {
+			return true;
+		}
+
+		symbol -= 257;
+		size_t length = bitReader.readBitsFast(lengthExtraBits[symbol]) + lengthBase[symbol];
+		entry = distTree->lookup(bitReader.peekBitsFast(HuffmanTree::maxCodeLength));
+		if (entry.length == 0) {
+			throw std::runtime_error("Invalid Huffman code");
+		}
+		bitReader.consumeFast(entry.length);
+		size_t distance = bitReader.readBitsFast(distanceExtraBits[entry.value]) + distanceBase[entry.value];
+
+		if (distance > outPos) {
+			throw std::runtime_error("Invalid distance in DEFLATE data");
+		}
+		copyMatch(out + outPos, distance, length);
+		outPos += length;
+	}
+	return false;
+}
+
+void Inflater::copyPendingMatch(size_t target) {
+	size_t n = std::min(pendingLength, target - outPos);
+	reserveOutput(n);
+	for (size_t i = 0; i < n; i++) {
+		output[outPos] = output[outPos - pendingDistance];
+		outPos++;
+	}
+	pendingLength -= n;
+}
+
+// Checked decode of a single symbol, used near the end of the input or output.
+// Returns false when the end-of-block symbol was decoded.
+bool Inflater::inflateSymbol(size_t target) {
+	int symbol = litLengthTree->decode(bitReader);
+	if (symbol <= 255) {
+		reserveOutput(1);
+		output[outPos++] = static_cast<uint8_t>(symbol);
+		return true;
+	}
+	if (symbol == 256) {
+		return false;
+	}
+
+	symbol -= 257;
+	size_t length = bitReader.readBits(lengthExtraBits[symbol]) + lengthBase[symbol];
+	int distSymbol = distTree->decode(bitReader);
+	size_t distance = bitReader.readBits(distanceExtraBits[distSymbol]) + distanceBase[distSymbol];
+
+	if (distance > outPos) {
+		throw std::runtime_error("Invalid distance in DEFLATE data");
+	}
+	pendingLength = length;
+	pendingDistance = distance;
+	copyPendingMatch(target);
+	return true;
+}
+
+// Returns true when the block ended, false when target was reached first.
+bool Inflater::inflateBlockData(size_t target) {
+	if (pendingLength) {
+		copyPendingMatch(target);
+	}
+	while (outPos < target) {
+		if (inflateBlockDataFast(target)) {
+			return true;
+		}
+		if (outPos >= target) {
+			break;
+		}
+		if (!inflateSymbol(target)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void Inflater::beginBlock() {
+	finalBlock = bitReader.readBit();
+	int btype = bitReader.readBits(2);
+	if (statsEnabled && stats && btype < 3) {
+		stats->blockTypes[btype]++;
+		// the code length table and the two tables decodeTrees() builds from it
+		stats->huffmanTableBuilds += btype == 2 ? 3 : 0;
+	}
+	if (btype == 0) {
+		uint16_t len = bitReader.readBytes(2);
+		uint16_t nlen = bitReader.readBytes(2);
+		if ((len ^ 0xFFFF) != nlen) {
+			throw std::runtime_error("Invalid stored block length");
+		}
+		storedRemaining = len;
+		state = State::Stored;
+	}
+	else if (btype == 1) {
+		const auto& trees = fixedTrees();
+		litLengthTree = &trees.first;
+		distTree = &trees.second;
+		state = State::Huffman;
+	}
+	else if (btype == 2) {
+		decodeTrees(bitReader, dynamicTrees);
+		litLengthTree = &dynamicTrees.literalLength;
+		distTree = &dynamicTrees.distance;
+		state = State::Huffman;
+	}
+	else {
+		throw std::runtime_error("Invalid BTYPE in DEFLATE data");
+	}
+}
+
+size_t Inflater::inflateTo(size_t target) {
+	while (state != State::Done && outPos < target) {
+		switch (state) {
+		case State::BlockHeader:
+			beginBlock();
+			// an empty stored block ends right away
+			if (state == State::Stored && storedRemaining == 0) {
+				endBlock();
+			}
+			break;
+		case State::Stored:
+			inflateBlockNoCompression(target);
+			break;
+		case State::Huffman:
+			if (inflateBlockData(target)) {
+				endBlock();
+			}
+			break;
+		case State::Done:
+			break;
+		}
+	}
+	return outPos;
+}
+
+void Inflater::inflate() {
+	inflateTo(SIZE_MAX);
+	output.resize(outPos);
+}
+
+void Inflater::discardOutput(size_t n) {
+	std::memmove(output.data(), output.data() + n, outPos - n);
+	outPos -= n;
+}
+
+#pragma region Parallel
+// Inflates from a bit offset that is only guessed to start a block, before the output in front
+// of it is known. A byte copied from that unknown window is written as windowMarker plus its
+// index in the window, to be filled in once the window is known.
+class SpeculativeInflater {
+public:
+	static constexpr uint16_t windowMarker = 256;
+
+	// hasWindow is false only at the start of the stream, where nothing can be referenced
+	SpeculativeInflater(std::span<const uint8_t> data, size_t startBit, bool hasWindow, std::pmr::memory_resource* resource)
+		: bitReader(data.subspan(startBit / 8)), firstBit(startBit / 8 * 8), windowBytes(hasWindow ? Inflater::windowSize : 0), symbols(resource), dynamicTrees(resource) {
+		bitReader.readBits(static_cast<int>(startBit % 8));
+	}
+
+	// Decodes one block; returns false once the final block is done. Throws on anything a
+	// valid stream cannot contain.
+	bool decodeBlock() {
+		bool finalBlock = bitReader.readBit();
+		int btype = bitReader.readBits(2);
+		if (btype == 0) {
+			uint32_t len = bitReader.readBytes(2);
+			uint32_t nlen = bitReader.readBytes(2);
+			if ((len ^ 0xFFFF) != nlen) {
+				throw std::runtime_error("Invalid stored block length");
+			}
+			std::array<uint8_t, 4096> bytes;
+			while (len > 0) {
+				uint32_t n = std::min<uint32_t>(len, bytes.size());
+				bitReader.readAlignedBytes(bytes.data(), n);
+				symbols.insert(symbols.end(), bytes.begin(), bytes.begin() + n);
+				len -= n;
+			}
+		}
+		else if (btype == 1) {
+			decodeHuffmanBlock(fixedTrees().first, fixedTrees().second);
+		}
+		else if (btype == 2) {
+			decodeTrees(bitReader, dynamicTrees, true);
+			decodeHuffmanBlock(dynamicTrees.literalLength, dynamicTrees.distance);
+		}
+		else {
+			throw std::runtime_error("Invalid BTYPE in DEFLATE data");
+		}
+		return !finalBlock;
+	}
+
+	size_t bitPosition() const { return firstBit + bitReader.bitPosition(); }
+	std::span<const uint16_t> output() const { return symbols; }
+
+private:
+	void decodeHuffmanBlock(const HuffmanTree& literalLengthTree, const HuffmanTree& distanceTree) {
+		while (true) {
+			int symbol = literalLengthTree.decode(bitReader);
+			if (symbol <= 255) {
+				symbols.push_back(static_cast<uint16_t>(symbol));
+				continue;
+			}
+			if (symbol == 256) {
+				return;
+			}
+
+			symbol -= 257;
+			size_t length = bitReader.readBits(lengthExtraBits[symbol]) + lengthBase[symbol];
+			int distSymbol = distanceTree.decode(bitReader);
+			size_t distance = bitReader.readBits(distanceExtraBits[distSymbol]) + distanceBase[distSymbol];
+			size_t size = symbols.size();
+			if (distance > size + windowBytes) {
+				throw std::runtime_error("Invalid distance in DEFLATE data");
+			}
+			symbols.resize(size + length);
+			uint16_t* out = symbols.data() + size;
+			for (size_t i = 0; i < length; i++) {
+				if (distance <= size + i) {
+					out[i] = out[i - distance];
+				}
+				else {
+					out[i] = static_cast<uint16_t>(windowMarker + Inflater::windowSize + size + i - distance);
+				}
+			}
+		}
+	}
+
+	BitReader bitReader;
+	size_t firstBit;
+	size_t windowBytes;
+	std::pmr::vector<uint16_t> symbols;
+	DynamicTrees dynamicTrees;
+};
+
+// Only whether the bits at bit could start a non-final dynamic block, without the cost of an
+// exception for the many that cannot: the block type, the code counts and a complete code
+// length code.
+static bool couldStartDynamicBlock(std::span<const uint8_t> data, size_t bit) {
+	auto bitsAt = [&](size_t at, int n) {
+		uint32_t value = 0;
+		for (int i = 0; i < n; i++, at++) {
+			value |= ((data[at / 8] >> (at % 8)) & 1u) << i;
+		}
+		return value;
+	};
+	if (bit + 17 + 19 * 3 > data.size() * 8 || bitsAt(bit, 3) != 4) {
+		return false;
+	}
+	uint32_t hlit = bitsAt(bit + 3, 5) + 257;
+	uint32_t hdist = bitsAt(bit + 8, 5) + 1;
+	uint32_t hclen = bitsAt(bit + 13, 4) + 4;
+	if (hlit > 286 || hdist > 30) {
+		return false;
+	}
+	std::array<int, 19> codeLengthBl = {};
+	for (uint32_t i = 0; i < hclen; i++) {
+		codeLengthBl[codeLengthOrder[i]] = static_cast<int>(bitsAt(bit + 17 + 3 * i, 3));
+	}
+	return isAcceptedCode(codeLengthBl, false);
+}
+
+// compressed bytes a thread must get before splitting pays for the search and the patching
+static constexpr size_t minParallelChunkBytes = 256 * 1024;
+
+// Resolves window markers against window, whose first windowSize - windowValid bytes lie in
+// front of the stream. False if a marker points there.
+static bool resolveSymbols(std::span<const uint16_t> symbols, const uint8_t* window, size_t windowValid, uint8_t* out) {
+	const size_t firstValid = Inflater::windowSize - windowValid;
+	for (size_t i = 0; i < symbols.size(); i++) {
+		uint16_t symbol = symbols[i];
+		if (symbol < SpeculativeInflater::windowMarker) {
+			out[i] = static_cast<uint8_t>(symbol);
+			continue;
+		}
+		size_t index = symbol - SpeculativeInflater::windowMarker;
+		if (index < firstValid) {
+			return false;
+		}
+		out[i] = window[index];
+	}
+	return true;
+}
+
+std::optional<size_t> inflateParallel(std::span<const uint8_t> data, std::pmr::vector<uint8_t>& output, uint32_t threadCount, std::stop_token stopToken) {
+	const size_t chunkCount = std::min<size_t>(threadCount, data.size() / minParallelChunkBytes);
+	if (chunkCount < 2) {
+		return std::nullopt;
+	}
+	std::pmr::memory_resource* resource = output.get_allocator().resource();
+
+	struct Chunk {
+		std::unique_ptr<SpeculativeInflater> inflater;
+		size_t startBit = 0;
+		bool finalBlock = false;
+		bool failed = false;
+		// the 32 KB in front of the chunk, filled in once the chunks before it are resolved
+		std::array<uint8_t, Inflater::windowSize> window;
+		size_t windowValid = 0;
+		size_t outputOffset = 0;
+	};
+	std::vector<Chunk> chunks(chunkCount);
+	ThreadPool pool(static_cast<uint32_t>(chunkCount) - 1);
+
+	// every piece but the first looks for the first bit that starts a dynamic block and decodes
+	// that block to its end
+	chunks[0].inflater = std::make_unique<SpeculativeInflater>(data, 0, false, resource);
+	for (size_t k = 1; k < chunkCount; k++) {
+		pool.submit([&, k] {
+			const size_t endBit = data.size() * (k + 1) / chunkCount * 8;
+			for (size_t bit = data.size() * k / chunkCount * 8; bit < endBit && !stopToken.stop_requested(); bit++) {
+				if (!couldStartDynamicBlock(data, bit)) {
+					continue;
+				}
+				try {
+					auto candidate = std::make_unique<SpeculativeInflater>(data, bit, true, resource);
+					candidate->decodeBlock();
+					chunks[k].inflater = std::move(candidate);
+					chunks[k].startBit = bit;
+					return;
+				}
+				catch (const std::exception&) {
+				}
+			}
+		});
+	}
+	pool.wait();
+	// a piece without a block start is left to the piece in front of it
+	std::erase_if(chunks, [](const Chunk& chunk) { return !chunk.inflater; });
+
+	// each piece decodes up to the first block boundary at or past the start of the next one
+	for (size_t k = 0; k < chunks.size(); k++) {
+		pool.submit([&, k] {
+			Chunk& chunk = chunks[k];
+			const size_t stopBit = k + 1 < chunks.size() ? chunks[k + 1].startBit : SIZE_MAX;
+			try {
+				while (chunk.inflater->bitPosition() < stopBit) {
+					if (stopToken.stop_requested()) {
+						chunk.failed = true;
+						return;
+					}
+					if (!chunk.inflater->decodeBlock()) {
+						chunk.finalBlock = true;
+						return;
+					}
+				}
+			}
+			catch (const std::exception&) {
+				chunk.failed = true;
+			}
+		});
+	}
+	pool.wait();
+
+	// A piece is confirmed once the one in front of it, itself confirmed, stopped exactly at its
+	// start. Walking them in order also carries each window forward, which only needs the last
+	// 32 KB of every piece resolved.
+	size_t windowValid = 0;
+	std::array<uint8_t, Inflater::windowSize> window;
+	size_t totalSize = 0;
+	size_t usedChunks = 0;
+	for (size_t k = 0; k < chunks.size(); k++) {
+		Chunk& chunk = chunks[k];
+		if (chunk.failed) {
+			return std::nullopt;
+		}
+		chunk.window = window;
+		chunk.windowValid = windowValid;
+		chunk.outputOffset = totalSize;
+		std::span<const uint16_t> symbols = chunk.inflater->output();
+		totalSize += symbols.size();
+		usedChunks = k + 1;
+		if (chunk.finalBlock) {
+			break;
+		}
+		if (k + 1 == chunks.size() || chunk.inflater->bitPosition() != chunks[k + 1].startBit) {
+			return std::nullopt;
+		}
+
+		std::span<const uint16_t> tail = symbols.last(std::min(symbols.size(), Inflater::windowSize));
+		std::memmove(window.data(), window.data() + tail.size(), Inflater::windowSize - tail.size());
+		if (!resolveSymbols(tail, chunk.window.data(), chunk.windowValid, window.data() + Inflater::windowSize - tail.size())) {
+			return std::nullopt;
+		}
+		windowValid = std::min(Inflater::windowSize, windowValid + symbols.size());
+	}
+
+	output.resize(totalSize);
+	std::atomic<bool> resolved = true;
+	for (size_t k = 0; k < usedChunks; k++) {
+		pool.submit([&, k] {
+			const Chunk& chunk = chunks[k];
+			if (!resolveSymbols(chunk.inflater->output(), chunk.window.data(), chunk.windowValid, output.data() + chunk.outputOffset)) {
+				resolved = false;
+			}
+		});
+	}
+	pool.wait();
+	if (!resolved) {
+		return std::nullopt;
+	}
+	return (chunks[usedChunks - 1].inflater->bitPosition() + 7) / 8;
+}
+#pragma endregion
@@ -0,0 +1,91 @@
+#pragma once
+#include "BitReader.h"
+#include "HuffmanTree.h"
+#include "Stats.h"
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <vector>
+
+// The tables of a dynamic block. An inflater keeps one set and rebuilds it for each block,
+// so the tables are only allocated once per stream.
+struct DynamicTrees {
+	explicit DynamicTrees(std::pmr::memory_resource* resource) : codeLength(resource), literalLength(resource), distance(resource) {}
+
+	HuffmanTree codeLength;
+	HuffmanTree literalLength;
+	HuffmanTree distance;
+};
+
+// Decodes a raw DEFLATE stream into output. The output vector should be sized up front
+// to the expected decompressed length; it is grown only if the stream turns out longer
+// and is trimmed to the exact length once the final block ends.
+//
+// Decoding can also be driven incrementally with inflateTo(), which stops as soon as the
+// requested amount of output exists and resumes mid-block on the next call. Together with
+// discardOutput() this keeps only a sliding window of the output in memory.
+class Inflater {
+public:
+	// a match copies at most 258 bytes and the chunked copy may write up to 15 more
+	static constexpr size_t maxMatchLength = 258;
+	static constexpr size_t copySlack = 16;
+	// furthest back a match may reach
+	static constexpr size_t windowSize = 32768;
+
+	// the tables come from the memory resource of output
+	Inflater(BitReader& bitReader, std::pmr::vector<uint8_t>& output) : bitReader(bitReader), output(output), dynamicTrees(output.get_allocator().resource()) {}
+	~Inflater() = default;
+
+	void inflate();
+	// Decodes until at least target bytes of output exist or the stream ends and returns
+	// the output size. Output is only grown if target is beyond its current size.
+	size_t inflateTo(size_t target);
+	// Drops the first n bytes of output and moves the rest to the front. At least
+	// windowSize bytes must remain unless the stream has not produced that much yet.
+	void discardOutput(size_t n);
+	size_t outputSize() const { return outPos; }
+	// counts block types and table builds into stats, which may be null
+	void setStats(AxImageLoader::DecodeStats* decodeStats) { stats = decodeStats; }
+	bool finished() const { return state == State::Done; }
+
+private:
+	enum class State {
+		BlockHeader,
+		Stored,
+		Huffman,
+		Done
+	};
+
+	void beginBlock();
+	void endBlock() { state = finalBlock ? State::Done : State::BlockHeader; }
+	void inflateBlockNoCompression(size_t target);
+	bool inflateBlockData(size_t target);
+	bool inflateBlockDataFast(size_t target);
+	bool inflateSymbol(size_t target);
+	void copyPendingMatch(size_t target);
+	void reserveOutput(size_t n);
+
+	BitReader& bitReader;
+	std::pmr::vector<uint8_t>& output;
+	size_t outPos = 0;
+
+	State state = State::BlockHeader;
+	bool finalBlock = false;
+	size_t storedRemaining = 0;
+	DynamicTrees dynamicTrees;
+	const HuffmanTree* litLengthTree = nullptr;
+	const HuffmanTree* distTree = nullptr;
+	// a match cut short by the output target
+	size_t pendingLength = 0;
+	size_t pendingDistance = 0;
+	AxImageLoader::DecodeStats* stats = nullptr;
+};
+
+// Experimental: inflates a complete raw DEFLATE stream on up to threadCount threads. The input
+// is cut into pieces and each thread searches its piece for the start of a dynamic Huffman
+// block, then decodes from there before the 32 KB window in front of it is known. References
+// into that window are patched once the pieces before it are done. Returns how many bytes of
+// data the stream took, or nothing if a guessed block start proved wrong, the data is invalid
+// or stopToken fired; the caller then inflates serially, which reports any error.
+std::optional<size_t> inflateParallel(std::span<const uint8_t> data, std::pmr::vector<uint8_t>& output, uint32_t threadCount, std::stop_token stopToken);
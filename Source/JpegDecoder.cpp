@@ -0,0 +1,1237 @@
+#include "JpegDecoder.h"
+#include "BitReader.h"
+#include "HuffmanTree.h"
+#include "JpegKernels.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// position in the natural (row-major) block of each coefficient in stream order
+static constexpr std::array<uint8_t, 64> zigzagOrder = {
+	0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+	12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// markers this decoder looks at; the rest are skipped by their length
+static constexpr uint8_t markerSof0 = 0xC0;
+static constexpr uint8_t markerSof1 = 0xC1;
+static constexpr uint8_t markerSof2 = 0xC2;
+static constexpr uint8_t markerDht = 0xC4;
+static constexpr uint8_t markerDac = 0xCC;
+static constexpr uint8_t markerRst0 = 0xD0;
+static constexpr uint8_t markerRst7 = 0xD7;
+static constexpr uint8_t markerSoi = 0xD8;
+static constexpr uint8_t markerEoi = 0xD9;
+static constexpr uint8_t markerSos = 0xDA;
+static constexpr uint8_t markerDqt = 0xDB;
+static constexpr uint8_t markerDri = 0xDD;
+static constexpr uint8_t markerApp14 = 0xEE;
+static constexpr uint8_t markerTem = 0x01;
+
+// an MCU of an interleaved scan holds at most this many blocks
+static constexpr uint32_t maxBlocksPerMcu = 10;
+// rows converted per task when the color conversion is split between threads
+static constexpr uint32_t convertRowsPerTask = 64;
+
+static std::pmr::memory_resource* scratchResource(const AxImageLoader::LoadOptions& options) {
+	return options.scratchMemory ? options.scratchMemory : std::pmr::get_default_resource();
+}
+
+static void throwIfCancelled(const AxImageLoader::LoadOptions& options) {
+	if (options.stopToken.stop_requested()) {
+		throw std::runtime_error(std::string(AxImageLoader::cancelledError));
+	}
+}
+
+static uint16_t readBigEndian16(const uint8_t* p) {
+	return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+#pragma region Huffman
+// The two-level table of the DEFLATE HuffmanTree, for JPEG's codes: read MSB first and up to
+// 16 bits long, so the top primaryBits of a 16-bit peek index the primary table.
+class JpegHuffmanTable {
+public:
+	static constexpr int maxCodeLength = 16;
+	static constexpr int primaryBits = 9;
+	static constexpr int secondaryBits = maxCodeLength - primaryBits;
+	static constexpr int fastAcBits = 11;
+
+	explicit JpegHuffmanTable(std::pmr::memory_resource* resource) : table(1 << primaryBits, resource) {}
+
+	// counts[n] codes of length n + 1, handed out to symbols in order
+	void build(std::span<const uint8_t> counts, std::span<const uint8_t> symbols) {
+		table.assign(1 << primaryBits, HuffmanEntry{});
+		uint32_t code = 0;
+		size_t symbol = 0;
+		for (int length = 1; length <= maxCodeLength; length++) {
+			for (int i = 0; i < counts[length - 1]; i++, code++, symbol++) {
+				if (code >= (1u << length)) {
+					throw std::runtime_error("Invalid JPEG Huffman table");
+				}
+				insert(code, length, symbols[symbol]);
+			}
+			code <<= 1;
+		}
+
+		// AC symbols are a zero run and a size; when the code and the size bits after it fit in
+		// fastAcBits, the slot can hold the finished coefficient
+		for (uint32_t i = 0; i < (1u << fastAcBits); i++) {
+			fastAc[i] = 0;
+			HuffmanEntry entry = lookup(i << (maxCodeLength - fastAcBits));
+			int run = entry.value >> 4;
+			int size = entry.value & 15;
+			if (entry.length == 0 || size == 0 || entry.length + size > fastAcBits) {
+				continue;
+			}
+			int bits = static_cast<int>(i >> (fastAcBits - entry.length - size)) & ((1 << size) - 1);
+			int value = bits < (1 << (size - 1)) ? bits - (1 << size) + 1 : bits;
+			fastAc[i] = (value * 256) | (run << 4) | (entry.length + size);
+		}
+		defined = true;
+	}
+
+	// Unchecked reads need at least symbolBits buffered, see hasSymbolBits()
+	template<bool Unchecked = false>
+	uint8_t decode(ReversedBitReader& reader) const {
+		HuffmanEntry entry = lookup(Unchecked ? reader.peekBitsFast(maxCodeLength) : reader.peekBits(maxCodeLength));
+		if (entry.length == 0) {
+			throw std::runtime_error("Invalid Huffman code in JPEG data");
+		}
+		Unchecked ? reader.consumeFast(entry.length) : reader.consume(entry.length);
+		return static_cast<uint8_t>(entry.value);
+	}
+
+	// the entry for the code at the top of 16 peeked bits
+	HuffmanEntry lookup(uint32_t bits) const {
+		HuffmanEntry entry = table[bits >> secondaryBits];
+		if (entry.secondary) {
+			entry = table[entry.value + (bits & ((1u << secondaryBits) - 1))];
+		}
+		return entry;
+	}
+
+	// Indexed by the next fastAcBits of the stream: coefficient * 256 | run << 4 | bits used,
+	// or 0 when the slot has to go through decode()
+	std::array<int32_t, 1 << fastAcBits> fastAc = {};
+	bool defined = false;
+
+private:
+	void insert(uint32_t code, int length, uint8_t symbol) {
+		HuffmanEntry leaf = { symbol, static_cast<uint8_t>(length), 0 };
+		if (length <= primaryBits) {
+			std::fill_n(table.begin() + (code << (primaryBits - length)), 1u << (primaryBits - length), leaf);
+			return;
+		}
+		uint32_t prefix = code >> (length - primaryBits);
+		if (!table[prefix].secondary) {
+			table[prefix] = { static_cast<uint16_t>(table.size()), 0, 1 };
+			table.resize(table.size() + (1u << secondaryBits));
+		}
+		int rest = length - primaryBits;
+		uint32_t first = table[prefix].value + ((code & ((1u << rest) - 1)) << (secondaryBits - rest));
+		std::fill_n(table.begin() + first, 1u << (secondaryBits - rest), leaf);
+	}
+
+	std::pmr::vector<HuffmanEntry> table;
+};
+
+// the next s bits of the stream as a signed value, the way JPEG codes coefficient magnitudes
+template<bool Unchecked = false>
+static inline int receiveExtend(ReversedBitReader& reader, int s) {
+	if (s == 0) {
+		return 0;
+	}
+	int value = static_cast<int>(Unchecked ? reader.readBitsFast(s) : reader.readBits(s));
+	return value < (1 << (s - 1)) ? value - (1 << s) + 1 : value;
+}
+
+// Decodes one AC symbol into the zero run before value. A run of 16 zeros comes back as 15
+// with value 0, the end of the block (or band) as -1 with value the symbol's run bits, which
+// progressive scans use to code runs of empty bands.
+template<bool Unchecked>
+static inline int decodeAcCoefficient(ReversedBitReader& reader, const JpegHuffmanTable& table, int& value) {
+	uint32_t bits = Unchecked ? reader.peekBitsFast(JpegHuffmanTable::maxCodeLength) : reader.peekBits(JpegHuffmanTable::maxCodeLength);
+	int fast = table.fastAc[bits >> (JpegHuffmanTable::maxCodeLength - JpegHuffmanTable::fastAcBits)];
+	if (fast != 0) {
+		Unchecked ? reader.consumeFast(fast & 15) : reader.consume(fast & 15);
+		value = fast >> 8;
+		return (fast >> 4) & 15;
+	}
+	int rs = table.decode<Unchecked>(reader);
+	int s = rs & 15;
+	if (s == 0) {
+		value = rs == 0xF0 ? 0 : rs >> 4;
+		return rs == 0xF0 ? 15 : -1;
+	}
+	value = receiveExtend<Unchecked>(reader, s);
+	return rs >> 4;
+}
+
+// a code and the magnitude bits after it
+static constexpr int symbolBits = 31;
+
+// Refills the reader if a whole symbol might not be buffered; false near the end of the data,
+// where only the checked reads will do
+static inline bool hasSymbolBits(ReversedBitReader& reader) {
+	if (reader.bufferedBits() < symbolBits && reader.canRefillFast()) {
+		reader.refillFast();
+	}
+	return reader.bufferedBits() >= symbolBits;
+}
+
+static inline int16_t dequantize(int value, uint16_t quant) {
+	return static_cast<int16_t>(std::clamp(value * static_cast<int>(quant), INT16_MIN, INT16_MAX));
+}
+#pragma endregion
+
+#pragma region Decoder
+struct JpegComponent {
+	explicit JpegComponent(std::pmr::memory_resource* resource) : plane(resource), coefficients(resource) {}
+
+	uint8_t id = 0;
+	uint8_t h = 1;
+	uint8_t v = 1;
+	uint8_t quantTable = 0;
+	// samples at this component's resolution, and the blocks that hold any
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t blocksWide = 0;
+	uint32_t blocksHigh = 0;
+	// blocks once padded to whole MCUs; plane rows are blocksPerLine * 8 samples
+	uint32_t blocksPerLine = 0;
+	uint32_t blocksPerColumn = 0;
+	// the block rows the region needs
+	uint32_t firstBlockRow = 0;
+	uint32_t endBlockRow = 0;
+	std::pmr::vector<uint8_t> plane;
+	// progressive images keep every coefficient until the last scan, 64 per block in natural order
+	std::pmr::vector<int16_t> coefficients;
+};
+
+struct JpegScan {
+	uint8_t count = 0;
+	std::array<uint8_t, 4> components = {};
+	std::array<uint8_t, 4> dcTables = {};
+	std::array<uint8_t, 4> acTables = {};
+	// spectral selection and successive approximation; 0, 63, 0, 0 in sequential scans
+	uint8_t ss = 0;
+	uint8_t se = 63;
+	uint8_t ah = 0;
+	uint8_t al = 0;
+};
+
+enum class ColorTransform {
+	Gray,
+	YCbCr,
+	Rgb,
+	Cmyk,
+	Ycck
+};
+
+// The entropy-coded data of a scan with the stuffed zero bytes removed, split at its restart
+// markers: interval k is bytes[starts[k], starts[k + 1]).
+struct EntropySegments {
+	explicit EntropySegments(std::pmr::memory_resource* resource) : bytes(resource), starts(resource) {}
+
+	std::span<const uint8_t> interval(size_t k) const {
+		if (k + 1 >= starts.size()) {
+			return {};
+		}
+		return std::span<const uint8_t>(bytes).subspan(starts[k], starts[k + 1] - starts[k]);
+	}
+
+	std::pmr::vector<uint8_t> bytes;
+	std::pmr::vector<size_t> starts;
+};
+
+// A block of a sequential scan between entropy decoding and its IDCT
+struct PendingBlock {
+	uint32_t blockX;
+	uint32_t blockY;
+	uint8_t component;
+	bool hasAc;
+};
+
+// what one thread needs to decode restart intervals of a sequential scan
+struct IntervalScratch {
+	explicit IntervalScratch(std::pmr::memory_resource* resource) : coefficients(resource), blocks(resource) {}
+
+	std::pmr::vector<int16_t> coefficients;
+	std::pmr::vector<PendingBlock> blocks;
+};
+
+// the upsampled component rows and an RGB row for the conversions that go through one
+struct RowScratch {
+	explicit RowScratch(std::pmr::memory_resource* resource)
+		: upsampled{ std::pmr::vector<uint8_t>(resource), std::pmr::vector<uint8_t>(resource), std::pmr::vector<uint8_t>(resource), std::pmr::vector<uint8_t>(resource) }, rgb(resource) {}
+
+	std::array<std::pmr::vector<uint8_t>, 4> upsampled;
+	std::pmr::vector<uint8_t> rgb;
+};
+
+class JpegDecoder {
+public:
+	JpegDecoder(std::span<const uint8_t> data, const AxImageLoader::LoadOptions& options)
+		: data(data), options(options), resource(scratchResource(options)), stats(decodeStats(options)), idct(selectIdctKernel()), components(resource),
+		  dcTables{ JpegHuffmanTable(resource), JpegHuffmanTable(resource), JpegHuffmanTable(resource), JpegHuffmanTable(resource) },
+		  acTables{ JpegHuffmanTable(resource), JpegHuffmanTable(resource), JpegHuffmanTable(resource), JpegHuffmanTable(resource) }, segments(resource) {}
+
+	// parses markers up to and including the frame header
+	JpegHeader readHeader();
+	void decode(uint16_t outChannels, const AxImageLoader::ImageRegion& region, uint8_t* dst, size_t rowPitch);
+
+private:
+	uint8_t nextMarker();
+	std::span<const uint8_t> readSegment();
+	void readMarkerSegment(uint8_t marker, std::span<const uint8_t> segment);
+	void readFrame(uint8_t marker, std::span<const uint8_t> segment);
+	void readHuffmanTables(std::span<const uint8_t> segment);
+	void readQuantTables(std::span<const uint8_t> segment);
+	JpegScan readScanHeader(std::span<const uint8_t> segment) const;
+	void readEntropyData();
+
+	void prepareRegion(const AxImageLoader::ImageRegion& region);
+	void decodeScan(const JpegScan& scan);
+	void decodeIntervals(const JpegScan& scan, size_t firstInterval, size_t endInterval, size_t endMcu, IntervalScratch& scratch, AxImageLoader::DecodeStats* stageStats);
+	void decodeMcus(const JpegScan& scan, ReversedBitReader& reader, std::array<int, 4>& dcPredictors, uint32_t& eobRun, size_t firstMcu, size_t endMcu, IntervalScratch& scratch);
+	void decodeSequentialBlock(const JpegScan& scan, uint32_t scanComponent, ReversedBitReader& reader, int& dcPredictor, uint32_t blockX, uint32_t blockY, IntervalScratch& scratch);
+	void decodeProgressiveBlock(const JpegScan& scan, uint32_t scanComponent, ReversedBitReader& reader, int& dcPredictor, uint32_t& eobRun, uint32_t blockX, uint32_t blockY);
+	void inverseTransformPending(IntervalScratch& scratch);
+	void inverseTransformCoefficients();
+
+	const uint8_t* componentRow(size_t index, uint32_t y, RowScratch& scratch) const;
+	void convertRows(uint32_t firstRow, uint32_t endRow, uint16_t outChannels, const AxImageLoader::ImageRegion& region, uint8_t* dst, size_t rowPitch, RowScratch& scratch) const;
+
+	// runs tasks on the pool when there is one, rethrowing the first exception they throw
+	template<typename Task>
+	void runTasks(size_t count, Task task);
+
+	std::span<const uint8_t> data;
+	size_t pos = 0;
+	const AxImageLoader::LoadOptions& options;
+	std::pmr::memory_resource* resource;
+	AxImageLoader::DecodeStats* stats;
+	IdctKernel idct;
+	std::optional<ThreadPool> pool;
+
+	JpegHeader header;
+	bool frameRead = false;
+	std::pmr::vector<JpegComponent> components;
+	uint32_t hMax = 1;
+	uint32_t vMax = 1;
+	uint32_t mcusPerLine = 0;
+	uint32_t mcuRows = 0;
+	std::array<JpegHuffmanTable, 4> dcTables;
+	std::array<JpegHuffmanTable, 4> acTables;
+	std::array<std::array<uint16_t, 64>, 4> quantTables = {};
+	std::array<bool, 4> quantDefined = {};
+	uint32_t restartInterval = 0;
+	bool hasAdobe = false;
+	uint8_t adobeTransform = 0;
+	// components that have been in a scan, for stopping after the last sequential one
+	uint32_t scannedComponents = 0;
+	// reused by every scan, so progressive images keep one buffer
+	EntropySegments segments;
+};
+
+// Returns the marker at pos, skipping fill bytes. Stray bytes in front of it are tolerated,
+// as other decoders do.
+uint8_t JpegDecoder::nextMarker() {
+	while (pos < data.size() && data[pos] != 0xFF) {
+		pos++;
+	}
+	while (pos < data.size() && data[pos] == 0xFF) {
+		pos++;
+	}
+	if (pos >= data.size()) {
+		throw std::runtime_error("Unexpected end of JPEG data");
+	}
+	return data[pos++];
+}
+
+// the payload of the segment at pos; its length field counts itself but not the marker
+std::span<const uint8_t> JpegDecoder::readSegment() {
+	if (pos + 2 > data.size()) {
+		throw std::runtime_error("Unexpected end of JPEG data");
+	}
+	size_t length = readBigEndian16(&data[pos]);
+	if (length < 2 || pos + length > data.size()) {
+		throw std::runtime_error("Invalid JPEG segment length");
+	}
+	std::span<const uint8_t> segment = data.subspan(pos + 2, length - 2);
+	pos += length;
+	return segment;
+}
+
+void JpegDecoder::readMarkerSegment(uint8_t marker, std::span<const uint8_t> segment) {
+	switch (marker) {
+	case markerSof0:
+	case markerSof1:
+	case markerSof2:
+		readFrame(marker, segment);
+		break;
+	case markerDht:
+		readHuffmanTables(segment);
+		break;
+	case markerDqt:
+		readQuantTables(segment);
+		break;
+	case markerDri:
+		if (segment.size() < 2) {
+			throw std::runtime_error("Invalid JPEG restart interval");
+		}
+		restartInterval = readBigEndian16(segment.data());
+		break;
+	case markerApp14:
+		// Adobe's segment says whether three components are YCbCr or RGB, four CMYK or YCCK
+		if (segment.size() >= 12 && std::memcmp(segment.data(), "Adobe", 5) == 0) {
+			hasAdobe = true;
+			adobeTransform = segment[11];
+		}
+		break;
+	default:
+		// every other frame type is lossless, hierarchical or arithmetic coded
+		if ((marker >= 0xC3 && marker <= 0xCF && marker != markerDht && marker != markerDac)) {
+			throw std::runtime_error("Unsupported JPEG process: lossless, hierarchical and arithmetic coded JPEGs are not supported");
+		}
+		break;
+	}
+}
+
+void JpegDecoder::readFrame(uint8_t marker, std::span<const uint8_t> segment) {
+	if (frameRead) {
+		throw std::runtime_error("JPEG has more than one frame header");
+	}
+	if (segment.size() < 6) {
+		throw std::runtime_error("Invalid JPEG frame header");
+	}
+	if (segment[0] != 8) {
+		throw std::runtime_error("Unsupported JPEG sample precision: " + std::to_string(segment[0]));
+	}
+	header.height = readBigEndian16(&segment[1]);
+	header.width = readBigEndian16(&segment[3]);
+	header.components = segment[5];
+	header.progressive = marker == markerSof2;
+	if (header.width == 0 || header.height == 0) {
+		throw std::runtime_error("Invalid JPEG image size");
+	}
+	if (header.components != 1 && header.components != 3 && header.components != 4) {
+		throw std::runtime_error("Unsupported JPEG component count: " + std::to_string(header.components));
+	}
+	if (segment.size() < 6 + 3 * static_cast<size_t>(header.components)) {
+		throw std::runtime_error("Invalid JPEG frame header");
+	}
+
+	components.clear();
+	for (uint32_t i = 0; i < header.components; i++) {
+		JpegComponent& component = components.emplace_back(resource);
+		component.id = segment[6 + 3 * i];
+		component.h = segment[7 + 3 * i] >> 4;
+		component.v = segment[7 + 3 * i] & 15;
+		component.quantTable = segment[8 + 3 * i];
+		if (component.h < 1 || component.h > 4 || component.v < 1 || component.v > 4 || component.quantTable > 3) {
+			throw std::runtime_error("Invalid JPEG component parameters");
+		}
+		hMax = std::max<uint32_t>(hMax, component.h);
+		vMax = std::max<uint32_t>(vMax, component.v);
+	}
+	for (JpegComponent& component : components) {
+		// upsampling handles whole ratios only, as libjpeg does
+		if (hMax % component.h != 0 || vMax % component.v != 0) {
+			throw std::runtime_error("Unsupported JPEG sampling factors");
+		}
+	}
+
+	mcusPerLine = (header.width + 8 * hMax - 1) / (8 * hMax);
+	mcuRows = (header.height + 8 * vMax - 1) / (8 * vMax);
+	for (JpegComponent& component : components) {
+		component.width = (header.width * component.h + hMax - 1) / hMax;
+		component.height = (header.height * component.v + vMax - 1) / vMax;
+		component.blocksWide = (component.width + 7) / 8;
+		component.blocksHigh = (component.height + 7) / 8;
+		component.blocksPerLine = mcusPerLine * component.h;
+		component.blocksPerColumn = mcuRows * component.v;
+	}
+	frameRead = true;
+}
+
+void JpegDecoder::readHuffmanTables(std::span<const uint8_t> segment) {
+	size_t i = 0;
+	while (i < segment.size()) {
+		uint8_t tableClass = segment[i] >> 4;
+		uint8_t tableIndex = segment[i] & 15;
+		if (tableClass > 1 || tableIndex > 3 || i + 17 > segment.size()) {
+			throw std::runtime_error("Invalid JPEG Huffman table");
+		}
+		std::span<const uint8_t> counts = segment.subspan(i + 1, 16);
+		size_t symbolCount = 0;
+		for (uint8_t count : counts) {
+			symbolCount += count;
+		}
+		if (symbolCount > 256 || i + 17 + symbolCount > segment.size()) {
+			throw std::runtime_error("Invalid JPEG Huffman table");
+		}
+		(tableClass == 0 ? dcTables : acTables)[tableIndex].build(counts, segment.subspan(i + 17, symbolCount));
+		i += 17 + symbolCount;
+	}
+}
+
+// tables arrive in zigzag order and are kept in natural order
+void JpegDecoder::readQuantTables(std::span<const uint8_t> segment) {
+	size_t i = 0;
+	while (i < segment.size()) {
+		uint8_t precision = segment[i] >> 4;
+		uint8_t tableIndex = segment[i] & 15;
+		size_t valueBytes = precision == 0 ? 1 : 2;
+		if (precision > 1 || tableIndex > 3 || i + 1 + 64 * valueBytes > segment.size()) {
+			throw std::runtime_error("Invalid JPEG quantization table");
+		}
+		for (size_t k = 0; k < 64; k++) {
+			const uint8_t* value = &segment[i + 1 + k * valueBytes];
+			quantTables[tableIndex][zigzagOrder[k]] = valueBytes == 1 ? value[0] : readBigEndian16(value);
+		}
+		quantDefined[tableIndex] = true;
+		i += 1 + 64 * valueBytes;
+	}
+}
+
+JpegScan JpegDecoder::readScanHeader(std::span<const uint8_t> segment) const {
+	if (!frameRead) {
+		throw std::runtime_error("JPEG scan comes before the frame header");
+	}
+	JpegScan scan;
+	scan.count = segment.empty() ? 0 : segment[0];
+	if (scan.count < 1 || scan.count > 4 || segment.size() < 4 + 2 * static_cast<size_t>(scan.count)) {
+		throw std::runtime_error("Invalid JPEG scan header");
+	}
+	uint32_t blocksPerMcu = 0;
+	for (uint32_t i = 0; i < scan.count; i++) {
+		uint8_t id = segment[1 + 2 * i];
+		auto component = std::find_if(components.begin(), components.end(), [&](const JpegComponent& c) { return c.id == id; });
+		if (component == components.end()) {
+			throw std::runtime_error("JPEG scan refers to an unknown component");
+		}
+		scan.components[i] = static_cast<uint8_t>(component - components.begin());
+		scan.dcTables[i] = segment[2 + 2 * i] >> 4;
+		scan.acTables[i] = segment[2 + 2 * i] & 15;
+		if (scan.dcTables[i] > 3 || scan.acTables[i] > 3) {
+			throw std::runtime_error("Invalid JPEG scan header");
+		}
+		blocksPerMcu += static_cast<uint32_t>(component->h) * component->v;
+	}
+	if (scan.count > 1 && blocksPerMcu > maxBlocksPerMcu) {
+		throw std::runtime_error("Invalid JPEG scan header");
+	}
+
+	const uint8_t* parameters = &segment[1 + 2 * scan.count];
+	if (header.progressive) {
+		scan.ss = parameters[0];
+		scan.se = parameters[1];
+		scan.ah = parameters[2] >> 4;
+		scan.al = parameters[2] & 15;
+		bool dcScan = scan.ss == 0;
+		if ((dcScan && scan.se != 0) || (!dcScan && (scan.se < scan.ss || scan.se > 63 || scan.count != 1)) || scan.al > 13) {
+			throw std::runtime_error("Invalid JPEG progressive scan parameters");
+		}
+	}
+
+	for (uint32_t i = 0; i < scan.count; i++) {
+		bool needsDc = !header.progressive || (scan.ss == 0 && scan.ah == 0);
+		bool needsAc = !header.progressive || scan.ss > 0;
+		if ((needsDc && !dcTables[scan.dcTables[i]].defined) || (needsAc && !acTables[scan.acTables[i]].defined)) {
+			throw std::runtime_error("JPEG scan uses an undefined Huffman table");
+		}
+	}
+	return scan;
+}
+
+// Copies the scan's entropy-coded data from pos up to the marker that ends it, dropping the
+// zero after each 0xFF data byte and cutting at restart markers. pos is left on the marker.
+void JpegDecoder::readEntropyData() {
+	segments.bytes.clear();
+	segments.bytes.reserve(data.size() - pos);
+	segments.starts.assign(1, 0);
+	while (pos < data.size()) {
+		const void* found = std::memchr(data.data() + pos, 0xFF, data.size() - pos);
+		size_t end = found ? static_cast<size_t>(static_cast<const uint8_t*>(found) - data.data()) : data.size();
+		segments.bytes.insert(segments.bytes.end(), data.begin() + pos, data.begin() + end);
+		pos = end;
+		if (pos + 1 >= data.size()) {
+			pos = data.size();
+			break;
+		}
+		uint8_t next = data[pos + 1];
+		if (next == 0x00) {
+			segments.bytes.push_back(0xFF);
+			pos += 2;
+		}
+		else if (next == 0xFF) {
+			pos++;
+		}
+		else if (next >= markerRst0 && next <= markerRst7) {
+			segments.starts.push_back(segments.bytes.size());
+			pos += 2;
+		}
+		else {
+			break;
+		}
+	}
+	segments.starts.push_back(segments.bytes.size());
+	if (stats) {
+		stats->compressedBytes += segments.bytes.size();
+	}
+}
+
+JpegHeader JpegDecoder::readHeader() {
+	if (!isJpeg(data)) {
+		throw std::runtime_error("Invalid JPEG signature");
+	}
+	pos = 2;
+	while (!frameRead) {
+		uint8_t marker = nextMarker();
+		if (marker == markerSos || marker == markerEoi) {
+			throw std::runtime_error("JPEG has no frame header");
+		}
+		if ((marker >= markerRst0 && marker <= markerRst7) || marker == markerTem || marker == markerSoi) {
+			continue;
+		}
+		readMarkerSegment(marker, readSegment());
+	}
+	return header;
+}
+
+// Works out which block rows each component needs for region. Vertical upsampling blends in
+// one source row either side, hence the extra row at both ends.
+void JpegDecoder::prepareRegion(const AxImageLoader::ImageRegion& region) {
+	for (JpegComponent& component : components) {
+		uint32_t ratio = vMax / component.v;
+		uint32_t firstRow = region.y / ratio;
+		uint32_t endRow = std::min(component.height, (region.y + region.height - 1) / ratio + 2);
+		component.firstBlockRow = firstRow == 0 ? 0 : (firstRow - 1) / 8;
+		component.endBlockRow = (endRow + 7) / 8;
+
+		component.plane.resize(static_cast<size_t>(component.blocksPerLine) * 8 * component.blocksPerColumn * 8);
+		if (header.progressive) {
+			component.coefficients.assign(static_cast<size_t>(component.blocksPerLine) * component.blocksPerColumn * 64, 0);
+		}
+	}
+}
+
+template<typename Task>
+void JpegDecoder::runTasks(size_t count, Task task) {
+	if (!pool || count < 2) {
+		for (size_t i = 0; i < count; i++) {
+			task(i);
+		}
+		return;
+	}
+	std::mutex failureMutex;
+	std::exception_ptr failure;
+	std::atomic<bool> failed = false;
+	for (size_t i = 0; i < count; i++) {
+		pool->submit([&, i] {
+			if (failed) {
+				return;
+			}
+			try {
+				task(i);
+			}
+			catch (...) {
+				std::lock_guard lock(failureMutex);
+				if (!failure) {
+					failure = std::current_exception();
+				}
+				failed = true;
+			}
+		});
+	}
+	pool->wait();
+	if (failure) {
+		std::rethrow_exception(failure);
+	}
+}
+
+void JpegDecoder::decodeScan(const JpegScan& scan) {
+	readEntropyData();
+
+	// an interleaved scan codes MCUs of h x v blocks from each component, a single component
+	// scan codes that component's blocks one at a time
+	const JpegComponent& first = components[scan.components[0]];
+	size_t scanMcusPerLine = scan.count > 1 ? mcusPerLine : first.blocksWide;
+	size_t scanMcuRows = scan.count > 1 ? mcuRows : first.blocksHigh;
+	size_t endMcuRow = 0;
+	for (uint32_t i = 0; i < scan.count; i++) {
+		const JpegComponent& component = components[scan.components[i]];
+		endMcuRow = std::max<size_t>(endMcuRow, scan.count > 1 ? (component.endBlockRow + component.v - 1) / component.v : component.endBlockRow);
+		scannedComponents |= 1u << scan.components[i];
+	}
+	const size_t endMcu = std::min(endMcuRow, scanMcuRows) * scanMcusPerLine;
+	const size_t intervalMcus = restartInterval > 0 ? restartInterval : std::max<size_t>(endMcu, 1);
+	const size_t intervalCount = (endMcu + intervalMcus - 1) / intervalMcus;
+
+	if (!pool || intervalCount < 2) {
+		IntervalScratch scratch(resource);
+		decodeIntervals(scan, 0, intervalCount, endMcu, scratch, stats);
+		return;
+	}
+
+	// restart intervals start with fresh predictions at a known MCU, so each task takes a run
+	// of them; the scratch is allocated here since the scratch resource need not be thread safe
+	StageTimer timer(stats, &AxImageLoader::DecodeStats::entropyNanoseconds);
+	const size_t taskCount = std::min<size_t>(intervalCount, (pool->workerCount() + 1) * 4);
+	std::pmr::vector<IntervalScratch> scratch(resource);
+	scratch.reserve(taskCount);
+	for (size_t i = 0; i < taskCount; i++) {
+		IntervalScratch& taskScratch = scratch.emplace_back(resource);
+		taskScratch.coefficients.resize(scanMcusPerLine * maxBlocksPerMcu * 64);
+		taskScratch.blocks.reserve(scanMcusPerLine * maxBlocksPerMcu);
+	}
+	runTasks(taskCount, [&](size_t task) {
+		decodeIntervals(scan, intervalCount * task / taskCount, intervalCount * (task + 1) / taskCount, endMcu, scratch[task], nullptr);
+	});
+}
+
+void JpegDecoder::decodeIntervals(const JpegScan& scan, size_t firstInterval, size_t endInterval, size_t endMcu, IntervalScratch& scratch, AxImageLoader::DecodeStats* stageStats) {
+	const JpegComponent& first = components[scan.components[0]];
+	const size_t scanMcusPerLine = scan.count > 1 ? mcusPerLine : first.blocksWide;
+	const size_t intervalMcus = restartInterval > 0 ? restartInterval : std::max<size_t>(endMcu, 1);
+	for (size_t interval = firstInterval; interval < endInterval; interval++) {
+		ReversedBitReader reader(segments.interval(interval));
+		std::array<int, 4> dcPredictors = {};
+		uint32_t eobRun = 0;
+		size_t mcu = interval * intervalMcus;
+		const size_t intervalEnd = std::min(endMcu, mcu + intervalMcus);
+		// a row of MCUs at a time, so the blocks are still in cache for the IDCT
+		while (mcu < intervalEnd) {
+			throwIfCancelled(options);
+			size_t rowEnd = std::min(intervalEnd, (mcu / scanMcusPerLine + 1) * scanMcusPerLine);
+			try {
+				StageTimer timer(stageStats, &AxImageLoader::DecodeStats::entropyNanoseconds);
+				decodeMcus(scan, reader, dcPredictors, eobRun, mcu, rowEnd, scratch);
+			}
+			catch (const std::out_of_range&) {
+				throw std::runtime_error("Unexpected end of JPEG scan data");
+			}
+			if (!header.progressive) {
+				StageTimer timer(stageStats, &AxImageLoader::DecodeStats::idctNanoseconds);
+				inverseTransformPending(scratch);
+			}
+			mcu = rowEnd;
+		}
+	}
+}
+
+void JpegDecoder::decodeMcus(const JpegScan& scan, ReversedBitReader& reader, std::array<int, 4>& dcPredictors, uint32_t& eobRun, size_t firstMcu, size_t endMcu, IntervalScratch& scratch) {
+	if (!header.progressive) {
+		size_t blockCount = 0;
+		for (uint32_t i = 0; i < scan.count; i++) {
+			blockCount += scan.count > 1 ? static_cast<size_t>(components[scan.components[i]].h) * components[scan.components[i]].v : 1;
+		}
+		scratch.coefficients.resize((endMcu - firstMcu) * blockCount * 64);
+		scratch.blocks.clear();
+	}
+	auto decodeBlock = [&](uint32_t i, uint32_t blockX, uint32_t blockY) {
+		if (header.progressive) {
+			decodeProgressiveBlock(scan, i, reader, dcPredictors[i], eobRun, blockX, blockY);
+		}
+		else {
+			decodeSequentialBlock(scan, i, reader, dcPredictors[i], blockX, blockY, scratch);
+		}
+	};
+
+	if (scan.count == 1) {
+		const JpegComponent& component = components[scan.components[0]];
+		for (size_t mcu = firstMcu; mcu < endMcu; mcu++) {
+			decodeBlock(0, static_cast<uint32_t>(mcu % component.blocksWide), static_cast<uint32_t>(mcu / component.blocksWide));
+		}
+		return;
+	}
+	for (size_t mcu = firstMcu; mcu < endMcu; mcu++) {
+		const uint32_t mcuX = static_cast<uint32_t>(mcu % mcusPerLine);
+		const uint32_t mcuY = static_cast<uint32_t>(mcu / mcusPerLine);
+		for (uint32_t i = 0; i < scan.count; i++) {
+			const JpegComponent& component = components[scan.components[i]];
+			for (uint32_t y = 0; y < component.v; y++) {
+				for (uint32_t x = 0; x < component.h; x++) {
+					decodeBlock(i, mcuX * component.h + x, mcuY * component.v + y);
+				}
+			}
+		}
+	}
+}
+
+void JpegDecoder::decodeSequentialBlock(const JpegScan& scan, uint32_t scanComponent, ReversedBitReader& reader, int& dcPredictor, uint32_t blockX, uint32_t blockY, IntervalScratch& scratch) {
+	const uint8_t componentIndex = scan.components[scanComponent];
+	const JpegHuffmanTable& dcTable = dcTables[scan.dcTables[scanComponent]];
+	const JpegHuffmanTable& acTable = acTables[scan.acTables[scanComponent]];
+	const uint16_t* quant = quantTables[components[componentIndex].quantTable].data();
+	int16_t* block = scratch.coefficients.data() + scratch.blocks.size() * 64;
+	std::fill_n(block, 64, int16_t(0));
+
+	int s;
+	int difference;
+	if (hasSymbolBits(reader)) {
+		s = dcTable.decode<true>(reader);
+		if (s > 15) {
+			throw std::runtime_error("Invalid DC coefficient in JPEG data");
+		}
+		difference = receiveExtend<true>(reader, s);
+	}
+	else {
+		s = dcTable.decode(reader);
+		if (s > 15) {
+			throw std::runtime_error("Invalid DC coefficient in JPEG data");
+		}
+		difference = receiveExtend(reader, s);
+	}
+	// valid predictions stay far inside 16 bits; wrapping keeps corrupt ones from overflowing
+	dcPredictor = static_cast<int16_t>(dcPredictor + difference);
+	block[0] = dequantize(dcPredictor, quant[0]);
+
+	bool hasAc = false;
+	for (int k = 1; k < 64; k++) {
+		int value;
+		int run;
+		if (hasSymbolBits(reader)) {
+			run = decodeAcCoefficient<true>(reader, acTable, value);
+		}
+		else {
+			run = decodeAcCoefficient<false>(reader, acTable, value);
+		}
+		if (run < 0) {
+			break;
+		}
+		k += run;
+		if (value == 0) {
+			continue;
+		}
+		if (k > 63) {
+			throw std::runtime_error("Invalid AC coefficient run in JPEG data");
+		}
+		block[zigzagOrder[k]] = dequantize(value, quant[zigzagOrder[k]]);
+		hasAc = true;
+	}
+	scratch.blocks.push_back({ blockX, blockY, componentIndex, hasAc });
+}
+
+// successive approximation after the libjpeg decode_mcu_* routines; coefficients are kept
+// shifted into place and dequantized only once every scan is in
+void JpegDecoder::decodeProgressiveBlock(const JpegScan& scan, uint32_t scanComponent, ReversedBitReader& reader, int& dcPredictor, uint32_t& eobRun, uint32_t blockX, uint32_t blockY) {
+	JpegComponent& component = components[scan.components[scanComponent]];
+	int16_t* block = component.coefficients.data() + (static_cast<size_t>(blockY) * component.blocksPerLine + blockX) * 64;
+
+	if (scan.ss == 0) {
+		if (scan.ah == 0) {
+			const JpegHuffmanTable& dcTable = dcTables[scan.dcTables[scanComponent]];
+			const bool unchecked = hasSymbolBits(reader);
+			int s = unchecked ? dcTable.decode<true>(reader) : dcTable.decode(reader);
+			if (s > 15) {
+				throw std::runtime_error("Invalid DC coefficient in JPEG data");
+			}
+			int difference = unchecked ? receiveExtend<true>(reader, s) : receiveExtend(reader, s);
+			dcPredictor = static_cast<int16_t>(dcPredictor + difference);
+			block[0] = static_cast<int16_t>(dcPredictor * (1 << scan.al));
+		}
+		else if (reader.readBit()) {
+			block[0] = static_cast<int16_t>(block[0] | (1 << scan.al));
+		}
+		return;
+	}
+
+	const JpegHuffmanTable& acTable = acTables[scan.acTables[scanComponent]];
+	if (scan.ah == 0) {
+		if (eobRun > 0) {
+			eobRun--;
+			return;
+		}
+		for (int k = scan.ss; k <= scan.se; k++) {
+			int value;
+			int run = hasSymbolBits(reader) ? decodeAcCoefficient<true>(reader, acTable, value) : decodeAcCoefficient<false>(reader, acTable, value);
+			if (run < 0) {
+				eobRun = (1u << value) - 1;
+				if (value > 0) {
+					eobRun += reader.readBits(value);
+				}
+				break;
+			}
+			k += run;
+			if (value == 0) {
+				continue;
+			}
+			if (k > 63) {
+				throw std::runtime_error("Invalid AC coefficient run in JPEG data");
+			}
+			block[zigzagOrder[k]] = static_cast<int16_t>(value * (1 << scan.al));
+		}
+		return;
+	}
+
+	// Refinement: coefficients that are already nonzero get one correction bit each, new ones
+	// arrive as +-1 at this bit position after a run of still-zero coefficients.
+	const int16_t plusOne = static_cast<int16_t>(1 << scan.al);
+	auto refine = [&](int16_t& coefficient) {
+		if (reader.readBit() && (coefficient & plusOne) == 0) {
+			coefficient = static_cast<int16_t>(coefficient >= 0 ? coefficient + plusOne : coefficient - plusOne);
+		}
+	};
+	int k = scan.ss;
+	if (eobRun == 0) {
+		for (; k <= scan.se; k++) {
+			int rs = hasSymbolBits(reader) ? acTable.decode<true>(reader) : acTable.decode(reader);
+			int run = rs >> 4;
+			int s = rs & 15;
+			int16_t newValue = 0;
+			if (s != 0) {
+				newValue = reader.readBit() ? plusOne : static_cast<int16_t>(-plusOne);
+			}
+			else if (run != 15) {
+				eobRun = 1u << run;
+				if (run > 0) {
+					eobRun += reader.readBits(run);
+				}
+				break;
+			}
+			while (k <= scan.se) {
+				int16_t& coefficient = block[zigzagOrder[k]];
+				if (coefficient != 0) {
+					refine(coefficient);
+				}
+				else if (--run < 0) {
+					break;
+				}
+				k++;
+			}
+			if (newValue != 0) {
+				if (k > 63) {
+					throw std::runtime_error("Invalid AC coefficient run in JPEG data");
+				}
+				block[zigzagOrder[k]] = newValue;
+			}
+		}
+	}
+	if (eobRun > 0) {
+		for (; k <= scan.se; k++) {
+			int16_t& coefficient = block[zigzagOrder[k]];
+			if (coefficient != 0) {
+				refine(coefficient);
+			}
+		}
+		eobRun--;
+	}
+}
+
+// blocks above the region are entropy decoded, since later ones depend on them, but not transformed
+void JpegDecoder::inverseTransformPending(IntervalScratch& scratch) {
+	for (size_t i = 0; i < scratch.blocks.size(); i++) {
+		const PendingBlock& block = scratch.blocks[i];
+		JpegComponent& component = components[block.component];
+		if (block.blockY < component.firstBlockRow || block.blockY >= component.endBlockRow) {
+			continue;
+		}
+		if (!quantDefined[component.quantTable]) {
+			throw std::runtime_error("JPEG component uses an undefined quantization table");
+		}
+		const size_t stride = static_cast<size_t>(component.blocksPerLine) * 8;
+		uint8_t* out = component.plane.data() + static_cast<size_t>(block.blockY) * 8 * stride + static_cast<size_t>(block.blockX) * 8;
+		const int16_t* coefficients = scratch.coefficients.data() + i * 64;
+		if (block.hasAc) {
+			idct(coefficients, out, stride);
+		}
+		else {
+			idctDcOnly(coefficients[0], out, stride);
+		}
+	}
+}
+
+// the IDCT of a progressive image, once every scan is in; split into bands of block rows
+void JpegDecoder::inverseTransformCoefficients() {
+	StageTimer timer(stats, &AxImageLoader::DecodeStats::idctNanoseconds);
+	struct Band {
+		size_t component;
+		uint32_t firstRow;
+		uint32_t endRow;
+	};
+	std::pmr::vector<Band> bands(resource);
+	for (size_t c = 0; c < components.size(); c++) {
+		const JpegComponent& component = components[c];
+		if (!quantDefined[component.quantTable]) {
+			throw std::runtime_error("JPEG component uses an undefined quantization table");
+		}
+		uint32_t endRow = std::min(component.endBlockRow, component.blocksHigh);
+		for (uint32_t row = component.firstBlockRow; row < endRow; row += 8) {
+			bands.push_back({ c, row, std::min(endRow, row + 8) });
+		}
+	}
+	runTasks(bands.size(), [&](size_t b) {
+		throwIfCancelled(options);
+		JpegComponent& component = components[bands[b].component];
+		const uint16_t* quant = quantTables[component.quantTable].data();
+		const size_t stride = static_cast<size_t>(component.blocksPerLine) * 8;
+		alignas(16) std::array<int16_t, 64> dequantized;
+		for (uint32_t blockY = bands[b].firstRow; blockY < bands[b].endRow; blockY++) {
+			for (uint32_t blockX = 0; blockX < component.blocksWide; blockX++) {
+				const int16_t* block = component.coefficients.data() + (static_cast<size_t>(blockY) * component.blocksPerLine + blockX) * 64;
+				uint8_t* out = component.plane.data() + static_cast<size_t>(blockY) * 8 * stride + static_cast<size_t>(blockX) * 8;
+				int ac = 0;
+				for (size_t k = 1; k < 64; k++) {
+					ac |= block[k];
+				}
+				if (ac == 0) {
+					idctDcOnly(dequantize(block[0], quant[0]), out, stride);
+					continue;
+				}
+				for (size_t k = 0; k < 64; k++) {
+					dequantized[k] = dequantize(block[k], quant[k]);
+				}
+				idct(dequantized.data(), out, stride);
+			}
+		}
+	});
+}
+
+// Row y of a component at full resolution. Full resolution planes are returned as they are,
+// 2x1, 2x2 and 1x2 subsampling goes through the triangle filter and other ratios replicate.
+const uint8_t* JpegDecoder::componentRow(size_t index, uint32_t y, RowScratch& scratch) const {
+	const JpegComponent& component = components[index];
+	const size_t stride = static_cast<size_t>(component.blocksPerLine) * 8;
+	const uint32_t hRatio = hMax / component.h;
+	const uint32_t vRatio = vMax / component.v;
+	const uint32_t sourceRow = y / vRatio;
+	const uint8_t* near = component.plane.data() + sourceRow * stride;
+	if (hRatio == 1 && vRatio == 1) {
+		return near;
+	}
+
+	uint8_t* out = scratch.upsampled[index].data();
+	if (hRatio == 2 && vRatio == 1) {
+		static const UpsampleKernel upsampleH2V1 = selectUpsampleH2V1();
+		upsampleH2V1(near, nullptr, out, component.width);
+		return out;
+	}
+	if (vRatio == 2 && hRatio <= 2) {
+		// the other source row nearest to y; the edge rows stand in past the top and bottom
+		const bool lowerHalf = y % 2 == 1;
+		const uint32_t farRow = lowerHalf ? std::min(sourceRow + 1, component.height - 1) : (sourceRow == 0 ? 0 : sourceRow - 1);
+		const uint8_t* far = component.plane.data() + farRow * stride;
+		if (hRatio == 2) {
+			static const UpsampleKernel upsampleH2V2 = selectUpsampleH2V2();
+			upsampleH2V2(near, far, out, component.width);
+			return out;
+		}
+		const int bias = lowerHalf ? 2 : 1;
+		for (uint32_t x = 0; x < component.width; x++) {
+			out[x] = static_cast<uint8_t>((near[x] * 3 + far[x] + bias) >> 2);
+		}
+		return out;
+	}
+	for (uint32_t x = 0; x < header.width; x++) {
+		out[x] = near[x / hRatio];
+	}
+	return out;
+}
+
+// inverted CMYK as Adobe writes it: a channel is the product of its value and K
+static inline uint8_t multiplyInk(uint8_t value, uint8_t k) {
+	uint32_t t = static_cast<uint32_t>(value) * k + 128;
+	return static_cast<uint8_t>((t + (t >> 8)) >> 8);
+}
+
+static void expandGray(const uint8_t* gray, uint8_t* out, uint32_t count, uint16_t outChannels) {
+	if (outChannels == 1) {
+		std::memcpy(out, gray, count);
+		return;
+	}
+	for (uint32_t x = 0; x < count; x++) {
+		std::memset(out, gray[x], outChannels);
+		if (outChannels == 2 || outChannels == 4) {
+			out[outChannels - 1] = 255;
+		}
+		out += outChannels;
+	}
+}
+
+// Rec. 601 luma with the integer weights PNG conversion uses
+static void expandRgb(const uint8_t* rgb, uint8_t* out, uint32_t count, uint16_t outChannels) {
+	if (outChannels == 3) {
+		std::memcpy(out, rgb, static_cast<size_t>(count) * 3);
+		return;
+	}
+	for (uint32_t x = 0; x < count; x++, rgb += 3) {
+		if (outChannels <= 2) {
+			out[0] = static_cast<uint8_t>((299 * rgb[0] + 587 * rgb[1] + 114 * rgb[2]) / 1000);
+		}
+		else {
+			std::memcpy(out, rgb, 3);
+		}
+		if (outChannels == 2 || outChannels == 4) {
+			out[outChannels - 1] = 255;
+		}
+		out += outChannels;
+	}
+}
+
+void JpegDecoder::convertRows(uint32_t firstRow, uint32_t endRow, uint16_t outChannels, const AxImageLoader::ImageRegion& region, uint8_t* dst, size_t rowPitch, RowScratch& scratch) const {
+	ColorTransform transform = ColorTransform::Gray;
+	if (components.size() == 3) {
+		bool rgbIds = components[0].id == 'R' && components[1].id == 'G' && components[2].id == 'B';
+		transform = (hasAdobe ? adobeTransform == 0 : rgbIds) ? ColorTransform::Rgb : ColorTransform::YCbCr;
+	}
+	else if (components.size() == 4) {
+		transform = hasAdobe && adobeTransform == 2 ? ColorTransform::Ycck : ColorTransform::Cmyk;
+	}
+	const uint32_t x0 = region.x;
+	const uint32_t count = region.width;
+	static const YCbCrKernel toRgb = selectYCbCrKernel(3);
+	static const YCbCrKernel toRgba = selectYCbCrKernel(4);
+
+	for (uint32_t y = firstRow; y < endRow; y++) {
+		uint8_t* out = dst + static_cast<size_t>(y - region.y) * rowPitch;
+		// YCbCr to gray keeps the luma plane as it is
+		if (transform == ColorTransform::Gray || (transform == ColorTransform::YCbCr && outChannels <= 2)) {
+			expandGray(componentRow(0, y, scratch) + x0, out, count, outChannels);
+			continue;
+		}
+		std::array<const uint8_t*, 4> planes = {};
+		for (size_t c = 0; c < components.size(); c++) {
+			planes[c] = componentRow(c, y, scratch) + x0;
+		}
+		if (transform == ColorTransform::YCbCr) {
+			(outChannels == 4 ? toRgba : toRgb)(planes[0], planes[1], planes[2], out, count);
+			continue;
+		}
+
+		uint8_t* rgb = scratch.rgb.data();
+		if (transform == ColorTransform::Rgb) {
+			for (uint32_t x = 0; x < count; x++) {
+				rgb[3 * x] = planes[0][x];
+				rgb[3 * x + 1] = planes[1][x];
+				rgb[3 * x + 2] = planes[2][x];
+			}
+		}
+		else {
+			if (transform == ColorTransform::Ycck) {
+				toRgb(planes[0], planes[1], planes[2], rgb, count);
+			}
+			for (uint32_t x = 0; x < count; x++) {
+				for (int c = 0; c < 3; c++) {
+					uint8_t ink = transform == ColorTransform::Ycck ? static_cast<uint8_t>(255 - rgb[3 * x + c]) : planes[c][x];
+					rgb[3 * x + c] = multiplyInk(ink, planes[3][x]);
+				}
+			}
+		}
+		expandRgb(rgb, out, count, outChannels);
+	}
+}
+
+void JpegDecoder::decode(uint16_t outChannels, const AxImageLoader::ImageRegion& region, uint8_t* dst, size_t rowPitch) {
+	if (!frameRead) {
+		readHeader();
+	}
+	if (outChannels < 1 || outChannels > 4) {
+		throw std::runtime_error("Unsupported output channel count: " + std::to_string(outChannels));
+	}
+	if (options.pipelined) {
+		uint32_t threadCount = options.pipelineThreads;
+		if (threadCount == 0) {
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+		if (threadCount > 1) {
+			pool.emplace(threadCount - 1);
+		}
+	}
+	prepareRegion(region);
+
+	bool scanned = false;
+	while (pos < data.size()) {
+		uint8_t marker = nextMarker();
+		if (marker == markerEoi) {
+			break;
+		}
+		if ((marker >= markerRst0 && marker <= markerRst7) || marker == markerTem || marker == markerSoi) {
+			continue;
+		}
+		if (marker != markerSos) {
+			readMarkerSegment(marker, readSegment());
+			continue;
+		}
+		JpegScan scan = readScanHeader(readSegment());
+		decodeScan(scan);
+		scanned = true;
+		// a sequential image is done once every component had its scan; whatever follows,
+		// trailing metadata included, is never read
+		if (!header.progressive && scannedComponents == (1u << components.size()) - 1) {
+			break;
+		}
+	}
+	if (!scanned) {
+		throw std::runtime_error("JPEG image has no scans");
+	}
+	if (header.progressive) {
+		inverseTransformCoefficients();
+	}
+
+	StageTimer timer(stats, &AxImageLoader::DecodeStats::convertNanoseconds);
+	const size_t paddedWidth = static_cast<size_t>(mcusPerLine) * 8 * hMax;
+	auto makeScratch = [&] {
+		RowScratch scratch(resource);
+		for (auto& row : scratch.upsampled) {
+			row.resize(paddedWidth);
+		}
+		scratch.rgb.resize(static_cast<size_t>(region.width) * 3);
+		return scratch;
+	};
+	const uint32_t endRow = region.y + region.height;
+	const size_t taskCount = pool ? (region.height + convertRowsPerTask - 1) / convertRowsPerTask : 1;
+	std::pmr::vector<RowScratch> scratch(resource);
+	scratch.reserve(taskCount);
+	for (size_t i = 0; i < taskCount; i++) {
+		scratch.push_back(makeScratch());
+	}
+	runTasks(taskCount, [&](size_t task) {
+		uint32_t first = region.y + static_cast<uint32_t>(task * region.height / taskCount);
+		uint32_t end = task + 1 == taskCount ? endRow : region.y + static_cast<uint32_t>((task + 1) * region.height / taskCount);
+		for (uint32_t y = first; y < end; y += convertRowsPerTask) {
+			throwIfCancelled(options);
+			convertRows(y, std::min(end, y + convertRowsPerTask), outChannels, region, dst, rowPitch, scratch[task]);
+		}
+	});
+}
+#pragma endregion
+
+bool isJpeg(std::span<const uint8_t> data) {
+	return data.size() >= 3 && data[0] == 0xFF && data[1] == markerSoi && data[2] == 0xFF;
+}
+
+JpegHeader readJpegHeader(std::span<const uint8_t> data, std::pmr::memory_resource* scratch) {
+	AxImageLoader::LoadOptions options;
+	options.scratchMemory = scratch;
+	return JpegDecoder(data, options).readHeader();
+}
+
+uint16_t jpegOutputChannels(const JpegHeader& header, uint16_t requiredChannels) {
+	if (requiredChannels > 4) {
+		throw std::runtime_error("Unsupported output channel count: " + std::to_string(requiredChannels));
+	}
+	if (requiredChannels != 0) {
+		return requiredChannels;
+	}
+	return header.components == 1 ? 1 : 3;
+}
+
+void decodeJpeg(std::span<const uint8_t> data, uint16_t outChannels, const AxImageLoader::ImageRegion& region, uint8_t* dst, size_t rowPitch, const AxImageLoader::LoadOptions& options) {
+	JpegDecoder(data, options).decode(outChannels, region, dst, rowPitch);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "AxImageLoader.h"
+#include <cstdint>
+#include <memory_resource>
+#include <span>
+
+// SOI followed by the start of the next marker
+bool isJpeg(std::span<const uint8_t> data);
+
+// what the frame header says, read without touching the scans
+struct JpegHeader {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint8_t components = 0;
+	bool progressive = false;
+};
+
+// Reads markers up to the frame header (SOFn) and throws unless it describes a JPEG the
+// decoder handles: 8-bit Huffman coded, baseline, extended sequential or progressive. The
+// tables read on the way are held in scratch; null uses the default resource.
+JpegHeader readJpegHeader(std::span<const uint8_t> data, std::pmr::memory_resource* scratch = nullptr);
+
+// the output channels for requiredChannels; 0 keeps grayscale and turns everything else into RGB
+uint16_t jpegOutputChannels(const JpegHeader& header, uint16_t requiredChannels);
+
+// Decodes the pixels of region, which must lie inside the image, into dst with outChannels
+// (1-4) 8-bit samples per pixel, region row y at dst + y * rowPitch. Sequential scans stop
+// after the last block row the region needs. With options.pipelined the restart intervals of
+// a scan are decoded on pipelineThreads threads, as are the IDCT of progressive images and
+// the color conversion. Throws on corrupt data and when options.stopToken fires.
+void decodeJpeg(std::span<const uint8_t> data, uint16_t outChannels, const AxImageLoader::ImageRegion& region, uint8_t* dst, size_t rowPitch, const AxImageLoader::LoadOptions& options);
@@ -0,0 +1,528 @@
+#include "JpegKernels.h"
+#include "CpuFeatures.h"
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <string>
+
+// islow constants: cosines scaled by 2^13
+static constexpr int idctConstBits = 13;
+static constexpr int idctPass1Bits = 2;
+static constexpr int fix0298 = 2446;
+static constexpr int fix0390 = 3196;
+static constexpr int fix0541 = 4433;
+static constexpr int fix0765 = 6270;
+static constexpr int fix0899 = 7373;
+static constexpr int fix1175 = 9633;
+static constexpr int fix1501 = 12299;
+static constexpr int fix1847 = 15137;
+static constexpr int fix1961 = 16069;
+static constexpr int fix2053 = 16819;
+static constexpr int fix2562 = 20995;
+static constexpr int fix3072 = 25172;
+
+// JFIF YCbCr weights in 12-bit fixed point: 1.402, 0.344136, 0.714136 and 1.772
+static constexpr int yCbCrBits = 12;
+static constexpr int crToR = 5743;
+static constexpr int cbToG = 1410;
+static constexpr int crToG = 2925;
+static constexpr int cbToB = 7258;
+
+#pragma region Scalar
+static inline uint8_t clampSample(int64_t value) {
+	return static_cast<uint8_t>(std::clamp<int64_t>(value, 0, 255));
+}
+
+// the SIMD kernels keep the first pass at 16 bits
+static inline int32_t saturate16(int64_t value) {
+	return static_cast<int32_t>(std::clamp<int64_t>(value, INT16_MIN, INT16_MAX));
+}
+
+static inline int64_t descale(int64_t value, int bits) {
+	return (value + (int64_t(1) << (bits - 1))) >> bits;
+}
+
+// One 1-D pass of the islow transform over in[0], in[stride], ...; the results are scaled up
+// by 2^idctConstBits. 64-bit, so coefficients no encoder would write cannot overflow it.
+template<typename Sample>
+static inline std::array<int64_t, 8> idct1d(const Sample* in, size_t stride) {
+	int64_t z2 = in[2 * stride];
+	int64_t z3 = in[6 * stride];
+	int64_t z1 = (z2 + z3) * fix0541;
+	int64_t tmp2 = z1 - z3 * fix1847;
+	int64_t tmp3 = z1 + z2 * fix0765;
+	int64_t tmp0 = (static_cast<int64_t>(in[0]) + in[4 * stride]) * (1 << idctConstBits);
+	int64_t tmp1 = (static_cast<int64_t>(in[0]) - in[4 * stride]) * (1 << idctConstBits);
+	int64_t tmp10 = tmp0 + tmp3;
+	int64_t tmp13 = tmp0 - tmp3;
+	int64_t tmp11 = tmp1 + tmp2;
+	int64_t tmp12 = tmp1 - tmp2;
+
+	tmp0 = in[7 * stride];
+	tmp1 = in[5 * stride];
+	tmp2 = in[3 * stride];
+	tmp3 = in[stride];
+	z1 = tmp0 + tmp3;
+	z2 = tmp1 + tmp2;
+	z3 = tmp0 + tmp2;
+	int64_t z4 = tmp1 + tmp3;
+	int64_t z5 = (z3 + z4) * fix1175;
+	tmp0 *= fix0298;
+	tmp1 *= fix2053;
+	tmp2 *= fix3072;
+	tmp3 *= fix1501;
+	z1 *= -fix0899;
+	z2 *= -fix2562;
+	z3 = z3 * -fix1961 + z5;
+	z4 = z4 * -fix0390 + z5;
+	tmp0 += z1 + z3;
+	tmp1 += z2 + z4;
+	tmp2 += z2 + z3;
+	tmp3 += z1 + z4;
+	return { tmp10 + tmp3, tmp11 + tmp2, tmp12 + tmp1, tmp13 + tmp0, tmp13 - tmp0, tmp12 - tmp1, tmp11 - tmp2, tmp10 - tmp3 };
+}
+
+// columns first, then rows; a column or row without AC terms is flat, which skips the multiplies
+void idctScalar(const int16_t* coefficients, uint8_t* out, size_t outStride) {
+	std::array<int32_t, 64> workspace;
+	for (int column = 0; column < 8; column++) {
+		const int16_t* in = coefficients + column;
+		int32_t* ws = workspace.data() + column;
+		if (in[8] == 0 && in[16] == 0 && in[24] == 0 && in[32] == 0 && in[40] == 0 && in[48] == 0 && in[56] == 0) {
+			int32_t dc = saturate16(static_cast<int64_t>(in[0]) * (1 << idctPass1Bits));
+			for (int row = 0; row < 8; row++) {
+				ws[row * 8] = dc;
+			}
+			continue;
+		}
+		std::array<int64_t, 8> result = idct1d(in, 8);
+		for (int row = 0; row < 8; row++) {
+			ws[row * 8] = saturate16(descale(result[row], idctConstBits - idctPass1Bits));
+		}
+	}
+
+	for (int row = 0; row < 8; row++) {
+		const int32_t* ws = workspace.data() + row * 8;
+		uint8_t* outRow = out + row * outStride;
+		if (ws[1] == 0 && ws[2] == 0 && ws[3] == 0 && ws[4] == 0 && ws[5] == 0 && ws[6] == 0 && ws[7] == 0) {
+			std::fill(outRow, outRow + 8, clampSample(saturate16(descale(ws[0], idctPass1Bits + 3)) + 128));
+			continue;
+		}
+		std::array<int64_t, 8> result = idct1d(ws, 1);
+		for (int column = 0; column < 8; column++) {
+			outRow[column] = clampSample(saturate16(descale(result[column], idctConstBits + idctPass1Bits + 3)) + 128);
+		}
+	}
+}
+
+void idctDcOnly(int dc, uint8_t* out, size_t outStride) {
+	uint8_t value = clampSample(((static_cast<int64_t>(dc) + 4) >> 3) + 128);
+	for (int row = 0; row < 8; row++) {
+		std::fill(out + row * outStride, out + row * outStride + 8, value);
+	}
+}
+
+// Outputs columns first to last - 1 of a 2x1 row. Each output sample is 3/4 of its source
+// sample and 1/4 of the neighbour on its side, the edge sample standing in for the missing one.
+static void upsampleH2V1Columns(const uint8_t* in, uint8_t* out, uint32_t inWidth, uint32_t first, uint32_t last) {
+	for (uint32_t i = first; i < last; i++) {
+		int current = in[i] * 3;
+		int previous = in[i == 0 ? 0 : i - 1];
+		int next = in[i + 1 == inWidth ? i : i + 1];
+		out[2 * i] = static_cast<uint8_t>((current + previous + 1) >> 2);
+		out[2 * i + 1] = static_cast<uint8_t>((current + next + 2) >> 2);
+	}
+}
+
+// as upsampleH2V1Columns, on column sums that already blend the two source rows 3:1
+static void upsampleH2V2Columns(const uint8_t* near, const uint8_t* far, uint8_t* out, uint32_t inWidth, uint32_t first, uint32_t last) {
+	auto columnSum = [&](uint32_t i) { return near[i] * 3 + far[i]; };
+	for (uint32_t i = first; i < last; i++) {
+		int current = columnSum(i) * 3;
+		int previous = columnSum(i == 0 ? 0 : i - 1);
+		int next = columnSum(i + 1 == inWidth ? i : i + 1);
+		out[2 * i] = static_cast<uint8_t>((current + previous + 8) >> 4);
+		out[2 * i + 1] = static_cast<uint8_t>((current + next + 7) >> 4);
+	}
+}
+
+void upsampleH2V1Scalar(const uint8_t* near, const uint8_t*, uint8_t* out, uint32_t inWidth) {
+	upsampleH2V1Columns(near, out, inWidth, 0, inWidth);
+}
+
+void upsampleH2V2Scalar(const uint8_t* near, const uint8_t* far, uint8_t* out, uint32_t inWidth) {
+	upsampleH2V2Columns(near, far, out, inWidth, 0, inWidth);
+}
+
+template<uint16_t Channels>
+static void yCbCrToRgbScalar(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, uint8_t* out, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		int luma = (y[i] << yCbCrBits) + (1 << (yCbCrBits - 1));
+		int blue = cb[i] - 128;
+		int red = cr[i] - 128;
+		out[0] = clampSample((luma + crToR * red) >> yCbCrBits);
+		out[1] = clampSample((luma - cbToG * blue - crToG * red) >> yCbCrBits);
+		out[2] = clampSample((luma + cbToB * blue) >> yCbCrBits);
+		if constexpr (Channels == 4) {
+			out[3] = 255;
+		}
+		out += Channels;
+	}
+}
+#pragma endregion
+
+#if AX_ARCH_X86
+#pragma region X86
+static inline __m128i pairConstants(int a, int b) {
+	return _mm_setr_epi16(static_cast<int16_t>(a), static_cast<int16_t>(b), static_cast<int16_t>(a), static_cast<int16_t>(b),
+		static_cast<int16_t>(a), static_cast<int16_t>(b), static_cast<int16_t>(a), static_cast<int16_t>(b));
+}
+
+// One 1-D pass over eight vectors at once, lane i of v[k] holding input k of line i. The
+// multiplies of idct1d are regrouped into pairs for _mm_madd_epi16; the results are
+// descaled by Shift and packed back to 16 bits with saturation.
+template<int Shift>
+static inline void idctPassSse2(__m128i* v) {
+	const __m128i round = _mm_set1_epi32(1 << (Shift - 1));
+	auto descalePack = [&](__m128i low, __m128i high) {
+		return _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(low, round), Shift), _mm_srai_epi32(_mm_add_epi32(high, round), Shift));
+	};
+
+	// even part
+	const __m128i pair26Low = _mm_unpacklo_epi16(v[2], v[6]);
+	const __m128i pair26High = _mm_unpackhi_epi16(v[2], v[6]);
+	const __m128i toTmp3 = pairConstants(fix0541 + fix0765, fix0541);
+	const __m128i toTmp2 = pairConstants(fix0541, fix0541 - fix1847);
+	__m128i tmp3Low = _mm_madd_epi16(pair26Low, toTmp3);
+	__m128i tmp3High = _mm_madd_epi16(pair26High, toTmp3);
+	__m128i tmp2Low = _mm_madd_epi16(pair26Low, toTmp2);
+	__m128i tmp2High = _mm_madd_epi16(pair26High, toTmp2);
+
+	const __m128i pair04Low = _mm_unpacklo_epi16(v[0], v[4]);
+	const __m128i pair04High = _mm_unpackhi_epi16(v[0], v[4]);
+	const __m128i sum = pairConstants(1 << idctConstBits, 1 << idctConstBits);
+	const __m128i difference = pairConstants(1 << idctConstBits, -(1 << idctConstBits));
+	__m128i tmp0Low = _mm_madd_epi16(pair04Low, sum);
+	__m128i tmp0High = _mm_madd_epi16(pair04High, sum);
+	__m128i tmp1Low = _mm_madd_epi16(pair04Low, difference);
+	__m128i tmp1High = _mm_madd_epi16(pair04High, difference);
+
+	__m128i tmp10Low = _mm_add_epi32(tmp0Low, tmp3Low), tmp10High = _mm_add_epi32(tmp0High, tmp3High);
+	__m128i tmp13Low = _mm_sub_epi32(tmp0Low, tmp3Low), tmp13High = _mm_sub_epi32(tmp0High, tmp3High);
+	__m128i tmp11Low = _mm_add_epi32(tmp1Low, tmp2Low), tmp11High = _mm_add_epi32(tmp1High, tmp2High);
+	__m128i tmp12Low = _mm_sub_epi32(tmp1Low, tmp2Low), tmp12High = _mm_sub_epi32(tmp1High, tmp2High);
+
+	// odd part
+	const __m128i z3 = _mm_add_epi16(v[7], v[3]);
+	const __m128i z4 = _mm_add_epi16(v[5], v[1]);
+	const __m128i pair34Low = _mm_unpacklo_epi16(z3, z4);
+	const __m128i pair34High = _mm_unpackhi_epi16(z3, z4);
+	const __m128i toZ3 = pairConstants(fix1175 - fix1961, fix1175);
+	const __m128i toZ4 = pairConstants(fix1175, fix1175 - fix0390);
+	__m128i z3Low = _mm_madd_epi16(pair34Low, toZ3), z3High = _mm_madd_epi16(pair34High, toZ3);
+	__m128i z4Low = _mm_madd_epi16(pair34Low, toZ4), z4High = _mm_madd_epi16(pair34High, toZ4);
+
+	const __m128i pair71Low = _mm_unpacklo_epi16(v[7], v[1]);
+	const __m128i pair71High = _mm_unpackhi_epi16(v[7], v[1]);
+	const __m128i toOdd0 = pairConstants(fix0298 - fix0899, -fix0899);
+	const __m128i toOdd3 = pairConstants(-fix0899, fix1501 - fix0899);
+	__m128i odd0Low = _mm_add_epi32(_mm_madd_epi16(pair71Low, toOdd0), z3Low);
+	__m128i odd0High = _mm_add_epi32(_mm_madd_epi16(pair71High, toOdd0), z3High);
+	__m128i odd3Low = _mm_add_epi32(_mm_madd_epi16(pair71Low, toOdd3), z4Low);
+	__m128i odd3High = _mm_add_epi32(_mm_madd_epi16(pair71High, toOdd3), z4High);
+
+	const __m128i pair53Low = _mm_unpacklo_epi16(v[5], v[3]);
+	const __m128i pair53High = _mm_unpackhi_epi16(v[5], v[3]);
+	const __m128i toOdd1 = pairConstants(fix2053 - fix2562, -fix2562);
+	const __m128i toOdd2 = pairConstants(-fix2562, fix3072 - fix2562);
+	__m128i odd1Low = _mm_add_epi32(_mm_madd_epi16(pair53Low, toOdd1), z4Low);
+	__m128i odd1High = _mm_add_epi32(_mm_madd_epi16(pair53High, toOdd1), z4High);
+	__m128i odd2Low = _mm_add_epi32(_mm_madd_epi16(pair53Low, toOdd2), z3Low);
+	__m128i odd2High = _mm_add_epi32(_mm_madd_epi16(pair53High, toOdd2), z3High);
+
+	v[0] = descalePack(_mm_add_epi32(tmp10Low, odd3Low), _mm_add_epi32(tmp10High, odd3High));
+	v[7] = descalePack(_mm_sub_epi32(tmp10Low, odd3Low), _mm_sub_epi32(tmp10High, odd3High));
+	v[1] = descalePack(_mm_add_epi32(tmp11Low, odd2Low), _mm_add_epi32(tmp11High, odd2High));
+	v[6] = descalePack(_mm_sub_epi32(tmp11Low, odd2Low), _mm_sub_epi32(tmp11High, odd2High));
+	v[2] = descalePack(_mm_add_epi32(tmp12Low, odd1Low), _mm_add_epi32(tmp12High, odd1High));
+	v[5] = descalePack(_mm_sub_epi32(tmp12Low, odd1Low), _mm_sub_epi32(tmp12High, odd1High));
+	v[3] = descalePack(_mm_add_epi32(tmp13Low, odd0Low), _mm_add_epi32(tmp13High, odd0High));
+	v[4] = descalePack(_mm_sub_epi32(tmp13Low, odd0Low), _mm_sub_epi32(tmp13High, odd0High));
+}
+
+static inline void transpose8x8Sse2(__m128i* v) {
+	__m128i a0 = _mm_unpacklo_epi16(v[0], v[1]);
+	__m128i a1 = _mm_unpackhi_epi16(v[0], v[1]);
+	__m128i a2 = _mm_unpacklo_epi16(v[2], v[3]);
+	__m128i a3 = _mm_unpackhi_epi16(v[2], v[3]);
+	__m128i a4 = _mm_unpacklo_epi16(v[4], v[5]);
+	__m128i a5 = _mm_unpackhi_epi16(v[4], v[5]);
+	__m128i a6 = _mm_unpacklo_epi16(v[6], v[7]);
+	__m128i a7 = _mm_unpackhi_epi16(v[6], v[7]);
+	__m128i b0 = _mm_unpacklo_epi32(a0, a2);
+	__m128i b1 = _mm_unpackhi_epi32(a0, a2);
+	__m128i b2 = _mm_unpacklo_epi32(a1, a3);
+	__m128i b3 = _mm_unpackhi_epi32(a1, a3);
+	__m128i b4 = _mm_unpacklo_epi32(a4, a6);
+	__m128i b5 = _mm_unpackhi_epi32(a4, a6);
+	__m128i b6 = _mm_unpacklo_epi32(a5, a7);
+	__m128i b7 = _mm_unpackhi_epi32(a5, a7);
+	v[0] = _mm_unpacklo_epi64(b0, b4);
+	v[1] = _mm_unpackhi_epi64(b0, b4);
+	v[2] = _mm_unpacklo_epi64(b1, b5);
+	v[3] = _mm_unpackhi_epi64(b1, b5);
+	v[4] = _mm_unpacklo_epi64(b2, b6);
+	v[5] = _mm_unpackhi_epi64(b2, b6);
+	v[6] = _mm_unpacklo_epi64(b3, b7);
+	v[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+// the columns pass runs on the rows as loaded, the rows pass on the transpose
+static void idctSse2(const int16_t* coefficients, uint8_t* out, size_t outStride) {
+	__m128i v[8];
+	for (int row = 0; row < 8; row++) {
+		v[row] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(coefficients + row * 8));
+	}
+	idctPassSse2<idctConstBits - idctPass1Bits>(v);
+	transpose8x8Sse2(v);
+	idctPassSse2<idctConstBits + idctPass1Bits + 3>(v);
+	transpose8x8Sse2(v);
+
+	const __m128i center = _mm_set1_epi16(128);
+	for (int row = 0; row < 8; row += 2) {
+		__m128i samples = _mm_packus_epi16(_mm_adds_epi16(v[row], center), _mm_adds_epi16(v[row + 1], center));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(out + row * outStride), samples);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(out + (row + 1) * outStride), _mm_unpackhi_epi64(samples, samples));
+	}
+}
+
+static inline __m128i loadWidened(const uint8_t* p) {
+	return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), _mm_setzero_si128());
+}
+
+// Eight source samples per step, which read one sample either side, so the first column and
+// the last eight or so are left to the scalar code.
+static void upsampleH2V1Sse2(const uint8_t* near, const uint8_t*, uint8_t* out, uint32_t inWidth) {
+	if (inWidth < 10) {
+		upsampleH2V1Columns(near, out, inWidth, 0, inWidth);
+		return;
+	}
+	upsampleH2V1Columns(near, out, inWidth, 0, 1);
+	const __m128i three = _mm_set1_epi16(3);
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i two = _mm_set1_epi16(2);
+	uint32_t i = 1;
+	for (; i + 9 <= inWidth; i += 8) {
+		__m128i current = _mm_mullo_epi16(loadWidened(near + i), three);
+		__m128i even = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(current, loadWidened(near + i - 1)), one), 2);
+		__m128i odd = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(current, loadWidened(near + i + 1)), two), 2);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i), _mm_packus_epi16(_mm_unpacklo_epi16(even, odd), _mm_unpackhi_epi16(even, odd)));
+	}
+	upsampleH2V1Columns(near, out, inWidth, i, inWidth);
+}
+
+static void upsampleH2V2Sse2(const uint8_t* near, const uint8_t* far, uint8_t* out, uint32_t inWidth) {
+	if (inWidth < 10) {
+		upsampleH2V2Columns(near, far, out, inWidth, 0, inWidth);
+		return;
+	}
+	upsampleH2V2Columns(near, far, out, inWidth, 0, 1);
+	const __m128i three = _mm_set1_epi16(3);
+	const __m128i eight = _mm_set1_epi16(8);
+	const __m128i seven = _mm_set1_epi16(7);
+	auto columnSum = [&](uint32_t i) { return _mm_add_epi16(_mm_mullo_epi16(loadWidened(near + i), three), loadWidened(far + i)); };
+	uint32_t i = 1;
+	for (; i + 9 <= inWidth; i += 8) {
+		__m128i current = _mm_mullo_epi16(columnSum(i), three);
+		__m128i even = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(current, columnSum(i - 1)), eight), 4);
+		__m128i odd = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(current, columnSum(i + 1)), seven), 4);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i), _mm_packus_epi16(_mm_unpacklo_epi16(even, odd), _mm_unpackhi_epi16(even, odd)));
+	}
+	upsampleH2V2Columns(near, far, out, inWidth, i, inWidth);
+}
+
+// Converts 8 pixels to 16-bit R, G and B. The products are paired so one _mm_madd_epi16
+// gives luma plus a chroma term in 32 bits, with the same rounding as the scalar code.
+static inline void yCbCrToRgb8Sse2(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, __m128i& r, __m128i& g, __m128i& b) {
+	const __m128i center = _mm_set1_epi16(128);
+	const __m128i round = _mm_set1_epi32(1 << (yCbCrBits - 1));
+	const __m128i luma = loadWidened(y);
+	const __m128i blue = _mm_sub_epi16(loadWidened(cb), center);
+	const __m128i red = _mm_sub_epi16(loadWidened(cr), center);
+
+	const __m128i lumaRedLow = _mm_unpacklo_epi16(luma, red), lumaRedHigh = _mm_unpackhi_epi16(luma, red);
+	const __m128i lumaBlueLow = _mm_unpacklo_epi16(luma, blue), lumaBlueHigh = _mm_unpackhi_epi16(luma, blue);
+	const __m128i redOneLow = _mm_unpacklo_epi16(red, _mm_set1_epi16(1)), redOneHigh = _mm_unpackhi_epi16(red, _mm_set1_epi16(1));
+	const __m128i toR = pairConstants(1 << yCbCrBits, crToR);
+	const __m128i toG = pairConstants(1 << yCbCrBits, -cbToG);
+	const __m128i toGRed = pairConstants(-crToG, 1 << (yCbCrBits - 1));
+	const __m128i toB = pairConstants(1 << yCbCrBits, cbToB);
+
+	r = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lumaRedLow, toR), round), yCbCrBits),
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lumaRedHigh, toR), round), yCbCrBits));
+	g = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lumaBlueLow, toG), _mm_madd_epi16(redOneLow, toGRed)), yCbCrBits),
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lumaBlueHigh, toG), _mm_madd_epi16(redOneHigh, toGRed)), yCbCrBits));
+	b = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lumaBlueLow, toB), round), yCbCrBits),
+		_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lumaBlueHigh, toB), round), yCbCrBits));
+}
+
+// 8 pixels as two registers of RGBA
+static inline void yCbCrToRgba8Sse2(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, __m128i& low, __m128i& high) {
+	__m128i r, g, b;
+	yCbCrToRgb8Sse2(y, cb, cr, r, g, b);
+	__m128i rg = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_packus_epi16(g, g));
+	__m128i ba = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_set1_epi8(-1));
+	low = _mm_unpacklo_epi16(rg, ba);
+	high = _mm_unpackhi_epi16(rg, ba);
+}
+
+static void yCbCrToRgbaSse2(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, uint8_t* out, uint32_t count) {
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i low, high;
+		yCbCrToRgba8Sse2(y + i, cb + i, cr + i, low, high);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 4), low);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 4 + 16), high);
+	}
+	yCbCrToRgbScalar<4>(y + i, cb + i, cr + i, out + i * 4, count - i);
+}
+
+// the RGBA registers lose their alpha bytes to a shuffle, leaving 24 bytes of RGB
+AX_TARGET("ssse3")
+static void yCbCrToRgbSsse3(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, uint8_t* out, uint32_t count) {
+	const __m128i dropAlpha = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i low, high;
+		yCbCrToRgba8Sse2(y + i, cb + i, cr + i, low, high);
+		low = _mm_shuffle_epi8(low, dropAlpha);
+		high = _mm_shuffle_epi8(high, dropAlpha);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 3), _mm_or_si128(low, _mm_slli_si128(high, 12)));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(out + i * 3 + 16), _mm_srli_si128(high, 4));
+	}
+	yCbCrToRgbScalar<3>(y + i, cb + i, cr + i, out + i * 3, count - i);
+}
+#pragma endregion
+#endif
+
+#if AX_ARCH_ARM64
+#pragma region Neon
+static void upsampleH2V1Neon(const uint8_t* near, const uint8_t*, uint8_t* out, uint32_t inWidth) {
+	if (inWidth < 10) {
+		upsampleH2V1Columns(near, out, inWidth, 0, inWidth);
+		return;
+	}
+	upsampleH2V1Columns(near, out, inWidth, 0, 1);
+	uint32_t i = 1;
+	for (; i + 9 <= inWidth; i += 8) {
+		uint16x8_t current = vmulq_n_u16(vmovl_u8(vld1_u8(near + i)), 3);
+		uint8x8x2_t samples;
+		samples.val[0] = vshrn_n_u16(vaddq_u16(vaddq_u16(current, vmovl_u8(vld1_u8(near + i - 1))), vdupq_n_u16(1)), 2);
+		samples.val[1] = vshrn_n_u16(vaddq_u16(vaddq_u16(current, vmovl_u8(vld1_u8(near + i + 1))), vdupq_n_u16(2)), 2);
+		vst2_u8(out + 2 * i, samples);
+	}
+	upsampleH2V1Columns(near, out, inWidth, i, inWidth);
+}
+
+static void upsampleH2V2Neon(const uint8_t* near, const uint8_t* far, uint8_t* out, uint32_t inWidth) {
+	if (inWidth < 10) {
+		upsampleH2V2Columns(near, far, out, inWidth, 0, inWidth);
+		return;
+	}
+	upsampleH2V2Columns(near, far, out, inWidth, 0, 1);
+	auto columnSum = [&](uint32_t i) { return vmlaq_n_u16(vmovl_u8(vld1_u8(far + i)), vmovl_u8(vld1_u8(near + i)), 3); };
+	uint32_t i = 1;
+	for (; i + 9 <= inWidth; i += 8) {
+		uint16x8_t current = vmulq_n_u16(columnSum(i), 3);
+		uint8x8x2_t samples;
+		samples.val[0] = vshrn_n_u16(vaddq_u16(vaddq_u16(current, columnSum(i - 1)), vdupq_n_u16(8)), 4);
+		samples.val[1] = vshrn_n_u16(vaddq_u16(vaddq_u16(current, columnSum(i + 1)), vdupq_n_u16(7)), 4);
+		vst2_u8(out + 2 * i, samples);
+	}
+	upsampleH2V2Columns(near, far, out, inWidth, i, inWidth);
+}
+
+// widening multiply-accumulates give the scalar sums exactly; the structured stores interleave
+template<uint16_t Channels>
+static void yCbCrToRgbNeon(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, uint8_t* out, uint32_t count) {
+	const int32x4_t round = vdupq_n_s32(1 << (yCbCrBits - 1));
+	const int16x8_t center = vdupq_n_s16(128);
+	auto narrow = [](int32x4_t low, int32x4_t high) {
+		return vqmovun_s16(vcombine_s16(vqmovn_s32(vshrq_n_s32(low, yCbCrBits)), vqmovn_s32(vshrq_n_s32(high, yCbCrBits))));
+	};
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		int16x8_t luma = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(y + i)));
+		int16x8_t blue = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(cb + i))), center);
+		int16x8_t red = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(cr + i))), center);
+		int32x4_t lumaLow = vaddq_s32(vmull_n_s16(vget_low_s16(luma), 1 << yCbCrBits), round);
+		int32x4_t lumaHigh = vaddq_s32(vmull_n_s16(vget_high_s16(luma), 1 << yCbCrBits), round);
+
+		uint8x8_t r = narrow(vmlal_n_s16(lumaLow, vget_low_s16(red), crToR), vmlal_n_s16(lumaHigh, vget_high_s16(red), crToR));
+		uint8x8_t g = narrow(vmlsl_n_s16(vmlsl_n_s16(lumaLow, vget_low_s16(blue), cbToG), vget_low_s16(red), crToG),
+			vmlsl_n_s16(vmlsl_n_s16(lumaHigh, vget_high_s16(blue), cbToG), vget_high_s16(red), crToG));
+		uint8x8_t b = narrow(vmlal_n_s16(lumaLow, vget_low_s16(blue), cbToB), vmlal_n_s16(lumaHigh, vget_high_s16(blue), cbToB));
+		if constexpr (Channels == 3) {
+			uint8x8x3_t pixels = { { r, g, b } };
+			vst3_u8(out + i * 3, pixels);
+		}
+		else {
+			uint8x8x4_t pixels = { { r, g, b, vdup_n_u8(255) } };
+			vst4_u8(out + i * 4, pixels);
+		}
+	}
+	yCbCrToRgbScalar<Channels>(y + i, cb + i, cr + i, out + i * Channels, count - i);
+}
+#pragma endregion
+#endif
+
+IdctKernel selectIdctKernel() {
+#if AX_ARCH_X86
+	return idctSse2;
+#else
+	return idctScalar;
+#endif
+}
+
+UpsampleKernel selectUpsampleH2V1() {
+#if AX_ARCH_X86
+	return upsampleH2V1Sse2;
+#elif AX_ARCH_ARM64
+	return upsampleH2V1Neon;
+#else
+	return upsampleH2V1Scalar;
+#endif
+}
+
+UpsampleKernel selectUpsampleH2V2() {
+#if AX_ARCH_X86
+	return upsampleH2V2Sse2;
+#elif AX_ARCH_ARM64
+	return upsampleH2V2Neon;
+#else
+	return upsampleH2V2Scalar;
+#endif
+}
+
+YCbCrKernel selectYCbCrScalar(uint16_t outChannels) {
+	if (outChannels != 3 && outChannels != 4) {
+		throw std::runtime_error("Unsupported output channel count: " + std::to_string(outChannels));
+	}
+	return outChannels == 4 ? yCbCrToRgbScalar<4> : yCbCrToRgbScalar<3>;
+}
+
+YCbCrKernel selectYCbCrKernel(uint16_t outChannels) {
+	if (outChannels != 3 && outChannels != 4) {
+		throw std::runtime_error("Unsupported output channel count: " + std::to_string(outChannels));
+	}
+#if AX_ARCH_X86
+	if (outChannels == 4) {
+		return yCbCrToRgbaSse2;
+	}
+	return getCpuFeatures().ssse3 ? yCbCrToRgbSsse3 : yCbCrToRgbScalar<3>;
+#elif AX_ARCH_ARM64
+	return outChannels == 4 ? yCbCrToRgbNeon<4> : yCbCrToRgbNeon<3>;
+#else
+	return outChannels == 4 ? yCbCrToRgbScalar<4> : yCbCrToRgbScalar<3>;
+#endif
+}
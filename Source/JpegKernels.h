@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Inverse DCT of one block of dequantized coefficients in natural (row-major) order into 8
+// rows of 8 samples, level shifted and clamped to 0-255. Integer arithmetic after the libjpeg
+// "islow" method; the SIMD kernels match the scalar one unless their 16-bit intermediates
+// saturate, which takes coefficients no encoder writes.
+using IdctKernel = void (*)(const int16_t* coefficients, uint8_t* out, size_t outStride);
+
+IdctKernel selectIdctKernel();
+
+// a block whose only coefficient is the dequantized DC decodes to one flat value
+void idctDcOnly(int dc, uint8_t* out, size_t outStride);
+
+// Doubles a row of inWidth samples horizontally with the triangle filter libjpeg calls fancy
+// upsampling, writing 2 * inWidth samples. For 2x2 subsampling near, the source row closest
+// to the output row, is first blended 3:1 with far, the next closest; 2x1 ignores far.
+using UpsampleKernel = void (*)(const uint8_t* near, const uint8_t* far, uint8_t* out, uint32_t inWidth);
+
+UpsampleKernel selectUpsampleH2V1();
+UpsampleKernel selectUpsampleH2V2();
+
+// Full range YCbCr as JFIF defines it to interleaved RGB, or RGBA with alpha 255
+using YCbCrKernel = void (*)(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, uint8_t* out, uint32_t count);
+
+// outChannels is 3 or 4
+YCbCrKernel selectYCbCrKernel(uint16_t outChannels);
+
+// Plain per-sample versions of the kernels above, which the SIMD ones are checked against
+void idctScalar(const int16_t* coefficients, uint8_t* out, size_t outStride);
+void upsampleH2V1Scalar(const uint8_t* near, const uint8_t* far, uint8_t* out, uint32_t inWidth);
+void upsampleH2V2Scalar(const uint8_t* near, const uint8_t* far, uint8_t* out, uint32_t inWidth);
+YCbCrKernel selectYCbCrScalar(uint16_t outChannels);
@@ -0,0 +1,123 @@
+#include "MappedFile.h"
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept : mapping(std::exchange(other.mapping, nullptr)), size(std::exchange(other.size, 0)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+	if (this != &other) {
+		close();
+		mapping = std::exchange(other.mapping, nullptr);
+		size = std::exchange(other.size, 0);
+	}
+	return *this;
+}
+
+#ifdef _WIN32
+bool MappedFile::open(const std::filesystem::path& path) {
+	close();
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) {
+		CloseHandle(file);
+		return false;
+	}
+	if (fileSize.QuadPart == 0) {
+		CloseHandle(file);
+		return true;
+	}
+
+	// the view keeps the mapping object alive, so both handles can be closed right away
+	HANDLE fileMapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!fileMapping) {
+		return false;
+	}
+	void* view = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(fileMapping);
+	if (!view) {
+		return false;
+	}
+
+	mapping = static_cast<const uint8_t*>(view);
+	size = static_cast<size_t>(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::close() {
+	if (mapping) {
+		UnmapViewOfFile(mapping);
+	}
+	mapping = nullptr;
+	size = 0;
+}
+
+void MappedFile::prefetch() const {
+	if (mapping) {
+		WIN32_MEMORY_RANGE_ENTRY range = { const_cast<uint8_t*>(mapping), size };
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+	}
+}
+#else
+bool MappedFile::open(const std::filesystem::path& path) {
+	close();
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0) {
+		::close(fd);
+		return false;
+	}
+	if (fileStat.st_size == 0) {
+		::close(fd);
+		return true;
+	}
+
+	// the mapping holds its own reference to the file, so the descriptor can be closed right away
+	void* view = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (view == MAP_FAILED) {
+		return false;
+	}
+	madvise(view, static_cast<size_t>(fileStat.st_size), MADV_SEQUENTIAL);
+
+	mapping = static_cast<const uint8_t*>(view);
+	size = static_cast<size_t>(fileStat.st_size);
+	return true;
+}
+
+void MappedFile::close() {
+	if (mapping) {
+		munmap(const_cast<uint8_t*>(mapping), size);
+	}
+	mapping = nullptr;
+	size = 0;
+}
+
+void MappedFile::prefetch() const {
+	if (mapping) {
+		madvise(const_cast<uint8_t*>(mapping), size, MADV_WILLNEED);
+	}
+}
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+// Read-only memory mapping of a whole file. The mapping lives as long as the object.
+class MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	// returns false if the file cannot be opened or mapped; an empty file maps to an empty span
+	bool open(const std::filesystem::path& path);
+	void close();
+	// asks the OS to start reading the whole file in the background, without waiting for it
+	void prefetch() const;
+	std::span<const uint8_t> data() const { return { mapping, size }; }
+
+private:
+	const uint8_t* mapping = nullptr;
+	size_t size = 0;
+};
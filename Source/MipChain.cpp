@@ -0,0 +1,246 @@
+#include "MipChain.h"
+#include "CpuFeatures.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#pragma region Scalar
+template<uint16_t Channels>
+static void downsampleRowScalar(const uint8_t* row0, const uint8_t* row1, uint8_t* out, uint32_t outWidth) {
+	for (uint32_t x = 0; x < outWidth; x++) {
+		const uint8_t* a = row0 + 2 * x * Channels;
+		const uint8_t* b = row1 + 2 * x * Channels;
+		for (uint16_t c = 0; c < Channels; c++) {
+			out[x * Channels + c] = static_cast<uint8_t>((a[c] + a[Channels + c] + b[c] + b[Channels + c] + 2) >> 2);
+		}
+	}
+}
+
+// Linear light is kept at 16 bits. Going back, the table is indexed by the top 13 bits,
+// which still tells apart the darkest sRGB steps.
+static constexpr int linearToSrgbShift = 3;
+
+struct SrgbTables {
+	std::array<uint16_t, 256> toLinear;
+	std::array<uint8_t, (65536 >> linearToSrgbShift)> toSrgb;
+};
+
+static const SrgbTables& srgbTables() {
+	static const SrgbTables tables = [] {
+		SrgbTables t;
+		for (int i = 0; i < 256; i++) {
+			double v = i / 255.0;
+			double linear = v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4);
+			t.toLinear[i] = static_cast<uint16_t>(std::lround(linear * 65535.0));
+		}
+		for (size_t i = 0; i < t.toSrgb.size(); i++) {
+			// centre of the bucket the index stands for
+			double linear = ((i << linearToSrgbShift) + (1 << (linearToSrgbShift - 1))) / 65535.0;
+			double v = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+			t.toSrgb[i] = static_cast<uint8_t>(std::clamp<long>(std::lround(v * 255.0), 0, 255));
+		}
+		return t;
+	}();
+	return tables;
+}
+
+// the last channel of gray-alpha and RGBA pixels is alpha and is not gamma encoded
+template<uint16_t Channels>
+static void downsampleRowSrgb(const uint8_t* row0, const uint8_t* row1, uint8_t* out, uint32_t outWidth) {
+	constexpr uint16_t colorChannels = (Channels == 2 || Channels == 4) ? Channels - 1 : Channels;
+	const SrgbTables& tables = srgbTables();
+	for (uint32_t x = 0; x < outWidth; x++) {
+		const uint8_t* a = row0 + 2 * x * Channels;
+		const uint8_t* b = row1 + 2 * x * Channels;
+		for (uint16_t c = 0; c < colorChannels; c++) {
+			uint32_t sum = tables.toLinear[a[c]] + tables.toLinear[a[Channels + c]] + tables.toLinear[b[c]] + tables.toLinear[b[Channels + c]];
+			out[x * Channels + c] = tables.toSrgb[((sum + 2) >> 2) >> linearToSrgbShift];
+		}
+		if constexpr (colorChannels < Channels) {
+			constexpr uint16_t c = Channels - 1;
+			out[x * Channels + c] = static_cast<uint8_t>((a[c] + a[Channels + c] + b[c] + b[Channels + c] + 2) >> 2);
+		}
+	}
+}
+#pragma endregion
+
+#if AX_ARCH_X86
+#pragma region X86
+// Sums horizontally adjacent pixels of 16 bytes into 8 16-bit lanes, i.e. the output bytes
+// of 8 / Channels pixels. 3-byte pixels do not fit a register evenly and stay scalar.
+template<uint16_t Channels>
+static inline __m128i sumPixelPairs(__m128i v) {
+	const __m128i zero = _mm_setzero_si128();
+	if constexpr (Channels == 1) {
+		return _mm_add_epi16(_mm_and_si128(v, _mm_set1_epi16(0xFF)), _mm_srli_epi16(v, 8));
+	}
+	else if constexpr (Channels == 2) {
+		__m128i low = _mm_unpacklo_epi8(v, zero);
+		__m128i high = _mm_unpackhi_epi8(v, zero);
+		low = _mm_add_epi16(low, _mm_srli_epi64(low, 32));
+		high = _mm_add_epi16(high, _mm_srli_epi64(high, 32));
+		// the sums sit in the even 32-bit elements
+		low = _mm_shuffle_epi32(low, _MM_SHUFFLE(3, 1, 2, 0));
+		high = _mm_shuffle_epi32(high, _MM_SHUFFLE(3, 1, 2, 0));
+		return _mm_unpacklo_epi64(low, high);
+	}
+	else {
+		__m128i low = _mm_unpacklo_epi8(v, zero);
+		__m128i high = _mm_unpackhi_epi8(v, zero);
+		low = _mm_add_epi16(low, _mm_srli_si128(low, 8));
+		high = _mm_add_epi16(high, _mm_srli_si128(high, 8));
+		return _mm_unpacklo_epi64(low, high);
+	}
+}
+
+// 32 bytes of each source row make 16 output bytes per step
+template<uint16_t Channels>
+static void downsampleRowSse2(const uint8_t* row0, const uint8_t* row1, uint8_t* out, uint32_t outWidth) {
+	const __m128i two = _mm_set1_epi16(2);
+	const size_t outBytes = static_cast<size_t>(outWidth) * Channels;
+	size_t i = 0;
+	for (; i + 16 <= outBytes; i += 16) {
+		const uint8_t* a = row0 + 2 * i;
+		const uint8_t* b = row1 + 2 * i;
+		__m128i low = _mm_add_epi16(sumPixelPairs<Channels>(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a))),
+			sumPixelPairs<Channels>(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b))));
+		__m128i high = _mm_add_epi16(sumPixelPairs<Channels>(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 16))),
+			sumPixelPairs<Channels>(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 16))));
+		low = _mm_srli_epi16(_mm_add_epi16(low, two), 2);
+		high = _mm_srli_epi16(_mm_add_epi16(high, two), 2);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(low, high));
+	}
+	downsampleRowScalar<Channels>(row0 + 2 * i, row1 + 2 * i, out + i, static_cast<uint32_t>((outBytes - i) / Channels));
+}
+#pragma endregion
+#endif
+
+#if AX_ARCH_ARM64
+#pragma region Neon
+// The structured loads split 16 pixels into one register per channel, so every channel
+// count works the same way: pairwise widening adds, then a rounding narrow by 2 bits.
+template<uint16_t Channels>
+static void downsampleRowNeon(const uint8_t* row0, const uint8_t* row1, uint8_t* out, uint32_t outWidth) {
+	uint32_t x = 0;
+	for (; x + 8 <= outWidth; x += 8) {
+		const uint8_t* a = row0 + 2 * x * Channels;
+		const uint8_t* b = row1 + 2 * x * Channels;
+		if constexpr (Channels == 1) {
+			uint16x8_t sum = vaddq_u16(vpaddlq_u8(vld1q_u8(a)), vpaddlq_u8(vld1q_u8(b)));
+			vst1_u8(out + x, vrshrn_n_u16(sum, 2));
+		}
+		else if constexpr (Channels == 2) {
+			uint8x16x2_t pa = vld2q_u8(a), pb = vld2q_u8(b);
+			uint8x8x2_t result;
+			for (int c = 0; c < 2; c++) {
+				result.val[c] = vrshrn_n_u16(vaddq_u16(vpaddlq_u8(pa.val[c]), vpaddlq_u8(pb.val[c])), 2);
+			}
+			vst2_u8(out + x * 2, result);
+		}
+		else if constexpr (Channels == 3) {
+			uint8x16x3_t pa = vld3q_u8(a), pb = vld3q_u8(b);
+			uint8x8x3_t result;
+			for (int c = 0; c < 3; c++) {
+				result.val[c] = vrshrn_n_u16(vaddq_u16(vpaddlq_u8(pa.val[c]), vpaddlq_u8(pb.val[c])), 2);
+			}
+			vst3_u8(out + x * 3, result);
+		}
+		else {
+			uint8x16x4_t pa = vld4q_u8(a), pb = vld4q_u8(b);
+			uint8x8x4_t result;
+			for (int c = 0; c < 4; c++) {
+				result.val[c] = vrshrn_n_u16(vaddq_u16(vpaddlq_u8(pa.val[c]), vpaddlq_u8(pb.val[c])), 2);
+			}
+			vst4_u8(out + x * 4, result);
+		}
+	}
+	downsampleRowScalar<Channels>(row0 + 2 * x * Channels, row1 + 2 * x * Channels, out + x * Channels, outWidth - x);
+}
+#pragma endregion
+#endif
+
+template<uint16_t Channels>
+static MipRowFilter linearFilter() {
+#if AX_ARCH_X86
+	if constexpr (Channels != 3) {
+		return downsampleRowSse2<Channels>;
+	}
+	return downsampleRowScalar<Channels>;
+#elif AX_ARCH_ARM64
+	return downsampleRowNeon<Channels>;
+#else
+	return downsampleRowScalar<Channels>;
+#endif
+}
+
+MipRowFilter selectMipRowFilter(uint16_t channels, AxImageLoader::MipChain mipChain) {
+	bool srgb = mipChain == AxImageLoader::MipChain::Srgb;
+	switch (channels) {
+	case 1: return srgb ? downsampleRowSrgb<1> : linearFilter<1>();
+	case 2: return srgb ? downsampleRowSrgb<2> : linearFilter<2>();
+	case 3: return srgb ? downsampleRowSrgb<3> : linearFilter<3>();
+	case 4: return srgb ? downsampleRowSrgb<4> : linearFilter<4>();
+	default:
+		throw std::runtime_error("Unsupported output channel count: " + std::to_string(channels));
+	}
+}
+
+std::vector<AxImageLoader::MipLevel> mipLevels(uint32_t width, uint32_t height, uint16_t channels) {
+	std::vector<AxImageLoader::MipLevel> levels;
+	size_t offset = 0;
+	while (true) {
+		levels.push_back({ width, height, offset });
+		offset += static_cast<size_t>(width) * height * channels;
+		if ((width <= 1 && height <= 1) || width == 0 || height == 0) {
+			break;
+		}
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+	return levels;
+}
+
+MipChainBuilder::MipChainBuilder(uint8_t* pixels, std::span<const AxImageLoader::MipLevel> levels, uint16_t channels, AxImageLoader::MipChain mipChain)
+	: pixels(pixels), levels(levels), channels(channels), filter(selectMipRowFilter(channels, mipChain)) {}
+
+uint8_t* MipChainBuilder::row(size_t level, uint32_t y) const {
+	return pixels + levels[level].offset + static_cast<size_t>(y) * levels[level].width * channels;
+}
+
+void MipChainBuilder::rowWritten(uint32_t y) {
+	for (size_t level = 0; level + 1 < levels.size(); level++) {
+		const AxImageLoader::MipLevel& source = levels[level];
+		// rows pair up as (0, 1), (2, 3), ...; the last row of an odd height is left out, and a
+		// single row pairs with itself
+		bool singleRow = source.height == 1;
+		if (!singleRow && (y % 2 == 0 || y / 2 >= levels[level + 1].height)) {
+			return;
+		}
+		const uint8_t* row0 = row(level, singleRow ? y : y - 1);
+		const uint8_t* row1 = row(level, y);
+		y = singleRow ? 0 : y / 2;
+		uint8_t* out = row(level + 1, y);
+
+		if (source.width > 1) {
+			filter(row0, row1, out, levels[level + 1].width);
+		}
+		else {
+			// a single column pairs with itself as well
+			std::array<uint8_t, 8> pair0, pair1;
+			std::memcpy(pair0.data(), row0, channels);
+			std::memcpy(pair0.data() + channels, row0, channels);
+			std::memcpy(pair1.data(), row1, channels);
+			std::memcpy(pair1.data() + channels, row1, channels);
+			filter(pair0.data(), pair1.data(), out, 1);
+		}
+	}
+}
+
+void MipChainBuilder::buildAll() {
+	for (uint32_t y = 0; y < levels[0].height; y++) {
+		rowWritten(y);
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "AxImageLoader.h"
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Averages two rows of 8-bit pixels into one row of outWidth pixels, each the rounded mean of
+// a 2x2 block; the rows hold at least 2 * outWidth pixels. The linear filter has SIMD kernels
+// for every channel count; the sRGB filter goes through lookup tables.
+using MipRowFilter = void (*)(const uint8_t* row0, const uint8_t* row1, uint8_t* out, uint32_t outWidth);
+
+MipRowFilter selectMipRowFilter(uint16_t channels, AxImageLoader::MipChain mipChain);
+
+// every level from width x height down to 1x1, packed back to back
+std::vector<AxImageLoader::MipLevel> mipLevels(uint32_t width, uint32_t height, uint16_t channels);
+
+// Fills levels 1 and up of a chain while level 0 is being written. Once a row that completes
+// a pair arrives, the row below it in the next level is built and passed on the same way, so
+// each level is made from rows that were just written.
+class MipChainBuilder {
+public:
+	MipChainBuilder(uint8_t* pixels, std::span<const AxImageLoader::MipLevel> levels, uint16_t channels, AxImageLoader::MipChain mipChain);
+
+	// rows of level 0 must arrive in order
+	void rowWritten(uint32_t y);
+	// for decodes that do not produce rows in order: builds the chain from a finished level 0
+	void buildAll();
+
+private:
+	uint8_t* row(size_t level, uint32_t y) const;
+
+	uint8_t* pixels;
+	std::span<const AxImageLoader::MipLevel> levels;
+	uint16_t channels;
+	MipRowFilter filter;
+};
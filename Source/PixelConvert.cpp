@@ -0,0 +1,171 @@
+#include "PixelConvert.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+PaletteTable makePaletteTable(std::span<const uint8_t> plte, std::span<const uint8_t> trns) {
+	PaletteTable table;
+	table.size = static_cast<uint32_t>(std::min<size_t>(plte.size() / 3, 256));
+	for (uint32_t i = 0; i < table.size; i++) {
+		table.rgba[i * 4 + 0] = plte[i * 3 + 0];
+		table.rgba[i * 4 + 1] = plte[i * 3 + 1];
+		table.rgba[i * 4 + 2] = plte[i * 3 + 2];
+		table.rgba[i * 4 + 3] = i < trns.size() ? trns[i] : 255;
+	}
+	return table;
+}
+
+// Rec. 601 luma with integer weights, truncated like the float version it replaces but
+// without its rounding error
+static inline uint8_t toGray(uint32_t r, uint32_t g, uint32_t b) {
+	return static_cast<uint8_t>((299 * r + 587 * g + 114 * b) / 1000);
+}
+
+// reads sample i of a row, scaled to 8 bits
+template<uint8_t BitDepth>
+static inline uint8_t readSample(const uint8_t* scanline, uint32_t i) {
+	if constexpr (BitDepth == 8) {
+		return scanline[i];
+	}
+	else if constexpr (BitDepth == 16) {
+		return scanline[i * 2];
+	}
+	else {
+		constexpr uint32_t mask = (1u << BitDepth) - 1;
+		constexpr uint32_t scale = 255 / mask;
+		uint32_t bit = i * BitDepth;
+		uint32_t shift = 8 - BitDepth - (bit & 7);
+		return static_cast<uint8_t>(((scanline[bit >> 3] >> shift) & mask) * scale);
+	}
+}
+
+// palette indices are the raw sample values, not scaled
+template<uint8_t BitDepth>
+static inline uint32_t readIndex(const uint8_t* scanline, uint32_t i) {
+	if constexpr (BitDepth == 8) {
+		return scanline[i];
+	}
+	else {
+		constexpr uint32_t mask = (1u << BitDepth) - 1;
+		uint32_t bit = i * BitDepth;
+		uint32_t shift = 8 - BitDepth - (bit & 7);
+		return (scanline[bit >> 3] >> shift) & mask;
+	}
+}
+
+template<uint8_t ColorType, uint8_t BitDepth, uint16_t OutChannels>
+static void convertRow(const uint8_t* scanline, uint8_t* outRow, uint32_t width, const PaletteTable& palette) {
+	constexpr uint32_t samplesPerPixel = ColorType == 2 ? 3 : ColorType == 4 ? 2 : ColorType == 6 ? 4 : 1;
+	constexpr bool sameLayout = BitDepth == 8 && ColorType != 3 && samplesPerPixel == OutChannels;
+	if constexpr (sameLayout) {
+		std::memcpy(outRow, scanline, static_cast<size_t>(width) * OutChannels);
+		return;
+	}
+
+	for (uint32_t x = 0; x < width; x++) {
+		uint8_t r, g, b, a = 255;
+		if constexpr (ColorType == 3) {
+			uint32_t index = readIndex<BitDepth>(scanline, x);
+			if (index >= palette.size) {
+				throw std::runtime_error("Palette index out of bounds in PNG image");
+			}
+			const uint8_t* entry = &palette.rgba[index * 4];
+			r = entry[0];
+			g = entry[1];
+			b = entry[2];
+			a = entry[3];
+		}
+		else if constexpr (ColorType == 0 || ColorType == 4) {
+			r = g = b = readSample<BitDepth>(scanline, x * samplesPerPixel);
+			if constexpr (ColorType == 4) {
+				a = readSample<BitDepth>(scanline, x * samplesPerPixel + 1);
+			}
+		}
+		else {
+			r = readSample<BitDepth>(scanline, x * samplesPerPixel + 0);
+			g = readSample<BitDepth>(scanline, x * samplesPerPixel + 1);
+			b = readSample<BitDepth>(scanline, x * samplesPerPixel + 2);
+			if constexpr (ColorType == 6) {
+				a = readSample<BitDepth>(scanline, x * samplesPerPixel + 3);
+			}
+		}
+
+		uint8_t* out = outRow + static_cast<size_t>(x) * OutChannels;
+		if constexpr (OutChannels <= 2) {
+			// gray sources skip the weighting, their three channels are equal
+			if constexpr (ColorType == 0 || ColorType == 4) {
+				out[0] = r;
+			}
+			else {
+				out[0] = toGray(r, g, b);
+			}
+			if constexpr (OutChannels == 2) {
+				out[1] = a;
+			}
+		}
+		else {
+			out[0] = r;
+			out[1] = g;
+			out[2] = b;
+			if constexpr (OutChannels == 4) {
+				out[3] = a;
+			}
+		}
+	}
+}
+
+template<uint8_t ColorType, uint8_t BitDepth>
+static RowConverter selectForOutChannels(uint16_t outChannels) {
+	switch (outChannels) {
+	case 1: return convertRow<ColorType, BitDepth, 1>;
+	case 2: return convertRow<ColorType, BitDepth, 2>;
+	case 3: return convertRow<ColorType, BitDepth, 3>;
+	case 4: return convertRow<ColorType, BitDepth, 4>;
+	default:
+		throw std::runtime_error("Unsupported output channel count: " + std::to_string(outChannels));
+	}
+}
+
+RowConverter selectRowConverter(uint8_t colorType, uint8_t bitDepth, uint16_t outChannels) {
+	switch (colorType) {
+	case 0: // Grayscale
+		switch (bitDepth) {
+		case 1: return selectForOutChannels<0, 1>(outChannels);
+		case 2: return selectForOutChannels<0, 2>(outChannels);
+		case 4: return selectForOutChannels<0, 4>(outChannels);
+		case 8: return selectForOutChannels<0, 8>(outChannels);
+		case 16: return selectForOutChannels<0, 16>(outChannels);
+		}
+		break;
+	case 2: // Truecolor
+		switch (bitDepth) {
+		case 8: return selectForOutChannels<2, 8>(outChannels);
+		case 16: return selectForOutChannels<2, 16>(outChannels);
+		}
+		break;
+	case 3: // Indexed-color
+		switch (bitDepth) {
+		case 1: return selectForOutChannels<3, 1>(outChannels);
+		case 2: return selectForOutChannels<3, 2>(outChannels);
+		case 4: return selectForOutChannels<3, 4>(outChannels);
+		case 8: return selectForOutChannels<3, 8>(outChannels);
+		}
+		break;
+	case 4: // Grayscale with alpha
+		switch (bitDepth) {
+		case 8: return selectForOutChannels<4, 8>(outChannels);
+		case 16: return selectForOutChannels<4, 16>(outChannels);
+		}
+		break;
+	case 6: // Truecolor with alpha
+		switch (bitDepth) {
+		case 8: return selectForOutChannels<6, 8>(outChannels);
+		case 16: return selectForOutChannels<6, 16>(outChannels);
+		}
+		break;
+	default:
+		throw std::runtime_error("Unsupported PNG color type: " + std::to_string(colorType));
+	}
+	throw std::runtime_error("Unsupported PNG bit depth " + std::to_string(bitDepth) + " for color type " + std::to_string(colorType));
+}
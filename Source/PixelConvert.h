@@ -0,0 +1,20 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <span>
+
+// PLTE entries expanded to RGBA, with tRNS alpha applied and 255 elsewhere
+struct PaletteTable {
+	std::array<uint8_t, 256 * 4> rgba = {};
+	uint32_t size = 0;
+};
+
+PaletteTable makePaletteTable(std::span<const uint8_t> plte, std::span<const uint8_t> trns);
+
+// Converts width pixels of an unfiltered scanline into 8-bit samples with the output channel
+// count. Each (color type, bit depth, output channels) combination is its own instantiation,
+// so the per-pixel loop has no format branches left in it.
+using RowConverter = void (*)(const uint8_t* scanline, uint8_t* outRow, uint32_t width, const PaletteTable& palette);
+
+// throws for combinations PNG does not allow or output channel counts outside 1-4
+RowConverter selectRowConverter(uint8_t colorType, uint8_t bitDepth, uint16_t outChannels);
@@ -0,0 +1,288 @@
+#include "PngEncoder.h"
+#include "Checksum.h"
+#include "CpuFeatures.h"
+#include "Deflater.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+// filtered bytes per band; large enough that restarting the DEFLATE window costs little
+static constexpr size_t bandBytes = 256 * 1024;
+
+static void writeUint32(std::vector<uint8_t>& out, uint32_t value) {
+	const uint8_t bytes[4] = { static_cast<uint8_t>(value >> 24), static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value) };
+	out.insert(out.end(), bytes, bytes + 4);
+}
+
+// Appends the chunk whose data are the bytes written by writeData, length and CRC included
+template <typename WriteData>
+static void writeChunk(std::vector<uint8_t>& out, const char (&name)[5], WriteData&& writeData) {
+	const size_t start = out.size();
+	writeUint32(out, 0);
+	out.insert(out.end(), name, name + 4);
+	writeData(out);
+	const size_t length = out.size() - start - 8;
+	for (size_t i = 0; i < 4; i++) {
+		out[start + i] = static_cast<uint8_t>(length >> (24 - 8 * i));
+	}
+	writeUint32(out, crc32(0, std::span<const uint8_t>(out).subspan(start + 4)));
+}
+
+static inline uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+	int p = a + b - c;
+	int pa = std::abs(p - a);
+	int pb = std::abs(p - b);
+	int pc = std::abs(p - c);
+	if (pa <= pb && pa <= pc) {
+		return a;
+	}
+	return pb <= pc ? b : c;
+}
+
+// x filtered with filter type (0-4), given its left (a), upper (b) and upper left (c) neighbours
+static inline uint8_t filterByte(uint32_t type, uint8_t x, uint8_t a, uint8_t b, uint8_t c) {
+	switch (type) {
+	case 0:
+		return x;
+	case 1:
+		return static_cast<uint8_t>(x - a);
+	case 2:
+		return static_cast<uint8_t>(x - b);
+	case 3:
+		return static_cast<uint8_t>(x - ((a + b) >> 1));
+	default:
+		return static_cast<uint8_t>(x - paeth(a, b, c));
+	}
+}
+
+// Scalar filtering of bytes begin to end - 1. With sums it adds every filter's cost to them,
+// otherwise it writes the bytes filtered with type to filtered.
+static void filterBytesScalar(const uint8_t* row, const uint8_t* prior, size_t begin, size_t end, uint32_t bytesPerPixel, std::array<uint64_t, 5>* sums, uint32_t type, uint8_t* filtered) {
+	for (size_t i = begin; i < end; i++) {
+		const uint8_t a = i >= bytesPerPixel ? row[i - bytesPerPixel] : 0;
+		const uint8_t c = i >= bytesPerPixel ? prior[i - bytesPerPixel] : 0;
+		if (sums) {
+			for (uint32_t filter = 0; filter < 5; filter++) {
+				(*sums)[filter] += std::abs(static_cast<int8_t>(filterByte(filter, row[i], a, prior[i], c)));
+			}
+		}
+		else {
+			filtered[i] = filterByte(type, row[i], a, prior[i], c);
+		}
+	}
+}
+
+#if AX_ARCH_X86
+// 16-bit half of the Paeth selection: masks of the lanes predicted by a and by b
+AX_TARGET("sse2")
+static inline void paethMasksSse2(__m128i a, __m128i b, __m128i c, __m128i& useA, __m128i& useB) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i pa = _mm_sub_epi16(b, c);
+	__m128i pb = _mm_sub_epi16(a, c);
+	__m128i pc = _mm_add_epi16(pa, pb);
+	pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+	pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+	pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+	__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+	useA = _mm_cmpeq_epi16(smallest, pa);
+	useB = _mm_andnot_si128(useA, _mm_cmpeq_epi16(smallest, pb));
+}
+
+// the masks are worked out on 16-bit lanes, then narrowed to select bytes
+AX_TARGET("sse2")
+static inline __m128i paethPredictorSse2(__m128i a, __m128i b, __m128i c) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i useALow, useBLow, useAHigh, useBHigh;
+	paethMasksSse2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero), useALow, useBLow);
+	paethMasksSse2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero), useAHigh, useBHigh);
+	__m128i useA = _mm_packs_epi16(useALow, useAHigh);
+	__m128i useB = _mm_packs_epi16(useBLow, useBHigh);
+	__m128i useC = _mm_andnot_si128(_mm_or_si128(useA, useB), _mm_set1_epi8(-1));
+	return _mm_or_si128(_mm_or_si128(_mm_and_si128(useA, a), _mm_and_si128(useB, b)), _mm_and_si128(useC, c));
+}
+
+AX_TARGET("sse2")
+static inline __m128i filterVectorSse2(uint32_t type, __m128i x, __m128i a, __m128i b, __m128i c) {
+	switch (type) {
+	case 0:
+		return x;
+	case 1:
+		return _mm_sub_epi8(x, a);
+	case 2:
+		return _mm_sub_epi8(x, b);
+	case 3:
+		return _mm_sub_epi8(x, _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1))));
+	default:
+		return _mm_sub_epi8(x, paethPredictorSse2(a, b, c));
+	}
+}
+
+// Like filterBytesScalar, 16 bytes at a time from begin, which must be at least bytesPerPixel.
+// Returns where it stopped, leaving fewer than 16 bytes.
+AX_TARGET("sse2")
+static size_t filterBytesSse2(const uint8_t* row, const uint8_t* prior, size_t begin, size_t end, uint32_t bytesPerPixel, std::array<uint64_t, 5>* sums, uint32_t type, uint8_t* filtered) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i totals[5] = { zero, zero, zero, zero, zero };
+	size_t i = begin;
+	for (; i + 16 <= end; i += 16) {
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i - bytesPerPixel));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prior + i));
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prior + i - bytesPerPixel));
+		if (sums) {
+			for (uint32_t filter = 0; filter < 5; filter++) {
+				// |v| of a signed byte is min(v, -v) read as unsigned
+				__m128i residual = filterVectorSse2(filter, x, a, b, c);
+				residual = _mm_min_epu8(residual, _mm_sub_epi8(zero, residual));
+				totals[filter] = _mm_add_epi64(totals[filter], _mm_sad_epu8(residual, zero));
+			}
+		}
+		else {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(filtered + i), filterVectorSse2(type, x, a, b, c));
+		}
+	}
+	if (sums) {
+		for (uint32_t filter = 0; filter < 5; filter++) {
+			(*sums)[filter] += static_cast<uint64_t>(_mm_cvtsi128_si64(totals[filter])) + static_cast<uint64_t>(_mm_cvtsi128_si64(_mm_unpackhi_epi64(totals[filter], totals[filter])));
+		}
+	}
+	return i;
+}
+#endif
+
+// the whole row through filterBytesScalar, with the vector version for the middle part
+static void filterBytes(const uint8_t* row, const uint8_t* prior, size_t rowBytes, uint32_t bytesPerPixel, std::array<uint64_t, 5>* sums, uint32_t type, uint8_t* filtered) {
+	size_t begin = 0;
+#if AX_ARCH_X86
+	if (getCpuFeatures().sse2 && rowBytes >= bytesPerPixel) {
+		filterBytesScalar(row, prior, 0, bytesPerPixel, bytesPerPixel, sums, type, filtered);
+		begin = filterBytesSse2(row, prior, bytesPerPixel, rowBytes, bytesPerPixel, sums, type, filtered);
+	}
+#endif
+	filterBytesScalar(row, prior, begin, rowBytes, bytesPerPixel, sums, type, filtered);
+}
+
+// Filters row, with prior the row above it (zeros for the first), into out: the filter type
+// followed by rowBytes filtered bytes. Picks the filter whose output, read as signed bytes,
+// has the smallest sum of magnitudes, the heuristic libpng uses; one pass scores all five.
+static void filterRow(const uint8_t* row, const uint8_t* prior, size_t rowBytes, uint32_t bytesPerPixel, uint8_t* out) {
+	std::array<uint64_t, 5> sums = {};
+	filterBytes(row, prior, rowBytes, bytesPerPixel, &sums, 0, nullptr);
+	const uint32_t type = static_cast<uint32_t>(std::min_element(sums.begin(), sums.end()) - sums.begin());
+	out[0] = static_cast<uint8_t>(type);
+	filterBytes(row, prior, rowBytes, bytesPerPixel, nullptr, type, out + 1);
+}
+
+std::vector<uint8_t> encodePng(const AxImageLoader::Image& image, const AxImageLoader::SaveOptions& options) {
+	if (image.blockFormat != AxImageLoader::BlockFormat::None) {
+		throw std::runtime_error("Block-compressed images cannot be saved as PNG");
+	}
+	if (image.channels < 1 || image.channels > 4) {
+		throw std::runtime_error("Unsupported channel count: " + std::to_string(image.channels));
+	}
+	if (image.width == 0 || image.height == 0 || image.width > 0x7FFFFFFF || image.height > 0x7FFFFFFF) {
+		throw std::runtime_error("Invalid image dimensions");
+	}
+	const size_t rowBytes = static_cast<size_t>(image.width) * image.channels;
+	// a band of one row still has to fit a chunk after DEFLATE's framing
+	if (rowBytes > 0x7F000000) {
+		throw std::runtime_error("Image rows too wide to save as PNG");
+	}
+	if (image.data.size() / rowBytes < image.height) {
+		throw std::runtime_error("Image data is smaller than width * height * channels");
+	}
+
+	DeflateStrategy strategy = DeflateStrategy::Greedy;
+	if (options.compression == AxImageLoader::PngCompression::Store) {
+		strategy = DeflateStrategy::Store;
+	}
+	else if (options.compression == AxImageLoader::PngCompression::Fast) {
+		strategy = DeflateStrategy::HuffmanOnly;
+	}
+
+	// each band becomes one IDAT chunk holding its piece of the zlib stream
+	const uint32_t rowsPerBand = static_cast<uint32_t>(std::clamp<size_t>(bandBytes / (rowBytes + 1), 1, image.height));
+	const uint32_t bandCount = (image.height + rowsPerBand - 1) / rowsPerBand;
+	std::vector<std::vector<uint8_t>> chunks(bandCount);
+	std::vector<uint32_t> adlers(bandCount);
+	auto encodeBand = [&](uint32_t band) {
+		const uint32_t firstRow = band * rowsPerBand;
+		const uint32_t rowCount = std::min(rowsPerBand, image.height - firstRow);
+		std::vector<uint8_t> filtered(static_cast<size_t>(rowCount) * (rowBytes + 1));
+		const std::vector<uint8_t> zeroRow(firstRow == 0 ? rowBytes : 0, 0);
+		for (uint32_t y = 0; y < rowCount; y++) {
+			const uint8_t* row = image.data.data() + (firstRow + y) * rowBytes;
+			uint8_t* out = filtered.data() + y * (rowBytes + 1);
+			if (strategy == DeflateStrategy::Store) {
+				out[0] = 0;
+				std::memcpy(out + 1, row, rowBytes);
+			}
+			else {
+				filterRow(row, firstRow + y == 0 ? zeroRow.data() : row - rowBytes, rowBytes, image.channels, out);
+			}
+		}
+		adlers[band] = adler32(1, filtered);
+
+		writeChunk(chunks[band], "IDAT", [&](std::vector<uint8_t>& out) {
+			if (band == 0) {
+				// deflate with a 32K window, no dictionary, fastest level
+				out.push_back(0x78);
+				out.push_back(0x01);
+			}
+			deflatePiece(filtered, strategy, band + 1 == bandCount, out);
+		});
+	};
+
+	uint32_t threadCount = options.threads;
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threadCount = std::min(threadCount, bandCount);
+	if (threadCount > 1) {
+		// the calling thread encodes too while it waits
+		ThreadPool pool(threadCount - 1);
+		for (uint32_t band = 0; band < bandCount; band++) {
+			pool.submit([&encodeBand, band] { encodeBand(band); });
+		}
+		pool.wait();
+	}
+	else {
+		for (uint32_t band = 0; band < bandCount; band++) {
+			encodeBand(band);
+		}
+	}
+
+	uint32_t adler = adlers[0];
+	for (uint32_t band = 1; band < bandCount; band++) {
+		const uint32_t firstRow = band * rowsPerBand;
+		const size_t bandSize = static_cast<size_t>(std::min(rowsPerBand, image.height - firstRow)) * (rowBytes + 1);
+		adler = adler32Combine(adler, adlers[band], bandSize);
+	}
+
+	std::vector<uint8_t> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	static constexpr std::array<uint8_t, 5> colorTypes = { 0, 0, 4, 2, 6 };
+	writeChunk(png, "IHDR", [&](std::vector<uint8_t>& out) {
+		writeUint32(out, image.width);
+		writeUint32(out, image.height);
+		// bit depth, color type, compression, filter and interlace methods
+		const uint8_t fields[5] = { 8, colorTypes[image.channels], 0, 0, 0 };
+		out.insert(out.end(), fields, fields + 5);
+	});
+	size_t size = png.size() + 16 + 12;
+	for (const std::vector<uint8_t>& chunk : chunks) {
+		size += chunk.size();
+	}
+	png.reserve(size);
+	for (const std::vector<uint8_t>& chunk : chunks) {
+		png.insert(png.end(), chunk.begin(), chunk.end());
+	}
+	// the stream's Adler-32 is only known once every band is done, so it gets a chunk of its own
+	writeChunk(png, "IDAT", [&](std::vector<uint8_t>& out) { writeUint32(out, adler); });
+	writeChunk(png, "IEND", [](std::vector<uint8_t>&) {});
+	return png;
+}
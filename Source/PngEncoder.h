@@ -0,0 +1,10 @@
+#pragma once
+#include "AxImageLoader.h"
+#include <cstdint>
+#include <vector>
+
+// Encodes image, which must hold 8-bit pixels with 1-4 channels, as a PNG file. Rows are
+// filtered and compressed in bands, one DEFLATE piece per band, on options.threads threads;
+// the bands are joined with sync flushes, each in its own IDAT chunk. Throws if the image
+// cannot be saved.
+std::vector<uint8_t> encodePng(const AxImageLoader::Image& image, const AxImageLoader::SaveOptions& options);
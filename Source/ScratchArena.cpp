@@ -0,0 +1,114 @@
+#include "ScratchArena.h"
+#include <algorithm>
+#include <cstdint>
+#include <new>
+
+// the block suits any alignment up to this; larger ones are padded inside it
+static constexpr size_t blockAlignment = 64;
+// block sizes are rounded up to this, so a slightly larger decode does not regrow the block
+static constexpr size_t blockGranularity = 64 * 1024;
+
+ScratchArena::ScratchArena(size_t maxRetainedBytes) : maxRetained(maxRetainedBytes) {}
+
+ScratchArena::~ScratchArena() {
+	for (const Overflow& overflow : overflows) {
+		::operator delete(overflow.pointer, overflow.bytes, std::align_val_t(overflow.alignment));
+	}
+	replaceBlock(0);
+}
+
+void* ScratchArena::do_allocate(size_t bytes, size_t alignment) {
+	std::lock_guard lock(mutex);
+	if (block) {
+		const uintptr_t start = reinterpret_cast<uintptr_t>(block);
+		const size_t offset = ((start + used + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1)) - start;
+		if (offset <= blockBytes && bytes <= blockBytes - offset) {
+			used = offset + bytes;
+			peakBytes = std::max(peakBytes, used + overflowBytes);
+			return block + offset;
+		}
+	}
+
+	overflows.push_back({ nullptr, bytes, alignment });
+	try {
+		overflows.back().pointer = ::operator new(bytes, std::align_val_t(alignment));
+	}
+	catch (...) {
+		overflows.pop_back();
+		throw;
+	}
+	overflowBytes += bytes;
+	peakBytes = std::max(peakBytes, used + overflowBytes);
+	return overflows.back().pointer;
+}
+
+void ScratchArena::do_deallocate(void* pointer, size_t bytes, size_t alignment) {
+	std::lock_guard lock(mutex);
+	const uintptr_t address = reinterpret_cast<uintptr_t>(pointer);
+	const uintptr_t start = reinterpret_cast<uintptr_t>(block);
+	if (block && address >= start && address <= start + blockBytes) {
+		// only the newest allocation can be handed back
+		if (address + bytes == start + used) {
+			used = address - start;
+		}
+		return;
+	}
+
+	auto overflow = std::find_if(overflows.begin(), overflows.end(), [pointer](const Overflow& o) { return o.pointer == pointer; });
+	if (overflow != overflows.end()) {
+		::operator delete(pointer, bytes, std::align_val_t(alignment));
+		overflowBytes -= overflow->bytes;
+		*overflow = overflows.back();
+		overflows.pop_back();
+	}
+}
+
+void ScratchArena::reset() {
+	std::lock_guard lock(mutex);
+	for (const Overflow& overflow : overflows) {
+		::operator delete(overflow.pointer, overflow.bytes, std::align_val_t(overflow.alignment));
+	}
+	overflows.clear();
+	overflowBytes = 0;
+
+	const size_t wanted = std::min(maxRetained, (peakBytes + blockGranularity - 1) / blockGranularity * blockGranularity);
+	if (peakBytes > blockBytes && wanted > blockBytes) {
+		replaceBlock(wanted);
+	}
+	used = 0;
+	peakBytes = 0;
+}
+
+void ScratchArena::shrink(size_t bytes) {
+	std::lock_guard lock(mutex);
+	if (blockBytes > bytes) {
+		replaceBlock(bytes);
+	}
+}
+
+void ScratchArena::setMaxRetainedBytes(size_t bytes) {
+	std::lock_guard lock(mutex);
+	maxRetained = bytes;
+	if (blockBytes > bytes) {
+		replaceBlock(bytes);
+	}
+}
+
+size_t ScratchArena::retainedBytes() const {
+	std::lock_guard lock(mutex);
+	return blockBytes;
+}
+
+// callers hold the mutex; the old block must not be in use
+void ScratchArena::replaceBlock(size_t bytes) {
+	if (block) {
+		::operator delete(block, blockBytes, std::align_val_t(blockAlignment));
+		block = nullptr;
+		blockBytes = 0;
+	}
+	if (bytes > 0) {
+		block = static_cast<std::byte*>(::operator new(bytes, std::align_val_t(blockAlignment)));
+		blockBytes = bytes;
+	}
+	used = 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+// Scratch memory of one decode at a time, handed out from a single block by bumping a pointer.
+// Memory is only reclaimed by reset(), apart from the most recent allocation, which can be
+// given back so a growing vector reuses its space. A request the block cannot fit comes from
+// the heap; the next reset() then grows the block to the most the decode had in use, up to
+// maxRetainedBytes, so repeating a decode of the same size touches the heap no more.
+// Allocating is thread safe, for the worker threads of parallel decodes.
+class ScratchArena : public std::pmr::memory_resource {
+public:
+	explicit ScratchArena(size_t maxRetainedBytes);
+	~ScratchArena() override;
+	ScratchArena(const ScratchArena&) = delete;
+	ScratchArena& operator=(const ScratchArena&) = delete;
+
+	// Forgets every allocation, which must no longer be in use, and resizes the block for the
+	// next decode
+	void reset();
+	// frees the block if it is larger than bytes, for between decodes
+	void shrink(size_t bytes);
+	void setMaxRetainedBytes(size_t bytes);
+	size_t retainedBytes() const;
+
+private:
+	struct Overflow {
+		void* pointer;
+		size_t bytes;
+		size_t alignment;
+	};
+
+	void* do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void* pointer, size_t bytes, size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+	void replaceBlock(size_t bytes);
+
+	mutable std::mutex mutex;
+	std::byte* block = nullptr;
+	size_t blockBytes = 0;
+	size_t used = 0;
+	// bytes of live overflow allocations, and the most in use at once since the last reset
+	size_t overflowBytes = 0;
+	size_t peakBytes = 0;
+	size_t maxRetained;
+	std::vector<Overflow> overflows;
+};
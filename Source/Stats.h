@@ -0,0 +1,111 @@
+#pragma once
+#include "AxImageLoader.h"
+#include <chrono>
+#include <mutex>
+#include <optional>
+
+#ifdef AX_IMAGE_LOADER_STATS
+inline constexpr bool statsEnabled = true;
+#else
+inline constexpr bool statsEnabled = false;
+#endif
+
+// the struct a decode records into; always null without AX_IMAGE_LOADER_STATS, so every
+// recording guarded by a null check folds away
+inline AxImageLoader::DecodeStats* decodeStats(const AxImageLoader::LoadOptions& options) {
+	if constexpr (statsEnabled) {
+		return options.stats;
+	}
+	else {
+		return nullptr;
+	}
+}
+
+// Adds the time until it goes out of scope to one stage of stats, if stats is set. Without
+// AX_IMAGE_LOADER_STATS it is empty and disappears entirely.
+class StageTimer {
+public:
+	using Stage = uint64_t AxImageLoader::DecodeStats::*;
+
+#ifdef AX_IMAGE_LOADER_STATS
+	StageTimer(AxImageLoader::DecodeStats* stats, Stage stage) : stats(stats), stage(stage) {
+		if (stats) {
+			start = std::chrono::steady_clock::now();
+		}
+	}
+	~StageTimer() {
+		if (stats) {
+			stats->*stage += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		}
+	}
+
+private:
+	AxImageLoader::DecodeStats* stats;
+	Stage stage;
+	std::chrono::steady_clock::time_point start;
+#else
+	StageTimer(AxImageLoader::DecodeStats*, Stage) {}
+#endif
+};
+
+inline void addStats(AxImageLoader::DecodeStats& into, const AxImageLoader::DecodeStats& from) {
+	into.readNanoseconds += from.readNanoseconds;
+	into.chunkNanoseconds += from.chunkNanoseconds;
+	into.inflateNanoseconds += from.inflateNanoseconds;
+	into.unfilterNanoseconds += from.unfilterNanoseconds;
+	into.entropyNanoseconds += from.entropyNanoseconds;
+	into.idctNanoseconds += from.idctNanoseconds;
+	into.convertNanoseconds += from.convertNanoseconds;
+	into.mipNanoseconds += from.mipNanoseconds;
+	into.blockCompressionNanoseconds += from.blockCompressionNanoseconds;
+	into.inputBytes += from.inputBytes;
+	into.compressedBytes += from.compressedBytes;
+	into.inflatedBytes += from.inflatedBytes;
+	into.outputBytes += from.outputBytes;
+	for (size_t i = 0; i < into.blockTypes.size(); i++) {
+		into.blockTypes[i] += from.blockTypes[i];
+	}
+	for (size_t i = 0; i < into.filterTypes.size(); i++) {
+		into.filterTypes[i] += from.filterTypes[i];
+	}
+	into.huffmanTableBuilds += from.huffmanTableBuilds;
+}
+
+// One load's view of LoadOptions::stats. The load records into a private struct, which is
+// added to the caller's under a lock when the scope ends, so parallel loads can share one.
+class StatsScope {
+public:
+	StatsScope(const StatsScope&) = delete;
+	StatsScope& operator=(const StatsScope&) = delete;
+
+#ifdef AX_IMAGE_LOADER_STATS
+	explicit StatsScope(const AxImageLoader::LoadOptions& options) : callerOptions(options) {
+		if (options.stats) {
+			scopedOptions.emplace(options);
+			scopedOptions->stats = &collected;
+		}
+	}
+	~StatsScope() {
+		if (scopedOptions) {
+			static std::mutex mutex;
+			std::lock_guard lock(mutex);
+			addStats(*callerOptions.stats, collected);
+		}
+	}
+
+	// the options to decode with, pointing at the private struct
+	const AxImageLoader::LoadOptions& options() const { return scopedOptions ? *scopedOptions : callerOptions; }
+
+private:
+	const AxImageLoader::LoadOptions& callerOptions;
+	std::optional<AxImageLoader::LoadOptions> scopedOptions;
+	AxImageLoader::DecodeStats collected;
+#else
+	explicit StatsScope(const AxImageLoader::LoadOptions& options) : callerOptions(options) {}
+
+	const AxImageLoader::LoadOptions& options() const { return callerOptions; }
+
+private:
+	const AxImageLoader::LoadOptions& callerOptions;
+#endif
+};
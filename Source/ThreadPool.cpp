@@ -0,0 +1,113 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+// pool and queue of the worker running on this thread, so nested submits stay local
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local uint32_t currentQueue = 0;
+
+ThreadPool::ThreadPool(uint32_t workerCount) {
+	if (workerCount == 0) {
+		workerCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	for (uint32_t i = 0; i < workerCount; i++) {
+		queues.push_back(std::make_unique<WorkQueue>());
+	}
+	threads.reserve(workerCount);
+	for (uint32_t i = 0; i < workerCount; i++) {
+		threads.emplace_back([this, i] { workerLoop(i); });
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	wait();
+	{
+		std::lock_guard lock(sleepMutex);
+		stopping = true;
+	}
+	workAvailable.notify_all();
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+void ThreadPool::submit(Task task) {
+	uint32_t index;
+	if (currentPool == this) {
+		index = currentQueue;
+	}
+	else {
+		index = nextQueue.fetch_add(1, std::memory_order_relaxed) % workerCount();
+	}
+	unfinishedTasks.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard lock(queues[index]->mutex);
+		queues[index]->tasks.push_back(std::move(task));
+	}
+	{
+		std::lock_guard lock(sleepMutex);
+		queuedTasks++;
+	}
+	workAvailable.notify_one();
+}
+
+void ThreadPool::wait() {
+	// outside threads have no queue of their own and only steal
+	uint32_t index = currentPool == this ? currentQueue : 0;
+	while (unfinishedTasks.load(std::memory_order_acquire) != 0) {
+		if (runPendingTask(index)) {
+			continue;
+		}
+		// everything left is already running on a worker
+		std::unique_lock lock(sleepMutex);
+		allDone.wait(lock, [this] { return unfinishedTasks.load(std::memory_order_acquire) == 0 || queuedTasks != 0; });
+	}
+}
+
+bool ThreadPool::runPendingTask(uint32_t index) {
+	Task task;
+	// own queue from the back, then steal from the front of the others
+	{
+		std::lock_guard lock(queues[index]->mutex);
+		if (!queues[index]->tasks.empty()) {
+			task = std::move(queues[index]->tasks.back());
+			queues[index]->tasks.pop_back();
+		}
+	}
+	for (size_t i = 1; !task && i < queues.size(); i++) {
+		WorkQueue& victim = *queues[(index + i) % queues.size()];
+		std::lock_guard lock(victim.mutex);
+		if (!victim.tasks.empty()) {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+		}
+	}
+	if (!task) {
+		return false;
+	}
+
+	{
+		std::lock_guard lock(sleepMutex);
+		queuedTasks--;
+	}
+	task();
+	if (unfinishedTasks.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		std::lock_guard lock(sleepMutex);
+		allDone.notify_all();
+	}
+	return true;
+}
+
+void ThreadPool::workerLoop(uint32_t index) {
+	currentPool = this;
+	currentQueue = index;
+	while (true) {
+		if (runPendingTask(index)) {
+			continue;
+		}
+		std::unique_lock lock(sleepMutex);
+		workAvailable.wait(lock, [this] { return stopping || queuedTasks != 0; });
+		if (stopping && queuedTasks == 0) {
+			return;
+		}
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own task deque. A worker runs its own tasks
+// newest first and steals the oldest task of another worker when it runs dry, so tasks
+// submitted from inside a task stay on the thread that produced them.
+class ThreadPool {
+public:
+	using Task = std::move_only_function<void()>;
+
+	// 0 uses one worker per hardware thread
+	explicit ThreadPool(uint32_t workerCount = 0);
+	// finishes every queued task before joining the workers
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// tasks must not throw
+	void submit(Task task);
+	// blocks until every submitted task has run; the calling thread runs tasks while it waits
+	void wait();
+	uint32_t workerCount() const { return static_cast<uint32_t>(threads.size()); }
+
+private:
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	void workerLoop(uint32_t index);
+	bool runPendingTask(uint32_t index);
+
+	std::vector<std::unique_ptr<WorkQueue>> queues;
+	std::vector<std::thread> threads;
+	std::mutex sleepMutex;
+	std::condition_variable workAvailable;
+	std::condition_variable allDone;
+	size_t queuedTasks = 0;
+	std::atomic<size_t> unfinishedTasks = 0;
+	std::atomic<uint32_t> nextQueue = 0;
+	bool stopping = false;
+};
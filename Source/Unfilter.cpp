@@ -0,0 +1,460 @@
+#include "Unfilter.h"
+#include "CpuFeatures.h"
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using UnfilterFunction = void (*)(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes);
+
+struct UnfilterKernels {
+	UnfilterFunction sub = nullptr;
+	UnfilterFunction up = nullptr;
+	UnfilterFunction average = nullptr;
+	UnfilterFunction paeth = nullptr;
+};
+
+#pragma region Scalar
+static uint8_t paethFilter(uint8_t a, uint8_t b, uint8_t c) {
+	int p = static_cast<int>(a) + static_cast<int>(b) - static_cast<int>(c);
+	int pa = std::abs(p - static_cast<int>(a));
+	int pb = std::abs(p - static_cast<int>(b));
+	int pc = std::abs(p - static_cast<int>(c));
+	if (pa <= pb && pa <= pc) return a;
+	else if (pb <= pc) return b;
+	else return c;
+}
+
+void unfilterScanlineScalar(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes, uint32_t bpp, uint8_t filter) {
+	switch (filter) {
+	case 0: // None
+		break;
+	case 1: // Sub
+		for (uint32_t i = bpp; i < rowBytes; i++) {
+			scanline[i] = static_cast<uint8_t>(scanline[i] + scanline[i - bpp]);
+		}
+		break;
+	case 2: // Up
+		if (prev) {
+			for (uint32_t i = 0; i < rowBytes; i++) {
+				scanline[i] = static_cast<uint8_t>(scanline[i] + prev[i]);
+			}
+		}
+		break;
+	case 3: // Average
+		if (prev) {
+			for (uint32_t i = 0; i < bpp; i++) {
+				scanline[i] = static_cast<uint8_t>(scanline[i] + (prev[i] >> 1));
+			}
+			for (uint32_t i = bpp; i < rowBytes; i++) {
+				scanline[i] = static_cast<uint8_t>(scanline[i] + ((scanline[i - bpp] + prev[i]) >> 1));
+			}
+		}
+		else {
+			for (uint32_t i = bpp; i < rowBytes; i++) {
+				scanline[i] = static_cast<uint8_t>(scanline[i] + (scanline[i - bpp] >> 1));
+			}
+		}
+		break;
+	case 4: // Paeth
+		if (prev) {
+			for (uint32_t i = 0; i < bpp; i++) {
+				scanline[i] = static_cast<uint8_t>(scanline[i] + paethFilter(0, prev[i], 0));
+			}
+			for (uint32_t i = bpp; i < rowBytes; i++) {
+				scanline[i] = static_cast<uint8_t>(scanline[i] + paethFilter(scanline[i - bpp], prev[i], prev[i - bpp]));
+			}
+		}
+		else {
+			for (uint32_t i = bpp; i < rowBytes; i++) {
+				scanline[i] = static_cast<uint8_t>(scanline[i] + paethFilter(scanline[i - bpp], 0, 0));
+			}
+		}
+		break;
+	default:
+		throw std::runtime_error("Invalid PNG filter type: " + std::to_string(filter));
+		break;
+	}
+}
+
+// Sub, Average and Paeth carry a dependency from one pixel to the next, so with one or two
+// bytes per pixel there is nothing to vectorize. A compile-time bpp and a branchless
+// predictor still let the compiler unroll these and use conditional moves.
+static inline int paethPredictor(int a, int b, int c) {
+	int pa = std::abs(b - c);
+	int pb = std::abs(a - c);
+	int pc = std::abs(a + b - 2 * c);
+	int nearest = pb <= pc ? b : c;
+	return (pa <= pb && pa <= pc) ? a : nearest;
+}
+
+template<uint32_t Bpp>
+static void unfilterSubScalar(uint8_t* scanline, const uint8_t*, uint32_t rowBytes) {
+	for (uint32_t i = Bpp; i < rowBytes; i++) {
+		scanline[i] = static_cast<uint8_t>(scanline[i] + scanline[i - Bpp]);
+	}
+}
+
+static void unfilterUpScalar(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes) {
+	for (uint32_t i = 0; i < rowBytes; i++) {
+		scanline[i] = static_cast<uint8_t>(scanline[i] + prev[i]);
+	}
+}
+
+template<uint32_t Bpp>
+static void unfilterAverageScalar(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes) {
+	for (uint32_t i = 0; i < Bpp && i < rowBytes; i++) {
+		scanline[i] = static_cast<uint8_t>(scanline[i] + (prev[i] >> 1));
+	}
+	for (uint32_t i = Bpp; i < rowBytes; i++) {
+		scanline[i] = static_cast<uint8_t>(scanline[i] + ((scanline[i - Bpp] + prev[i]) >> 1));
+	}
+}
+
+template<uint32_t Bpp>
+static void unfilterPaethScalar(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes) {
+	for (uint32_t i = 0; i < Bpp && i < rowBytes; i++) {
+		scanline[i] = static_cast<uint8_t>(scanline[i] + prev[i]);
+	}
+	for (uint32_t i = Bpp; i < rowBytes; i++) {
+		scanline[i] = static_cast<uint8_t>(scanline[i] + paethPredictor(scanline[i - Bpp], prev[i], prev[i - Bpp]));
+	}
+}
+
+template<uint32_t Bpp>
+static UnfilterKernels scalarKernels() {
+	return { unfilterSubScalar<Bpp>, unfilterUpScalar, unfilterAverageScalar<Bpp>, unfilterPaethScalar<Bpp> };
+}
+#pragma endregion
+
+#if AX_ARCH_X86
+#pragma region X86
+// For bpp >= 3 one pixel is processed per step with its bytes side by side in a register.
+// 3 and 6 byte pixels are assembled in general registers, which avoids both touching
+// memory past the row and the store-forwarding stall of going through a stack buffer.
+template<uint32_t Bpp>
+static inline __m128i loadPixel(const uint8_t* p) {
+	if constexpr (Bpp == 8) {
+		return _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+	}
+	else if constexpr (Bpp == 4) {
+		int32_t v;
+		std::memcpy(&v, p, 4);
+		return _mm_cvtsi32_si128(v);
+	}
+	else if constexpr (Bpp == 3) {
+		uint16_t low;
+		std::memcpy(&low, p, 2);
+		return _mm_cvtsi32_si128(static_cast<int32_t>(low | (static_cast<uint32_t>(p[2]) << 16)));
+	}
+	else {
+		int32_t low;
+		uint16_t high;
+		std::memcpy(&low, p, 4);
+		std::memcpy(&high, p + 4, 2);
+		return _mm_insert_epi16(_mm_cvtsi32_si128(low), high, 2);
+	}
+}
+
+template<uint32_t Bpp>
+static inline void storePixel(uint8_t* p, __m128i v) {
+	if constexpr (Bpp == 8) {
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(p), v);
+	}
+	else if constexpr (Bpp == 4) {
+		int32_t low = _mm_cvtsi128_si32(v);
+		std::memcpy(p, &low, 4);
+	}
+	else if constexpr (Bpp == 3) {
+		uint32_t low = static_cast<uint32_t>(_mm_cvtsi128_si32(v));
+		uint16_t head = static_cast<uint16_t>(low);
+		std::memcpy(p, &head, 2);
+		p[2] = static_cast<uint8_t>(low >> 16);
+	}
+	else {
+		int32_t low = _mm_cvtsi128_si32(v);
+		uint16_t high = static_cast<uint16_t>(_mm_extract_epi16(v, 2));
+		std::memcpy(p, &low, 4);
+		std::memcpy(p + 4, &high, 2);
+	}
+}
+
+template<uint32_t Bpp>
+static void unfilterSubSse2(uint8_t* scanline, const uint8_t*, uint32_t rowBytes) {
+	__m128i a = _mm_setzero_si128();
+	for (uint32_t i = 0; i + Bpp <= rowBytes; i += Bpp) {
+		a = _mm_add_epi8(a, loadPixel<Bpp>(scanline + i));
+		storePixel<Bpp>(scanline + i, a);
+	}
+}
+
+static void unfilterUpSse2(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes) {
+	uint32_t i = 0;
+	for (; i + 16 <= rowBytes; i += 16) {
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(scanline + i));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(scanline + i), _mm_add_epi8(x, b));
+	}
+	unfilterUpScalar(scanline + i, prev + i, rowBytes - i);
+}
+
+AX_TARGET("avx2")
+static void unfilterUpAvx2(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes) {
+	uint32_t i = 0;
+	for (; i + 32 <= rowBytes; i += 32) {
+		__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(scanline + i));
+		__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(scanline + i), _mm256_add_epi8(x, b));
+	}
+	unfilterUpSse2(scanline + i, prev + i, rowBytes - i);
+}
+
+// floor((a + b) / 2): pavgb rounds up, so subtract the bit lost when a + b is odd
+template<uint32_t Bpp>
+static void unfilterAverageSse2(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes) {
+	const __m128i one = _mm_set1_epi8(1);
+	__m128i a = _mm_setzero_si128();
+	for (uint32_t i = 0; i + Bpp <= rowBytes; i += Bpp) {
+		__m128i b = loadPixel<Bpp>(prev + i);
+		__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+		a = _mm_add_epi8(loadPixel<Bpp>(scanline + i), average);
+		storePixel<Bpp>(scanline + i, a);
+	}
+}
+
+// Paeth works on 16-bit lanes: with p = a + b - c the three distances are |b - c|,
+// |a - c| and |a + b - 2c|. The smallest one picks the predictor, ties favouring a, then b.
+static inline __m128i selectPaethPredictor(__m128i a, __m128i b, __m128i c, __m128i pa, __m128i pb, __m128i pc) {
+	__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+	__m128i useA = _mm_cmpeq_epi16(smallest, pa);
+	__m128i useB = _mm_andnot_si128(useA, _mm_cmpeq_epi16(smallest, pb));
+	__m128i useC = _mm_andnot_si128(_mm_or_si128(useA, useB), _mm_set1_epi16(-1));
+	return _mm_or_si128(_mm_or_si128(_mm_and_si128(useA, a), _mm_and_si128(useB, b)), _mm_and_si128(useC, c));
+}
+
+// SSE2 has no 16-bit absolute value, so it is max(v, -v)
+template<uint32_t Bpp>
+static void unfilterPaethSse2(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = zero;
+	__m128i c = zero;
+	for (uint32_t i = 0; i + Bpp <= rowBytes; i += Bpp) {
+		__m128i b = _mm_unpacklo_epi8(loadPixel<Bpp>(prev + i), zero);
+		__m128i x = _mm_unpacklo_epi8(loadPixel<Bpp>(scanline + i), zero);
+
+		__m128i pa = _mm_sub_epi16(b, c);
+		__m128i pb = _mm_sub_epi16(a, c);
+		__m128i pc = _mm_add_epi16(pa, pb);
+		pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+		pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+		pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+
+		a = _mm_and_si128(_mm_add_epi16(x, selectPaethPredictor(a, b, c, pa, pb, pc)), _mm_set1_epi16(0xff));
+		c = b;
+		storePixel<Bpp>(scanline + i, _mm_packus_epi16(a, a));
+	}
+}
+
+template<uint32_t Bpp>
+AX_TARGET("ssse3")
+static void unfilterPaethSsse3(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = zero;
+	__m128i c = zero;
+	for (uint32_t i = 0; i + Bpp <= rowBytes; i += Bpp) {
+		__m128i b = _mm_unpacklo_epi8(loadPixel<Bpp>(prev + i), zero);
+		__m128i x = _mm_unpacklo_epi8(loadPixel<Bpp>(scanline + i), zero);
+
+		__m128i pa = _mm_sub_epi16(b, c);
+		__m128i pb = _mm_sub_epi16(a, c);
+		__m128i pc = _mm_abs_epi16(_mm_add_epi16(pa, pb));
+		pa = _mm_abs_epi16(pa);
+		pb = _mm_abs_epi16(pb);
+
+		a = _mm_and_si128(_mm_add_epi16(x, selectPaethPredictor(a, b, c, pa, pb, pc)), _mm_set1_epi16(0xff));
+		c = b;
+		storePixel<Bpp>(scanline + i, _mm_packus_epi16(a, a));
+	}
+}
+
+template<uint32_t Bpp>
+static UnfilterKernels x86Kernels(const CpuFeatures& features) {
+	UnfilterKernels kernels = scalarKernels<Bpp>();
+	kernels.up = features.avx2 ? unfilterUpAvx2 : unfilterUpSse2;
+	if constexpr (Bpp >= 3) {
+		kernels.sub = unfilterSubSse2<Bpp>;
+		kernels.average = unfilterAverageSse2<Bpp>;
+		kernels.paeth = features.ssse3 ? unfilterPaethSsse3<Bpp> : unfilterPaethSse2<Bpp>;
+	}
+	return kernels;
+}
+#pragma endregion
+#endif
+
+#if AX_ARCH_ARM64
+#pragma region Neon
+// same layout as the x86 kernels: pixels are assembled in a general register
+template<uint32_t Bpp>
+static inline uint8x8_t loadPixelNeon(const uint8_t* p) {
+	if constexpr (Bpp == 8) {
+		return vld1_u8(p);
+	}
+	else if constexpr (Bpp == 4) {
+		uint32_t v;
+		std::memcpy(&v, p, 4);
+		return vcreate_u8(v);
+	}
+	else if constexpr (Bpp == 3) {
+		uint16_t low;
+		std::memcpy(&low, p, 2);
+		return vcreate_u8(low | (static_cast<uint64_t>(p[2]) << 16));
+	}
+	else {
+		uint32_t low;
+		uint16_t high;
+		std::memcpy(&low, p, 4);
+		std::memcpy(&high, p + 4, 2);
+		return vcreate_u8(low | (static_cast<uint64_t>(high) << 32));
+	}
+}
+
+template<uint32_t Bpp>
+static inline void storePixelNeon(uint8_t* p, uint8x8_t v) {
+	if constexpr (Bpp == 8) {
+		vst1_u8(p, v);
+	}
+	else {
+		uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(v), 0);
+		uint32_t low = static_cast<uint32_t>(bits);
+		if constexpr (Bpp == 4) {
+			std::memcpy(p, &low, 4);
+		}
+		else if constexpr (Bpp == 3) {
+			uint16_t head = static_cast<uint16_t>(low);
+			std::memcpy(p, &head, 2);
+			p[2] = static_cast<uint8_t>(low >> 16);
+		}
+		else {
+			uint16_t high = static_cast<uint16_t>(bits >> 32);
+			std::memcpy(p, &low, 4);
+			std::memcpy(p + 4, &high, 2);
+		}
+	}
+}
+
+template<uint32_t Bpp>
+static void unfilterSubNeon(uint8_t* scanline, const uint8_t*, uint32_t rowBytes) {
+	uint8x8_t a = vdup_n_u8(0);
+	for (uint32_t i = 0; i + Bpp <= rowBytes; i += Bpp) {
+		a = vadd_u8(a, loadPixelNeon<Bpp>(scanline + i));
+		storePixelNeon<Bpp>(scanline + i, a);
+	}
+}
+
+static void unfilterUpNeon(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes) {
+	uint32_t i = 0;
+	for (; i + 16 <= rowBytes; i += 16) {
+		vst1q_u8(scanline + i, vaddq_u8(vld1q_u8(scanline + i), vld1q_u8(prev + i)));
+	}
+	unfilterUpScalar(scanline + i, prev + i, rowBytes - i);
+}
+
+// the halving add already rounds down
+template<uint32_t Bpp>
+static void unfilterAverageNeon(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes) {
+	uint8x8_t a = vdup_n_u8(0);
+	for (uint32_t i = 0; i + Bpp <= rowBytes; i += Bpp) {
+		a = vadd_u8(loadPixelNeon<Bpp>(scanline + i), vhadd_u8(a, loadPixelNeon<Bpp>(prev + i)));
+		storePixelNeon<Bpp>(scanline + i, a);
+	}
+}
+
+template<uint32_t Bpp>
+static void unfilterPaethNeon(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes) {
+	uint8x8_t a = vdup_n_u8(0);
+	uint8x8_t c = vdup_n_u8(0);
+	for (uint32_t i = 0; i + Bpp <= rowBytes; i += Bpp) {
+		uint8x8_t b = loadPixelNeon<Bpp>(prev + i);
+		uint16x8_t pa = vmovl_u8(vabd_u8(b, c));
+		uint16x8_t pb = vmovl_u8(vabd_u8(a, c));
+		uint16x8_t pc = vabdq_u16(vaddl_u8(a, b), vshll_n_u8(c, 1));
+
+		uint8x8_t useA = vmovn_u16(vandq_u16(vcleq_u16(pa, pb), vcleq_u16(pa, pc)));
+		uint8x8_t useB = vmovn_u16(vcleq_u16(pb, pc));
+		uint8x8_t predictor = vbsl_u8(useA, a, vbsl_u8(useB, b, c));
+
+		a = vadd_u8(loadPixelNeon<Bpp>(scanline + i), predictor);
+		c = b;
+		storePixelNeon<Bpp>(scanline + i, a);
+	}
+}
+
+template<uint32_t Bpp>
+static UnfilterKernels neonKernels() {
+	UnfilterKernels kernels = scalarKernels<Bpp>();
+	kernels.up = unfilterUpNeon;
+	if constexpr (Bpp >= 3) {
+		kernels.sub = unfilterSubNeon<Bpp>;
+		kernels.average = unfilterAverageNeon<Bpp>;
+		kernels.paeth = unfilterPaethNeon<Bpp>;
+	}
+	return kernels;
+}
+#pragma endregion
+#endif
+
+template<uint32_t Bpp>
+static UnfilterKernels selectKernels() {
+#if AX_ARCH_X86
+	return x86Kernels<Bpp>(getCpuFeatures());
+#elif AX_ARCH_ARM64
+	return neonKernels<Bpp>();
+#else
+	return scalarKernels<Bpp>();
+#endif
+}
+
+// indexed by bpp; PNG only produces distances of 1, 2, 3, 4, 6 and 8 bytes
+static const std::array<UnfilterKernels, 9>& kernelTable() {
+	static const std::array<UnfilterKernels, 9> table = {
+		UnfilterKernels{},
+		selectKernels<1>(),
+		selectKernels<2>(),
+		selectKernels<3>(),
+		selectKernels<4>(),
+		UnfilterKernels{},
+		selectKernels<6>(),
+		UnfilterKernels{},
+		selectKernels<8>()
+	};
+	return table;
+}
+
+void unfilterScanline(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes, uint32_t bpp, uint8_t filter) {
+	if (filter == 0) {
+		return;
+	}
+	if (bpp >= kernelTable().size() || !kernelTable()[bpp].sub) {
+		unfilterScanlineScalar(scanline, prev, rowBytes, bpp, filter);
+		return;
+	}
+
+	const UnfilterKernels& kernels = kernelTable()[bpp];
+	switch (filter) {
+	case 1:
+		kernels.sub(scanline, prev, rowBytes);
+		break;
+	case 2:
+		kernels.up(scanline, prev, rowBytes);
+		break;
+	case 3:
+		kernels.average(scanline, prev, rowBytes);
+		break;
+	case 4:
+		kernels.paeth(scanline, prev, rowBytes);
+		break;
+	default:
+		throw std::runtime_error("Invalid PNG filter type: " + std::to_string(filter));
+	}
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <cstdint>
+
+// Reverses the PNG filter of one scanline in place. prev is the previous unfiltered
+// scanline and must point at rowBytes zeros for the first row. bpp is the filter's
+// bytes-per-pixel distance (1 for sub-byte depths). The kernel for each (bpp, filter)
+// pair is chosen once per process from the CPU's SIMD support.
+void unfilterScanline(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes, uint32_t bpp, uint8_t filter);
+
+// Straightforward per-byte implementation, the reference every SIMD kernel has to
+// match; prev may be null for the first row.
+void unfilterScanlineScalar(uint8_t* scanline, const uint8_t* prev, uint32_t rowBytes, uint32_t bpp, uint8_t filter);